@@ -0,0 +1,403 @@
+#include "rcrdp.h"
+#include "http_server.h"
+#include "image_encode.h"
+#include "json.h"
+#include "session_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Micro-benchmarks for the capture, encode and request parsing hot paths.
+// Built with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc so allocations
+// made by rcrdp code are counted; allocations inside libc, zlib and libjpeg are not.
+
+#define BENCH_MIN_TIME_NS 300000000ULL
+#define BENCH_MIN_ITERATIONS 3
+
+static UINT64 alloc_count = 0;
+static UINT64 alloc_bytes = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&alloc_bytes, size, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&alloc_bytes, count * size, __ATOMIC_RELAXED);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&alloc_bytes, size, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+typedef enum {
+    CONTENT_FLAT,       // large uniform areas with window borders
+    CONTENT_TEXT,       // dense dark glyph strokes on white
+    CONTENT_NOISE,      // random pixels, the worst case for compression
+    CONTENT_COUNT
+} FrameContent;
+
+static const char* content_names[CONTENT_COUNT] = { "flat", "text", "noise" };
+
+typedef struct {
+    UINT32 width;
+    UINT32 height;
+} Resolution;
+
+static const Resolution resolutions[] = {
+    { 1024, 768 },
+    { 1920, 1080 },
+    { 3840, 2160 },
+};
+
+#define RESOLUTION_COUNT (sizeof(resolutions) / sizeof(resolutions[0]))
+
+typedef struct {
+    const char* filter;
+    RDPClient* client;
+    HttpServer* server;
+    BYTE* frame;
+    UINT32 width;
+    UINT32 height;
+    UINT32 stride;
+    Arena* arena;
+} BenchState;
+
+typedef BOOL (*BenchFn)(BenchState* state, void* arg);
+
+static UINT64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000000000ULL + (UINT64)ts.tv_nsec;
+}
+
+static UINT32 xorshift32(UINT32* seed)
+{
+    UINT32 x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+static void fill_frame(BYTE* frame, UINT32 width, UINT32 height, UINT32 stride, FrameContent content)
+{
+    UINT32 seed = 0x9e3779b9u;
+    for (UINT32 y = 0; y < height; y++) {
+        UINT32* row = (UINT32*)(frame + (size_t)y * stride);
+        for (UINT32 x = 0; x < width; x++) {
+            UINT32 pixel;
+            switch (content) {
+                case CONTENT_FLAT:
+                    // Desktop background, a title bar and window frames every 256 pixels
+                    if (y % 256 < 24)
+                        pixel = 0x002b579a;
+                    else if (x % 256 == 0 || y % 256 == 24)
+                        pixel = 0x00a0a0a0;
+                    else
+                        pixel = 0x00f0f0f0;
+                    break;
+                case CONTENT_TEXT:
+                    // 8x16 cells with pseudo-random strokes, like a page of small text
+                    pixel = ((x % 8) < 6 && (y % 16) < 12 && (xorshift32(&seed) & 3) == 0) ? 0x00202020
+                                                                                            : 0x00ffffff;
+                    break;
+                default:
+                    pixel = xorshift32(&seed) & 0x00ffffff;
+                    break;
+            }
+            row[x] = pixel;
+        }
+    }
+}
+
+static BOOL bench_selected(BenchState* state, const char* name)
+{
+    return !state->filter || strstr(name, state->filter) != NULL;
+}
+
+// Repeats fn until BENCH_MIN_TIME_NS has passed, then prints ns/op, MB/s of
+// bytes_per_op (0 to omit) and allocations per op
+static void run_bench(BenchState* state, const char* name, BenchFn fn, void* arg, size_t bytes_per_op)
+{
+    if (!bench_selected(state, name))
+        return;
+    
+    // Warm up caches and lazily allocated buffers
+    if (!fn(state, arg)) {
+        printf("%-44s FAILED\n", name);
+        return;
+    }
+    
+    UINT64 allocs_before = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+    UINT64 bytes_before = __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED);
+    UINT64 iterations = 0;
+    UINT64 start = now_ns();
+    UINT64 elapsed = 0;
+    while (elapsed < BENCH_MIN_TIME_NS || iterations < BENCH_MIN_ITERATIONS) {
+        fn(state, arg);
+        iterations++;
+        elapsed = now_ns() - start;
+    }
+    UINT64 allocs = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED) - allocs_before;
+    UINT64 bytes = __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED) - bytes_before;
+    
+    double ns_per_op = (double)elapsed / (double)iterations;
+    char throughput[32] = "";
+    if (bytes_per_op > 0)
+        snprintf(throughput, sizeof(throughput), "%10.1f MB/s", (double)bytes_per_op * 1e3 / ns_per_op);
+    
+    printf("%-44s %14.0f ns/op %15s %8.2f allocs/op %12.0f B/op\n", name, ns_per_op, throughput,
+           (double)allocs / (double)iterations, (double)bytes / (double)iterations);
+}
+
+static BOOL bench_copy_frame_full(BenchState* state, void* arg)
+{
+    (void)arg;
+    return copy_frame_buffer(state->client, state->frame, state->width, state->height, state->stride, NULL);
+}
+
+static BOOL bench_copy_frame_tile(BenchState* state, void* arg)
+{
+    const FrameRect* tile = (const FrameRect*)arg;
+    return copy_frame_buffer(state->client, state->frame, state->width, state->height, state->stride, tile);
+}
+
+static BOOL bench_get_latest_frame(BenchState* state, void* arg)
+{
+    (void)arg;
+    BYTE* buffer = NULL;
+    UINT32 width, height, stride;
+    if (!get_latest_frame(state->client, &buffer, &width, &height, &stride, NULL))
+        return FALSE;
+    free(buffer);
+    return TRUE;
+}
+
+static BOOL bench_encode_png(BenchState* state, void* arg)
+{
+    (void)arg;
+    BYTE* png = NULL;
+    size_t length = 0;
+    if (!encode_png_memory(state->frame, state->width, state->height, state->stride, &png, &length, NULL))
+        return FALSE;
+    free(png);
+    return TRUE;
+}
+
+static BOOL bench_encode_image(BenchState* state, void* arg)
+{
+    const ImageFormat* format = (const ImageFormat*)arg;
+    BYTE* data = NULL;
+    size_t length = 0;
+    if (!encode_image_memory(*format, JPEG_DEFAULT_QUALITY, state->frame, state->width, state->height, state->stride,
+                             &data, &length, NULL))
+        return FALSE;
+    free(data);
+    return TRUE;
+}
+
+// The parser works in place, so each run starts from a fresh copy, as recv would leave it
+static BOOL bench_parse_request(BenchState* state, void* arg)
+{
+    (void)state;
+    char buffer[1024];
+    size_t length = strlen((const char*)arg);
+    memcpy(buffer, arg, length);
+    
+    HttpParser parser;
+    http_parser_init(&parser, buffer, sizeof(buffer));
+    return http_parser_execute(&parser, length) == HTTP_PARSE_DONE;
+}
+
+typedef struct {
+    int flags;
+    int x;
+    int y;
+} BenchMouseEvent;
+
+static BOOL bench_json_bind(BenchState* state, void* arg)
+{
+    (void)state;
+    static const JsonField fields[] = {
+        JSON_REQUIRED(BenchMouseEvent, flags, JSON_FIELD_INT, 0, 0xFFFF),
+        JSON_REQUIRED(BenchMouseEvent, x, JSON_FIELD_INT, 0, 0xFFFF),
+        JSON_REQUIRED(BenchMouseEvent, y, JSON_FIELD_INT, 0, 0xFFFF),
+    };
+    
+    // The decoder works in place, as on a request body
+    char buffer[128];
+    size_t length = strlen((const char*)arg);
+    memcpy(buffer, arg, length + 1);
+    
+    static JsonDocument doc;
+    BenchMouseEvent event;
+    return json_parse(&doc, buffer, length) &&
+           json_bind(&doc, 0, fields, sizeof(fields) / sizeof(fields[0]), &event);
+}
+
+static BOOL bench_route_request(BenchState* state, void* arg)
+{
+    HttpResponse* response = route_request(state->server, (HttpRequest*)arg);
+    if (!response)
+        return FALSE;
+    free_http_response(response);
+    return TRUE;
+}
+
+// As a connection worker serves it: the response lives in an arena reset after the send
+static BOOL bench_route_request_arena(BenchState* state, void* arg)
+{
+    http_response_bind_arena(state->arena);
+    HttpResponse* response = route_request(state->server, (HttpRequest*)arg);
+    http_response_bind_arena(NULL);
+    if (!response)
+        return FALSE;
+    free_http_response(response);
+    arena_reset(state->arena);
+    return TRUE;
+}
+
+static void bench_frames(BenchState* state)
+{
+    for (size_t r = 0; r < RESOLUTION_COUNT; r++) {
+        state->width = resolutions[r].width;
+        state->height = resolutions[r].height;
+        state->stride = state->width * 4;
+        size_t frame_bytes = (size_t)state->stride * state->height;
+        state->frame = (BYTE*)malloc(frame_bytes);
+        if (!state->frame)
+            return;
+        
+        char name[64];
+        fill_frame(state->frame, state->width, state->height, state->stride, CONTENT_FLAT);
+        
+        snprintf(name, sizeof(name), "copy_frame_buffer/full/%ux%u", state->width, state->height);
+        run_bench(state, name, bench_copy_frame_full, NULL, frame_bytes);
+        
+        FrameRect tile = { state->width / 2, state->height / 2, 64, 64 };
+        snprintf(name, sizeof(name), "copy_frame_buffer/64x64/%ux%u", state->width, state->height);
+        run_bench(state, name, bench_copy_frame_tile, &tile, (size_t)64 * 64 * 4);
+        
+        snprintf(name, sizeof(name), "get_latest_frame/%ux%u", state->width, state->height);
+        run_bench(state, name, bench_get_latest_frame, NULL, frame_bytes);
+        
+        for (int content = 0; content < CONTENT_COUNT; content++) {
+            fill_frame(state->frame, state->width, state->height, state->stride, (FrameContent)content);
+            snprintf(name, sizeof(name), "encode_png/%s/%ux%u", content_names[content], state->width,
+                     state->height);
+            run_bench(state, name, bench_encode_png, NULL, frame_bytes);
+            
+            static const ImageFormat qoi = IMAGE_FORMAT_QOI;
+            snprintf(name, sizeof(name), "encode_qoi/%s/%ux%u", content_names[content], state->width,
+                     state->height);
+            run_bench(state, name, bench_encode_image, (void*)&qoi, frame_bytes);
+            
+            static const ImageFormat jpeg = IMAGE_FORMAT_JPEG;
+            snprintf(name, sizeof(name), "encode_jpeg/%s/%ux%u", content_names[content], state->width,
+                     state->height);
+            run_bench(state, name, bench_encode_image, (void*)&jpeg, frame_bytes);
+        }
+        
+        free(state->frame);
+        state->frame = NULL;
+    }
+}
+
+static void bench_http(BenchState* state)
+{
+    static const char* get_request =
+        "GET /sessions/lab1/screen?fresh=1 HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "User-Agent: curl/8.5.0\r\n"
+        "Accept: */*\r\n"
+        "\r\n";
+    static const char* post_request =
+        "POST /sendmouse HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: 37\r\n"
+        "\r\n"
+        "{\"flags\": 36864, \"x\": 512, \"y\": 384}";
+    static const char* json = "{\"flags\": 36864, \"x\": 512, \"y\": 384}";
+    
+    run_bench(state, "http_parser/get", bench_parse_request, (void*)get_request, strlen(get_request));
+    run_bench(state, "http_parser/post", bench_parse_request, (void*)post_request, strlen(post_request));
+    run_bench(state, "json/sendmouse", bench_json_bind, (void*)json, strlen(json));
+    
+    // The client is never connected, so screen and input routes stop at the readiness check
+    static const struct {
+        const char* name;
+        const char* arena_name;
+        const char* raw;
+    } routes[] = {
+        { "route_request/status", "route_request/status/arena", "GET /status HTTP/1.1\r\n\r\n" },
+        { "route_request/screen_not_ready", "route_request/screen_not_ready/arena", "GET /screen HTTP/1.1\r\n\r\n" },
+        { "route_request/unknown_session", "route_request/unknown_session/arena",
+          "GET /sessions/missing/screen HTTP/1.1\r\n\r\n" },
+        { "route_request/not_found", "route_request/not_found/arena", "GET /nowhere HTTP/1.1\r\n\r\n" },
+    };
+    for (size_t i = 0; i < sizeof(routes) / sizeof(routes[0]); i++) {
+        char buffer[256];
+        size_t length = strlen(routes[i].raw);
+        memcpy(buffer, routes[i].raw, length);
+        
+        HttpParser parser;
+        http_parser_init(&parser, buffer, sizeof(buffer));
+        if (http_parser_execute(&parser, length) != HTTP_PARSE_DONE)
+            continue;
+        run_bench(state, routes[i].name, bench_route_request, &parser.request, 0);
+        run_bench(state, routes[i].arena_name, bench_route_request_arena, &parser.request, 0);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    BenchState state;
+    memset(&state, 0, sizeof(state));
+    state.filter = argc > 1 ? argv[1] : NULL;
+    
+    state.client = rdp_client_new();
+    state.server = (HttpServer*)calloc(1, sizeof(HttpServer));
+    SessionPool* sessions = session_pool_new();
+    state.arena = arena_new(ARENA_DEFAULT_CAPACITY);
+    if (!state.client || !state.server || !sessions || !state.arena) {
+        fprintf(stderr, "Failed to set up benchmark state\n");
+        return 1;
+    }
+    
+    // Unprefixed routes resolve the "default" session; it is unlinked again
+    // before the pool is freed, so the pool never disconnects the client
+    RDPSession default_session;
+    memset(&default_session, 0, sizeof(default_session));
+    strcpy(default_session.id, "default");
+    default_session.client = state.client;
+    sessions->sessions[sessions->count++] = &default_session;
+    state.server->sessions = sessions;
+    
+    printf("rcrdp micro-benchmarks (allocations counted in rcrdp code only)\n");
+    bench_frames(&state);
+    bench_http(&state);
+    
+    sessions->count = 0;
+    session_pool_free(sessions);
+    arena_free(state.arena);
+    free(state.server);
+    rdp_client_free(state.client);
+    return 0;
+}
@@ -0,0 +1,535 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// Closed-loop HTTP load generator: each worker keeps one request in flight,
+// picking routes at random by weight, for a fixed duration. Latency is
+// measured from connect (or, with -k, from sending on the kept connection)
+// to the end of the response. Pair it with
+// `rcrdp -F synthetic` to load the HTTP and encode pipeline without an RDP
+// server.
+
+#define LOADGEN_DEFAULT_PORT 8080
+#define LOADGEN_DEFAULT_CONCURRENCY 8
+#define LOADGEN_DEFAULT_DURATION_S 10
+#define LOADGEN_DEFAULT_MIX "screen:8,status:1,sendkey:1"
+#define LOADGEN_BUFFER_SIZE 65536
+
+typedef struct {
+    const char* name;
+    const char* method;
+    const char* path;
+    const char* body;
+} LoadRoute;
+
+// Input routes send events with no visible effect on a real desktop: key
+// releases and pointer moves
+static const LoadRoute load_routes[] = {
+    { "screen", "GET", "/screen", NULL },
+    { "screen_fresh", "GET", "/screen?fresh=1", NULL },
+    { "screen_region", "GET", "/screen?x=0&y=0&width=256&height=256", NULL },
+    { "status", "GET", "/status", NULL },
+    { "metrics", "GET", "/metrics", NULL },
+    { "sendkey", "POST", "/sendkey", "{\"flags\": 32768, \"code\": 42}" },
+    { "sendmouse", "POST", "/sendmouse", "{\"flags\": 2048, \"x\": 100, \"y\": 100}" },
+    { "movemouse", "POST", "/movemouse", "{\"x\": 200, \"y\": 150}" },
+    { "probe", "POST", "/probe", "{\"probes\": [{\"op\": \"color\", \"x\": 0, \"y\": 0, \"color\": \"#000000\"}]}" },
+};
+
+#define LOAD_ROUTE_COUNT (sizeof(load_routes) / sizeof(load_routes[0]))
+
+typedef struct {
+    uint64_t* samples_us;
+    size_t count;
+    size_t capacity;
+    uint64_t status_2xx;
+    uint64_t status_4xx;
+    uint64_t status_5xx;
+    uint64_t status_other;
+    uint64_t errors;
+    uint64_t bytes;
+} RouteStats;
+
+typedef struct {
+    const char* host;
+    const char* port;
+    const char* session;
+    int concurrency;
+    int duration_s;
+    int keep_alive;
+    unsigned weights[LOAD_ROUTE_COUNT];
+    unsigned weight_total;
+    struct addrinfo* address;
+    volatile int stopping;
+} LoadConfig;
+
+typedef struct {
+    LoadConfig* config;
+    pthread_t thread;
+    uint32_t seed;
+    RouteStats stats[LOAD_ROUTE_COUNT];
+} LoadWorker;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static uint32_t xorshift32(uint32_t* seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+static void record_sample(RouteStats* stats, uint64_t latency_us)
+{
+    if (stats->count == stats->capacity) {
+        size_t capacity = stats->capacity ? stats->capacity * 2 : 4096;
+        uint64_t* grown = (uint64_t*)realloc(stats->samples_us, capacity * sizeof(uint64_t));
+        if (!grown)
+            return;
+        stats->samples_us = grown;
+        stats->capacity = capacity;
+    }
+    stats->samples_us[stats->count++] = latency_us;
+}
+
+static int send_all(int fd, const char* data, size_t length)
+{
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return -1;
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return 0;
+}
+
+static int connect_server(LoadConfig* config)
+{
+    int fd = socket(config->address->ai_family, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, config->address->ai_addr, config->address->ai_addrlen) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads one response framed by Content-Length, leaving the connection open
+// unless the server closes it; returns the HTTP status, or -1 on error
+static int read_framed_response(int fd, char* buffer, uint64_t* bytes, int* reusable)
+{
+    size_t received = 0;
+    char* headers_end = NULL;
+    while (!headers_end) {
+        if (received >= LOADGEN_BUFFER_SIZE - 1)
+            return -1;
+        ssize_t n = recv(fd, buffer + received, LOADGEN_BUFFER_SIZE - 1 - received, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        received += (size_t)n;
+        buffer[received] = '\0';
+        headers_end = strstr(buffer, "\r\n\r\n");
+    }
+    
+    if (received < 12 || strncmp(buffer, "HTTP/1.", 7) != 0)
+        return -1;
+    int status = atoi(buffer + 9);
+    *headers_end = '\0';
+    const char* length_header = strcasestr(buffer, "\r\nContent-Length:");
+    if (!length_header)
+        return -1;
+    *reusable = strcasestr(buffer, "\r\nConnection: close") == NULL;
+    
+    // Drain the body
+    size_t head_length = (size_t)(headers_end - buffer) + 4;
+    size_t total = head_length + strtoul(length_header + 17, NULL, 10);
+    while (received < total) {
+        size_t want = total - received < LOADGEN_BUFFER_SIZE ? total - received : LOADGEN_BUFFER_SIZE;
+        ssize_t n = recv(fd, buffer, want, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        received += (size_t)n;
+    }
+    
+    *bytes += received;
+    return status;
+}
+
+// Issues one request and reads the response; without keep-alive every request
+// gets a fresh connection and the response is read to EOF. *fd holds the kept
+// connection between calls, -1 when there is none. Returns the HTTP status,
+// or -1 on a connection error.
+static int issue_request(LoadConfig* config, const LoadRoute* route, char* buffer, uint64_t* bytes, int* fd)
+{
+    if (*fd < 0)
+        *fd = connect_server(config);
+    if (*fd < 0)
+        return -1;
+    
+    size_t body_length = route->body ? strlen(route->body) : 0;
+    int length = snprintf(buffer, LOADGEN_BUFFER_SIZE,
+                          "%s %s%s%s HTTP/1.1\r\n"
+                          "Host: %s:%s\r\n"
+                          "Content-Type: application/json\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Connection: %s\r\n"
+                          "\r\n"
+                          "%s",
+                          route->method, config->session ? "/sessions/" : "",
+                          config->session ? config->session : "", route->path, config->host, config->port,
+                          body_length, config->keep_alive ? "keep-alive" : "close", route->body ? route->body : "");
+    if (length < 0 || length >= LOADGEN_BUFFER_SIZE || send_all(*fd, buffer, (size_t)length) != 0) {
+        close(*fd);
+        *fd = -1;
+        return -1;
+    }
+    
+    if (config->keep_alive) {
+        int reusable = 0;
+        int status = read_framed_response(*fd, buffer, bytes, &reusable);
+        if (status < 0 || !reusable) {
+            close(*fd);
+            *fd = -1;
+        }
+        return status;
+    }
+    
+    // The status line is parsed from the first read; the rest is drained
+    int status = -1;
+    size_t received = 0;
+    for (;;) {
+        ssize_t n = recv(*fd, buffer, LOADGEN_BUFFER_SIZE - 1, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        if (received == 0) {
+            buffer[n] = '\0';
+            if (n >= 12 && strncmp(buffer, "HTTP/1.", 7) == 0)
+                status = atoi(buffer + 9);
+        }
+        received += (size_t)n;
+    }
+    close(*fd);
+    *fd = -1;
+    
+    *bytes += received;
+    return received > 0 ? status : -1;
+}
+
+static const LoadRoute* pick_route(LoadWorker* worker, size_t* index)
+{
+    LoadConfig* config = worker->config;
+    unsigned ticket = xorshift32(&worker->seed) % config->weight_total;
+    for (size_t i = 0; i < LOAD_ROUTE_COUNT; i++) {
+        if (ticket < config->weights[i]) {
+            *index = i;
+            return &load_routes[i];
+        }
+        ticket -= config->weights[i];
+    }
+    *index = 0;
+    return &load_routes[0];
+}
+
+static void* worker_proc(void* arg)
+{
+    LoadWorker* worker = (LoadWorker*)arg;
+    char* buffer = (char*)malloc(LOADGEN_BUFFER_SIZE);
+    if (!buffer)
+        return NULL;
+    
+    int fd = -1;
+    while (!worker->config->stopping) {
+        size_t index;
+        const LoadRoute* route = pick_route(worker, &index);
+        RouteStats* stats = &worker->stats[index];
+        
+        uint64_t start = now_us();
+        int status = issue_request(worker->config, route, buffer, &stats->bytes, &fd);
+        uint64_t latency = now_us() - start;
+        
+        if (status < 0) {
+            stats->errors++;
+            continue;
+        }
+        record_sample(stats, latency);
+        if (status >= 200 && status < 300)
+            stats->status_2xx++;
+        else if (status >= 400 && status < 500)
+            stats->status_4xx++;
+        else if (status >= 500 && status < 600)
+            stats->status_5xx++;
+        else
+            stats->status_other++;
+    }
+    
+    if (fd >= 0)
+        close(fd);
+    free(buffer);
+    return NULL;
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentile of sorted samples, in milliseconds
+static double percentile_ms(const uint64_t* sorted, size_t count, double p)
+{
+    if (count == 0)
+        return 0.0;
+    size_t rank = (size_t)(p / 100.0 * (double)count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > count)
+        rank = count;
+    return (double)sorted[rank - 1] / 1000.0;
+}
+
+static void print_row(const char* name, RouteStats* stats, double elapsed_s)
+{
+    qsort(stats->samples_us, stats->count, sizeof(uint64_t), compare_u64);
+    printf("%-14s %9zu %9.1f %8.2f %8.2f %8.2f %8.2f %8.2f %7llu %7llu %7llu %7llu %9.1f\n", name, stats->count,
+           (double)stats->count / elapsed_s, percentile_ms(stats->samples_us, stats->count, 50.0),
+           percentile_ms(stats->samples_us, stats->count, 90.0),
+           percentile_ms(stats->samples_us, stats->count, 99.0),
+           percentile_ms(stats->samples_us, stats->count, 99.9),
+           stats->count ? (double)stats->samples_us[stats->count - 1] / 1000.0 : 0.0,
+           (unsigned long long)stats->status_2xx, (unsigned long long)stats->status_4xx,
+           (unsigned long long)stats->status_5xx, (unsigned long long)(stats->status_other + stats->errors),
+           (double)stats->bytes / elapsed_s / 1e6);
+}
+
+static void merge_stats(RouteStats* into, const RouteStats* from)
+{
+    for (size_t i = 0; i < from->count; i++)
+        record_sample(into, from->samples_us[i]);
+    into->status_2xx += from->status_2xx;
+    into->status_4xx += from->status_4xx;
+    into->status_5xx += from->status_5xx;
+    into->status_other += from->status_other;
+    into->errors += from->errors;
+    into->bytes += from->bytes;
+}
+
+// Parses "route:weight,route:weight"; a route without a weight counts 1
+static int parse_mix(LoadConfig* config, const char* mix)
+{
+    char* copy = strdup(mix);
+    if (!copy)
+        return -1;
+    
+    memset(config->weights, 0, sizeof(config->weights));
+    config->weight_total = 0;
+    
+    char* save = NULL;
+    for (char* item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        char* weight = strchr(item, ':');
+        if (weight)
+            *weight++ = '\0';
+        
+        size_t i;
+        for (i = 0; i < LOAD_ROUTE_COUNT; i++) {
+            if (strcmp(load_routes[i].name, item) == 0)
+                break;
+        }
+        if (i == LOAD_ROUTE_COUNT) {
+            fprintf(stderr, "Error: Unknown route %s\n", item);
+            free(copy);
+            return -1;
+        }
+        
+        int value = weight ? atoi(weight) : 1;
+        if (value < 0) {
+            fprintf(stderr, "Error: Invalid weight for %s\n", item);
+            free(copy);
+            return -1;
+        }
+        config->weights[i] += (unsigned)value;
+        config->weight_total += (unsigned)value;
+    }
+    free(copy);
+    
+    if (config->weight_total == 0) {
+        fprintf(stderr, "Error: Route mix is empty\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void print_usage(void)
+{
+    printf("Usage: rcrdp_loadgen [options]\n\n");
+    printf("  -H, --host <host>         rcrdp HTTP host (default: 127.0.0.1)\n");
+    printf("  -p, --port <port>         rcrdp HTTP port (default: %d)\n", LOADGEN_DEFAULT_PORT);
+    printf("  -c, --concurrency <n>     Requests in flight (default: %d)\n", LOADGEN_DEFAULT_CONCURRENCY);
+    printf("  -d, --duration <s>        Test duration in seconds (default: %d)\n", LOADGEN_DEFAULT_DURATION_S);
+    printf("  -m, --mix <mix>           Route weights (default: %s)\n", LOADGEN_DEFAULT_MIX);
+    printf("  -s, --session <id>        Target /sessions/<id>/ instead of the default session\n");
+    printf("  -k, --keep-alive          Reuse one connection per worker instead of connecting per request\n");
+    printf("  --help                    Show this help message\n\n");
+    printf("Routes:");
+    for (size_t i = 0; i < LOAD_ROUTE_COUNT; i++)
+        printf(" %s", load_routes[i].name);
+    printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+    LoadConfig config;
+    memset(&config, 0, sizeof(config));
+    config.host = "127.0.0.1";
+    config.concurrency = LOADGEN_DEFAULT_CONCURRENCY;
+    config.duration_s = LOADGEN_DEFAULT_DURATION_S;
+    const char* mix = LOADGEN_DEFAULT_MIX;
+    char port[16];
+    snprintf(port, sizeof(port), "%d", LOADGEN_DEFAULT_PORT);
+    
+    static struct option long_options[] = {
+        {"host", required_argument, 0, 'H'},
+        {"port", required_argument, 0, 'p'},
+        {"concurrency", required_argument, 0, 'c'},
+        {"duration", required_argument, 0, 'd'},
+        {"mix", required_argument, 0, 'm'},
+        {"session", required_argument, 0, 's'},
+        {"keep-alive", no_argument, 0, 'k'},
+        {"help", no_argument, 0, '?'},
+        {0, 0, 0, 0}
+    };
+    
+    int opt;
+    while ((opt = getopt_long(argc, argv, "H:p:c:d:m:s:k?", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'H':
+                config.host = optarg;
+                break;
+            case 'p':
+                snprintf(port, sizeof(port), "%s", optarg);
+                break;
+            case 'c':
+                config.concurrency = atoi(optarg);
+                break;
+            case 'd':
+                config.duration_s = atoi(optarg);
+                break;
+            case 'm':
+                mix = optarg;
+                break;
+            case 's':
+                config.session = optarg;
+                break;
+            case 'k':
+                config.keep_alive = 1;
+                break;
+            case '?':
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    config.port = port;
+    
+    if (config.concurrency <= 0 || config.duration_s <= 0) {
+        fprintf(stderr, "Error: Concurrency and duration must be positive\n");
+        return 1;
+    }
+    if (parse_mix(&config, mix) != 0)
+        return 1;
+    
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(config.host, config.port, &hints, &config.address);
+    if (rc != 0) {
+        fprintf(stderr, "Error: Cannot resolve %s: %s\n", config.host, gai_strerror(rc));
+        return 1;
+    }
+    
+    LoadWorker* workers = (LoadWorker*)calloc((size_t)config.concurrency, sizeof(LoadWorker));
+    if (!workers) {
+        freeaddrinfo(config.address);
+        return 1;
+    }
+    
+    printf("rcrdp load generator: %s:%s, %d in flight for %d s, mix %s\n", config.host, config.port,
+           config.concurrency, config.duration_s, mix);
+    
+    uint64_t start = now_us();
+    int started = 0;
+    for (int i = 0; i < config.concurrency; i++) {
+        workers[i].config = &config;
+        workers[i].seed = 0x9e3779b9u * (uint32_t)(i + 1);
+        if (pthread_create(&workers[i].thread, NULL, worker_proc, &workers[i]) != 0) {
+            fprintf(stderr, "Error: Failed to start worker %d\n", i);
+            break;
+        }
+        started++;
+    }
+    
+    sleep((unsigned)config.duration_s);
+    __atomic_store_n(&config.stopping, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i].thread, NULL);
+    double elapsed_s = (double)(now_us() - start) / 1e6;
+    
+    printf("\n%-14s %9s %9s %8s %8s %8s %8s %8s %7s %7s %7s %7s %9s\n", "route", "requests", "req/s", "p50 ms",
+           "p90 ms", "p99 ms", "p99.9 ms", "max ms", "2xx", "4xx", "5xx", "err", "MB/s");
+    
+    RouteStats total;
+    memset(&total, 0, sizeof(total));
+    for (size_t r = 0; r < LOAD_ROUTE_COUNT; r++) {
+        if (config.weights[r] == 0)
+            continue;
+        RouteStats route;
+        memset(&route, 0, sizeof(route));
+        for (int i = 0; i < started; i++)
+            merge_stats(&route, &workers[i].stats[r]);
+        print_row(load_routes[r].name, &route, elapsed_s);
+        merge_stats(&total, &route);
+        free(route.samples_us);
+    }
+    print_row("total", &total, elapsed_s);
+    free(total.samples_us);
+    
+    for (int i = 0; i < started; i++) {
+        for (size_t r = 0; r < LOAD_ROUTE_COUNT; r++)
+            free(workers[i].stats[r].samples_us);
+    }
+    free(workers);
+    freeaddrinfo(config.address);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <winpr3/winpr/wtypes.h>
+
+#define ARENA_DEFAULT_CAPACITY (64 * 1024)
+
+typedef struct _ArenaBlock ArenaBlock;
+
+// Bump allocator for memory that lives exactly as long as one request. The
+// first block is kept across resets; what does not fit in it goes to
+// overflow blocks that a reset frees. Not thread-safe: one owner at a time.
+typedef struct {
+    BYTE* base;
+    size_t capacity;
+    size_t used;
+    ArenaBlock* overflow;       // newest first; allocations bump the newest
+} Arena;
+
+Arena* arena_new(size_t capacity);
+void arena_free(Arena* arena);
+
+// 16-byte aligned, uninitialized; NULL only if an overflow block can't be allocated
+void* arena_alloc(Arena* arena, size_t size);
+char* arena_strdup(Arena* arena, const char* text);
+
+// Releases everything allocated since the last reset; O(1) unless overflow
+// blocks were needed
+void arena_reset(Arena* arena);
+
+#endif // ARENA_H
@@ -0,0 +1,44 @@
+#ifndef BITMAP_DECODE_H
+#define BITMAP_DECODE_H
+
+#include "rcrdp.h"
+#include "worker_pool.h"
+#include <freerdp3/freerdp/codec/interleaved.h>
+#include <freerdp3/freerdp/codec/planar.h>
+
+// Updates smaller than this many pixels are decoded on the calling thread
+#define BITMAP_DECODE_INLINE_PIXELS 16384
+
+// Codec state for one decode at a time; reused across tasks
+typedef struct _DecodeContext {
+    BITMAP_INTERLEAVED_CONTEXT* interleaved;
+    BITMAP_PLANAR_CONTEXT* planar;
+    UINT32 planar_width;
+    UINT32 planar_height;
+    BYTE* scratch;
+    size_t scratch_size;
+    struct _DecodeContext* next;
+} DecodeContext;
+
+// Shared by all sessions; FreeRDP's legacy bitmap path is single-threaded
+struct _BitmapDecoder {
+    WorkerPool* workers;
+    int thread_count;
+    
+    // Idle decode contexts, grown on demand; batch completion is signalled on done
+    DecodeContext* idle;
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+};
+
+// Bitmap decoder functions
+BitmapDecoder* bitmap_decoder_new(int thread_count);
+void bitmap_decoder_free(BitmapDecoder* decoder);
+int bitmap_decoder_default_threads(void);
+
+// Decodes every rectangle of a legacy bitmap update into the GDI primary surface
+// and invalidates it. Non-overlapping rectangles run in parallel; overlapping
+// ones keep their wire order. Returns once the whole update has been applied.
+BOOL bitmap_decoder_update(BitmapDecoder* decoder, rdpGdi* gdi, const BITMAP_UPDATE* update);
+
+#endif // BITMAP_DECODE_H
@@ -0,0 +1,24 @@
+#ifndef CLIPBOARD_H
+#define CLIPBOARD_H
+
+#include "rcrdp.h"
+
+// Client side of the clipboard channel (MS-RDPECLIP), limited to Unicode
+// text. Text put on the remote clipboard is only announced in a format
+// list; the server asks for the data when something on the remote side
+// pastes it. Reading the remote clipboard sends a format data request and
+// waits for the matching response. Callbacks run on the event thread.
+RDPClipboard* rdp_clipboard_new(void);
+void rdp_clipboard_free(RDPClipboard* clipboard);
+
+// Channel lifetime, from the channel connected and disconnected events
+void rdp_clipboard_connected(RDPClient* client, CliprdrClientContext* cliprdr);
+void rdp_clipboard_disconnected(RDPClient* client);
+
+// text is UTF-8; returns once the server has acknowledged the format list
+ClipboardResult rdp_clipboard_set_text(RDPClient* client, const char* text, size_t length, UINT32 timeout_ms);
+
+// *text is a malloc'd NUL-terminated UTF-8 copy of the remote clipboard
+ClipboardResult rdp_clipboard_get_text(RDPClient* client, UINT32 timeout_ms, char** text, size_t* length);
+
+#endif // CLIPBOARD_H
@@ -0,0 +1,46 @@
+#ifndef CURSOR_H
+#define CURSOR_H
+
+#include "rcrdp.h"
+
+#define CURSOR_CACHE_SIZE 32        // pointer cache entries advertised to the server
+#define CURSOR_MAX_SIZE 384         // large pointers are at most 384x384
+
+// The remote pointer, which the server sends apart from the desktop and
+// gdi->primary_buffer never contains. Shapes are decoded to 32-bit ARGB when
+// they arrive and kept by cache index; the position follows both the server's
+// pointer position updates and the mouse input sent through rcrdp.
+typedef struct {
+    BOOL visible;               // FALSE after a null system pointer
+    BOOL default_shape;         // the built-in arrow, as for the default system pointer
+    UINT32 x;                   // hotspot position on the desktop
+    UINT32 y;
+    UINT32 hotspot_x;
+    UINT32 hotspot_y;
+    UINT32 width;
+    UINT32 height;
+    UINT64 shape_hash;          // of the pixels and hotspot, equal for identical shapes
+    UINT64 shape_changes;       // shape updates since the client was created
+} CursorInfo;
+
+RDPCursor* rdp_cursor_new(void);
+void rdp_cursor_free(RDPCursor* cursor);
+
+// Takes over the pointer update callbacks; called after gdi_init on every
+// connect, and empties the shape cache since indices belong to a connection
+void rdp_cursor_register(RDPClient* client, rdpUpdate* update);
+
+// Mouse input moves the pointer without the server echoing it back
+void rdp_cursor_note_position(RDPCursor* cursor, UINT32 x, UINT32 y);
+
+BOOL rdp_cursor_get_info(RDPCursor* cursor, CursorInfo* info);
+
+// Identifies an encoding of area with the cursor drawn in; 0 when the cursor
+// is hidden or outside area, so the encoding equals the one without it
+UINT64 cursor_info_key(const CursorInfo* info, const FrameRect* area);
+
+// Alpha-blends the current cursor into pixels, a private copy of area of the
+// desktop, and returns the cursor_info_key of what was drawn
+UINT64 rdp_cursor_draw(RDPCursor* cursor, BYTE* pixels, UINT32 stride, const FrameRect* area);
+
+#endif // CURSOR_H
@@ -0,0 +1,39 @@
+#ifndef FRAME_HISTORY_H
+#define FRAME_HISTORY_H
+
+#include "rcrdp.h"
+
+#define HISTORY_TILE_SIZE 64
+
+// Recent frames kept as the oldest frame in full plus, for every later
+// generation the history thread saw, the 64x64 tiles that changed. When the
+// budget is exceeded the oldest delta is folded into the base frame, so the
+// window shrinks from the old end one generation at a time. A resize starts
+// the history over.
+typedef struct {
+    size_t budget_bytes;
+    size_t bytes;               // base frame plus deltas; the working copy is not counted
+    UINT32 frames;              // reconstructable generations
+    UINT64 oldest_generation;
+    UINT64 newest_generation;
+    UINT64 span_ms;             // paint time from oldest to newest
+} FrameHistoryStats;
+
+typedef enum {
+    HISTORY_BY_GENERATION,      // newest frame at or before a generation
+    HISTORY_BY_PAINT_TIME       // newest frame painted at or before a get_time_ms() value
+} FrameHistoryLookup;
+
+typedef struct _FrameHistory FrameHistory;
+
+// Follows client's frames from a thread of its own; the paint path is not touched
+FrameHistory* frame_history_start(RDPClient* client, size_t budget_bytes, const char** error);
+void frame_history_stop(FrameHistory* history);
+void frame_history_get_stats(FrameHistory* history, FrameHistoryStats* stats);
+
+// Rebuilds a frame from the history; caller frees *buffer
+BOOL frame_history_get(FrameHistory* history, FrameHistoryLookup lookup, UINT64 key, BYTE** buffer,
+                       UINT32* width, UINT32* height, UINT32* stride, UINT64* generation, UINT64* paint_ms,
+                       const char** error);
+
+#endif // FRAME_HISTORY_H
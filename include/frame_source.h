@@ -0,0 +1,58 @@
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include "rcrdp.h"
+
+#define LOCAL_SOURCE_DEFAULT_FPS 10
+#define LOCAL_SOURCE_MAX_FPS 1000
+#define LOCAL_SOURCE_TILE_SIZE 64
+
+// Produces frames for an RDPClient. Everything downstream of the frame
+// buffer (copy_frame_buffer, generations, damage) is shared; a source only
+// decides where paints come from and where input goes. Operations other
+// than start and stop are called with the client connected.
+typedef struct {
+    const char* name;
+
+    // start returns once the source is connecting or connected; phases and
+    // client->connected advance as for a FreeRDP connection
+    BOOL (*start)(FrameSource* source, RDPClient* client);
+    void (*stop)(FrameSource* source, RDPClient* client);
+
+    // Called with client->input_mutex held
+    BOOL (*send_keyboard)(FrameSource* source, RDPClient* client, DWORD flags, DWORD code);
+    BOOL (*send_mouse)(FrameSource* source, RDPClient* client, DWORD flags, UINT16 x, UINT16 y);
+    BOOL (*refresh_rect)(FrameSource* source, RDPClient* client, const FrameRect* rect);
+    BOOL (*suppress_output)(FrameSource* source, RDPClient* client, BOOL allow);
+
+    // Geometry has already been validated
+    BOOL (*resize)(FrameSource* source, RDPClient* client, UINT32 width, UINT32 height, const char** error);
+    
+    // Clipboard text in UTF-8; may wait up to timeout_ms for the other side
+    ClipboardResult (*set_clipboard)(FrameSource* source, RDPClient* client, const char* text, size_t length,
+                                     UINT32 timeout_ms);
+    ClipboardResult (*get_clipboard)(FrameSource* source, RDPClient* client, UINT32 timeout_ms, char** text,
+                                     size_t* length);
+
+    // NULL for sources that are not owned by a client
+    void (*free)(FrameSource* source);
+} FrameSourceOps;
+
+struct _FrameSource {
+    const FrameSourceOps* ops;
+};
+
+// The FreeRDP connection; shared by every client that has no other source
+FrameSource* rdp_freerdp_source(void);
+
+// Creates a source from a spec:
+//   freerdp
+//   synthetic[:fps=<n>,damage=full|tile|none,log=<file>]
+//   replay:<directory of PNG files>[,fps=<n>,log=<file>]
+// log= appends every input event the source receives to a file. Local
+// sources keep the clipboard in memory.
+FrameSource* frame_source_new(const char* spec, const char** error);
+void frame_source_free(FrameSource* source);
+const char* frame_source_name(const FrameSource* source);
+
+#endif // FRAME_SOURCE_H
@@ -0,0 +1,50 @@
+#ifndef HTTP_ROUTER_H
+#define HTTP_ROUTER_H
+
+#include "http_server.h"
+#include "metrics.h"
+
+// How a route uses its worker, for admission decisions
+typedef enum {
+    HTTP_COST_CHEAP,        // answers from memory in microseconds
+    HTTP_COST_FRAME,        // copies and encodes frames; CPU-bound for milliseconds
+    HTTP_COST_BLOCKING      // waits on the remote desktop for up to its timeout
+} HttpCostClass;
+
+// client is the route's session for per-session routes and NULL otherwise
+typedef HttpResponse* (*HttpRouteHandler)(HttpServer* server, RDPClient* client, HttpRequest* request);
+
+// One entry of the declarative route table. Segments of the form {name}
+// match any one segment and are returned as path parameters.
+struct _HttpRoute {
+    HttpMethod method;
+    const char* pattern;
+    HttpRouteHandler handler;
+    BOOL per_session;       // served on the default session and under /sessions/{id}
+    MetricRoute metric;     // label on the request latency histogram
+    HttpCostClass cost;
+    int max_in_flight;      // 0: unlimited, except blocking routes get half the workers
+    const char* summary;    // listed at startup
+};
+
+typedef struct _HttpRouter HttpRouter;
+
+typedef enum {
+    HTTP_ROUTE_FOUND,
+    HTTP_ROUTE_NOT_FOUND,
+    HTTP_ROUTE_METHOD_NOT_ALLOWED
+} HttpRouteResult;
+
+// Compiles routes into a segment trie; routes must outlive the router.
+// Literal segments take precedence over parameters at the same position.
+HttpRouter* http_router_new(const HttpRoute* routes, size_t route_count);
+void http_router_free(HttpRouter* router);
+
+// On HTTP_ROUTE_FOUND fills request->route, ->params and ->session_scoped;
+// on HTTP_ROUTE_METHOD_NOT_ALLOWED writes the Allow header value to allow
+HttpRouteResult http_router_match(const HttpRouter* router, HttpRequest* request, char* allow, size_t allow_size);
+
+// Value of a {name} segment of the matched route, or NULL
+const char* http_path_param(const HttpRequest* request, const char* name);
+
+#endif // HTTP_ROUTER_H
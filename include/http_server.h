@@ -2,62 +2,167 @@
 #define HTTP_SERVER_H
 
 #include "rcrdp.h"
+#include "arena.h"
+#include "session_pool.h"
+#include "worker_pool.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
 
-#define MAX_REQUEST_SIZE 8192
+#define MAX_REQUEST_SIZE 65536
 #define MAX_RESPONSE_SIZE 65536
 #define DEFAULT_PORT 8080
+#define HTTP_MAX_HEADERS 48
+#define HTTP_MAX_QUERY_PARAMS 32
+#define HTTP_MAX_PATH_PARAMS 4
+#define HTTP_KEEPALIVE_TIMEOUT_MS 5000      // idle time before a persistent connection is closed
+#define HTTP_MAX_KEEPALIVE_REQUESTS 1000    // requests served on one connection before it is closed
+#define HTTP_IDLE_POLL_MS 50                // how often an idle connection checks for queued connections
 
 typedef enum {
     HTTP_GET,
     HTTP_POST,
+    HTTP_DELETE,
+    HTTP_PUT,
     HTTP_INVALID
 } HttpMethod;
 
+// Stages reported in the Server-Timing header; handlers fill in the ones they run
+typedef enum {
+    HTTP_STAGE_PARSE,
+    HTTP_STAGE_ROUTE,
+    HTTP_STAGE_SNAPSHOT,
+    HTTP_STAGE_CONVERT,
+    HTTP_STAGE_ENCODE,
+    HTTP_STAGE_COUNT
+} HttpStage;
+
+// Name and value, both NUL-terminated in the connection's read buffer
+typedef struct {
+    const char* name;
+    const char* value;
+} HttpField;
+
+typedef struct _HttpRoute HttpRoute;
+
+// Every pointer refers to the connection's read buffer and is valid until
+// the next request on the connection is parsed
 typedef struct {
     HttpMethod method;
-    char path[256];
-    char* body;
+    const char* path;       // percent-decoded, without the query string
+    HttpField query[HTTP_MAX_QUERY_PARAMS];     // percent-decoded, '+' as space
+    int query_count;
+    HttpField headers[HTTP_MAX_HEADERS];
+    int header_count;
+    char* body;             // NUL-terminated, chunked bodies decoded; NULL when empty
     size_t body_length;
-    char headers[1024];
+    BOOL keep_alive;        // HTTP/1.1 without "Connection: close", or 1.0 with "keep-alive"
+    BOOL expect_continue;
+    UINT64 stage_ns[HTTP_STAGE_COUNT];
+
+    // Set by routing
+    const HttpRoute* route;
+    BOOL session_scoped;    // matched under /sessions/{id}
+    HttpField params[HTTP_MAX_PATH_PARAMS];     // values copied to param_storage
+    int param_count;
+    char param_storage[128];
 } HttpRequest;
 
+typedef enum {
+    HTTP_PARSE_INCOMPLETE,  // read more into the buffer and call again
+    HTTP_PARSE_DONE,
+    HTTP_PARSE_ERROR        // answer error_status and close the connection
+} HttpParseResult;
+
+// Resumable parser over a caller-owned buffer: it scans each byte once,
+// NUL-terminates fields in place, decodes chunked bodies in place and
+// never allocates
+typedef struct {
+    char* buffer;
+    size_t capacity;
+    int state;
+    size_t scan;            // first byte not yet examined
+    size_t line_start;
+    size_t content_length;
+    size_t chunk_remaining;
+    size_t body_start;
+    size_t body_end;        // end of the (decoded) body so far
+    size_t end;             // one past the request's last byte once parsed
+    size_t saved_offset;    // byte replaced by the body's NUL terminator
+    char saved_byte;
+    BOOL has_saved_byte;
+    BOOL has_content_length;
+    BOOL chunked;
+    BOOL continue_pending;  // headers asked for 100-continue and the body has not arrived
+    int error_status;
+    const char* error;
+    HttpRequest request;
+} HttpParser;
+
 typedef struct {
     int status_code;
     char* content_type;
     char* body;
     size_t body_length;
     int is_binary;
+    char extra_headers[512];
+    Arena* arena;           // owns the response's memory, or NULL when it is on the heap
 } HttpResponse;
 
 typedef struct {
     int server_fd;
     int port;
-    RDPClient* rdp_client;
+    SessionPool* sessions;      // "default" serves the unprefixed routes, all of them /sessions/{id}/...
+    WorkerPool* workers;        // shared pool handling connections and encoding
+    int worker_count;
     int running;
 } HttpServer;
 
 // HTTP Server functions
 HttpServer* http_server_new(int port);
 void http_server_free(HttpServer* server);
-int http_server_start(HttpServer* server, RDPClient* rdp_client);
+int http_server_start(HttpServer* server, SessionPool* sessions);
 void http_server_stop(HttpServer* server);
 int http_server_run(HttpServer* server);
 
-// HTTP handling functions
-HttpRequest* parse_http_request(const char* request_data);
-void free_http_request(HttpRequest* request);
+// HTTP request parsing
+void http_parser_init(HttpParser* parser, char* buffer, size_t capacity);
+HttpParseResult http_parser_execute(HttpParser* parser, size_t length);
+// Drops the parsed request and moves pipelined bytes after it to the buffer start
+void http_parser_next(HttpParser* parser, size_t* length);
+const char* http_header_get(const HttpRequest* request, const char* name);
+const char* http_query_value(const HttpRequest* request, const char* name);
+BOOL http_query_get(const HttpRequest* request, const char* name, char* value, size_t value_size);
+// Decimal integer in [min_value, max_value]; FALSE when malformed or out of range
+BOOL http_query_int(const HttpRequest* request, const char* name, int min_value, int max_value, int* value);
+
+// HTTP responses
 HttpResponse* create_http_response(int status_code, const char* content_type, 
                                  const char* body, size_t body_length, int is_binary);
 void free_http_response(HttpResponse* response);
-int send_http_response(int client_fd, HttpResponse* response);
+// Responses created on this thread come from arena until it is unbound with
+// NULL; the owner resets the arena once they have been sent
+void http_response_bind_arena(Arena* arena);
+void http_response_add_header(HttpResponse* response, const char* name, const char* value);
+int send_http_response(int client_fd, HttpResponse* response, BOOL keep_alive);
+HttpResponse* route_request(HttpServer* server, HttpRequest* request);
 
 // Route handlers
-HttpResponse* handle_get_screen(RDPClient* client);
+HttpResponse* handle_get_screen(RDPClient* client, HttpRequest* request);
 HttpResponse* handle_post_sendkey(RDPClient* client, HttpRequest* request);
 HttpResponse* handle_post_sendmouse(RDPClient* client, HttpRequest* request);
 HttpResponse* handle_post_movemouse(RDPClient* client, HttpRequest* request);
 HttpResponse* handle_get_status(RDPClient* client);
+HttpResponse* handle_post_wait_for(RDPClient* client, HttpRequest* request);
+HttpResponse* handle_post_probe(RDPClient* client, HttpRequest* request);
+HttpResponse* handle_post_resize(RDPClient* client, HttpRequest* request);
+HttpResponse* handle_get_clipboard(RDPClient* client, HttpRequest* request);
+HttpResponse* handle_put_clipboard(RDPClient* client, HttpRequest* request);
+HttpResponse* handle_get_cursor(RDPClient* client);
+HttpResponse* handle_get_recording(RDPClient* client);
+HttpResponse* handle_get_recording_frame(RDPClient* client, HttpRequest* request);
+HttpResponse* handle_get_sessions(SessionPool* sessions);
+HttpResponse* handle_post_sessions(SessionPool* sessions, HttpRequest* request);
+HttpResponse* handle_delete_session(SessionPool* sessions, const char* id);
+HttpResponse* handle_get_metrics(void);
 
 #endif // HTTP_SERVER_H
\ No newline at end of file
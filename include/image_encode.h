@@ -0,0 +1,60 @@
+#ifndef IMAGE_ENCODE_H
+#define IMAGE_ENCODE_H
+
+#include "rcrdp.h"
+
+#define JPEG_DEFAULT_QUALITY 80
+#define ENCODE_CACHE_ENTRIES 8
+#define ENCODE_CACHE_BUDGET (32 * 1024 * 1024)      // bytes per session
+
+// Screenshot output formats, in the order preferred when a client accepts several
+typedef enum {
+    IMAGE_FORMAT_PNG,
+    IMAGE_FORMAT_QOI,       // lossless, several times faster than PNG, larger
+    IMAGE_FORMAT_JPEG,      // lossy, libjpeg-turbo
+    IMAGE_FORMAT_COUNT
+} ImageFormat;
+
+const char* image_format_mime(ImageFormat format);
+
+// Accepts the names and MIME types above; "jpg" is taken for "jpeg"
+BOOL image_format_parse(const char* name, ImageFormat* format);
+
+// 0x00RRGGBB pixels to an encoded image in a malloc'd buffer; quality only
+// applies to JPEG. convert_ns, if set, receives the time spent converting
+// pixels as opposed to compressing them.
+BOOL encode_image_memory(ImageFormat format, int quality, BYTE* buffer, UINT32 width, UINT32 height, UINT32 stride,
+                         BYTE** data, size_t* length, UINT64* convert_ns);
+BOOL encode_qoi_memory(BYTE* buffer, UINT32 width, UINT32 height, UINT32 stride, BYTE** qoi_data,
+                       size_t* qoi_length);
+BOOL encode_jpeg_memory(BYTE* buffer, UINT32 width, UINT32 height, UINT32 stride, int quality, BYTE** jpeg_data,
+                        size_t* jpeg_length);
+
+// What an encoded frame was made from. A generation's pixels never change,
+// and the cursor key changes with the cursor's shape and position, so an
+// encoding stays valid for as long as it is cached.
+typedef struct {
+    UINT64 generation;
+    ImageFormat format;
+    int quality;            // 0 for lossless formats
+    FrameRect rect;         // all zero for the whole frame
+    UINT64 cursor;          // cursor_info_key of a composited cursor, 0 for none
+} EncodeKey;
+
+typedef struct _EncodeCache EncodeCache;
+
+// Recent encodings of one session's frames, least recently used evicted
+// first, so pollers asking again before the next paint skip the encode.
+// Holds at most ENCODE_CACHE_ENTRIES encodings and ENCODE_CACHE_BUDGET bytes.
+EncodeCache* encode_cache_new(void);
+void encode_cache_free(EncodeCache* cache);
+
+// On a hit, *data stays valid and the cache locked until encode_cache_release
+BOOL encode_cache_acquire(EncodeCache* cache, const EncodeKey* key, const BYTE** data, size_t* length);
+void encode_cache_release(EncodeCache* cache);
+
+// Stores a copy of data under key, evicting as needed; encodings larger
+// than the whole budget are not cached
+void encode_cache_put(EncodeCache* cache, const EncodeKey* key, const BYTE* data, size_t length);
+
+#endif // IMAGE_ENCODE_H
@@ -0,0 +1,24 @@
+#ifndef IMAGE_MATCH_H
+#define IMAGE_MATCH_H
+
+#include "rcrdp.h"
+
+// Template image in the same 0x00RRGGBB layout as the captured frame
+typedef struct {
+    UINT32* pixels;
+    UINT32 width;
+    UINT32 height;
+} ImageTemplate;
+
+// Decoding helpers
+size_t base64_decode(const char* input, size_t input_length, BYTE* output, size_t output_size);
+BOOL decode_png_memory(const BYTE* data, size_t length, ImageTemplate* image);
+void free_image_template(ImageTemplate* image);
+
+// Search `haystack` (a region copied from the frame) for `image`.
+// tolerance is the allowed per-channel difference (0 = exact match).
+// Returns TRUE and the top-left offset of the first match in scan order.
+BOOL find_template(const BYTE* haystack, UINT32 width, UINT32 height, UINT32 stride,
+                   const ImageTemplate* image, BYTE tolerance, UINT32* match_x, UINT32* match_y);
+
+#endif // IMAGE_MATCH_H
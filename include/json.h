@@ -0,0 +1,77 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stddef.h>
+#include <winpr3/winpr/wtypes.h>
+
+// Keys count as tokens, so a document of n objects with k keys each takes
+// n * (2k + 1) of them; this fits the largest input batch the routes accept
+#define JSON_MAX_TOKENS 2560
+#define JSON_MAX_DEPTH 32
+
+typedef enum {
+    JSON_OBJECT,
+    JSON_ARRAY,
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL
+} JsonType;
+
+// Containers are followed by their children; object children alternate key
+// and value. Strings are unescaped and NUL-terminated in the parsed text.
+typedef struct {
+    JsonType type;
+    UINT32 start;           // offset in the text; strings start after the quote
+    UINT32 length;          // bytes of a string or number
+    UINT32 count;           // array elements, or object key/value pairs
+    UINT32 next;            // first token after this value and its children
+} JsonToken;
+
+typedef struct {
+    char* text;
+    JsonToken tokens[JSON_MAX_TOKENS];
+    UINT32 count;
+    char error[128];
+} JsonDocument;
+
+typedef enum {
+    JSON_FIELD_INT,         // int; decimal, or hex as 0x... bare or quoted
+    JSON_FIELD_UINT,        // UINT32, same syntax
+    JSON_FIELD_DOUBLE,
+    JSON_FIELD_BOOL,
+    JSON_FIELD_STRING,      // const char* into the parsed text
+    JSON_FIELD_ARRAY        // UINT32 token index, for json_child/json_sibling
+} JsonFieldType;
+
+// One key of an object bound to a member of a handler struct. Integers must
+// lie in [min, max]; strings may be at most max bytes when max > 0. Members
+// of absent optional fields keep the value they had.
+typedef struct {
+    const char* name;
+    JsonFieldType type;
+    BOOL required;
+    size_t offset;
+    INT64 min;
+    INT64 max;
+} JsonField;
+
+#define JSON_REQUIRED(type, member, kind, min, max) { #member, kind, TRUE, offsetof(type, member), min, max }
+#define JSON_OPTIONAL(type, member, kind, min, max) { #member, kind, FALSE, offsetof(type, member), min, max }
+
+// Tokenizes text in one pass, modifying it in place; on failure doc->error
+// says what was wrong and where
+BOOL json_parse(JsonDocument* doc, char* text, size_t length);
+
+// Binds the keys of object token into target; unknown keys are ignored
+BOOL json_bind(JsonDocument* doc, UINT32 object, const JsonField* fields, size_t field_count, void* target);
+
+UINT32 json_child(const JsonDocument* doc, UINT32 container);
+UINT32 json_sibling(const JsonDocument* doc, UINT32 token);
+
+// Writes text as the inside of a JSON string literal to out, truncated to
+// fit size bytes, and returns out for use as a printf argument
+const char* json_escape(const char* text, char* out, size_t size);
+
+#endif // JSON_H
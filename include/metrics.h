@@ -0,0 +1,64 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <winpr3/winpr/wtypes.h>
+
+// Log-linear buckets with two sub-bucket bits per power of two, covering
+// durations up to ~9 minutes in microseconds and sizes up to 512 MiB
+#define METRIC_BUCKETS 112
+
+typedef enum {
+    METRIC_PAINTS,
+    METRIC_EVENT_LOOP_WAKEUPS,
+    METRIC_INPUT_KEY,
+    METRIC_INPUT_MOUSE,
+    METRIC_INPUT_MOVE,
+    METRIC_ENCODE_CACHE_HIT,
+    METRIC_ENCODE_CACHE_MISS,
+    METRIC_COUNTER_COUNT
+} MetricCounter;
+
+// Routes labelled on the request latency histogram, as set in the route
+// table; session-prefixed routes are counted under the route they map to
+typedef enum {
+    METRIC_ROUTE_SCREEN,
+    METRIC_ROUTE_STATUS,
+    METRIC_ROUTE_SENDKEY,
+    METRIC_ROUTE_SENDMOUSE,
+    METRIC_ROUTE_MOVEMOUSE,
+    METRIC_ROUTE_WAIT_FOR,
+    METRIC_ROUTE_PROBE,
+    METRIC_ROUTE_RESIZE,
+    METRIC_ROUTE_CLIPBOARD,
+    METRIC_ROUTE_CURSOR,
+    METRIC_ROUTE_RECORDING,
+    METRIC_ROUTE_SESSIONS,
+    METRIC_ROUTE_METRICS,
+    METRIC_ROUTE_OTHER,
+    METRIC_ROUTE_COUNT
+} MetricRoute;
+
+// Duration histograms take nanoseconds, size histograms take bytes
+typedef enum {
+    METRIC_HIST_COPY_FRAME,
+    METRIC_HIST_FRAME_LOCK_WAIT,
+    METRIC_HIST_PNG_ENCODE,
+    METRIC_HIST_PNG_BYTES,
+    METRIC_HIST_CHECK_EVENTS,
+    METRIC_HIST_SEND,
+    METRIC_HIST_REQUEST,        // first of METRIC_ROUTE_COUNT per-route histograms
+    METRIC_HIST_COUNT = METRIC_HIST_REQUEST + METRIC_ROUTE_COUNT
+} MetricHistogram;
+
+// Recording touches only the calling thread's shard, so it takes no lock
+// and no atomic read-modify-write; shards are summed when scraped
+UINT64 metrics_now_ns(void);
+void metrics_count(MetricCounter counter, UINT64 value);
+void metrics_observe(MetricHistogram histogram, UINT64 value);
+void metrics_observe_request(MetricRoute route, UINT64 duration_ns);
+
+// Renders all metrics in the Prometheus text format; caller frees *text
+BOOL metrics_render(char** text, size_t* length);
+
+#endif // METRICS_H
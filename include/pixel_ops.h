@@ -0,0 +1,23 @@
+#ifndef PIXEL_OPS_H
+#define PIXEL_OPS_H
+
+#include "rcrdp.h"
+
+// Per-rectangle color statistics gathered in a single pass
+typedef struct {
+    UINT64 sum_r;
+    UINT64 sum_g;
+    UINT64 sum_b;
+    UINT64 matching;    // pixels within tolerance of the target color
+    UINT64 count;
+} PixelStats;
+
+// Pixels are 0x00RRGGBB in memory order B, G, R, X; the X byte is ignored.
+void pixel_rect_stats(const BYTE* data, UINT32 stride, const FrameRect* rect,
+                      UINT32 color, BYTE tolerance, PixelStats* stats);
+
+// TRUE if every pixel in rect has the same RGB value (returned in color).
+// Stops at the first block that differs, so busy frames are rejected quickly.
+BOOL pixel_rect_is_uniform(const BYTE* data, UINT32 stride, const FrameRect* rect, UINT32* color);
+
+#endif // PIXEL_OPS_H
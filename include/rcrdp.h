@@ -3,6 +3,8 @@
 
 #include <freerdp3/freerdp/freerdp.h>
 #include <freerdp3/freerdp/gdi/gdi.h>
+#include <freerdp3/freerdp/client/cliprdr.h>
+#include <freerdp3/freerdp/client/disp.h>
 #include <freerdp3/freerdp/client/rdpei.h>
 #include <freerdp3/freerdp/client/rdpgfx.h>
 #include <freerdp3/freerdp/codec/bitmap.h>
@@ -10,9 +12,115 @@
 #include <winpr3/winpr/synch.h>
 
 #define MAX_SCREENSHOT_RETRIES 20
+#define DEFAULT_BLANK_FRAME_TIMEOUT_MS 2000
+#define FRAME_DAMAGE_HISTORY 64
+#define DEFAULT_DESKTOP_WIDTH 1024
+#define DEFAULT_DESKTOP_HEIGHT 768
+#define DEFAULT_COLOR_DEPTH 32
+#define MIN_DESKTOP_SIZE 200
+#define MAX_DESKTOP_SIZE 8192
+#define DEFAULT_RECONNECT_ATTEMPTS 20
+#define RECONNECT_BASE_DELAY_MS 500
+#define RECONNECT_MAX_DELAY_MS 30000
+#define IDLE_RESUME_TIMEOUT_MS 2000
+#define FRESH_FRAME_TIMEOUT_MS 2000
 
-// Forward declaration
+// Forward declarations
 typedef struct _RDPClient RDPClient;
+typedef struct _BitmapDecoder BitmapDecoder;
+typedef struct _FrameSource FrameSource;
+typedef struct _Recorder Recorder;
+typedef struct _FrameHistory FrameHistory;
+typedef struct _EncodeCache EncodeCache;
+typedef struct _RDPClipboard RDPClipboard;
+typedef struct _RDPCursor RDPCursor;
+
+// Connection phases reported by /status, in order
+typedef enum {
+    RDP_PHASE_IDLE = 0,
+    RDP_PHASE_TCP,          // TCP connect
+    RDP_PHASE_TLS_NLA,      // X.224 negotiation, TLS handshake, NLA, MCS
+    RDP_PHASE_LICENSING,    // licensing and capability exchange
+    RDP_PHASE_FIRST_FRAME,  // connected, waiting for the first paint
+    RDP_PHASE_READY,
+    RDP_PHASE_RECONNECTING, // connection dropped, supervisor retrying
+    RDP_PHASE_FAILED,
+    RDP_PHASE_COUNT
+} RDPConnectPhase;
+
+// Requested desktop size and wire color depth; frames are always kept at 32 bpp
+typedef struct {
+    UINT32 width;
+    UINT32 height;
+    UINT32 color_depth;
+} RDPGeometry;
+
+// Graphics pipeline codec preference (--gfx)
+typedef enum {
+    RDP_GFX_OFF = 0,        // legacy bitmap updates only
+    RDP_GFX_AUTO,           // AVC444 when a software H.264 decoder is available, else progressive
+    RDP_GFX_AVC444,
+    RDP_GFX_AVC420,
+    RDP_GFX_PROGRESSIVE     // RemoteFX progressive, planar and ClearCodec, no AVC
+} RDPGfxMode;
+
+// Negotiated graphics pipeline state for /status
+typedef struct {
+    RDPGfxMode mode;        // requested
+    BOOL active;            // channel open
+    UINT32 caps_version;    // RDPGFX_CAPVERSION_*, 0 until CapsConfirm
+    UINT32 caps_flags;
+    UINT32 codecs_seen;     // bit per RDPGFX_CODECID_* used in surface commands
+} RDPGfxInfo;
+
+// Reconnect supervisor counters for /status
+typedef struct {
+    UINT32 disconnects;         // connection losses seen
+    UINT32 attempts;            // freerdp_reconnect calls
+    UINT32 successes;
+    BOOL cookie;                // server issued an auto-reconnect cookie
+    UINT64 last_duration_ms;    // outage length of the last successful reconnect
+    UINT64 total_duration_ms;
+} RDPReconnectStats;
+
+// Idle policy state for /status
+typedef struct {
+    UINT32 timeout_ms;          // 0 when idle suppression is disabled
+    UINT64 idle_ms;             // time since the last screen consumer
+    BOOL suppressed;            // display updates currently paused
+    UINT32 suppress_count;
+} RDPIdleInfo;
+
+// Snapshot of connection progress for /status
+typedef struct {
+    RDPConnectPhase phase;
+    UINT64 phase_ms[RDP_PHASE_COUNT];  // time spent in each phase, including the current one
+    char error[128];
+} RDPConnectProgress;
+
+// Read-only view of the latest frame, valid while frame_mutex is held
+typedef struct {
+    const BYTE* data;
+    UINT32 width;
+    UINT32 height;
+    UINT32 stride;
+    UINT64 generation;
+} FrameView;
+
+// Rectangle in desktop coordinates
+typedef struct {
+    UINT32 x;
+    UINT32 y;
+    UINT32 width;
+    UINT32 height;
+} FrameRect;
+
+// Area damaged by the paint that produced a given frame generation
+typedef struct {
+    UINT64 generation;
+    FrameRect rect;
+    UINT64 paint_ms;        // get_time_ms() when EndPaint published it
+} FrameDamage;
 
 // Context extension to hold reference to RDPClient
 typedef struct {
@@ -23,16 +131,66 @@ typedef struct {
 typedef struct _RDPClient {
     freerdp* instance;
     RDPContext* context;
+    FrameSource* source;        // frame producer, the FreeRDP connection by default
+    Recorder* recorder;         // session recording, NULL when not recording
+    FrameHistory* history;      // recent frames for ?ago=, NULL when disabled
+    EncodeCache* encode_cache;  // recent screenshot encodings, NULL when out of memory
     BOOL connected;
     BOOL first_frame_received;
     BOOL screenshot_requested;
     char* screenshot_filename;
-    int screenshot_retry_count;
+    UINT32 blank_frame_timeout_ms;
+    BOOL nonblank_frame_seen;   // set by the first non-black frame, reset with first_frame_received
     char* hostname;
     int port;
     char* username;
     char* password;
     char* domain;
+    RDPGeometry geometry;
+    
+    // Display Control channel, set once the server opens it; guarded by state_mutex
+    DispClientContext* disp;
+    UINT32 disp_max_area;   // MaxMonitorAreaFactorA * B, 0 until caps arrive
+    
+    // Clipboard channel state and the remote pointer, NULL when out of memory
+    RDPClipboard* clipboard;
+    RDPCursor* cursor;
+    
+    // Graphics pipeline channel; negotiated values guarded by state_mutex
+    RDPGfxMode gfx_mode;
+    RdpgfxClientContext* gfx;
+    UINT32 gfx_caps_version;
+    UINT32 gfx_caps_flags;
+    UINT32 gfx_codecs_seen;
+    pcRdpgfxSurfaceCommand gfx_surface_command;   // GDI handler we forward to
+    
+    // Codec decode threading: shared decoder for legacy bitmap updates (NULL
+    // keeps GDI's inline decode) and FreeRDP's own tile threads (1 disables them)
+    BitmapDecoder* decoder;
+    int decode_threads;
+    
+    // Connection progress; guarded by state_mutex
+    RDPConnectPhase phase;
+    UINT64 phase_started_ms;
+    UINT64 phase_duration_ms[RDP_PHASE_COUNT];
+    char last_error[128];
+    pthread_mutex_t state_mutex;
+    
+    // Reconnect supervisor, run on the event thread; stats guarded by state_mutex
+    int reconnect_attempts;     // per outage, 0 disables reconnecting
+    unsigned int reconnect_seed;
+    RDPReconnectStats reconnect;
+    
+    // Idle policy: display updates are paused with Suppress Output after
+    // idle_timeout_ms without a screen consumer (0 disables); guarded by state_mutex
+    UINT32 idle_timeout_ms;
+    UINT64 last_consumer_ms;
+    BOOL output_suppressed;
+    UINT32 suppress_count;
+    
+    // Background connection thread
+    pthread_t connect_thread;
+    BOOL connect_thread_running;
     
     // Event processing thread
     pthread_t event_thread;
@@ -46,6 +204,15 @@ typedef struct _RDPClient {
     UINT32 latest_frame_stride;
     pthread_mutex_t frame_mutex;
     BOOL frame_updated;
+    
+    // Serializes input events sent from concurrent HTTP workers
+    pthread_mutex_t input_mutex;
+    
+    // Frame change notification: generation advances on every damaging
+    // paint and frame_cond is broadcast under frame_mutex
+    UINT64 frame_generation;
+    pthread_cond_t frame_cond;
+    FrameDamage damage_history[FRAME_DAMAGE_HISTORY];
 } RDPClient;
 
 typedef enum {
@@ -82,6 +249,40 @@ void rdp_client_free(RDPClient* client);
 BOOL rdp_client_connect(RDPClient* client, const char* hostname, int port, 
                        const char* username, const char* password, const char* domain);
 void rdp_client_disconnect(RDPClient* client);
+BOOL rdp_client_connect_async(RDPClient* client, const char* hostname, int port,
+                              const char* username, const char* password, const char* domain);
+void rdp_client_set_phase(RDPClient* client, RDPConnectPhase phase);
+RDPConnectPhase rdp_client_get_phase(RDPClient* client);
+const char* rdp_client_phase_name(RDPConnectPhase phase);
+void rdp_client_get_progress(RDPClient* client, RDPConnectProgress* progress);
+void rdp_client_get_reconnect_stats(RDPClient* client, RDPReconnectStats* stats);
+void rdp_client_get_idle_info(RDPClient* client, RDPIdleInfo* info);
+BOOL rdp_client_note_consumer(RDPClient* client);
+void rdp_client_check_idle(RDPClient* client);
+BOOL rdp_client_refresh_rect(RDPClient* client, const FrameRect* rect);
+BOOL rdp_client_refresh_frame(RDPClient* client, const FrameRect* rect, UINT32 timeout_ms);
+BOOL rdp_geometry_valid(const RDPGeometry* geometry, const char** error);
+BOOL rdp_client_resize(RDPClient* client, UINT32 width, UINT32 height, const char** error);
+BOOL get_desktop_size(RDPClient* client, UINT32* width, UINT32* height);
+
+// Clipboard text transfer; both calls may wait up to timeout_ms for the server
+typedef enum {
+    CLIPBOARD_OK,
+    CLIPBOARD_UNAVAILABLE,      // channel not open or not initialized yet
+    CLIPBOARD_EMPTY,            // the remote clipboard holds no text
+    CLIPBOARD_INVALID,          // text is not valid UTF-8
+    CLIPBOARD_TIMEOUT,          // the server did not answer in time
+    CLIPBOARD_FAILED            // send failed, server refused or out of memory
+} ClipboardResult;
+
+ClipboardResult rdp_client_set_clipboard(RDPClient* client, const char* text, size_t length, UINT32 timeout_ms);
+ClipboardResult rdp_client_get_clipboard(RDPClient* client, UINT32 timeout_ms, char** text, size_t* length);
+BOOL rdp_gfx_mode_parse(const char* name, RDPGfxMode* mode);
+const char* rdp_gfx_mode_name(RDPGfxMode mode);
+const char* rdp_gfx_version_name(UINT32 caps_version);
+const char* rdp_gfx_codec_name(UINT32 codec_id);
+BOOL rdp_h264_available(void);
+void rdp_client_get_gfx_info(RDPClient* client, RDPGfxInfo* info);
 
 // Command functions  
 typedef enum {
@@ -90,8 +291,14 @@ typedef enum {
     SCREENSHOT_BLACK = 2
 } ScreenshotResult;
 
-ScreenshotResult execute_screenshot(RDPClient* client, const char* output_file);
+ScreenshotResult wait_for_nonblank_frame(RDPClient* client, UINT32 timeout_ms, int* retries);
 BOOL request_screenshot(RDPClient* client, const char* output_file);
+BOOL encode_png_memory(BYTE* buffer, UINT32 width, UINT32 height, UINT32 stride,
+                       BYTE** png_data, size_t* png_length, UINT64* convert_ns);
+// As encode_png_memory with a given number of strips, at most one per row;
+// encode_png_memory picks one per core for large frames
+BOOL encode_png_strips(BYTE* buffer, UINT32 width, UINT32 height, UINT32 stride, int strip_count,
+                       BYTE** png_data, size_t* png_length, UINT64* convert_ns);
 BOOL execute_sendkey(RDPClient* client, DWORD flags, DWORD code);
 BOOL execute_sendmouse(RDPClient* client, DWORD flags, UINT16 x, UINT16 y);
 BOOL execute_movemouse(RDPClient* client, UINT16 x, UINT16 y);
@@ -102,8 +309,26 @@ void rdp_client_stop_event_thread(RDPClient* client);
 void* rdp_event_thread_proc(void* arg);
 
 // Non-blocking screenshot functions
-BOOL get_latest_frame(RDPClient* client, BYTE** buffer, UINT32* width, UINT32* height, UINT32* stride);
-BOOL copy_frame_buffer(RDPClient* client, BYTE* src_buffer, UINT32 width, UINT32 height, UINT32 stride);
+BOOL get_latest_frame(RDPClient* client, BYTE** buffer, UINT32* width, UINT32* height, UINT32* stride,
+                      UINT64* generation);
+BOOL get_frame_paint_time(RDPClient* client, UINT64 generation, UINT64* paint_ms);
+BOOL copy_frame_buffer(RDPClient* client, BYTE* src_buffer, UINT32 width, UINT32 height, UINT32 stride,
+                       const FrameRect* damage);
+
+// Frame change notification functions
+UINT64 get_frame_generation(RDPClient* client);
+BOOL get_frame_size(RDPClient* client, UINT32* width, UINT32* height);
+BOOL wait_for_frame_generation(RDPClient* client, UINT64 after, UINT32 timeout_ms, UINT64* generation);
+BOOL get_frame_damage_since(RDPClient* client, UINT64 since, FrameRect* damage);
+BOOL get_frame_region(RDPClient* client, const FrameRect* region, BYTE** buffer, UINT32* stride,
+                      UINT64* generation);
+BOOL acquire_frame_view(RDPClient* client, FrameView* view);
+void release_frame_view(RDPClient* client, FrameView* view);
+// Damage between since and an acquired view, and when the view's paint happened
+BOOL get_frame_view_damage(RDPClient* client, const FrameView* view, UINT64 since, FrameRect* damage,
+                           UINT64* paint_ms);
+BOOL frame_rect_intersects(const FrameRect* a, const FrameRect* b);
+UINT64 get_time_ms(void);
 
 // Utility functions
 CommandType parse_command(const char* cmd_str);
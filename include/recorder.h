@@ -0,0 +1,81 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "rcrdp.h"
+
+#define RECORDER_TILE_SIZE 64
+#define RECORDER_CAPTURE_INTERVAL_MS 200        // at most 5 recorded frames per second
+#define RECORDER_KEYFRAME_INTERVAL_MS 10000
+#define RECORDER_BATCH_BYTES (1024 * 1024)      // pending bytes that wake the writer early
+#define RECORDER_FLUSH_INTERVAL_MS 1000
+#define RECORDER_MAX_PENDING_BYTES (64 * 1024 * 1024)
+
+// Recording file layout, all integers little-endian:
+//
+//   header    "RCREC001", u32 version, u32 tile size, u64 start time (Unix ms), u64 reserved
+//   record    u8 type, u8[3] reserved, u32 payload length, u64 time (ms since start), payload
+//
+//   KEYFRAME  u32 width, u32 height, u64 generation, zlib(width * height * 4 bytes)
+//   DELTA     u64 generation, u32 tile count, tile count * (u16 x, y, width, height),
+//             zlib(tile pixels, tile by tile, rows of width * 4 bytes)
+//   INPUT     u32 kind, u32 flags, u32 code or x, u32 y
+//   INDEX     u32 count, count * (u64 time, u64 keyframe offset)
+//
+// The file is append-only. INDEX is written once, when recording stops,
+// followed by a footer of "RCRECIDX" and the u64 offset of the INDEX record;
+// a file without a footer was cut short and is read by walking the records.
+#define RECORDER_MAGIC "RCREC001"
+#define RECORDER_FOOTER_MAGIC "RCRECIDX"
+#define RECORDER_VERSION 1
+#define RECORDER_HEADER_SIZE 32
+#define RECORDER_RECORD_HEADER_SIZE 16
+
+typedef enum {
+    RECORD_KEYFRAME = 1,
+    RECORD_DELTA = 2,
+    RECORD_INPUT = 3,
+    RECORD_INDEX = 4
+} RecordType;
+
+typedef enum {
+    RECORD_INPUT_KEY = 1,
+    RECORD_INPUT_MOUSE = 2
+} RecordInputKind;
+
+// Counters for /recording
+typedef struct {
+    UINT64 start_unix_ms;
+    UINT64 duration_ms;
+    UINT32 keyframes;
+    UINT32 deltas;
+    UINT64 tiles;
+    UINT64 inputs;
+    UINT64 raw_bytes;           // tile and keyframe pixels before compression
+    UINT64 file_bytes;          // header plus every record appended so far
+    UINT64 pending_bytes;       // appended but not yet written
+    UINT32 dropped;             // records dropped because the writer fell behind
+} RecorderStats;
+
+typedef struct _Recorder Recorder;
+
+// Records client's frames to path from a capture thread that reads the
+// damage history, never from the paint path; a writer thread batches the
+// file writes
+Recorder* recorder_start(RDPClient* client, const char* path, const char** error);
+
+// Writes pending records and the index, then frees the recorder
+void recorder_stop(Recorder* recorder);
+
+// Appends an input record; does nothing when recorder is NULL
+void recorder_note_input(Recorder* recorder, RecordInputKind kind, DWORD flags, UINT32 a, UINT32 b);
+
+void recorder_get_stats(Recorder* recorder, RecorderStats* stats);
+const char* recorder_path(Recorder* recorder);
+
+// Rebuilds the frame on screen t_ms after recording started, from the last
+// keyframe at or before it; caller frees *buffer. *frame_t_ms is the time of
+// the last record applied.
+BOOL recorder_frame_at(Recorder* recorder, UINT64 t_ms, BYTE** buffer, UINT32* width, UINT32* height,
+                       UINT32* stride, UINT64* frame_t_ms, UINT64* generation, const char** error);
+
+#endif // RECORDER_H
@@ -0,0 +1,59 @@
+#ifndef SESSION_POOL_H
+#define SESSION_POOL_H
+
+#include "rcrdp.h"
+
+#define MAX_SESSIONS 256
+#define SESSION_ID_SIZE 64
+
+typedef struct {
+    char id[SESSION_ID_SIZE];
+    RDPClient* client;
+    int refcount;       // in-flight requests using the client
+    BOOL removed;       // freed once refcount drops to zero
+} RDPSession;
+
+typedef struct {
+    RDPSession* sessions[MAX_SESSIONS];
+    int count;
+    int next_auto_id;
+    UINT32 blank_frame_timeout_ms;  // applied to every new session
+    RDPGeometry geometry;           // default for sessions created without one
+    RDPGfxMode gfx_mode;            // applied to every new session
+    BitmapDecoder* decoder;         // shared by all sessions, owned by the caller
+    int decode_threads;
+    int reconnect_attempts;         // applied to every new session
+    UINT32 idle_timeout_ms;         // applied to every new session
+    const char* source;             // frame source spec for new sessions, NULL for FreeRDP
+    const char* record_dir;         // every new session is recorded here when set
+    size_t history_budget;          // bytes of frame history per session, 0 to disable
+    pthread_mutex_t mutex;
+} SessionPool;
+
+typedef enum {
+    SESSION_CREATE_OK,
+    SESSION_CREATE_INVALID,     // bad id, hostname or geometry
+    SESSION_CREATE_EXISTS,      // the id is already in use
+    SESSION_CREATE_FULL,        // MAX_SESSIONS reached
+    SESSION_CREATE_FAILED,      // out of memory, or source, recorder or history failed
+    SESSION_CREATE_UNREACHABLE  // the RDP connection could not be started
+} SessionCreateResult;
+
+// Session pool functions
+SessionPool* session_pool_new(void);
+void session_pool_free(SessionPool* pool);
+// On success a non-NULL session receives the new session pinned, to be released
+// by the caller; error receives a message for any other result
+SessionCreateResult session_pool_create(SessionPool* pool, const char* id, const char* hostname, int port,
+                                        const char* username, const char* password, const char* domain,
+                                        const RDPGeometry* geometry, RDPSession** session, const char** error);
+BOOL session_pool_remove(SessionPool* pool, const char* id);
+int session_pool_load_file(SessionPool* pool, const char* path);
+
+// Lookup pins the session until released so it cannot be freed mid-request
+RDPSession* session_pool_acquire(SessionPool* pool, const char* id, size_t id_length);
+void session_pool_release(SessionPool* pool, RDPSession* session);
+
+size_t session_pool_list_json(SessionPool* pool, char* buffer, size_t buffer_size);
+
+#endif // SESSION_POOL_H
@@ -0,0 +1,35 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <pthread.h>
+#include <winpr3/winpr/synch.h>
+
+typedef void (*WorkerTaskFn)(void* arg);
+
+typedef struct _WorkerTask {
+    WorkerTaskFn fn;
+    void* arg;
+    struct _WorkerTask* next;
+} WorkerTask;
+
+typedef struct {
+    pthread_t* threads;
+    int thread_count;
+
+    // FIFO task queue protected by mutex
+    WorkerTask* head;
+    WorkerTask* tail;
+    int pending;
+    pthread_mutex_t mutex;
+    pthread_cond_t task_available;
+    BOOL stopping;
+} WorkerPool;
+
+// Worker pool functions
+WorkerPool* worker_pool_new(int thread_count);
+void worker_pool_free(WorkerPool* pool);
+BOOL worker_pool_submit(WorkerPool* pool, WorkerTaskFn fn, void* arg);
+int worker_pool_default_size(void);
+int worker_pool_pending(WorkerPool* pool);   // tasks queued and not yet started
+
+#endif // WORKER_POOL_H
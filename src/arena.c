@@ -0,0 +1,97 @@
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+
+struct _ArenaBlock {
+    ArenaBlock* next;
+    size_t capacity;
+    size_t used;
+    size_t padding;             // keeps data 16-byte aligned after three size_t
+    BYTE data[];
+};
+
+static size_t align_up(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+Arena* arena_new(size_t capacity)
+{
+    Arena* arena = (Arena*)calloc(1, sizeof(Arena));
+    if (!arena)
+        return NULL;
+    
+    arena->capacity = align_up(capacity > 0 ? capacity : ARENA_DEFAULT_CAPACITY);
+    arena->base = (BYTE*)aligned_alloc(ARENA_ALIGN, arena->capacity);
+    if (!arena->base) {
+        free(arena);
+        return NULL;
+    }
+    
+    return arena;
+}
+
+void arena_free(Arena* arena)
+{
+    if (!arena)
+        return;
+    
+    arena_reset(arena);
+    free(arena->base);
+    free(arena);
+}
+
+void* arena_alloc(Arena* arena, size_t size)
+{
+    // Rounding up or adding the block header must not wrap
+    if (size > SIZE_MAX - sizeof(ArenaBlock) - ARENA_ALIGN)
+        return NULL;
+    size = align_up(size > 0 ? size : 1);
+    
+    if (size <= arena->capacity - arena->used) {
+        void* memory = arena->base + arena->used;
+        arena->used += size;
+        return memory;
+    }
+    
+    ArenaBlock* block = arena->overflow;
+    if (!block || size > block->capacity - block->used) {
+        // Oversized requests get a block of their own, like a response body
+        // holding a full-screen PNG
+        size_t capacity = size > arena->capacity ? size : arena->capacity;
+        block = (ArenaBlock*)aligned_alloc(ARENA_ALIGN, align_up(sizeof(ArenaBlock) + capacity));
+        if (!block)
+            return NULL;
+        block->capacity = capacity;
+        block->used = 0;
+        block->next = arena->overflow;
+        arena->overflow = block;
+    }
+    
+    void* memory = block->data + block->used;
+    block->used += size;
+    return memory;
+}
+
+char* arena_strdup(Arena* arena, const char* text)
+{
+    size_t length = strlen(text) + 1;
+    char* copy = (char*)arena_alloc(arena, length);
+    if (copy)
+        memcpy(copy, text, length);
+    return copy;
+}
+
+void arena_reset(Arena* arena)
+{
+    while (arena->overflow) {
+        ArenaBlock* block = arena->overflow;
+        arena->overflow = block->next;
+        free(block);
+    }
+    
+    arena->used = 0;
+}
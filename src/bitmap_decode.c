@@ -0,0 +1,317 @@
+#include "bitmap_decode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <freerdp3/freerdp/codec/color.h>
+#include <freerdp3/freerdp/gdi/region.h>
+
+typedef struct {
+    int pending;
+    BOOL failed;
+} DecodeBatch;
+
+typedef struct {
+    BitmapDecoder* decoder;
+    DecodeBatch* batch;
+    rdpGdi* gdi;
+    const BITMAP_DATA* bitmap;
+} DecodeTask;
+
+static DecodeContext* decode_context_new(void)
+{
+    DecodeContext* context = (DecodeContext*)calloc(1, sizeof(DecodeContext));
+    if (!context)
+        return NULL;
+    
+    context->interleaved = bitmap_interleaved_context_new(FALSE);
+    context->planar = freerdp_bitmap_planar_context_new(0, 64, 64);
+    if (!context->interleaved || !context->planar) {
+        bitmap_interleaved_context_free(context->interleaved);
+        freerdp_bitmap_planar_context_free(context->planar);
+        free(context);
+        return NULL;
+    }
+    
+    context->planar_width = 64;
+    context->planar_height = 64;
+    return context;
+}
+
+static void decode_context_free(DecodeContext* context)
+{
+    bitmap_interleaved_context_free(context->interleaved);
+    freerdp_bitmap_planar_context_free(context->planar);
+    free(context->scratch);
+    free(context);
+}
+
+static DecodeContext* decode_context_acquire(BitmapDecoder* decoder)
+{
+    pthread_mutex_lock(&decoder->mutex);
+    DecodeContext* context = decoder->idle;
+    if (context)
+        decoder->idle = context->next;
+    pthread_mutex_unlock(&decoder->mutex);
+    
+    return context ? context : decode_context_new();
+}
+
+static void decode_context_release(BitmapDecoder* decoder, DecodeContext* context)
+{
+    pthread_mutex_lock(&decoder->mutex);
+    context->next = decoder->idle;
+    decoder->idle = context;
+    pthread_mutex_unlock(&decoder->mutex);
+}
+
+int bitmap_decoder_default_threads(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus < 1 ? 1 : (int)cpus;
+}
+
+BitmapDecoder* bitmap_decoder_new(int thread_count)
+{
+    if (thread_count <= 0)
+        thread_count = bitmap_decoder_default_threads();
+    
+    BitmapDecoder* decoder = (BitmapDecoder*)calloc(1, sizeof(BitmapDecoder));
+    if (!decoder)
+        return NULL;
+    
+    decoder->workers = worker_pool_new(thread_count);
+    if (!decoder->workers) {
+        free(decoder);
+        return NULL;
+    }
+    decoder->thread_count = decoder->workers->thread_count;
+    
+    pthread_mutex_init(&decoder->mutex, NULL);
+    pthread_cond_init(&decoder->done, NULL);
+    
+    printf("DEBUG: Bitmap decoder started with %d threads\n", decoder->thread_count);
+    return decoder;
+}
+
+void bitmap_decoder_free(BitmapDecoder* decoder)
+{
+    if (!decoder)
+        return;
+    
+    worker_pool_free(decoder->workers);
+    
+    while (decoder->idle) {
+        DecodeContext* next = decoder->idle->next;
+        decode_context_free(decoder->idle);
+        decoder->idle = next;
+    }
+    
+    pthread_cond_destroy(&decoder->done);
+    pthread_mutex_destroy(&decoder->mutex);
+    free(decoder);
+}
+
+// Destination rectangle is inclusive and may be narrower than the encoded
+// bitmap; clip it to the surface
+static BOOL bitmap_visible_rect(const rdpGdi* gdi, const BITMAP_DATA* bitmap, FrameRect* rect)
+{
+    if (bitmap->destLeft >= gdi->width || bitmap->destTop >= gdi->height ||
+        bitmap->destRight < bitmap->destLeft || bitmap->destBottom < bitmap->destTop)
+        return FALSE;
+    
+    UINT32 width = bitmap->destRight - bitmap->destLeft + 1;
+    UINT32 height = bitmap->destBottom - bitmap->destTop + 1;
+    if (width > bitmap->width)
+        width = bitmap->width;
+    if (height > bitmap->height)
+        height = bitmap->height;
+    if (width > gdi->width - bitmap->destLeft)
+        width = gdi->width - bitmap->destLeft;
+    if (height > gdi->height - bitmap->destTop)
+        height = gdi->height - bitmap->destTop;
+    
+    rect->x = bitmap->destLeft;
+    rect->y = bitmap->destTop;
+    rect->width = width;
+    rect->height = height;
+    return width > 0 && height > 0;
+}
+
+// Same decode as gdi_Bitmap_Decompress, but into a per-context scratch buffer
+// and then straight onto the primary surface
+static BOOL decode_bitmap(DecodeContext* context, rdpGdi* gdi, const BITMAP_DATA* bitmap)
+{
+    FrameRect visible;
+    if (!bitmap_visible_rect(gdi, bitmap, &visible))
+        return TRUE;
+    
+    UINT32 width = bitmap->width;
+    UINT32 height = bitmap->height;
+    UINT32 bpp = bitmap->bitsPerPixel;
+    UINT32 format = gdi->dstFormat;
+    UINT32 scratch_stride = width * 4;
+    size_t scratch_size = (size_t)scratch_stride * height;
+    
+    if (context->scratch_size < scratch_size) {
+        BYTE* scratch = (BYTE*)realloc(context->scratch, scratch_size);
+        if (!scratch)
+            return FALSE;
+        context->scratch = scratch;
+        context->scratch_size = scratch_size;
+    }
+    
+    BOOL decoded;
+    if (bitmap->compressed) {
+        if (bpp < 32) {
+            decoded = interleaved_decompress(context->interleaved, bitmap->bitmapDataStream, bitmap->bitmapLength,
+                                             width, height, bpp, context->scratch, format, scratch_stride,
+                                             0, 0, width, height, &gdi->palette);
+        } else {
+            if (width > context->planar_width || height > context->planar_height) {
+                if (!freerdp_bitmap_planar_context_reset(context->planar, width, height))
+                    return FALSE;
+                context->planar_width = width;
+                context->planar_height = height;
+            }
+            decoded = planar_decompress(context->planar, bitmap->bitmapDataStream, bitmap->bitmapLength,
+                                        width, height, context->scratch, format, scratch_stride,
+                                        0, 0, width, height, TRUE);
+        }
+    } else {
+        UINT32 src_format = gdi_get_pixel_format(bpp);
+        size_t src_size = (size_t)width * height * FreeRDPGetBytesPerPixel(src_format);
+        if (src_format == 0 || bitmap->bitmapLength < src_size)
+            return FALSE;
+        
+        // Uncompressed bitmaps are sent bottom-up
+        decoded = freerdp_image_copy_no_overlap(context->scratch, format, scratch_stride, 0, 0, width, height,
+                                                bitmap->bitmapDataStream, src_format, 0, 0, 0,
+                                                &gdi->palette, FREERDP_FLIP_VERTICAL);
+    }
+    
+    if (!decoded)
+        return FALSE;
+    
+    return freerdp_image_copy_no_overlap(gdi->primary_buffer, format, gdi->stride, visible.x, visible.y,
+                                         visible.width, visible.height, context->scratch, format,
+                                         scratch_stride, 0, 0, &gdi->palette, FREERDP_FLIP_NONE);
+}
+
+static void decode_task_proc(void* arg)
+{
+    DecodeTask* task = (DecodeTask*)arg;
+    BitmapDecoder* decoder = task->decoder;
+    
+    DecodeContext* context = decode_context_acquire(decoder);
+    BOOL decoded = context && decode_bitmap(context, task->gdi, task->bitmap);
+    if (context)
+        decode_context_release(decoder, context);
+    
+    pthread_mutex_lock(&decoder->mutex);
+    if (!decoded)
+        task->batch->failed = TRUE;
+    if (--task->batch->pending == 0)
+        pthread_cond_broadcast(&decoder->done);
+    pthread_mutex_unlock(&decoder->mutex);
+}
+
+// Decodes bitmaps [first, last) in parallel and waits for all of them
+static BOOL decode_batch(BitmapDecoder* decoder, rdpGdi* gdi, const BITMAP_DATA* bitmaps,
+                         UINT32 first, UINT32 last, DecodeTask* tasks)
+{
+    DecodeBatch batch = { 0, FALSE };
+    
+    pthread_mutex_lock(&decoder->mutex);
+    batch.pending = (int)(last - first);
+    pthread_mutex_unlock(&decoder->mutex);
+    
+    for (UINT32 i = first; i < last; i++) {
+        DecodeTask* task = &tasks[i];
+        task->decoder = decoder;
+        task->batch = &batch;
+        task->gdi = gdi;
+        task->bitmap = &bitmaps[i];
+        
+        // Run it here if the pool is shutting down
+        if (!worker_pool_submit(decoder->workers, decode_task_proc, task))
+            decode_task_proc(task);
+    }
+    
+    pthread_mutex_lock(&decoder->mutex);
+    while (batch.pending > 0)
+        pthread_cond_wait(&decoder->done, &decoder->mutex);
+    pthread_mutex_unlock(&decoder->mutex);
+    
+    return !batch.failed;
+}
+
+static BOOL decode_inline(BitmapDecoder* decoder, rdpGdi* gdi, const BITMAP_UPDATE* update)
+{
+    DecodeContext* context = decode_context_acquire(decoder);
+    if (!context)
+        return FALSE;
+    
+    BOOL decoded = TRUE;
+    for (UINT32 i = 0; i < update->number && decoded; i++)
+        decoded = decode_bitmap(context, gdi, &update->rectangles[i]);
+    
+    decode_context_release(decoder, context);
+    return decoded;
+}
+
+BOOL bitmap_decoder_update(BitmapDecoder* decoder, rdpGdi* gdi, const BITMAP_UPDATE* update)
+{
+    if (!decoder || !gdi || !update)
+        return FALSE;
+    
+    const BITMAP_DATA* bitmaps = update->rectangles;
+    UINT32 count = update->number;
+    
+    UINT64 pixels = 0;
+    for (UINT32 i = 0; i < count; i++)
+        pixels += (UINT64)bitmaps[i].width * bitmaps[i].height;
+    
+    BOOL decoded;
+    if (count < 2 || pixels < BITMAP_DECODE_INLINE_PIXELS) {
+        // Not worth a thread handoff
+        decoded = decode_inline(decoder, gdi, update);
+    } else {
+        DecodeTask* tasks = (DecodeTask*)calloc(count, sizeof(DecodeTask));
+        if (!tasks)
+            return FALSE;
+        
+        // Split into runs of mutually disjoint rectangles so overlapping
+        // bitmaps are still drawn in wire order
+        decoded = TRUE;
+        UINT32 first = 0;
+        for (UINT32 i = 1; i <= count && decoded; i++) {
+            BOOL flush = i == count;
+            FrameRect rect = { bitmaps[i % count].destLeft, bitmaps[i % count].destTop,
+                               bitmaps[i % count].width, bitmaps[i % count].height };
+            for (UINT32 j = first; j < i && !flush; j++) {
+                FrameRect other = { bitmaps[j].destLeft, bitmaps[j].destTop, bitmaps[j].width, bitmaps[j].height };
+                flush = frame_rect_intersects(&rect, &other);
+            }
+            
+            if (flush) {
+                decoded = decode_batch(decoder, gdi, bitmaps, first, i, tasks);
+                first = i;
+            }
+        }
+        
+        free(tasks);
+    }
+    
+    if (!decoded)
+        return FALSE;
+    
+    for (UINT32 i = 0; i < count; i++) {
+        FrameRect visible;
+        if (bitmap_visible_rect(gdi, &bitmaps[i], &visible))
+            gdi_InvalidateRegion(gdi->primary->hdc, (INT32)visible.x, (INT32)visible.y,
+                                 (INT32)visible.width, (INT32)visible.height);
+    }
+    
+    return TRUE;
+}
@@ -0,0 +1,456 @@
+#include "clipboard.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <winpr3/winpr/string.h>
+#include <winpr3/winpr/user.h>
+
+struct _RDPClipboard {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    CliprdrClientContext* cliprdr;  // NULL while the channel is closed
+    BOOL ready;                     // capabilities and a format list have been sent
+
+    // Text offered to the server, kept across reconnects and announced again
+    // once the channel is ready; utf16 is NUL-terminated UTF-16LE
+    char* local_text;
+    size_t local_length;
+    WCHAR* local_utf16;
+    size_t local_utf16_bytes;
+    BOOL local_owner;               // our format list is the latest one
+    BOOL remote_has_text;           // the server's latest format list has CF_UNICODETEXT
+
+    // Format lists are answered in order, so responses are matched by count
+    UINT64 lists_sent;
+    UINT64 lists_answered;
+    BOOL last_list_ok;
+
+    // Format data responses carry no request id, so only one request is
+    // outstanding at a time; a response arriving with none pending is dropped
+    BOOL request_pending;
+    BOOL response_ready;
+    BOOL response_ok;
+    BYTE* response_data;
+    size_t response_length;
+};
+
+static void deadline_after(struct timespec* deadline, UINT32 ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+RDPClipboard* rdp_clipboard_new(void)
+{
+    RDPClipboard* clipboard = (RDPClipboard*)calloc(1, sizeof(RDPClipboard));
+    if (!clipboard)
+        return NULL;
+    
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    if (pthread_cond_init(&clipboard->cond, &cond_attr) != 0) {
+        pthread_condattr_destroy(&cond_attr);
+        free(clipboard);
+        return NULL;
+    }
+    pthread_condattr_destroy(&cond_attr);
+    
+    if (pthread_mutex_init(&clipboard->mutex, NULL) != 0) {
+        pthread_cond_destroy(&clipboard->cond);
+        free(clipboard);
+        return NULL;
+    }
+    return clipboard;
+}
+
+void rdp_clipboard_free(RDPClipboard* clipboard)
+{
+    if (!clipboard)
+        return;
+    
+    free(clipboard->local_text);
+    free(clipboard->local_utf16);
+    free(clipboard->response_data);
+    pthread_cond_destroy(&clipboard->cond);
+    pthread_mutex_destroy(&clipboard->mutex);
+    free(clipboard);
+}
+
+// Announces CF_UNICODETEXT when there is local text, else an empty list
+static UINT clipboard_send_format_list(CliprdrClientContext* cliprdr, BOOL has_text)
+{
+    CLIPRDR_FORMAT format = { CF_UNICODETEXT, NULL };
+    CLIPRDR_FORMAT_LIST list;
+    memset(&list, 0, sizeof(list));
+    list.common.msgType = CB_FORMAT_LIST;
+    list.numFormats = has_text ? 1 : 0;
+    list.formats = has_text ? &format : NULL;
+    return cliprdr->ClientFormatList(cliprdr, &list);
+}
+
+static UINT clipboard_monitor_ready(CliprdrClientContext* cliprdr, const CLIPRDR_MONITOR_READY* monitor_ready)
+{
+    WINPR_UNUSED(monitor_ready);
+    RDPClient* client = (RDPClient*)cliprdr->custom;
+    RDPClipboard* clipboard = client->clipboard;
+    
+    CLIPRDR_GENERAL_CAPABILITY_SET general;
+    memset(&general, 0, sizeof(general));
+    general.capabilitySetType = CB_CAPSTYPE_GENERAL;
+    general.capabilitySetLength = 12;
+    general.version = CB_CAPS_VERSION_2;
+    general.generalFlags = CB_USE_LONG_FORMAT_NAMES;
+    
+    CLIPRDR_CAPABILITIES capabilities;
+    memset(&capabilities, 0, sizeof(capabilities));
+    capabilities.cCapabilitiesSets = 1;
+    capabilities.capabilitySets = (CLIPRDR_CAPABILITY_SET*)&general;
+    UINT status = cliprdr->ClientCapabilities(cliprdr, &capabilities);
+    if (status != CHANNEL_RC_OK)
+        return status;
+    
+    // The client must follow its capabilities with a format list
+    pthread_mutex_lock(&clipboard->mutex);
+    BOOL has_text = clipboard->local_utf16 != NULL;
+    clipboard->lists_sent++;
+    pthread_mutex_unlock(&clipboard->mutex);
+    
+    status = clipboard_send_format_list(cliprdr, has_text);
+    
+    pthread_mutex_lock(&clipboard->mutex);
+    if (status != CHANNEL_RC_OK && clipboard->cliprdr == cliprdr)
+        clipboard->lists_sent--;
+    clipboard->ready = status == CHANNEL_RC_OK;
+    clipboard->local_owner = has_text;
+    clipboard->remote_has_text = FALSE;
+    pthread_cond_broadcast(&clipboard->cond);
+    pthread_mutex_unlock(&clipboard->mutex);
+    
+    printf("DEBUG: Clipboard channel ready%s\n", has_text ? ", local text announced" : "");
+    return status;
+}
+
+static UINT clipboard_server_capabilities(CliprdrClientContext* cliprdr, const CLIPRDR_CAPABILITIES* capabilities)
+{
+    // Only text is exchanged, which every server supports
+    WINPR_UNUSED(cliprdr);
+    WINPR_UNUSED(capabilities);
+    return CHANNEL_RC_OK;
+}
+
+static UINT clipboard_server_format_list(CliprdrClientContext* cliprdr, const CLIPRDR_FORMAT_LIST* list)
+{
+    RDPClient* client = (RDPClient*)cliprdr->custom;
+    RDPClipboard* clipboard = client->clipboard;
+    
+    BOOL has_text = FALSE;
+    for (UINT32 i = 0; i < list->numFormats; i++) {
+        if (list->formats[i].formatId == CF_UNICODETEXT)
+            has_text = TRUE;
+    }
+    
+    pthread_mutex_lock(&clipboard->mutex);
+    clipboard->local_owner = FALSE;
+    clipboard->remote_has_text = has_text;
+    pthread_mutex_unlock(&clipboard->mutex);
+    
+    CLIPRDR_FORMAT_LIST_RESPONSE response;
+    memset(&response, 0, sizeof(response));
+    response.common.msgType = CB_FORMAT_LIST_RESPONSE;
+    response.common.msgFlags = CB_RESPONSE_OK;
+    return cliprdr->ClientFormatListResponse(cliprdr, &response);
+}
+
+static UINT clipboard_server_format_list_response(CliprdrClientContext* cliprdr,
+                                                  const CLIPRDR_FORMAT_LIST_RESPONSE* response)
+{
+    RDPClient* client = (RDPClient*)cliprdr->custom;
+    RDPClipboard* clipboard = client->clipboard;
+    
+    pthread_mutex_lock(&clipboard->mutex);
+    clipboard->lists_answered++;
+    clipboard->last_list_ok = (response->common.msgFlags & CB_RESPONSE_OK) != 0;
+    pthread_cond_broadcast(&clipboard->cond);
+    pthread_mutex_unlock(&clipboard->mutex);
+    return CHANNEL_RC_OK;
+}
+
+// Something on the server is pasting the text we announced
+static UINT clipboard_server_format_data_request(CliprdrClientContext* cliprdr,
+                                                 const CLIPRDR_FORMAT_DATA_REQUEST* request)
+{
+    RDPClient* client = (RDPClient*)cliprdr->custom;
+    RDPClipboard* clipboard = client->clipboard;
+    
+    CLIPRDR_FORMAT_DATA_RESPONSE response;
+    memset(&response, 0, sizeof(response));
+    response.common.msgType = CB_FORMAT_DATA_RESPONSE;
+    response.common.msgFlags = CB_RESPONSE_FAIL;
+    
+    BYTE* data = NULL;
+    pthread_mutex_lock(&clipboard->mutex);
+    if (request->requestedFormatId == CF_UNICODETEXT && clipboard->local_utf16) {
+        data = (BYTE*)malloc(clipboard->local_utf16_bytes);
+        if (data) {
+            memcpy(data, clipboard->local_utf16, clipboard->local_utf16_bytes);
+            response.common.msgFlags = CB_RESPONSE_OK;
+            response.common.dataLen = (UINT32)clipboard->local_utf16_bytes;
+            response.requestedFormatData = data;
+        }
+    }
+    pthread_mutex_unlock(&clipboard->mutex);
+    
+    UINT status = cliprdr->ClientFormatDataResponse(cliprdr, &response);
+    free(data);
+    return status;
+}
+
+static UINT clipboard_server_format_data_response(CliprdrClientContext* cliprdr,
+                                                  const CLIPRDR_FORMAT_DATA_RESPONSE* response)
+{
+    RDPClient* client = (RDPClient*)cliprdr->custom;
+    RDPClipboard* clipboard = client->clipboard;
+    
+    pthread_mutex_lock(&clipboard->mutex);
+    if (clipboard->request_pending && !clipboard->response_ready) {
+        size_t length = response->requestedFormatData ? response->common.dataLen : 0;
+        free(clipboard->response_data);
+        clipboard->response_data = length > 0 ? (BYTE*)malloc(length) : NULL;
+        clipboard->response_length = clipboard->response_data ? length : 0;
+        if (clipboard->response_data)
+            memcpy(clipboard->response_data, response->requestedFormatData, length);
+        clipboard->response_ok = (response->common.msgFlags & CB_RESPONSE_OK) != 0 &&
+                                 (length == 0 || clipboard->response_data);
+        clipboard->response_ready = TRUE;
+        pthread_cond_broadcast(&clipboard->cond);
+    }
+    pthread_mutex_unlock(&clipboard->mutex);
+    return CHANNEL_RC_OK;
+}
+
+void rdp_clipboard_connected(RDPClient* client, CliprdrClientContext* cliprdr)
+{
+    RDPClipboard* clipboard = client->clipboard;
+    if (!clipboard)
+        return;
+    
+    cliprdr->custom = client;
+    cliprdr->MonitorReady = clipboard_monitor_ready;
+    cliprdr->ServerCapabilities = clipboard_server_capabilities;
+    cliprdr->ServerFormatList = clipboard_server_format_list;
+    cliprdr->ServerFormatListResponse = clipboard_server_format_list_response;
+    cliprdr->ServerFormatDataRequest = clipboard_server_format_data_request;
+    cliprdr->ServerFormatDataResponse = clipboard_server_format_data_response;
+    
+    // Lists sent on an earlier channel will never be answered
+    pthread_mutex_lock(&clipboard->mutex);
+    clipboard->cliprdr = cliprdr;
+    clipboard->ready = FALSE;
+    clipboard->lists_answered = clipboard->lists_sent;
+    pthread_mutex_unlock(&clipboard->mutex);
+}
+
+void rdp_clipboard_disconnected(RDPClient* client)
+{
+    RDPClipboard* clipboard = client->clipboard;
+    if (!clipboard)
+        return;
+    
+    pthread_mutex_lock(&clipboard->mutex);
+    clipboard->cliprdr = NULL;
+    clipboard->ready = FALSE;
+    clipboard->remote_has_text = FALSE;
+    clipboard->lists_answered = clipboard->lists_sent;
+    pthread_cond_broadcast(&clipboard->cond);
+    pthread_mutex_unlock(&clipboard->mutex);
+}
+
+ClipboardResult rdp_clipboard_set_text(RDPClient* client, const char* text, size_t length, UINT32 timeout_ms)
+{
+    RDPClipboard* clipboard = client->clipboard;
+    if (!clipboard)
+        return CLIPBOARD_UNAVAILABLE;
+    
+    // UTF-16 conversion stops at an embedded NUL, as a paste would
+    length = strnlen(text, length);
+    char* copy = (char*)malloc(length + 1);
+    if (!copy)
+        return CLIPBOARD_FAILED;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    
+    size_t units = 0;
+    WCHAR* utf16 = length > 0 ? ConvertUtf8NToWCharAlloc(copy, length, &units) : (WCHAR*)calloc(1, sizeof(WCHAR));
+    if (!utf16) {
+        free(copy);
+        return CLIPBOARD_INVALID;
+    }
+    
+    // Channel writes share the input lock with other HTTP-side senders; holding
+    // it from the channel check to the send keeps this list's sequence number
+    // the latest, so a failed send can take it back
+    pthread_mutex_lock(&client->input_mutex);
+    pthread_mutex_lock(&clipboard->mutex);
+    CliprdrClientContext* cliprdr = clipboard->ready ? clipboard->cliprdr : NULL;
+    if (!cliprdr) {
+        pthread_mutex_unlock(&clipboard->mutex);
+        pthread_mutex_unlock(&client->input_mutex);
+        free(copy);
+        free(utf16);
+        return CLIPBOARD_UNAVAILABLE;
+    }
+    free(clipboard->local_text);
+    free(clipboard->local_utf16);
+    clipboard->local_text = copy;
+    clipboard->local_length = length;
+    clipboard->local_utf16 = utf16;
+    clipboard->local_utf16_bytes = (units + 1) * sizeof(WCHAR);
+    clipboard->local_owner = TRUE;
+    clipboard->remote_has_text = FALSE;
+    UINT64 sequence = ++clipboard->lists_sent;
+    pthread_mutex_unlock(&clipboard->mutex);
+    
+    UINT status = clipboard_send_format_list(cliprdr, TRUE);
+    if (status != CHANNEL_RC_OK) {
+        // The server never saw the list, so there is no answer to wait for
+        pthread_mutex_lock(&clipboard->mutex);
+        if (clipboard->cliprdr == cliprdr && clipboard->lists_sent == sequence) {
+            clipboard->lists_sent--;
+            clipboard->local_owner = FALSE;
+        }
+        pthread_mutex_unlock(&clipboard->mutex);
+        pthread_mutex_unlock(&client->input_mutex);
+        return CLIPBOARD_FAILED;
+    }
+    pthread_mutex_unlock(&client->input_mutex);
+    
+    // Once the server has answered, a paste on the remote side sees the new text
+    struct timespec deadline;
+    deadline_after(&deadline, timeout_ms);
+    pthread_mutex_lock(&clipboard->mutex);
+    int rc = 0;
+    while (clipboard->lists_answered < sequence && clipboard->cliprdr == cliprdr && rc == 0)
+        rc = pthread_cond_timedwait(&clipboard->cond, &clipboard->mutex, &deadline);
+    
+    ClipboardResult result;
+    if (clipboard->cliprdr != cliprdr)
+        result = CLIPBOARD_UNAVAILABLE;
+    else if (clipboard->lists_answered < sequence)
+        result = CLIPBOARD_TIMEOUT;
+    else
+        result = clipboard->last_list_ok ? CLIPBOARD_OK : CLIPBOARD_FAILED;
+    pthread_mutex_unlock(&clipboard->mutex);
+    
+    if (result == CLIPBOARD_OK)
+        printf("DEBUG: Clipboard set to %zu bytes of text\n", length);
+    return result;
+}
+
+// Converts a CF_UNICODETEXT payload, which may be unaligned and need not be
+// NUL-terminated, to UTF-8
+static char* clipboard_utf16_to_utf8(const BYTE* data, size_t bytes, size_t* length)
+{
+    size_t units = bytes / sizeof(WCHAR);
+    WCHAR* aligned = (WCHAR*)malloc((units + 1) * sizeof(WCHAR));
+    if (!aligned)
+        return NULL;
+    if (units > 0)
+        memcpy(aligned, data, units * sizeof(WCHAR));
+    aligned[units] = 0;
+    
+    char* text = NULL;
+    units = _wcsnlen(aligned, units);
+    if (units == 0) {
+        text = (char*)calloc(1, 1);
+        *length = 0;
+    } else {
+        text = ConvertWCharNToUtf8Alloc(aligned, units, length);
+    }
+    free(aligned);
+    return text;
+}
+
+ClipboardResult rdp_clipboard_get_text(RDPClient* client, UINT32 timeout_ms, char** text, size_t* length)
+{
+    RDPClipboard* clipboard = client->clipboard;
+    if (!clipboard)
+        return CLIPBOARD_UNAVAILABLE;
+    
+    struct timespec deadline;
+    deadline_after(&deadline, timeout_ms);
+    pthread_mutex_lock(&clipboard->mutex);
+    
+    // While our announcement is the latest, the remote clipboard is our own text
+    if (clipboard->ready && clipboard->local_owner) {
+        *text = (char*)malloc(clipboard->local_length + 1);
+        if (*text) {
+            memcpy(*text, clipboard->local_text, clipboard->local_length + 1);
+            *length = clipboard->local_length;
+        }
+        pthread_mutex_unlock(&clipboard->mutex);
+        return *text ? CLIPBOARD_OK : CLIPBOARD_FAILED;
+    }
+    
+    int rc = 0;
+    while (clipboard->ready && clipboard->request_pending && rc == 0)
+        rc = pthread_cond_timedwait(&clipboard->cond, &clipboard->mutex, &deadline);
+    
+    CliprdrClientContext* cliprdr = clipboard->ready ? clipboard->cliprdr : NULL;
+    ClipboardResult result = CLIPBOARD_OK;
+    if (!cliprdr)
+        result = CLIPBOARD_UNAVAILABLE;
+    else if (clipboard->request_pending)
+        result = CLIPBOARD_TIMEOUT;
+    else if (!clipboard->remote_has_text)
+        result = CLIPBOARD_EMPTY;
+    if (result != CLIPBOARD_OK) {
+        pthread_mutex_unlock(&clipboard->mutex);
+        return result;
+    }
+    clipboard->request_pending = TRUE;
+    clipboard->response_ready = FALSE;
+    pthread_mutex_unlock(&clipboard->mutex);
+    
+    CLIPRDR_FORMAT_DATA_REQUEST request;
+    memset(&request, 0, sizeof(request));
+    request.common.msgType = CB_FORMAT_DATA_REQUEST;
+    request.requestedFormatId = CF_UNICODETEXT;
+    
+    pthread_mutex_lock(&client->input_mutex);
+    UINT status = cliprdr->ClientFormatDataRequest(cliprdr, &request);
+    pthread_mutex_unlock(&client->input_mutex);
+    
+    // The response arrives on the event thread
+    pthread_mutex_lock(&clipboard->mutex);
+    rc = 0;
+    while (status == CHANNEL_RC_OK && !clipboard->response_ready && clipboard->cliprdr == cliprdr && rc == 0)
+        rc = pthread_cond_timedwait(&clipboard->cond, &clipboard->mutex, &deadline);
+    
+    if (status != CHANNEL_RC_OK)
+        result = CLIPBOARD_FAILED;
+    else if (clipboard->response_ready)
+        result = clipboard->response_ok ? CLIPBOARD_OK : CLIPBOARD_EMPTY;
+    else
+        result = clipboard->cliprdr == cliprdr ? CLIPBOARD_TIMEOUT : CLIPBOARD_UNAVAILABLE;
+    
+    if (result == CLIPBOARD_OK) {
+        *text = clipboard_utf16_to_utf8(clipboard->response_data, clipboard->response_length, length);
+        if (!*text)
+            result = CLIPBOARD_FAILED;
+    }
+    free(clipboard->response_data);
+    clipboard->response_data = NULL;
+    clipboard->response_length = 0;
+    clipboard->request_pending = FALSE;
+    clipboard->response_ready = FALSE;
+    pthread_cond_broadcast(&clipboard->cond);
+    pthread_mutex_unlock(&clipboard->mutex);
+    return result;
+}
@@ -1,4 +1,9 @@
 #include "rcrdp.h"
+#include "pixel_ops.h"
+#include "metrics.h"
+#include "frame_source.h"
+#include "recorder.h"
+#include "cursor.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,74 +12,29 @@
 #include <unistd.h>
 #include <freerdp3/freerdp/input.h>
 #include <freerdp3/freerdp/gdi/gdi.h>
-#include <png.h>
 
 
 static BOOL write_png_file(const char* filename, BYTE* buffer, UINT32 width, UINT32 height, UINT32 stride)
 {
+    BYTE* png = NULL;
+    size_t png_length = 0;
+    if (!encode_png_memory(buffer, width, height, stride, &png, &png_length, NULL))
+        return FALSE;
+    
     FILE* fp = fopen(filename, "wb");
     if (!fp)
     {
         fprintf(stderr, "Failed to open file %s for writing\n", filename);
+        free(png);
         return FALSE;
     }
     
-    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (!png_ptr)
-    {
-        fclose(fp);
-        return FALSE;
-    }
-    
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    if (!info_ptr)
-    {
-        png_destroy_write_struct(&png_ptr, NULL);
-        fclose(fp);
-        return FALSE;
-    }
-    
-    if (setjmp(png_jmpbuf(png_ptr)))
-    {
-        png_destroy_write_struct(&png_ptr, &info_ptr);
-        fclose(fp);
-        return FALSE;
-    }
-    
-    png_init_io(png_ptr, fp);
-    
-    png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB,
-                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-    
-    png_write_info(png_ptr, info_ptr);
-    
-    png_bytep* row_pointers = (png_bytep*)malloc(sizeof(png_bytep) * height);
-    for (UINT32 y = 0; y < height; y++)
-    {
-        row_pointers[y] = (png_byte*)malloc(width * 3);
-        BYTE* src_line = buffer + y * stride;
-        
-        for (UINT32 x = 0; x < width; x++)
-        {
-            UINT32 pixel = ((UINT32*)src_line)[x];
-            // For PIXEL_FORMAT_RGBX32, the format is typically BGRX in memory
-            row_pointers[y][x * 3 + 0] = (pixel >> 16) & 0xFF; // R
-            row_pointers[y][x * 3 + 1] = (pixel >> 8) & 0xFF;  // G  
-            row_pointers[y][x * 3 + 2] = pixel & 0xFF;         // B
-        }
-    }
-    
-    png_write_image(png_ptr, row_pointers);
-    png_write_end(png_ptr, NULL);
-    
-    for (UINT32 y = 0; y < height; y++)
-        free(row_pointers[y]);
-    free(row_pointers);
-    
-    png_destroy_write_struct(&png_ptr, &info_ptr);
-    fclose(fp);
+    BOOL success = fwrite(png, 1, png_length, fp) == png_length;
+    if (fclose(fp) != 0)
+        success = FALSE;
+    free(png);
     
-    return TRUE;
+    return success;
 }
 
 BOOL request_screenshot(RDPClient* client, const char* output_file)
@@ -87,7 +47,7 @@ BOOL request_screenshot(RDPClient* client, const char* output_file)
     UINT32 width, height, stride;
     
     // Get the latest frame from the buffer updated by EndPaint callback
-    if (!get_latest_frame(client, &buffer, &width, &height, &stride)) {
+    if (!get_latest_frame(client, &buffer, &width, &height, &stride, NULL)) {
         printf("No frame data available yet - connection may be initializing\n");
         return FALSE;
     }
@@ -127,10 +87,48 @@ BOOL request_screenshot(RDPClient* client, const char* output_file)
     return success;
 }
 
-ScreenshotResult execute_screenshot(RDPClient* client, const char* output_file)
+ScreenshotResult wait_for_nonblank_frame(RDPClient* client, UINT32 timeout_ms, int* retries)
 {
-    // This function is now a wrapper around request_screenshot for compatibility
-    return request_screenshot(client, output_file) ? SCREENSHOT_SUCCESS : SCREENSHOT_ERROR;
+    if (!client)
+        return SCREENSHOT_ERROR;
+    
+    // Blank frames only precede the first real paint; later black frames are content
+    if (client->nonblank_frame_seen)
+        return SCREENSHOT_SUCCESS;
+    
+    UINT64 deadline_ms = get_time_ms() + timeout_ms;
+    int waited = 0;
+    if (retries)
+        *retries = 0;
+    
+    for (;;) {
+        FrameView view;
+        if (!acquire_frame_view(client, &view))
+            return SCREENSHOT_ERROR;
+        
+        FrameRect full = { 0, 0, view.width, view.height };
+        UINT32 color = 0;
+        BOOL blank = pixel_rect_is_uniform(view.data, view.stride, &full, &color) && color == 0;
+        UINT64 generation = view.generation;
+        release_frame_view(client, &view);
+        
+        if (!blank) {
+            client->nonblank_frame_seen = TRUE;
+            return SCREENSHOT_SUCCESS;
+        }
+        
+        // Sleep until the server paints again instead of polling
+        UINT64 now_ms = get_time_ms();
+        if (waited >= MAX_SCREENSHOT_RETRIES || now_ms >= deadline_ms)
+            return SCREENSHOT_BLACK;
+        
+        if (!wait_for_frame_generation(client, generation, (UINT32)(deadline_ms - now_ms), NULL))
+            return SCREENSHOT_BLACK;
+        
+        waited++;
+        if (retries)
+            *retries = waited;
+    }
 }
 
 BOOL execute_sendkey(RDPClient* client, DWORD flags, DWORD code)
@@ -141,12 +139,18 @@ BOOL execute_sendkey(RDPClient* client, DWORD flags, DWORD code)
     rdpInput* input = client->context->context.input;
     if (!input)
         return FALSE;
-        
-    if (!freerdp_input_send_keyboard_event(input, flags, code))
+    
+    pthread_mutex_lock(&client->input_mutex);
+    BOOL sent = client->source->ops->send_keyboard(client->source, client, flags, code);
+    pthread_mutex_unlock(&client->input_mutex);
+    
+    if (!sent)
     {
         fprintf(stderr, "Failed to send keyboard event\n");
         return FALSE;
     }
+    metrics_count(METRIC_INPUT_KEY, 1);
+    recorder_note_input(client->recorder, RECORD_INPUT_KEY, flags, code, 0);
     
     printf("Sent key event: flags=0x%08X, code=0x%08X\n", flags, code);
     return TRUE;
@@ -166,9 +170,12 @@ BOOL execute_sendmouse(RDPClient* client, DWORD flags, UINT16 x, UINT16 y)
     }
     
     // Debug coordinate bounds check
-    printf("DEBUG: Desktop resolution: 1024x768, mouse coordinates: %u,%u\n", x, y);
-    if (x >= 1024 || y >= 768) {
-        printf("WARNING: Mouse coordinates (%u,%u) are outside desktop bounds (1024x768)\n", x, y);
+    UINT32 desktop_width = 0, desktop_height = 0;
+    get_desktop_size(client, &desktop_width, &desktop_height);
+    printf("DEBUG: Desktop resolution: %ux%u, mouse coordinates: %u,%u\n", desktop_width, desktop_height, x, y);
+    if (x >= desktop_width || y >= desktop_height) {
+        printf("WARNING: Mouse coordinates (%u,%u) are outside desktop bounds (%ux%u)\n",
+               x, y, desktop_width, desktop_height);
     }
     
     // Decode mouse button flags for debugging
@@ -189,11 +196,21 @@ BOOL execute_sendmouse(RDPClient* client, DWORD flags, UINT16 x, UINT16 y)
     
     printf("DEBUG: Sending mouse event - %s at coordinates (%u,%u)\n", button_desc, x, y);
         
-    if (!freerdp_input_send_mouse_event(input, flags, x, y))
+    pthread_mutex_lock(&client->input_mutex);
+    BOOL sent = client->source->ops->send_mouse(client->source, client, flags, x, y);
+    pthread_mutex_unlock(&client->input_mutex);
+    
+    if (!sent)
     {
         fprintf(stderr, "ERROR: FreeRDP failed to send mouse event\n");
         return FALSE;
     }
+    metrics_count(METRIC_INPUT_MOUSE, 1);
+    recorder_note_input(client->recorder, RECORD_INPUT_MOUSE, flags, x, y);
+    
+    // Wheel events carry no position
+    if (!(flags & (PTR_FLAGS_WHEEL | PTR_FLAGS_HWHEEL)))
+        rdp_cursor_note_position(client->cursor, x, y);
     
     printf("SUCCESS: Mouse event sent to RDP session\n");
     
@@ -215,16 +232,26 @@ BOOL execute_movemouse(RDPClient* client, UINT16 x, UINT16 y)
     }
     
     // Debug coordinate bounds check
-    printf("DEBUG: Desktop resolution: 1024x768, moving mouse to: %u,%u\n", x, y);
-    if (x >= 1024 || y >= 768) {
-        printf("WARNING: Mouse coordinates (%u,%u) are outside desktop bounds (1024x768)\n", x, y);
+    UINT32 desktop_width = 0, desktop_height = 0;
+    get_desktop_size(client, &desktop_width, &desktop_height);
+    printf("DEBUG: Desktop resolution: %ux%u, moving mouse to: %u,%u\n", desktop_width, desktop_height, x, y);
+    if (x >= desktop_width || y >= desktop_height) {
+        printf("WARNING: Mouse coordinates (%u,%u) are outside desktop bounds (%ux%u)\n",
+               x, y, desktop_width, desktop_height);
     }
         
-    if (!freerdp_input_send_mouse_event(input, PTR_FLAGS_MOVE, x, y))
+    pthread_mutex_lock(&client->input_mutex);
+    BOOL sent = client->source->ops->send_mouse(client->source, client, PTR_FLAGS_MOVE, x, y);
+    pthread_mutex_unlock(&client->input_mutex);
+    
+    if (!sent)
     {
         fprintf(stderr, "ERROR: FreeRDP failed to move mouse\n");
         return FALSE;
     }
+    metrics_count(METRIC_INPUT_MOVE, 1);
+    recorder_note_input(client->recorder, RECORD_INPUT_MOUSE, PTR_FLAGS_MOVE, x, y);
+    rdp_cursor_note_position(client->cursor, x, y);
     
     printf("SUCCESS: Mouse moved to coordinates (%u,%u)\n", x, y);
     
@@ -0,0 +1,357 @@
+#include "cursor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freerdp3/freerdp/codec/color.h>
+#include <freerdp3/freerdp/pointer.h>
+
+typedef struct {
+    BOOL present;
+    BYTE* pixels;               // ARGB with a stride of width * 4; NULL for a 0x0 pointer
+    UINT32 width;
+    UINT32 height;
+    UINT32 hotspot_x;
+    UINT32 hotspot_y;
+    UINT64 hash;
+} CursorShape;
+
+struct _RDPCursor {
+    pthread_mutex_t mutex;
+    CursorShape cache[CURSOR_CACHE_SIZE];
+    CursorShape arrow;
+    const CursorShape* current;     // a cache entry or the arrow; NULL while hidden
+    UINT32 x;
+    UINT32 y;
+    UINT64 shape_changes;
+};
+
+// Stand-in for the client-side default pointer: X is black, . is white
+static const char* const default_arrow[] = {
+    "X           ",
+    "XX          ",
+    "X.X         ",
+    "X..X        ",
+    "X...X       ",
+    "X....X      ",
+    "X.....X     ",
+    "X......X    ",
+    "X.......X   ",
+    "X........X  ",
+    "X.........X ",
+    "X......XXXXX",
+    "X...X..X    ",
+    "X..XX..X    ",
+    "X.X  X..X   ",
+    "XX   X..X   ",
+    "X     X..X  ",
+    "      X..X  ",
+    "       XX   ",
+};
+
+// FNV-1a over the hotspot, size and pixels
+static UINT64 cursor_hash(const CursorShape* shape)
+{
+    UINT32 header[4] = { shape->width, shape->height, shape->hotspot_x, shape->hotspot_y };
+    UINT64 hash = 0xcbf29ce484222325ULL;
+    const BYTE* bytes = (const BYTE*)header;
+    for (size_t i = 0; i < sizeof(header); i++)
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    
+    size_t length = shape->pixels ? (size_t)shape->width * shape->height * 4 : 0;
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ shape->pixels[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+static BOOL cursor_build_arrow(CursorShape* shape)
+{
+    UINT32 height = sizeof(default_arrow) / sizeof(default_arrow[0]);
+    UINT32 width = (UINT32)strlen(default_arrow[0]);
+    UINT32* pixels = (UINT32*)calloc((size_t)width * height, sizeof(UINT32));
+    if (!pixels)
+        return FALSE;
+    
+    for (UINT32 y = 0; y < height; y++) {
+        for (UINT32 x = 0; x < width; x++) {
+            if (default_arrow[y][x] == 'X')
+                pixels[y * width + x] = 0xff000000;
+            else if (default_arrow[y][x] == '.')
+                pixels[y * width + x] = 0xffffffff;
+        }
+    }
+    
+    shape->present = TRUE;
+    shape->pixels = (BYTE*)pixels;
+    shape->width = width;
+    shape->height = height;
+    shape->hotspot_x = 0;
+    shape->hotspot_y = 0;
+    shape->hash = cursor_hash(shape);
+    return TRUE;
+}
+
+RDPCursor* rdp_cursor_new(void)
+{
+    RDPCursor* cursor = (RDPCursor*)calloc(1, sizeof(RDPCursor));
+    if (!cursor)
+        return NULL;
+    
+    if (!cursor_build_arrow(&cursor->arrow)) {
+        free(cursor);
+        return NULL;
+    }
+    if (pthread_mutex_init(&cursor->mutex, NULL) != 0) {
+        free(cursor->arrow.pixels);
+        free(cursor);
+        return NULL;
+    }
+    
+    // Clients show their default pointer until the server sends one
+    cursor->current = &cursor->arrow;
+    return cursor;
+}
+
+void rdp_cursor_free(RDPCursor* cursor)
+{
+    if (!cursor)
+        return;
+    
+    for (int i = 0; i < CURSOR_CACHE_SIZE; i++)
+        free(cursor->cache[i].pixels);
+    free(cursor->arrow.pixels);
+    pthread_mutex_destroy(&cursor->mutex);
+    free(cursor);
+}
+
+// Decodes a pointer into cache slot index and makes it current
+static BOOL cursor_set_shape(rdpContext* context, UINT32 index, UINT32 xor_bpp, UINT32 width, UINT32 height,
+                             UINT32 hotspot_x, UINT32 hotspot_y, const BYTE* xor_mask, UINT32 xor_length,
+                             const BYTE* and_mask, UINT32 and_length)
+{
+    RDPClient* client = ((RDPContext*)context)->client;
+    RDPCursor* cursor = client ? client->cursor : NULL;
+    if (!cursor)
+        return TRUE;
+    if (index >= CURSOR_CACHE_SIZE || width > CURSOR_MAX_SIZE || height > CURSOR_MAX_SIZE) {
+        fprintf(stderr, "Ignoring pointer %u of %ux%u\n", index, width, height);
+        return TRUE;
+    }
+    
+    // A 0x0 pointer is valid and draws nothing
+    CursorShape shape = { TRUE, NULL, width, height, hotspot_x, hotspot_y, 0 };
+    if (width > 0 && height > 0) {
+        shape.pixels = (BYTE*)malloc((size_t)width * height * 4);
+        if (!shape.pixels)
+            return FALSE;
+        const gdiPalette* palette = context->gdi ? &context->gdi->palette : NULL;
+        if (!freerdp_image_copy_from_pointer_data(shape.pixels, PIXEL_FORMAT_BGRA32, width * 4, 0, 0, width, height,
+                                                  xor_mask, xor_length, and_mask, and_length, xor_bpp, palette)) {
+            free(shape.pixels);
+            fprintf(stderr, "Failed to decode pointer %u (%u bpp)\n", index, xor_bpp);
+            return TRUE;
+        }
+    }
+    shape.hash = cursor_hash(&shape);
+    
+    pthread_mutex_lock(&cursor->mutex);
+    BYTE* replaced = cursor->cache[index].pixels;
+    cursor->cache[index] = shape;
+    cursor->current = &cursor->cache[index];
+    cursor->shape_changes++;
+    pthread_mutex_unlock(&cursor->mutex);
+    
+    free(replaced);
+    return TRUE;
+}
+
+static BOOL cursor_pointer_position(rdpContext* context, const POINTER_POSITION_UPDATE* position)
+{
+    RDPClient* client = ((RDPContext*)context)->client;
+    if (client)
+        rdp_cursor_note_position(client->cursor, position->xPos, position->yPos);
+    return TRUE;
+}
+
+static BOOL cursor_pointer_system(rdpContext* context, const POINTER_SYSTEM_UPDATE* system)
+{
+    RDPClient* client = ((RDPContext*)context)->client;
+    RDPCursor* cursor = client ? client->cursor : NULL;
+    if (!cursor)
+        return TRUE;
+    
+    pthread_mutex_lock(&cursor->mutex);
+    cursor->current = system->type == SYSPTR_NULL ? NULL : &cursor->arrow;
+    cursor->shape_changes++;
+    pthread_mutex_unlock(&cursor->mutex);
+    return TRUE;
+}
+
+static BOOL cursor_pointer_color(rdpContext* context, const POINTER_COLOR_UPDATE* color)
+{
+    return cursor_set_shape(context, color->cacheIndex, 24, color->width, color->height, color->hotSpotX,
+                            color->hotSpotY, color->xorMaskData, color->lengthXorMask, color->andMaskData,
+                            color->lengthAndMask);
+}
+
+static BOOL cursor_pointer_new(rdpContext* context, const POINTER_NEW_UPDATE* pointer)
+{
+    const POINTER_COLOR_UPDATE* color = &pointer->colorPtrAttr;
+    return cursor_set_shape(context, color->cacheIndex, pointer->xorBpp, color->width, color->height,
+                            color->hotSpotX, color->hotSpotY, color->xorMaskData, color->lengthXorMask,
+                            color->andMaskData, color->lengthAndMask);
+}
+
+static BOOL cursor_pointer_large(rdpContext* context, const POINTER_LARGE_UPDATE* pointer)
+{
+    return cursor_set_shape(context, pointer->cacheIndex, pointer->xorBpp, pointer->width, pointer->height,
+                            pointer->hotSpotX, pointer->hotSpotY, pointer->xorMaskData, pointer->lengthXorMask,
+                            pointer->andMaskData, pointer->lengthAndMask);
+}
+
+static BOOL cursor_pointer_cached(rdpContext* context, const POINTER_CACHED_UPDATE* cached)
+{
+    RDPClient* client = ((RDPContext*)context)->client;
+    RDPCursor* cursor = client ? client->cursor : NULL;
+    if (!cursor)
+        return TRUE;
+    
+    pthread_mutex_lock(&cursor->mutex);
+    if (cached->cacheIndex < CURSOR_CACHE_SIZE && cursor->cache[cached->cacheIndex].present) {
+        cursor->current = &cursor->cache[cached->cacheIndex];
+        cursor->shape_changes++;
+    }
+    pthread_mutex_unlock(&cursor->mutex);
+    return TRUE;
+}
+
+void rdp_cursor_register(RDPClient* client, rdpUpdate* update)
+{
+    RDPCursor* cursor = client->cursor;
+    if (!cursor || !update || !update->pointer)
+        return;
+    
+    pthread_mutex_lock(&cursor->mutex);
+    for (int i = 0; i < CURSOR_CACHE_SIZE; i++) {
+        free(cursor->cache[i].pixels);
+        memset(&cursor->cache[i], 0, sizeof(cursor->cache[i]));
+    }
+    cursor->current = &cursor->arrow;
+    pthread_mutex_unlock(&cursor->mutex);
+    
+    rdpPointerUpdate* pointer = update->pointer;
+    pointer->PointerPosition = cursor_pointer_position;
+    pointer->PointerSystem = cursor_pointer_system;
+    pointer->PointerColor = cursor_pointer_color;
+    pointer->PointerNew = cursor_pointer_new;
+    pointer->PointerLarge = cursor_pointer_large;
+    pointer->PointerCached = cursor_pointer_cached;
+}
+
+void rdp_cursor_note_position(RDPCursor* cursor, UINT32 x, UINT32 y)
+{
+    if (!cursor)
+        return;
+    
+    pthread_mutex_lock(&cursor->mutex);
+    cursor->x = x;
+    cursor->y = y;
+    pthread_mutex_unlock(&cursor->mutex);
+}
+
+// Called with mutex held
+static void cursor_info_locked(RDPCursor* cursor, CursorInfo* info)
+{
+    const CursorShape* shape = cursor->current;
+    memset(info, 0, sizeof(*info));
+    info->visible = shape != NULL;
+    info->default_shape = shape == &cursor->arrow;
+    info->x = cursor->x;
+    info->y = cursor->y;
+    info->shape_changes = cursor->shape_changes;
+    if (shape) {
+        info->hotspot_x = shape->hotspot_x;
+        info->hotspot_y = shape->hotspot_y;
+        info->width = shape->width;
+        info->height = shape->height;
+        info->shape_hash = shape->hash;
+    }
+}
+
+BOOL rdp_cursor_get_info(RDPCursor* cursor, CursorInfo* info)
+{
+    if (!cursor || !info)
+        return FALSE;
+    
+    pthread_mutex_lock(&cursor->mutex);
+    cursor_info_locked(cursor, info);
+    pthread_mutex_unlock(&cursor->mutex);
+    return TRUE;
+}
+
+// The cursor's rectangle clipped to area, in desktop coordinates; FALSE when empty
+static BOOL cursor_clip(const CursorInfo* info, const FrameRect* area, INT64* left, INT64* top, INT64* right,
+                        INT64* bottom)
+{
+    if (!info->visible || info->width == 0 || info->height == 0)
+        return FALSE;
+    
+    INT64 x = (INT64)info->x - info->hotspot_x;
+    INT64 y = (INT64)info->y - info->hotspot_y;
+    *left = x > area->x ? x : area->x;
+    *top = y > area->y ? y : area->y;
+    *right = x + info->width < (INT64)area->x + area->width ? x + info->width : (INT64)area->x + area->width;
+    *bottom = y + info->height < (INT64)area->y + area->height ? y + info->height : (INT64)area->y + area->height;
+    return *left < *right && *top < *bottom;
+}
+
+UINT64 cursor_info_key(const CursorInfo* info, const FrameRect* area)
+{
+    INT64 left, top, right, bottom;
+    if (!info || !area || !cursor_clip(info, area, &left, &top, &right, &bottom))
+        return 0;
+    
+    UINT64 key = info->shape_hash;
+    key = (key ^ info->x) * 0x100000001b3ULL;
+    key = (key ^ info->y) * 0x100000001b3ULL;
+    return key ? key : 1;
+}
+
+UINT64 rdp_cursor_draw(RDPCursor* cursor, BYTE* pixels, UINT32 stride, const FrameRect* area)
+{
+    if (!cursor || !pixels || !area)
+        return 0;
+    
+    pthread_mutex_lock(&cursor->mutex);
+    CursorInfo info;
+    cursor_info_locked(cursor, &info);
+    INT64 left, top, right, bottom;
+    if (!cursor_clip(&info, area, &left, &top, &right, &bottom)) {
+        pthread_mutex_unlock(&cursor->mutex);
+        return 0;
+    }
+    
+    // Straight alpha over 0x00RRGGBB
+    const CursorShape* shape = cursor->current;
+    INT64 origin_x = (INT64)info.x - info.hotspot_x;
+    INT64 origin_y = (INT64)info.y - info.hotspot_y;
+    for (INT64 y = top; y < bottom; y++) {
+        const UINT32* src = (const UINT32*)(shape->pixels + (size_t)(y - origin_y) * shape->width * 4);
+        UINT32* dst = (UINT32*)(pixels + (size_t)(y - area->y) * stride);
+        for (INT64 x = left; x < right; x++) {
+            UINT32 color = src[x - origin_x];
+            UINT32 alpha = color >> 24;
+            UINT32* out = &dst[x - area->x];
+            if (alpha == 0xff) {
+                *out = color & 0x00ffffff;
+            } else if (alpha > 0) {
+                UINT32 r = (((color >> 16) & 0xff) * alpha + ((*out >> 16) & 0xff) * (255 - alpha) + 127) / 255;
+                UINT32 g = (((color >> 8) & 0xff) * alpha + ((*out >> 8) & 0xff) * (255 - alpha) + 127) / 255;
+                UINT32 b = ((color & 0xff) * alpha + (*out & 0xff) * (255 - alpha) + 127) / 255;
+                *out = r << 16 | g << 8 | b;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cursor->mutex);
+    
+    return cursor_info_key(&info, area);
+}
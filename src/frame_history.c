@@ -0,0 +1,438 @@
+#include "frame_history.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Tiles of one generation: tile_count (x, y, width, height) quads followed
+// by their pixels, tile by tile, in one allocation
+typedef struct {
+    UINT64 generation;
+    UINT64 paint_ms;
+    UINT32 tile_count;
+    BYTE* data;
+    size_t bytes;
+} HistoryDelta;
+
+struct _FrameHistory {
+    RDPClient* client;
+    size_t budget_bytes;
+    
+    // Oldest reconstructable frame and the deltas after it; guarded by mutex
+    BYTE* base;
+    UINT64 base_generation;
+    UINT64 base_paint_ms;
+    BOOL has_base;
+    HistoryDelta* deltas;       // ring of delta_count entries from delta_first
+    size_t delta_first;
+    size_t delta_count;
+    size_t delta_capacity;
+    size_t bytes;
+    
+    // Frame geometry; changed only by the history thread, with mutex held
+    UINT32 width;
+    UINT32 height;
+    UINT32 stride;
+    
+    // History thread state
+    BYTE* shadow;               // newest frame in the history
+    BYTE* staging;              // damaged rows copied out under frame_mutex
+    size_t staging_capacity;
+    UINT16* scratch;            // changed tiles of the capture in progress
+    UINT64 last_generation;
+    
+    BOOL stopping;
+    pthread_mutex_t mutex;
+    pthread_t thread;
+    BOOL running;
+};
+
+static HistoryDelta* history_delta(FrameHistory* history, size_t i)
+{
+    return &history->deltas[(history->delta_first + i) % history->delta_capacity];
+}
+
+static void history_apply(BYTE* frame, UINT32 stride, const HistoryDelta* delta)
+{
+    const UINT16* tiles = (const UINT16*)delta->data;
+    const BYTE* pixels = delta->data + (size_t)delta->tile_count * 4 * sizeof(UINT16);
+    for (UINT32 i = 0; i < delta->tile_count; i++) {
+        const UINT16* tile = tiles + (size_t)i * 4;
+        size_t row_bytes = (size_t)tile[2] * 4;
+        BYTE* dst = frame + (size_t)tile[1] * stride + (size_t)tile[0] * 4;
+        for (UINT32 y = 0; y < tile[3]; y++) {
+            memcpy(dst, pixels, row_bytes);
+            dst += stride;
+            pixels += row_bytes;
+        }
+    }
+}
+
+// Drops every delta; mutex held
+static void history_clear(FrameHistory* history)
+{
+    for (size_t i = 0; i < history->delta_count; i++)
+        free(history_delta(history, i)->data);
+    history->delta_first = 0;
+    history->delta_count = 0;
+    history->has_base = FALSE;
+    history->bytes = 0;
+}
+
+// Folds the oldest deltas into the base frame until the budget holds; mutex held
+static void history_trim(FrameHistory* history)
+{
+    while (history->bytes > history->budget_bytes && history->delta_count > 0) {
+        HistoryDelta* oldest = history_delta(history, 0);
+        history_apply(history->base, history->stride, oldest);
+        history->base_generation = oldest->generation;
+        history->base_paint_ms = oldest->paint_ms;
+        history->bytes -= oldest->bytes;
+        free(oldest->data);
+        history->delta_first = (history->delta_first + 1) % history->delta_capacity;
+        history->delta_count--;
+    }
+}
+
+static BOOL history_push(FrameHistory* history, const HistoryDelta* delta)
+{
+    if (history->delta_count == history->delta_capacity) {
+        size_t capacity = history->delta_capacity ? history->delta_capacity * 2 : 256;
+        HistoryDelta* grown = (HistoryDelta*)malloc(capacity * sizeof(HistoryDelta));
+        if (!grown)
+            return FALSE;
+        for (size_t i = 0; i < history->delta_count; i++)
+            grown[i] = *history_delta(history, i);
+        free(history->deltas);
+        history->deltas = grown;
+        history->delta_first = 0;
+        history->delta_capacity = capacity;
+    }
+    
+    *history_delta(history, history->delta_count) = *delta;
+    history->delta_count++;
+    history->bytes += delta->bytes;
+    history_trim(history);
+    return TRUE;
+}
+
+static BOOL history_resize(FrameHistory* history, UINT32 width, UINT32 height)
+{
+    UINT32 columns = (width + HISTORY_TILE_SIZE - 1) / HISTORY_TILE_SIZE;
+    UINT32 rows = (height + HISTORY_TILE_SIZE - 1) / HISTORY_TILE_SIZE;
+    size_t frame_bytes = (size_t)width * height * 4;
+    
+    BYTE* base = (BYTE*)malloc(frame_bytes);
+    BYTE* shadow = (BYTE*)malloc(frame_bytes);
+    UINT16* scratch = (UINT16*)malloc((size_t)columns * rows * 4 * sizeof(UINT16));
+    if (!base || !shadow || !scratch) {
+        free(base);
+        free(shadow);
+        free(scratch);
+        return FALSE;
+    }
+    
+    pthread_mutex_lock(&history->mutex);
+    history_clear(history);
+    free(history->base);
+    history->base = base;
+    history->width = width;
+    history->height = height;
+    history->stride = width * 4;
+    pthread_mutex_unlock(&history->mutex);
+    
+    free(history->shadow);
+    free(history->scratch);
+    history->shadow = shadow;
+    history->scratch = scratch;
+    return TRUE;
+}
+
+// Takes the first frame after a (re)start as the base
+static void history_capture_base(FrameHistory* history)
+{
+    FrameView view;
+    if (!acquire_frame_view(history->client, &view))
+        return;
+    if (view.width != history->width || view.height != history->height) {
+        release_frame_view(history->client, &view);
+        return;
+    }
+    
+    UINT64 paint_ms;
+    FrameRect damage;
+    get_frame_view_damage(history->client, &view, view.generation, &damage, &paint_ms);
+    for (UINT32 y = 0; y < view.height; y++)
+        memcpy(history->shadow + (size_t)y * history->stride, view.data + (size_t)y * view.stride,
+               history->stride);
+    history->last_generation = view.generation;
+    release_frame_view(history->client, &view);
+    
+    pthread_mutex_lock(&history->mutex);
+    memcpy(history->base, history->shadow, (size_t)history->stride * history->height);
+    history->base_generation = history->last_generation;
+    history->base_paint_ms = paint_ms;
+    history->has_base = TRUE;
+    history->bytes = (size_t)history->stride * history->height;
+    pthread_mutex_unlock(&history->mutex);
+}
+
+// Adds the tiles that changed up to the current generation as one delta
+static void history_capture(FrameHistory* history)
+{
+    UINT32 width, height;
+    if (!get_frame_size(history->client, &width, &height))
+        return;
+    if (width != history->width || height != history->height) {
+        if (!history_resize(history, width, height))
+            return;
+    }
+    if (!history->has_base) {
+        history_capture_base(history);
+        return;
+    }
+    
+    // Damage and pixels come from one locked view, so the delta is exactly
+    // the frame at its generation
+    FrameView view;
+    if (!acquire_frame_view(history->client, &view))
+        return;
+    if (view.width != history->width || view.height != history->height) {
+        release_frame_view(history->client, &view);
+        return;
+    }
+    
+    UINT64 paint_ms;
+    FrameRect damage;
+    BOOL damaged = get_frame_view_damage(history->client, &view, history->last_generation, &damage, &paint_ms);
+    UINT64 generation = view.generation;
+    history->last_generation = generation;
+    
+    // Widen the damage to whole tiles
+    UINT32 x0 = damage.x / HISTORY_TILE_SIZE * HISTORY_TILE_SIZE;
+    UINT32 y0 = damage.y / HISTORY_TILE_SIZE * HISTORY_TILE_SIZE;
+    UINT32 x1 = (damage.x + damage.width + HISTORY_TILE_SIZE - 1) / HISTORY_TILE_SIZE * HISTORY_TILE_SIZE;
+    UINT32 y1 = (damage.y + damage.height + HISTORY_TILE_SIZE - 1) / HISTORY_TILE_SIZE * HISTORY_TILE_SIZE;
+    if (x1 > width)
+        x1 = width;
+    if (y1 > height)
+        y1 = height;
+    
+    // Staging holds only the damaged rectangle
+    size_t staging_stride = (size_t)(x1 > x0 ? x1 - x0 : 0) * 4;
+    size_t staging_bytes = staging_stride * (y1 > y0 ? y1 - y0 : 0);
+    if (damaged && staging_bytes > history->staging_capacity) {
+        BYTE* grown = (BYTE*)realloc(history->staging, staging_bytes);
+        if (!grown)
+            damaged = FALSE;
+        else {
+            history->staging = grown;
+            history->staging_capacity = staging_bytes;
+        }
+    }
+    if (!damaged || staging_bytes == 0) {
+        release_frame_view(history->client, &view);
+        return;
+    }
+    for (UINT32 y = y0; y < y1; y++)
+        memcpy(history->staging + (size_t)(y - y0) * staging_stride,
+               view.data + (size_t)y * view.stride + (size_t)x0 * 4, staging_stride);
+    release_frame_view(history->client, &view);
+    
+    // Keep the tiles whose pixels differ from the newest frame in the history
+    UINT32 tile_count = 0;
+    size_t pixel_bytes = 0;
+    for (UINT32 ty = y0; ty < y1; ty += HISTORY_TILE_SIZE) {
+        UINT32 th = ty + HISTORY_TILE_SIZE > y1 ? y1 - ty : HISTORY_TILE_SIZE;
+        for (UINT32 tx = x0; tx < x1; tx += HISTORY_TILE_SIZE) {
+            UINT32 tw = tx + HISTORY_TILE_SIZE > x1 ? x1 - tx : HISTORY_TILE_SIZE;
+            BOOL changed = FALSE;
+            for (UINT32 y = ty; y < ty + th && !changed; y++)
+                changed = memcmp(history->staging + (size_t)(y - y0) * staging_stride + (size_t)(tx - x0) * 4,
+                                 history->shadow + (size_t)y * history->stride + (size_t)tx * 4,
+                                 (size_t)tw * 4) != 0;
+            if (!changed)
+                continue;
+            
+            UINT16* tile = history->scratch + (size_t)tile_count * 4;
+            tile[0] = (UINT16)tx;
+            tile[1] = (UINT16)ty;
+            tile[2] = (UINT16)tw;
+            tile[3] = (UINT16)th;
+            tile_count++;
+            pixel_bytes += (size_t)tw * th * 4;
+        }
+    }
+    if (tile_count == 0)
+        return;
+    
+    size_t header_bytes = (size_t)tile_count * 4 * sizeof(UINT16);
+    HistoryDelta delta;
+    delta.generation = generation;
+    delta.paint_ms = paint_ms;
+    delta.tile_count = tile_count;
+    delta.bytes = header_bytes + pixel_bytes;
+    delta.data = (BYTE*)malloc(delta.bytes);
+    if (!delta.data) {
+        // The shadow is unchanged, so the next capture picks these tiles up again
+        return;
+    }
+    memcpy(delta.data, history->scratch, header_bytes);
+    
+    BYTE* pixels = delta.data + header_bytes;
+    for (UINT32 i = 0; i < tile_count; i++) {
+        const UINT16* tile = history->scratch + (size_t)i * 4;
+        size_t row_bytes = (size_t)tile[2] * 4;
+        for (UINT32 y = tile[1]; y < (UINT32)tile[1] + tile[3]; y++) {
+            const BYTE* src = history->staging + (size_t)(y - y0) * staging_stride + (size_t)(tile[0] - x0) * 4;
+            memcpy(pixels, src, row_bytes);
+            memcpy(history->shadow + (size_t)y * history->stride + (size_t)tile[0] * 4, src, row_bytes);
+            pixels += row_bytes;
+        }
+    }
+    
+    pthread_mutex_lock(&history->mutex);
+    BOOL pushed = history_push(history, &delta);
+    pthread_mutex_unlock(&history->mutex);
+    if (!pushed) {
+        // The shadow is ahead of the deltas; start over from a new base
+        free(delta.data);
+        pthread_mutex_lock(&history->mutex);
+        history_clear(history);
+        pthread_mutex_unlock(&history->mutex);
+    }
+}
+
+static void* history_thread_proc(void* arg)
+{
+    FrameHistory* history = (FrameHistory*)arg;
+    
+    for (;;) {
+        pthread_mutex_lock(&history->mutex);
+        BOOL stopping = history->stopping;
+        pthread_mutex_unlock(&history->mutex);
+        if (stopping)
+            break;
+        
+        // Every generation is captured while the thread keeps up; bursts coalesce
+        if (wait_for_frame_generation(history->client, history->last_generation, 250, NULL) ||
+            !history->has_base)
+            history_capture(history);
+        if (!history->has_base)
+            usleep(50000);
+    }
+    
+    return NULL;
+}
+
+FrameHistory* frame_history_start(RDPClient* client, size_t budget_bytes, const char** error)
+{
+    const char* ignored;
+    if (!error)
+        error = &ignored;
+    
+    FrameHistory* history = (FrameHistory*)calloc(1, sizeof(FrameHistory));
+    if (!history) {
+        *error = "Memory allocation failed";
+        return NULL;
+    }
+    history->client = client;
+    history->budget_bytes = budget_bytes;
+    pthread_mutex_init(&history->mutex, NULL);
+    
+    if (pthread_create(&history->thread, NULL, history_thread_proc, history) != 0) {
+        *error = "Failed to create history thread";
+        frame_history_stop(history);
+        return NULL;
+    }
+    history->running = TRUE;
+    return history;
+}
+
+void frame_history_stop(FrameHistory* history)
+{
+    if (!history)
+        return;
+    
+    pthread_mutex_lock(&history->mutex);
+    history->stopping = TRUE;
+    pthread_mutex_unlock(&history->mutex);
+    if (history->running)
+        pthread_join(history->thread, NULL);
+    
+    history_clear(history);
+    pthread_mutex_destroy(&history->mutex);
+    free(history->deltas);
+    free(history->base);
+    free(history->shadow);
+    free(history->staging);
+    free(history->scratch);
+    free(history);
+}
+
+void frame_history_get_stats(FrameHistory* history, FrameHistoryStats* stats)
+{
+    memset(stats, 0, sizeof(FrameHistoryStats));
+    pthread_mutex_lock(&history->mutex);
+    stats->budget_bytes = history->budget_bytes;
+    if (history->has_base) {
+        const HistoryDelta* newest = history->delta_count ? history_delta(history, history->delta_count - 1) : NULL;
+        stats->bytes = history->bytes;
+        stats->frames = (UINT32)history->delta_count + 1;
+        stats->oldest_generation = history->base_generation;
+        stats->newest_generation = newest ? newest->generation : history->base_generation;
+        stats->span_ms = newest ? newest->paint_ms - history->base_paint_ms : 0;
+    }
+    pthread_mutex_unlock(&history->mutex);
+}
+
+BOOL frame_history_get(FrameHistory* history, FrameHistoryLookup lookup, UINT64 key, BYTE** buffer,
+                       UINT32* width, UINT32* height, UINT32* stride, UINT64* generation, UINT64* paint_ms,
+                       const char** error)
+{
+    const char* ignored;
+    if (!error)
+        error = &ignored;
+    
+    pthread_mutex_lock(&history->mutex);
+    if (!history->has_base) {
+        pthread_mutex_unlock(&history->mutex);
+        *error = "History is empty";
+        return FALSE;
+    }
+    
+    UINT64 base_key = lookup == HISTORY_BY_GENERATION ? history->base_generation : history->base_paint_ms;
+    if (key < base_key) {
+        pthread_mutex_unlock(&history->mutex);
+        *error = "Frame is older than the history";
+        return FALSE;
+    }
+    
+    // Deltas are in generation and paint order; apply those at or before key
+    size_t frame_bytes = (size_t)history->stride * history->height;
+    *buffer = (BYTE*)malloc(frame_bytes);
+    if (!*buffer) {
+        pthread_mutex_unlock(&history->mutex);
+        *error = "Memory allocation failed";
+        return FALSE;
+    }
+    memcpy(*buffer, history->base, frame_bytes);
+    *generation = history->base_generation;
+    *paint_ms = history->base_paint_ms;
+    
+    for (size_t i = 0; i < history->delta_count; i++) {
+        const HistoryDelta* delta = history_delta(history, i);
+        UINT64 delta_key = lookup == HISTORY_BY_GENERATION ? delta->generation : delta->paint_ms;
+        if (delta_key > key)
+            break;
+        history_apply(*buffer, history->stride, delta);
+        *generation = delta->generation;
+        *paint_ms = delta->paint_ms;
+    }
+    
+    *width = history->width;
+    *height = history->height;
+    *stride = history->stride;
+    pthread_mutex_unlock(&history->mutex);
+    return TRUE;
+}
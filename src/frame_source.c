@@ -0,0 +1,691 @@
+#include "frame_source.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <png.h>
+
+typedef enum {
+    LOCAL_SYNTHETIC,
+    LOCAL_REPLAY
+} LocalMode;
+
+typedef enum {
+    LOCAL_DAMAGE_FULL,      // every paint redraws the whole desktop
+    LOCAL_DAMAGE_TILE,      // every paint redraws one tile
+    LOCAL_DAMAGE_NONE       // only the first paint and refreshes
+} LocalDamage;
+
+// Generates frames, or replays PNG files, into its own surface and publishes
+// them through copy_frame_buffer at a fixed paint rate. Input is recorded
+// rather than sent anywhere.
+typedef struct {
+    FrameSource base;
+    LocalMode mode;
+    LocalDamage damage;
+    UINT32 fps;
+    FILE* log;
+    
+    // Replayed frames, all width x height with a stride of width * 4
+    BYTE** frames;
+    UINT32 frame_count;
+    UINT32 frame_index;
+    UINT32 frame_width;
+    UINT32 frame_height;
+    
+    // Surface painted from; guarded by mutex
+    BYTE* surface;
+    UINT32 width;
+    UINT32 height;
+    UINT32 stride;
+    UINT64 paints;
+    UINT32 seed;
+    BOOL suppressed;
+    UINT64 input_events;
+    char* clipboard;        // NULL until set
+    size_t clipboard_length;
+    
+    RDPClient* client;
+    pthread_t thread;
+    BOOL running;
+    BOOL stopping;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+} LocalSource;
+
+static UINT32 local_random(LocalSource* local)
+{
+    UINT32 x = local->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    local->seed = x;
+    return x;
+}
+
+static void local_fill_rect(LocalSource* local, const FrameRect* rect, UINT32 color)
+{
+    for (UINT32 y = rect->y; y < rect->y + rect->height; y++) {
+        UINT32* row = (UINT32*)(local->surface + (size_t)y * local->stride);
+        for (UINT32 x = rect->x; x < rect->x + rect->width; x++)
+            row[x] = color;
+    }
+}
+
+// Desktop background with a title bar and window frame every 256 pixels;
+// tint varies the background so full repaints are visible
+static void local_draw_desktop(LocalSource* local, UINT32 tint)
+{
+    UINT32 background = 0x00f0f0f0 - ((tint & 0x1f) * 0x00010101);
+    for (UINT32 y = 0; y < local->height; y++) {
+        UINT32* row = (UINT32*)(local->surface + (size_t)y * local->stride);
+        for (UINT32 x = 0; x < local->width; x++) {
+            if (y % 256 < 24)
+                row[x] = 0x002b579a;
+            else if (x % 256 == 0 || y % 256 == 24)
+                row[x] = 0x00a0a0a0;
+            else
+                row[x] = background;
+        }
+    }
+}
+
+static BOOL local_alloc_surface(LocalSource* local, UINT32 width, UINT32 height)
+{
+    BYTE* surface = (BYTE*)malloc((size_t)width * height * 4);
+    if (!surface)
+        return FALSE;
+    
+    free(local->surface);
+    local->surface = surface;
+    local->width = width;
+    local->height = height;
+    local->stride = width * 4;
+    return TRUE;
+}
+
+// Produces the next paint into the surface and returns its damage; FALSE
+// when nothing changed. Called with mutex held.
+static BOOL local_next_paint(LocalSource* local, FrameRect* damage)
+{
+    local->paints++;
+    
+    if (local->mode == LOCAL_REPLAY) {
+        if (local->frame_count < 2)
+            return FALSE;
+        
+        local->frame_index = (local->frame_index + 1) % local->frame_count;
+        const BYTE* next = local->frames[local->frame_index];
+        
+        // Damage is the bounding box of the pixels that differ
+        UINT32 min_x = local->width, min_y = local->height, max_x = 0, max_y = 0;
+        for (UINT32 y = 0; y < local->height; y++) {
+            const UINT32* old_row = (const UINT32*)(local->surface + (size_t)y * local->stride);
+            const UINT32* new_row = (const UINT32*)(next + (size_t)y * local->stride);
+            if (memcmp(old_row, new_row, local->stride) == 0)
+                continue;
+            for (UINT32 x = 0; x < local->width; x++) {
+                if (old_row[x] == new_row[x])
+                    continue;
+                if (x < min_x) min_x = x;
+                if (x > max_x) max_x = x;
+            }
+            if (y < min_y) min_y = y;
+            max_y = y;
+        }
+        
+        memcpy(local->surface, next, (size_t)local->stride * local->height);
+        if (min_y > max_y)
+            return FALSE;
+        
+        damage->x = min_x;
+        damage->y = min_y;
+        damage->width = max_x - min_x + 1;
+        damage->height = max_y - min_y + 1;
+        return TRUE;
+    }
+    
+    switch (local->damage) {
+        case LOCAL_DAMAGE_FULL:
+            local_draw_desktop(local, (UINT32)local->paints);
+            damage->x = 0;
+            damage->y = 0;
+            damage->width = local->width;
+            damage->height = local->height;
+            return TRUE;
+        case LOCAL_DAMAGE_TILE: {
+            UINT32 columns = (local->width + LOCAL_SOURCE_TILE_SIZE - 1) / LOCAL_SOURCE_TILE_SIZE;
+            UINT32 rows = (local->height + LOCAL_SOURCE_TILE_SIZE - 1) / LOCAL_SOURCE_TILE_SIZE;
+            UINT32 tile = local_random(local) % (columns * rows);
+            damage->x = (tile % columns) * LOCAL_SOURCE_TILE_SIZE;
+            damage->y = (tile / columns) * LOCAL_SOURCE_TILE_SIZE;
+            damage->width = damage->x + LOCAL_SOURCE_TILE_SIZE > local->width ? local->width - damage->x
+                                                                              : LOCAL_SOURCE_TILE_SIZE;
+            damage->height = damage->y + LOCAL_SOURCE_TILE_SIZE > local->height ? local->height - damage->y
+                                                                                : LOCAL_SOURCE_TILE_SIZE;
+            local_fill_rect(local, damage, local_random(local) & 0x00ffffff);
+            return TRUE;
+        }
+        default:
+            return FALSE;
+    }
+}
+
+static void* local_thread_proc(void* arg)
+{
+    LocalSource* local = (LocalSource*)arg;
+    UINT64 interval_ms = 1000 / local->fps;
+    if (interval_ms == 0)
+        interval_ms = 1;
+    UINT64 next_paint_ms = get_time_ms() + interval_ms;
+    
+    pthread_mutex_lock(&local->mutex);
+    while (!local->stopping) {
+        UINT64 now_ms = get_time_ms();
+        if (now_ms < next_paint_ms) {
+            struct timespec deadline;
+            deadline.tv_sec = (time_t)(next_paint_ms / 1000);
+            deadline.tv_nsec = (long)(next_paint_ms % 1000) * 1000000L;
+            pthread_cond_timedwait(&local->wake, &local->mutex, &deadline);
+            continue;
+        }
+        
+        // Paint at a fixed rate; skip ahead rather than burst after a stall
+        next_paint_ms += interval_ms;
+        if (next_paint_ms <= now_ms)
+            next_paint_ms = now_ms + interval_ms;
+        
+        FrameRect damage;
+        if (!local->suppressed && local_next_paint(local, &damage))
+            copy_frame_buffer(local->client, local->surface, local->width, local->height, local->stride, &damage);
+        
+        // The idle policy takes input_mutex, so it runs without our lock
+        pthread_mutex_unlock(&local->mutex);
+        rdp_client_check_idle(local->client);
+        pthread_mutex_lock(&local->mutex);
+    }
+    pthread_mutex_unlock(&local->mutex);
+    
+    return NULL;
+}
+
+static BOOL local_start(FrameSource* source, RDPClient* client)
+{
+    LocalSource* local = (LocalSource*)source;
+    
+    pthread_mutex_lock(&local->mutex);
+    local->client = client;
+    local->stopping = FALSE;
+    local->suppressed = FALSE;
+    
+    // A replay has the size of its frames; a synthetic desktop uses the requested geometry
+    BOOL ready;
+    if (local->mode == LOCAL_REPLAY) {
+        ready = local_alloc_surface(local, local->frame_width, local->frame_height);
+        if (ready) {
+            local->frame_index = 0;
+            memcpy(local->surface, local->frames[0], (size_t)local->stride * local->height);
+            pthread_mutex_lock(&client->state_mutex);
+            client->geometry.width = local->width;
+            client->geometry.height = local->height;
+            pthread_mutex_unlock(&client->state_mutex);
+        }
+    } else {
+        UINT32 width, height;
+        get_desktop_size(client, &width, &height);
+        ready = local_alloc_surface(local, width, height);
+        if (ready)
+            local_draw_desktop(local, 0);
+    }
+    
+    if (!ready) {
+        pthread_mutex_unlock(&local->mutex);
+        rdp_client_set_phase(client, RDP_PHASE_FAILED);
+        return FALSE;
+    }
+    
+    // Nothing to negotiate: go straight to the first frame
+    client->connected = TRUE;
+    rdp_client_set_phase(client, RDP_PHASE_FIRST_FRAME);
+    copy_frame_buffer(client, local->surface, local->width, local->height, local->stride, NULL);
+    client->first_frame_received = TRUE;
+    rdp_client_set_phase(client, RDP_PHASE_READY);
+    pthread_mutex_unlock(&local->mutex);
+    
+    if (pthread_create(&local->thread, NULL, local_thread_proc, local) != 0) {
+        fprintf(stderr, "Failed to create %s source thread\n", source->ops->name);
+        client->connected = FALSE;
+        rdp_client_set_phase(client, RDP_PHASE_FAILED);
+        return FALSE;
+    }
+    local->running = TRUE;
+    
+    printf("DEBUG: %s source started, %ux%u at %u fps\n", source->ops->name, local->width, local->height,
+           local->fps);
+    return TRUE;
+}
+
+static void local_stop(FrameSource* source, RDPClient* client)
+{
+    LocalSource* local = (LocalSource*)source;
+    if (!local->running)
+        return;
+    
+    pthread_mutex_lock(&local->mutex);
+    local->stopping = TRUE;
+    pthread_cond_signal(&local->wake);
+    pthread_mutex_unlock(&local->mutex);
+    pthread_join(local->thread, NULL);
+    local->running = FALSE;
+    
+    client->connected = FALSE;
+    rdp_client_set_phase(client, RDP_PHASE_IDLE);
+    printf("DEBUG: %s source stopped after %llu paints and %llu input events\n", source->ops->name,
+           (unsigned long long)local->paints, (unsigned long long)local->input_events);
+}
+
+static BOOL local_send_keyboard(FrameSource* source, RDPClient* client, DWORD flags, DWORD code)
+{
+    WINPR_UNUSED(client);
+    LocalSource* local = (LocalSource*)source;
+    
+    pthread_mutex_lock(&local->mutex);
+    local->input_events++;
+    if (local->log)
+        fprintf(local->log, "%llu key flags=0x%04x code=%u\n", (unsigned long long)get_time_ms(),
+                (unsigned)flags, (unsigned)code);
+    pthread_mutex_unlock(&local->mutex);
+    return TRUE;
+}
+
+static BOOL local_send_mouse(FrameSource* source, RDPClient* client, DWORD flags, UINT16 x, UINT16 y)
+{
+    WINPR_UNUSED(client);
+    LocalSource* local = (LocalSource*)source;
+    
+    pthread_mutex_lock(&local->mutex);
+    local->input_events++;
+    if (local->log)
+        fprintf(local->log, "%llu mouse flags=0x%04x x=%u y=%u\n", (unsigned long long)get_time_ms(),
+                (unsigned)flags, x, y);
+    pthread_mutex_unlock(&local->mutex);
+    return TRUE;
+}
+
+// Repaints the area from the surface, even while output is suppressed
+static BOOL local_refresh_rect(FrameSource* source, RDPClient* client, const FrameRect* rect)
+{
+    LocalSource* local = (LocalSource*)source;
+    
+    pthread_mutex_lock(&local->mutex);
+    FrameRect area = *rect;
+    if (area.x >= local->width || area.y >= local->height) {
+        pthread_mutex_unlock(&local->mutex);
+        return FALSE;
+    }
+    if (area.x + area.width > local->width)
+        area.width = local->width - area.x;
+    if (area.y + area.height > local->height)
+        area.height = local->height - area.y;
+    
+    BOOL painted = copy_frame_buffer(client, local->surface, local->width, local->height, local->stride, &area);
+    pthread_mutex_unlock(&local->mutex);
+    return painted;
+}
+
+static BOOL local_suppress_output(FrameSource* source, RDPClient* client, BOOL allow)
+{
+    WINPR_UNUSED(client);
+    LocalSource* local = (LocalSource*)source;
+    
+    pthread_mutex_lock(&local->mutex);
+    local->suppressed = !allow;
+    pthread_mutex_unlock(&local->mutex);
+    return TRUE;
+}
+
+static BOOL local_resize(FrameSource* source, RDPClient* client, UINT32 width, UINT32 height,
+                         const char** error)
+{
+    LocalSource* local = (LocalSource*)source;
+    if (local->mode == LOCAL_REPLAY) {
+        *error = "Replay source has a fixed size";
+        return FALSE;
+    }
+    
+    pthread_mutex_lock(&local->mutex);
+    if (!local_alloc_surface(local, width, height)) {
+        pthread_mutex_unlock(&local->mutex);
+        *error = "Memory allocation failed";
+        return FALSE;
+    }
+    local_draw_desktop(local, (UINT32)local->paints);
+    
+    pthread_mutex_lock(&client->state_mutex);
+    client->geometry.width = width;
+    client->geometry.height = height;
+    pthread_mutex_unlock(&client->state_mutex);
+    
+    copy_frame_buffer(client, local->surface, local->width, local->height, local->stride, NULL);
+    pthread_mutex_unlock(&local->mutex);
+    
+    printf("DEBUG: %s source resized to %ux%u\n", source->ops->name, width, height);
+    return TRUE;
+}
+
+static ClipboardResult local_set_clipboard(FrameSource* source, RDPClient* client, const char* text, size_t length,
+                                           UINT32 timeout_ms)
+{
+    WINPR_UNUSED(client);
+    WINPR_UNUSED(timeout_ms);
+    LocalSource* local = (LocalSource*)source;
+    
+    char* copy = (char*)malloc(length + 1);
+    if (!copy)
+        return CLIPBOARD_FAILED;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    
+    pthread_mutex_lock(&local->mutex);
+    free(local->clipboard);
+    local->clipboard = copy;
+    local->clipboard_length = length;
+    if (local->log)
+        fprintf(local->log, "%llu clipboard bytes=%zu\n", (unsigned long long)get_time_ms(), length);
+    pthread_mutex_unlock(&local->mutex);
+    return CLIPBOARD_OK;
+}
+
+static ClipboardResult local_get_clipboard(FrameSource* source, RDPClient* client, UINT32 timeout_ms, char** text,
+                                           size_t* length)
+{
+    WINPR_UNUSED(client);
+    WINPR_UNUSED(timeout_ms);
+    LocalSource* local = (LocalSource*)source;
+    
+    pthread_mutex_lock(&local->mutex);
+    if (!local->clipboard) {
+        pthread_mutex_unlock(&local->mutex);
+        return CLIPBOARD_EMPTY;
+    }
+    *text = (char*)malloc(local->clipboard_length + 1);
+    if (*text) {
+        memcpy(*text, local->clipboard, local->clipboard_length + 1);
+        *length = local->clipboard_length;
+    }
+    pthread_mutex_unlock(&local->mutex);
+    return *text ? CLIPBOARD_OK : CLIPBOARD_FAILED;
+}
+
+static void local_free(FrameSource* source)
+{
+    LocalSource* local = (LocalSource*)source;
+    
+    for (UINT32 i = 0; i < local->frame_count; i++)
+        free(local->frames[i]);
+    free(local->frames);
+    free(local->surface);
+    free(local->clipboard);
+    if (local->log)
+        fclose(local->log);
+    pthread_cond_destroy(&local->wake);
+    pthread_mutex_destroy(&local->mutex);
+    free(local);
+}
+
+static const FrameSourceOps synthetic_source_ops = {
+    "synthetic",
+    local_start,
+    local_stop,
+    local_send_keyboard,
+    local_send_mouse,
+    local_refresh_rect,
+    local_suppress_output,
+    local_resize,
+    local_set_clipboard,
+    local_get_clipboard,
+    local_free,
+};
+
+static const FrameSourceOps replay_source_ops = {
+    "replay",
+    local_start,
+    local_stop,
+    local_send_keyboard,
+    local_send_mouse,
+    local_refresh_rect,
+    local_suppress_output,
+    local_resize,
+    local_set_clipboard,
+    local_get_clipboard,
+    local_free,
+};
+
+// Decodes a PNG into 32-bit pixels matching the frame buffer layout
+static BYTE* load_png_frame(const char* path, UINT32* width, UINT32* height)
+{
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    
+    if (!png_image_begin_read_from_file(&image, path))
+        return NULL;
+    
+    image.format = PNG_FORMAT_BGRA;
+    BYTE* pixels = (BYTE*)malloc(PNG_IMAGE_SIZE(image));
+    if (!pixels) {
+        png_image_free(&image);
+        return NULL;
+    }
+    
+    if (!png_image_finish_read(&image, NULL, pixels, 0, NULL)) {
+        free(pixels);
+        return NULL;
+    }
+    
+    *width = image.width;
+    *height = image.height;
+    return pixels;
+}
+
+static int compare_names(const void* a, const void* b)
+{
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+// Loads every .png in directory, in name order; frames of another size than
+// the first are skipped
+static BOOL local_load_replay(LocalSource* local, const char* directory, const char** error)
+{
+    DIR* dir = opendir(directory);
+    if (!dir) {
+        *error = "Cannot open replay directory";
+        return FALSE;
+    }
+    
+    char** names = NULL;
+    size_t name_count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (length < 5 || strcmp(entry->d_name + length - 4, ".png") != 0)
+            continue;
+        
+        char** grown = (char**)realloc(names, (name_count + 1) * sizeof(char*));
+        if (!grown)
+            break;
+        names = grown;
+        names[name_count] = strdup(entry->d_name);
+        if (names[name_count])
+            name_count++;
+    }
+    closedir(dir);
+    
+    qsort(names, name_count, sizeof(char*), compare_names);
+    
+    local->frames = (BYTE**)calloc(name_count ? name_count : 1, sizeof(BYTE*));
+    for (size_t i = 0; i < name_count && local->frames; i++) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", directory, names[i]);
+        
+        UINT32 width, height;
+        BYTE* pixels = load_png_frame(path, &width, &height);
+        if (!pixels) {
+            fprintf(stderr, "Replay: cannot read %s\n", path);
+        } else if (local->frame_count > 0 && (width != local->frame_width || height != local->frame_height)) {
+            fprintf(stderr, "Replay: %s is %ux%u, expected %ux%u; skipped\n", path, width, height,
+                    local->frame_width, local->frame_height);
+            free(pixels);
+        } else {
+            local->frame_width = width;
+            local->frame_height = height;
+            local->frames[local->frame_count++] = pixels;
+        }
+    }
+    
+    for (size_t i = 0; i < name_count; i++)
+        free(names[i]);
+    free(names);
+    
+    if (local->frame_count == 0) {
+        *error = "Replay directory has no readable PNG frames";
+        return FALSE;
+    }
+    
+    printf("DEBUG: Replay loaded %u frames of %ux%u from %s\n", local->frame_count, local->frame_width,
+           local->frame_height, directory);
+    return TRUE;
+}
+
+// Applies one "key=value" option, or a bare replay directory
+static BOOL local_parse_option(LocalSource* local, char* option, const char** directory, const char** error)
+{
+    char* value = strchr(option, '=');
+    if (!value) {
+        if (local->mode == LOCAL_REPLAY && !*directory) {
+            *directory = option;
+            return TRUE;
+        }
+        *error = "Invalid frame source option";
+        return FALSE;
+    }
+    *value++ = '\0';
+    
+    if (strcmp(option, "fps") == 0) {
+        int fps = atoi(value);
+        if (fps <= 0 || fps > LOCAL_SOURCE_MAX_FPS) {
+            *error = "Frame source fps must be between 1 and 1000";
+            return FALSE;
+        }
+        local->fps = (UINT32)fps;
+    } else if (strcmp(option, "damage") == 0) {
+        if (strcmp(value, "full") == 0)
+            local->damage = LOCAL_DAMAGE_FULL;
+        else if (strcmp(value, "tile") == 0)
+            local->damage = LOCAL_DAMAGE_TILE;
+        else if (strcmp(value, "none") == 0)
+            local->damage = LOCAL_DAMAGE_NONE;
+        else {
+            *error = "Frame source damage must be full, tile or none";
+            return FALSE;
+        }
+    } else if (strcmp(option, "log") == 0) {
+        if (local->log)
+            fclose(local->log);
+        local->log = fopen(value, "a");
+        if (!local->log) {
+            *error = "Cannot open input log";
+            return FALSE;
+        }
+        setvbuf(local->log, NULL, _IOLBF, 0);
+    } else {
+        *error = "Unknown frame source option";
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+FrameSource* frame_source_new(const char* spec, const char** error)
+{
+    const char* ignored;
+    if (!error)
+        error = &ignored;
+    
+    if (!spec || strcmp(spec, "freerdp") == 0)
+        return rdp_freerdp_source();
+    
+    const char* options = strchr(spec, ':');
+    size_t name_length = options ? (size_t)(options - spec) : strlen(spec);
+    
+    LocalMode mode;
+    if (name_length == 9 && strncmp(spec, "synthetic", 9) == 0)
+        mode = LOCAL_SYNTHETIC;
+    else if (name_length == 6 && strncmp(spec, "replay", 6) == 0)
+        mode = LOCAL_REPLAY;
+    else {
+        *error = "Unknown frame source";
+        return NULL;
+    }
+    
+    LocalSource* local = (LocalSource*)calloc(1, sizeof(LocalSource));
+    if (!local) {
+        *error = "Memory allocation failed";
+        return NULL;
+    }
+    local->base.ops = mode == LOCAL_REPLAY ? &replay_source_ops : &synthetic_source_ops;
+    local->mode = mode;
+    local->damage = LOCAL_DAMAGE_TILE;
+    local->fps = LOCAL_SOURCE_DEFAULT_FPS;
+    local->seed = 0x9e3779b9u;
+    pthread_mutex_init(&local->mutex, NULL);
+    
+    // The paint thread sleeps until absolute monotonic deadlines
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&local->wake, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    
+    char* copy = strdup(options ? options + 1 : "");
+    if (!copy) {
+        *error = "Memory allocation failed";
+        local_free(&local->base);
+        return NULL;
+    }
+    
+    const char* directory = NULL;
+    BOOL valid = TRUE;
+    char* save = NULL;
+    for (char* option = strtok_r(copy, ",", &save); option && valid; option = strtok_r(NULL, ",", &save))
+        valid = local_parse_option(local, option, &directory, error);
+    
+    if (valid && mode == LOCAL_REPLAY) {
+        if (!directory) {
+            *error = "Replay source needs a directory";
+            valid = FALSE;
+        } else {
+            valid = local_load_replay(local, directory, error);
+        }
+    }
+    free(copy);
+    
+    if (!valid) {
+        local_free(&local->base);
+        return NULL;
+    }
+    
+    return &local->base;
+}
+
+void frame_source_free(FrameSource* source)
+{
+    if (source && source->ops->free)
+        source->ops->free(source);
+}
+
+const char* frame_source_name(const FrameSource* source)
+{
+    return source ? source->ops->name : "none";
+}
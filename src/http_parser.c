@@ -0,0 +1,458 @@
+#include "http_server.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+typedef enum {
+    PARSE_REQUEST_LINE,
+    PARSE_HEADERS,
+    PARSE_BODY,
+    PARSE_CHUNK_SIZE,
+    PARSE_CHUNK_DATA,
+    PARSE_CHUNK_END,
+    PARSE_TRAILERS,
+    PARSE_DONE,
+    PARSE_ERROR
+} ParseState;
+
+static HttpParseResult parser_fail(HttpParser* parser, int status, const char* error)
+{
+    parser->state = PARSE_ERROR;
+    parser->error_status = status;
+    parser->error = error;
+    return HTTP_PARSE_ERROR;
+}
+
+// Returns the next complete line without its CR LF, NUL-terminated in place,
+// or NULL when it has not fully arrived; bytes already searched are not
+// searched again
+static char* parser_line(HttpParser* parser, size_t length)
+{
+    char* newline = (char*)memchr(parser->buffer + parser->scan, '\n', length - parser->scan);
+    if (!newline) {
+        parser->scan = length;
+        return NULL;
+    }
+    
+    char* line = parser->buffer + parser->line_start;
+    char* line_end = newline;
+    if (line_end > line && line_end[-1] == '\r')
+        line_end--;
+    *line_end = '\0';
+    
+    parser->scan = (size_t)(newline - parser->buffer) + 1;
+    parser->line_start = parser->scan;
+    return line;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Decodes %XX (and '+' as space in query strings) in place; rejects bad
+// escapes and %00, which would truncate the field
+static BOOL percent_decode(char* text, BOOL plus_as_space)
+{
+    char* out = text;
+    for (const char* in = text; *in; in++) {
+        if (*in == '%') {
+            int high = hex_value(in[1]);
+            int low = high >= 0 ? hex_value(in[2]) : -1;
+            if (low < 0 || (high == 0 && low == 0))
+                return FALSE;
+            *out++ = (char)(high * 16 + low);
+            in += 2;
+        } else if (*in == '+' && plus_as_space) {
+            *out++ = ' ';
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+    return TRUE;
+}
+
+static BOOL parse_query(HttpRequest* request, char* query)
+{
+    while (*query) {
+        char* param = query;
+        char* end = strchr(param, '&');
+        if (end) {
+            *end = '\0';
+            query = end + 1;
+        } else {
+            query = param + strlen(param);
+        }
+        if (*param == '\0')
+            continue;
+        
+        if (request->query_count == HTTP_MAX_QUERY_PARAMS)
+            return FALSE;
+        
+        // A bare "name" has an empty value
+        char* value = strchr(param, '=');
+        if (value)
+            *value++ = '\0';
+        else
+            value = param + strlen(param);
+        if (!percent_decode(param, TRUE) || !percent_decode(value, TRUE))
+            return FALSE;
+        
+        request->query[request->query_count].name = param;
+        request->query[request->query_count].value = value;
+        request->query_count++;
+    }
+    return TRUE;
+}
+
+static HttpParseResult parse_request_line(HttpParser* parser, char* line)
+{
+    HttpRequest* request = &parser->request;
+    
+    char* target = strchr(line, ' ');
+    if (!target)
+        return parser_fail(parser, 400, "Malformed request line");
+    *target++ = '\0';
+    
+    if (strcmp(line, "GET") == 0)
+        request->method = HTTP_GET;
+    else if (strcmp(line, "POST") == 0)
+        request->method = HTTP_POST;
+    else if (strcmp(line, "DELETE") == 0)
+        request->method = HTTP_DELETE;
+    else if (strcmp(line, "PUT") == 0)
+        request->method = HTTP_PUT;
+    else
+        return parser_fail(parser, 501, "Unsupported method");
+    
+    char* version = strchr(target, ' ');
+    if (!version || target[0] != '/')
+        return parser_fail(parser, 400, "Malformed request line");
+    *version++ = '\0';
+    if (strncmp(version, "HTTP/1.", 7) != 0 || (version[7] != '0' && version[7] != '1') || version[8])
+        return parser_fail(parser, 400, "Unsupported HTTP version");
+    request->keep_alive = version[7] == '1';
+    
+    // Routes match on the bare path
+    char* query = strchr(target, '?');
+    if (query)
+        *query++ = '\0';
+    if (!percent_decode(target, FALSE))
+        return parser_fail(parser, 400, "Malformed path");
+    request->path = target;
+    if (query && !parse_query(request, query))
+        return parser_fail(parser, 400, "Malformed or too many query parameters");
+    
+    return HTTP_PARSE_INCOMPLETE;
+}
+
+// TRUE when the comma-separated header value lists token
+static BOOL header_has_token(const char* value, const char* token)
+{
+    size_t token_length = strlen(token);
+    while (*value) {
+        while (*value == ' ' || *value == '\t' || *value == ',')
+            value++;
+        size_t length = strcspn(value, ", \t");
+        if (length == token_length && strncasecmp(value, token, length) == 0)
+            return TRUE;
+        value += length;
+    }
+    return FALSE;
+}
+
+static HttpParseResult parse_header_line(HttpParser* parser, char* line)
+{
+    HttpRequest* request = &parser->request;
+    
+    // Folded continuation lines are obsolete and a smuggling vector
+    if (*line == ' ' || *line == '\t')
+        return parser_fail(parser, 400, "Folded header line");
+    
+    char* colon = strchr(line, ':');
+    if (!colon || colon == line)
+        return parser_fail(parser, 400, "Malformed header line");
+    for (char* c = line; c < colon; c++) {
+        if (*c == ' ' || *c == '\t')
+            return parser_fail(parser, 400, "Malformed header line");
+    }
+    *colon = '\0';
+    
+    char* value = colon + 1;
+    while (*value == ' ' || *value == '\t')
+        value++;
+    char* value_end = value + strlen(value);
+    while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+        value_end--;
+    *value_end = '\0';
+    
+    if (request->header_count == HTTP_MAX_HEADERS)
+        return parser_fail(parser, 431, "Too many headers");
+    request->headers[request->header_count].name = line;
+    request->headers[request->header_count].value = value;
+    request->header_count++;
+    
+    if (strcasecmp(line, "Content-Length") == 0) {
+        char* end = NULL;
+        unsigned long long content_length = strtoull(value, &end, 10);
+        if (*value < '0' || *value > '9' || *end ||
+            (parser->has_content_length && parser->content_length != content_length))
+            return parser_fail(parser, 400, "Invalid Content-Length");
+        parser->content_length = (size_t)content_length;
+        parser->has_content_length = TRUE;
+    } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+        if (strcasecmp(value, "chunked") != 0)
+            return parser_fail(parser, 501, "Unsupported Transfer-Encoding");
+        parser->chunked = TRUE;
+    } else if (strcasecmp(line, "Connection") == 0) {
+        if (header_has_token(value, "close"))
+            request->keep_alive = FALSE;
+        else if (header_has_token(value, "keep-alive"))
+            request->keep_alive = TRUE;
+    } else if (strcasecmp(line, "Expect") == 0) {
+        if (strcasecmp(value, "100-continue") != 0)
+            return parser_fail(parser, 417, "Unsupported Expect");
+        request->expect_continue = TRUE;
+    }
+    
+    return HTTP_PARSE_INCOMPLETE;
+}
+
+// The blank line after the headers: decide how the body is framed
+static HttpParseResult parse_headers_end(HttpParser* parser)
+{
+    if (parser->chunked && parser->has_content_length)
+        return parser_fail(parser, 400, "Both Content-Length and Transfer-Encoding");
+    
+    parser->body_start = parser->scan;
+    parser->body_end = parser->scan;
+    if (parser->chunked) {
+        parser->state = PARSE_CHUNK_SIZE;
+    } else if (parser->content_length > 0) {
+        // One byte stays free for the body's terminator
+        if (parser->content_length >= parser->capacity - parser->body_start)
+            return parser_fail(parser, 413, "Request body too large");
+        parser->state = PARSE_BODY;
+    } else {
+        parser->state = PARSE_DONE;
+        return HTTP_PARSE_DONE;
+    }
+    parser->continue_pending = parser->request.expect_continue;
+    return HTTP_PARSE_INCOMPLETE;
+}
+
+static HttpParseResult parse_chunk_size(HttpParser* parser, char* line)
+{
+    size_t size = 0;
+    const char* c = line;
+    int digit;
+    if (hex_value(*c) < 0)
+        return parser_fail(parser, 400, "Malformed chunk size");
+    while ((digit = hex_value(*c)) >= 0) {
+        if (size > (parser->capacity >> 4))
+            return parser_fail(parser, 413, "Request body too large");
+        size = size * 16 + (size_t)digit;
+        c++;
+    }
+    
+    // Chunk extensions are ignored
+    while (*c == ' ' || *c == '\t')
+        c++;
+    if (*c && *c != ';')
+        return parser_fail(parser, 400, "Malformed chunk size");
+    
+    if (size == 0) {
+        parser->state = PARSE_TRAILERS;
+    } else {
+        if (size >= parser->capacity - parser->body_end)
+            return parser_fail(parser, 413, "Request body too large");
+        parser->chunk_remaining = size;
+        parser->state = PARSE_CHUNK_DATA;
+    }
+    return HTTP_PARSE_INCOMPLETE;
+}
+
+void http_parser_init(HttpParser* parser, char* buffer, size_t capacity)
+{
+    memset(parser, 0, sizeof(HttpParser));
+    parser->buffer = buffer;
+    parser->capacity = capacity;
+    parser->state = PARSE_REQUEST_LINE;
+}
+
+HttpParseResult http_parser_execute(HttpParser* parser, size_t length)
+{
+    HttpRequest* request = &parser->request;
+    
+    while (parser->state != PARSE_DONE) {
+        HttpParseResult result = HTTP_PARSE_INCOMPLETE;
+        char* line;
+        
+        switch (parser->state) {
+            case PARSE_REQUEST_LINE:
+                if (!(line = parser_line(parser, length)))
+                    goto incomplete;
+                // Stray blank lines between pipelined requests are skipped
+                if (*line == '\0')
+                    continue;
+                parser->state = PARSE_HEADERS;
+                result = parse_request_line(parser, line);
+                break;
+            case PARSE_HEADERS:
+                if (!(line = parser_line(parser, length)))
+                    goto incomplete;
+                result = *line ? parse_header_line(parser, line) : parse_headers_end(parser);
+                break;
+            case PARSE_BODY:
+                if (length - parser->body_start < parser->content_length) {
+                    parser->scan = length;
+                    goto incomplete;
+                }
+                parser->body_end = parser->body_start + parser->content_length;
+                parser->scan = parser->body_end;
+            
+                // The byte after the body may start the next request; it is
+                // put back by http_parser_next
+                parser->saved_offset = parser->body_end;
+                parser->saved_byte = parser->buffer[parser->body_end];
+                parser->has_saved_byte = TRUE;
+                parser->state = PARSE_DONE;
+                break;
+            case PARSE_CHUNK_SIZE:
+                if (!(line = parser_line(parser, length)))
+                    goto incomplete;
+                result = parse_chunk_size(parser, line);
+                break;
+            case PARSE_CHUNK_DATA: {
+                // Chunk data moves down over the chunk headers before it
+                size_t available = length - parser->scan;
+                size_t count = available < parser->chunk_remaining ? available : parser->chunk_remaining;
+                memmove(parser->buffer + parser->body_end, parser->buffer + parser->scan, count);
+                parser->body_end += count;
+                parser->scan += count;
+                parser->chunk_remaining -= count;
+                if (parser->chunk_remaining > 0)
+                    goto incomplete;
+                parser->line_start = parser->scan;
+                parser->state = PARSE_CHUNK_END;
+                break;
+            }
+            case PARSE_CHUNK_END:
+                if (!(line = parser_line(parser, length)))
+                    goto incomplete;
+                if (*line)
+                    return parser_fail(parser, 400, "Malformed chunk");
+                parser->state = PARSE_CHUNK_SIZE;
+                break;
+            case PARSE_TRAILERS:
+                if (!(line = parser_line(parser, length)))
+                    goto incomplete;
+                if (*line == '\0')
+                    parser->state = PARSE_DONE;
+                break;
+            default:
+                return HTTP_PARSE_ERROR;
+        }
+        
+        if (result == HTTP_PARSE_ERROR)
+            return HTTP_PARSE_ERROR;
+    }
+    
+    // Chunked bodies end before the consumed bytes, so their terminator
+    // overwrites nothing; after a Content-Length body the byte was saved
+    parser->end = parser->scan;
+    if (parser->body_end > parser->body_start)
+        parser->buffer[parser->body_end] = '\0';
+    request->body_length = parser->body_end - parser->body_start;
+    request->body = request->body_length > 0 ? parser->buffer + parser->body_start : NULL;
+    parser->continue_pending = FALSE;
+    return HTTP_PARSE_DONE;
+    
+incomplete:
+    // A request that cannot fit is refused rather than truncated
+    if (length >= parser->capacity - 1) {
+        if (parser->state == PARSE_REQUEST_LINE || parser->state == PARSE_HEADERS)
+            return parser_fail(parser, 431, "Request headers too large");
+        return parser_fail(parser, 413, "Request body too large");
+    }
+    return HTTP_PARSE_INCOMPLETE;
+}
+
+void http_parser_next(HttpParser* parser, size_t* length)
+{
+    if (parser->has_saved_byte)
+        parser->buffer[parser->saved_offset] = parser->saved_byte;
+    
+    size_t end = parser->state == PARSE_DONE ? parser->end : *length;
+    if (end < *length)
+        memmove(parser->buffer, parser->buffer + end, *length - end);
+    *length -= end;
+    
+    http_parser_init(parser, parser->buffer, parser->capacity);
+}
+
+const char* http_header_get(const HttpRequest* request, const char* name)
+{
+    if (!request || !name)
+        return NULL;
+    
+    for (int i = 0; i < request->header_count; i++) {
+        if (strcasecmp(request->headers[i].name, name) == 0)
+            return request->headers[i].value;
+    }
+    return NULL;
+}
+
+const char* http_query_value(const HttpRequest* request, const char* name)
+{
+    if (!request || !name)
+        return NULL;
+    
+    for (int i = 0; i < request->query_count; i++) {
+        if (strcmp(request->query[i].name, name) == 0)
+            return request->query[i].value;
+    }
+    return NULL;
+}
+
+// Copies the value of query parameter name; a bare "name" yields an empty value
+BOOL http_query_get(const HttpRequest* request, const char* name, char* value, size_t value_size)
+{
+    if (!value || value_size == 0)
+        return FALSE;
+    
+    const char* found = http_query_value(request, name);
+    if (!found)
+        return FALSE;
+    
+    snprintf(value, value_size, "%s", found);
+    return TRUE;
+}
+
+// value keeps the caller's default when the parameter is absent or empty
+BOOL http_query_int(const HttpRequest* request, const char* name, int min_value, int max_value, int* value)
+{
+    const char* text = http_query_value(request, name);
+    if (!text || text[0] == '\0')
+        return TRUE;
+    
+    // strtol alone would accept leading spaces, a '+' and trailing junk
+    if ((*text < '0' || *text > '9') && *text != '-')
+        return FALSE;
+    char* end = NULL;
+    errno = 0;
+    long parsed = strtol(text, &end, 10);
+    if (*end || errno == ERANGE || parsed < min_value || parsed > max_value)
+        return FALSE;
+    *value = (int)parsed;
+    return TRUE;
+}
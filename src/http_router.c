@@ -0,0 +1,239 @@
+#include "http_router.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HTTP_METHOD_COUNT HTTP_INVALID
+
+static const char* method_names[HTTP_METHOD_COUNT] = { "GET", "POST", "DELETE", "PUT" };
+
+// Prefix under which per-session routes are served as well
+static const char session_prefix[] = "/sessions/{id}";
+
+// Children of a node are a linked list of siblings; a node has at most one
+// parameter child, kept apart so literals are tried first
+typedef struct {
+    char* segment;              // literal text, or the parameter name
+    size_t length;
+    BOOL is_param;
+    int first_child;
+    int next_sibling;
+    int param_child;
+    const HttpRoute* routes[HTTP_METHOD_COUNT];
+    BOOL session_scoped[HTTP_METHOD_COUNT];
+} RouterNode;
+
+struct _HttpRouter {
+    RouterNode* nodes;
+    int node_count;
+    int node_capacity;
+};
+
+static int router_add_node(HttpRouter* router, const char* segment, size_t length, BOOL is_param)
+{
+    if (router->node_count == router->node_capacity) {
+        int capacity = router->node_capacity ? router->node_capacity * 2 : 32;
+        RouterNode* nodes = (RouterNode*)realloc(router->nodes, (size_t)capacity * sizeof(RouterNode));
+        if (!nodes)
+            return -1;
+        router->nodes = nodes;
+        router->node_capacity = capacity;
+    }
+    
+    RouterNode* node = &router->nodes[router->node_count];
+    memset(node, 0, sizeof(RouterNode));
+    node->segment = strndup(segment, length);
+    if (!node->segment)
+        return -1;
+    node->length = length;
+    node->is_param = is_param;
+    node->first_child = -1;
+    node->next_sibling = -1;
+    node->param_child = -1;
+    return router->node_count++;
+}
+
+// Finds or creates the child of parent for one pattern segment
+static int router_child(HttpRouter* router, int parent, const char* segment, size_t length)
+{
+    BOOL is_param = length >= 2 && segment[0] == '{' && segment[length - 1] == '}';
+    if (is_param) {
+        segment++;
+        length -= 2;
+        
+        int child = router->nodes[parent].param_child;
+        if (child >= 0) {
+            // One parameter name per position keeps lookups unambiguous
+            RouterNode* existing = &router->nodes[child];
+            if (existing->length != length || strncmp(existing->segment, segment, length) != 0)
+                return -1;
+            return child;
+        }
+        child = router_add_node(router, segment, length, TRUE);
+        if (child >= 0)
+            router->nodes[parent].param_child = child;
+        return child;
+    }
+    
+    for (int child = router->nodes[parent].first_child; child >= 0; child = router->nodes[child].next_sibling) {
+        RouterNode* node = &router->nodes[child];
+        if (node->length == length && strncmp(node->segment, segment, length) == 0)
+            return child;
+    }
+    
+    int child = router_add_node(router, segment, length, FALSE);
+    if (child >= 0) {
+        router->nodes[child].next_sibling = router->nodes[parent].first_child;
+        router->nodes[parent].first_child = child;
+    }
+    return child;
+}
+
+// Walks the segments of path from node, creating nodes as needed
+static int router_insert_path(HttpRouter* router, int node, const char* path)
+{
+    while (node >= 0 && *path == '/') {
+        path++;
+        size_t length = strcspn(path, "/");
+        node = router_child(router, node, path, length);
+        path += length;
+    }
+    return node;
+}
+
+static BOOL router_insert(HttpRouter* router, const HttpRoute* route, BOOL session_scoped)
+{
+    int node = 0;
+    if (session_scoped)
+        node = router_insert_path(router, node, session_prefix);
+    node = router_insert_path(router, node, route->pattern);
+    if (node < 0)
+        return FALSE;
+    
+    RouterNode* leaf = &router->nodes[node];
+    if (leaf->routes[route->method]) {
+        fprintf(stderr, "Duplicate route %s %s\n", method_names[route->method], route->pattern);
+        return FALSE;
+    }
+    leaf->routes[route->method] = route;
+    leaf->session_scoped[route->method] = session_scoped;
+    return TRUE;
+}
+
+HttpRouter* http_router_new(const HttpRoute* routes, size_t route_count)
+{
+    HttpRouter* router = (HttpRouter*)calloc(1, sizeof(HttpRouter));
+    if (!router)
+        return NULL;
+    
+    if (router_add_node(router, "", 0, FALSE) < 0) {
+        http_router_free(router);
+        return NULL;
+    }
+    
+    for (size_t i = 0; i < route_count; i++) {
+        const HttpRoute* route = &routes[i];
+        if (route->method >= HTTP_INVALID || route->pattern[0] != '/' || !router_insert(router, route, FALSE) ||
+            (route->per_session && !router_insert(router, route, TRUE))) {
+            fprintf(stderr, "Invalid route %s\n", route->pattern);
+            http_router_free(router);
+            return NULL;
+        }
+    }
+    
+    return router;
+}
+
+void http_router_free(HttpRouter* router)
+{
+    if (!router)
+        return;
+    
+    for (int i = 0; i < router->node_count; i++)
+        free(router->nodes[i].segment);
+    free(router->nodes);
+    free(router);
+}
+
+// Copies a parameter value out of the path, NUL-terminated
+static BOOL add_param(HttpRequest* request, size_t* storage_used, const RouterNode* node, const char* value,
+                      size_t length)
+{
+    if (request->param_count == HTTP_MAX_PATH_PARAMS || length + 1 > sizeof(request->param_storage) - *storage_used)
+        return FALSE;
+    
+    char* copy = request->param_storage + *storage_used;
+    memcpy(copy, value, length);
+    copy[length] = '\0';
+    *storage_used += length + 1;
+    
+    request->params[request->param_count].name = node->segment;
+    request->params[request->param_count].value = copy;
+    request->param_count++;
+    return TRUE;
+}
+
+HttpRouteResult http_router_match(const HttpRouter* router, HttpRequest* request, char* allow, size_t allow_size)
+{
+    const char* path = request->path;
+    size_t storage_used = 0;
+    int node = 0;
+    request->route = NULL;
+    request->param_count = 0;
+    
+    while (*path == '/') {
+        path++;
+        size_t length = strcspn(path, "/");
+        
+        int next = -1;
+        for (int child = router->nodes[node].first_child; child >= 0; child = router->nodes[child].next_sibling) {
+            const RouterNode* candidate = &router->nodes[child];
+            if (candidate->length == length && memcmp(candidate->segment, path, length) == 0) {
+                next = child;
+                break;
+            }
+        }
+        
+        // Parameters match any non-empty segment
+        if (next < 0 && length > 0 && router->nodes[node].param_child >= 0) {
+            next = router->nodes[node].param_child;
+            if (!add_param(request, &storage_used, &router->nodes[next], path, length))
+                return HTTP_ROUTE_NOT_FOUND;
+        }
+        
+        if (next < 0)
+            return HTTP_ROUTE_NOT_FOUND;
+        node = next;
+        path += length;
+    }
+    
+    const RouterNode* leaf = &router->nodes[node];
+    if (*path == '\0' && request->method < HTTP_INVALID && leaf->routes[request->method]) {
+        request->route = leaf->routes[request->method];
+        request->session_scoped = leaf->session_scoped[request->method];
+        return HTTP_ROUTE_FOUND;
+    }
+    
+    // The path exists for other methods
+    size_t used = 0;
+    if (allow_size > 0)
+        allow[0] = '\0';
+    for (int method = 0; method < HTTP_METHOD_COUNT; method++) {
+        if (leaf->routes[method] && used < allow_size)
+            used += (size_t)snprintf(allow + used, allow_size - used, "%s%s", used > 0 ? ", " : "",
+                                     method_names[method]);
+    }
+    return used > 0 ? HTTP_ROUTE_METHOD_NOT_ALLOWED : HTTP_ROUTE_NOT_FOUND;
+}
+
+const char* http_path_param(const HttpRequest* request, const char* name)
+{
+    if (!request || !name)
+        return NULL;
+    
+    for (int i = 0; i < request->param_count; i++) {
+        if (strcmp(request->params[i].name, name) == 0)
+            return request->params[i].value;
+    }
+    return NULL;
+}
@@ -1,108 +1,615 @@
 #include "http_server.h"
+#include "cursor.h"
+#include "frame_source.h"
+#include "frame_history.h"
+#include "image_encode.h"
+#include "image_match.h"
+#include "json.h"
+#include "metrics.h"
+#include "pixel_ops.h"
+#include "recorder.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <sys/stat.h>
 
-// Simple JSON parsing helper for POST requests
-static int parse_json_int(const char* json, const char* key)
+#define WAIT_FOR_DEFAULT_TIMEOUT_MS 5000
+#define WAIT_FOR_MAX_TIMEOUT_MS 60000
+#define MAX_PROBES 64
+#define RESIZE_DEFAULT_TIMEOUT_MS 5000
+#define RESIZE_MAX_TIMEOUT_MS 30000
+#define CLIPBOARD_DEFAULT_TIMEOUT_MS 2000
+#define CLIPBOARD_MAX_TIMEOUT_MS 30000
+#define MAX_INPUT_BATCH 256
+#define INPUT_EVENT_MAX_TOKENS 9    // an event object with up to four keys
+
+// A batch at the limit must not run out of tokens before the limit is checked
+_Static_assert(1 + MAX_INPUT_BATCH * INPUT_EVENT_MAX_TOKENS <= JSON_MAX_TOKENS, "JSON_MAX_TOKENS below a full input batch");
+
+typedef enum {
+    PROBE_COLOR,       // every pixel within tolerance of color (tolerance 0 = exact)
+    PROBE_MEAN,        // report the mean color
+    PROBE_FRACTION,    // fraction of pixels within tolerance, passes at >= min
+    PROBE_BLACK        // every pixel black
+} ProbeOp;
+
+typedef struct {
+    ProbeOp op;
+    FrameRect rect;
+    UINT32 color;
+    BYTE tolerance;
+    double min_fraction;
+} Probe;
+
+typedef struct {
+    int flags;
+    int code;
+} KeyEvent;
+
+typedef struct {
+    int flags;
+    int x;
+    int y;
+} MouseEvent;
+
+typedef struct {
+    const char* template;
+    int x;
+    int y;
+    int width;
+    int height;
+    int timeout_ms;
+    int tolerance;
+} WaitForRequest;
+
+typedef struct {
+    const char* op;
+    int x;
+    int y;
+    int width;
+    int height;
+    const char* color;
+    int tolerance;
+    double min;
+} ProbeSpec;
+
+typedef struct {
+    UINT32 probes;
+} ProbeRequest;
+
+typedef struct {
+    int width;
+    int height;
+    int timeout_ms;
+} ResizeRequest;
+
+// Absent strings stay NULL
+typedef struct {
+    const char* id;
+    const char* host;
+    int port;
+    const char* username;
+    const char* password;
+    const char* domain;
+    UINT32 width;
+    UINT32 height;
+    UINT32 bpp;
+} SessionRequest;
+
+// Decodes the request body in place; the document's strings point into it
+static HttpResponse* parse_json_body(HttpRequest* request, JsonDocument* doc)
+{
+    if (!request->body) {
+        return create_http_response(400, "text/plain", "Missing request body", 20, 0);
+    }
+    
+    if (!json_parse(doc, request->body, request->body_length)) {
+        return create_http_response(400, "text/plain", doc->error, strlen(doc->error), 0);
+    }
+    
+    return NULL;
+}
+
+// Input routes take one event object or an array of them. Every event is
+// bound and range-checked before any is sent, so a bad batch sends nothing.
+static HttpResponse* bind_input_events(HttpRequest* request, JsonDocument* doc, const JsonField* fields,
+                                       size_t field_count, void* events, size_t event_size, UINT32* count)
 {
-    if (!json || !key)
-        return 0;
+    HttpResponse* invalid = parse_json_body(request, doc);
+    if (invalid) {
+        return invalid;
+    }
     
-    char search_key[64];
-    snprintf(search_key, sizeof(search_key), "\"%s\":", key);
+    if (doc->tokens[0].type != JSON_ARRAY) {
+        *count = 1;
+        if (!json_bind(doc, 0, fields, field_count, events)) {
+            return create_http_response(400, "text/plain", doc->error, strlen(doc->error), 0);
+        }
+        return NULL;
+    }
     
-    const char* key_pos = strstr(json, search_key);
-    if (!key_pos)
-        return 0;
+    *count = doc->tokens[0].count;
+    if (*count == 0) {
+        return create_http_response(400, "text/plain", "Empty event batch", 17, 0);
+    }
+    if (*count > MAX_INPUT_BATCH) {
+        char message[64];
+        int length = snprintf(message, sizeof(message), "At most %d events per batch", MAX_INPUT_BATCH);
+        return create_http_response(400, "text/plain", message, (size_t)length, 0);
+    }
     
-    key_pos += strlen(search_key);
+    // Every event starts from the defaults the caller left in the first slot
+    for (UINT32 i = 1; i < *count; i++)
+        memcpy((BYTE*)events + i * event_size, events, event_size);
     
-    // Skip whitespace
-    while (*key_pos == ' ' || *key_pos == '\t')
-        key_pos++;
+    UINT32 token = json_child(doc, 0);
+    for (UINT32 i = 0; i < *count; i++) {
+        if (!json_bind(doc, token, fields, field_count, (BYTE*)events + i * event_size)) {
+            char message[192];
+            int length = snprintf(message, sizeof(message), "Event %u: %s", i, doc->error);
+            return create_http_response(400, "text/plain", message, (size_t)length, 0);
+        }
+        token = json_sibling(doc, token);
+    }
     
-    return atoi(key_pos);
+    return NULL;
 }
 
-HttpResponse* handle_get_screen(RDPClient* client)
+// Screen and input routes need a painted desktop; while the handshake is
+// still running, tell the caller when to retry instead of blocking
+static HttpResponse* check_client_ready(RDPClient* client)
 {
-    if (!client || !client->connected) {
-        return create_http_response(500, "text/plain", "RDP not connected", 17, 0);
+    if (!client) {
+        return create_http_response(500, "text/plain", "No RDP client", 13, 0);
     }
     
-    // Generate temporary filename
-    char temp_filename[256];
-    snprintf(temp_filename, sizeof(temp_filename), "/tmp/rcrdp_screen_%ld.png", time(NULL));
+    RDPConnectProgress progress;
+    rdp_client_get_progress(client, &progress);
+    
+    if (progress.phase == RDP_PHASE_READY && client->connected)
+        return NULL;
     
-    // Take screenshot
-    if (!request_screenshot(client, temp_filename)) {
-        return create_http_response(500, "text/plain", "Screenshot failed", 17, 0);
+    char message[192];
+    int status;
+    if (progress.phase == RDP_PHASE_FAILED) {
+        status = 502;
+        snprintf(message, sizeof(message), "RDP connection failed: %s", progress.error);
+    } else if (progress.phase == RDP_PHASE_IDLE) {
+        status = 500;
+        snprintf(message, sizeof(message), "RDP not connected");
+    } else if (progress.phase == RDP_PHASE_RECONNECTING) {
+        status = 503;
+        snprintf(message, sizeof(message), "RDP reconnecting: %s", progress.error);
+    } else {
+        status = 503;
+        snprintf(message, sizeof(message), "RDP connecting (%s)", rdp_client_phase_name(progress.phase));
     }
     
-    // Read PNG file
-    FILE* fp = fopen(temp_filename, "rb");
-    if (!fp) {
-        return create_http_response(500, "text/plain", "Failed to read screenshot", 25, 0);
+    HttpResponse* response = create_http_response(status, "text/plain", message, strlen(message), 0);
+    if (status == 503)
+        http_response_add_header(response, "Retry-After", "1");
+    return response;
+}
+
+// Reads the optional x, y, width and height query parameters; width and height
+// both select a region, and x/y default to the top-left corner
+static HttpResponse* parse_screen_region(HttpRequest* request, FrameRect* region, BOOL* has_region)
+{
+    int x = 0, y = 0, width = 0, height = 0;
+    if (!http_query_int(request, "x", 0, INT_MAX, &x) || !http_query_int(request, "y", 0, INT_MAX, &y) ||
+        !http_query_int(request, "width", 0, INT_MAX, &width) ||
+        !http_query_int(request, "height", 0, INT_MAX, &height)) {
+        return create_http_response(400, "text/plain", "Invalid region", 14, 0);
     }
     
-    // Get file size
-    fseek(fp, 0, SEEK_END);
-    long file_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    *has_region = width != 0 || height != 0;
+    if (!*has_region)
+        return NULL;
     
-    if (file_size <= 0) {
-        fclose(fp);
-        unlink(temp_filename);
-        return create_http_response(500, "text/plain", "Empty screenshot", 16, 0);
+    if (width == 0 || height == 0) {
+        return create_http_response(400, "text/plain", "Invalid region", 14, 0);
     }
     
-    // Read file content
-    char* png_data = malloc(file_size);
-    if (!png_data) {
-        fclose(fp);
-        unlink(temp_filename);
-        return create_http_response(500, "text/plain", "Memory allocation failed", 24, 0);
+    region->x = (UINT32)x;
+    region->y = (UINT32)y;
+    region->width = (UINT32)width;
+    region->height = (UINT32)height;
+    return NULL;
+}
+
+// Quality of the media range at the start of range, which ends at end;
+// q defaults to 1 and parameters other than q are ignored
+static double accept_quality(const char* range, const char* end)
+{
+    const char* param = memchr(range, ';', (size_t)(end - range));
+    while (param) {
+        param++;
+        while (param < end && (*param == ' ' || *param == '\t'))
+            param++;
+        if (end - param > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+            return strtod(param + 2, NULL);
+        param = memchr(param, ';', (size_t)(end - param));
+    }
+    return 1.0;
+}
+
+// Picks the acceptable format with the highest q, preferring earlier formats
+// on ties. An exact type outranks image/* which outranks */*, as in RFC 9110.
+static BOOL negotiate_image_format(const char* accept, ImageFormat* format)
+{
+    double quality[IMAGE_FORMAT_COUNT];
+    int specificity[IMAGE_FORMAT_COUNT];
+    for (int i = 0; i < IMAGE_FORMAT_COUNT; i++) {
+        quality[i] = 0.0;
+        specificity[i] = -1;
+    }
+    
+    const char* range = accept;
+    while (*range) {
+        const char* end = strchr(range, ',');
+        if (!end)
+            end = range + strlen(range);
+        while (range < end && (*range == ' ' || *range == '\t'))
+            range++;
+        size_t type_length = strcspn(range, ";, \t");
+        if (range + type_length > end)
+            type_length = (size_t)(end - range);
+        
+        double q = accept_quality(range, end);
+        for (int i = 0; i < IMAGE_FORMAT_COUNT; i++) {
+            const char* mime = image_format_mime((ImageFormat)i);
+            int level = -1;
+            if (type_length == strlen(mime) && strncasecmp(range, mime, type_length) == 0)
+                level = 2;
+            else if (type_length == 7 && strncasecmp(range, "image/*", 7) == 0)
+                level = 1;
+            else if (type_length == 3 && strncmp(range, "*/*", 3) == 0)
+                level = 0;
+            if (level > specificity[i]) {
+                specificity[i] = level;
+                quality[i] = q;
+            }
+        }
+        range = *end ? end + 1 : end;
     }
     
-    size_t bytes_read = fread(png_data, 1, file_size, fp);
-    fclose(fp);
-    unlink(temp_filename); // Clean up temp file
+    int best = -1;
+    for (int i = 0; i < IMAGE_FORMAT_COUNT; i++) {
+        if (quality[i] > 0.0 && (best < 0 || quality[i] > quality[best]))
+            best = i;
+    }
+    if (best < 0)
+        return FALSE;
+    *format = (ImageFormat)best;
+    return TRUE;
+}
+
+typedef struct {
+    ImageFormat format;
+    int quality;            // JPEG quality, 0 for lossless formats
+} ImageRequest;
+
+// ?format=png|qoi|jpeg overrides the Accept header; without either the
+// response is PNG. ?quality=1..100 sets the JPEG quality.
+static HttpResponse* parse_image_request(HttpRequest* request, ImageRequest* image)
+{
+    image->format = IMAGE_FORMAT_PNG;
+    image->quality = 0;
     
-    if (bytes_read != (size_t)file_size) {
-        free(png_data);
-        return create_http_response(500, "text/plain", "Failed to read PNG data", 23, 0);
+    const char* format = http_query_value(request, "format");
+    const char* accept = http_header_get(request, "Accept");
+    if (format) {
+        if (!image_format_parse(format, &image->format)) {
+            return create_http_response(400, "text/plain", "Invalid format", 14, 0);
+        }
+    } else if (accept && !negotiate_image_format(accept, &image->format)) {
+        return create_http_response(406, "text/plain", "Supported types: image/png, image/qoi, image/jpeg", 49, 0);
     }
     
-    // Create response with PNG data
-    HttpResponse* response = create_http_response(200, "image/png", png_data, file_size, 1);
-    free(png_data); // create_http_response makes its own copy
+    if (image->format == IMAGE_FORMAT_JPEG) {
+        image->quality = JPEG_DEFAULT_QUALITY;
+        if (!http_query_int(request, "quality", 1, 100, &image->quality)) {
+            return create_http_response(400, "text/plain", "Invalid quality", 15, 0);
+        }
+    }
+    return NULL;
+}
+
+static HttpResponse* create_image_response(const ImageRequest* image, const BYTE* data, size_t length, BOOL cached)
+{
+    HttpResponse* response = create_http_response(200, image_format_mime(image->format), (const char*)data, length, 1);
+    http_response_add_header(response, "Vary", "Accept");
+    http_response_add_header(response, "X-Encode-Cache", cached ? "hit" : "miss");
+    return response;
+}
+
+// The cached encoding for key, or NULL on a miss
+static HttpResponse* get_cached_image(EncodeCache* cache, const EncodeKey* key, const ImageRequest* image)
+{
+    const BYTE* data;
+    size_t length;
+    if (!encode_cache_acquire(cache, key, &data, &length))
+        return NULL;
     
+    HttpResponse* response = create_image_response(image, data, length, TRUE);
+    encode_cache_release(cache);
     return response;
 }
 
-HttpResponse* handle_post_sendkey(RDPClient* client, HttpRequest* request)
+// Encodes pixels as requested and stores the result under key when a cache
+// is given; NULL if encoding fails
+static HttpResponse* encode_image_response(HttpRequest* request, const ImageRequest* image, BYTE* pixels,
+                                           UINT32 width, UINT32 height, UINT32 stride, EncodeCache* cache,
+                                           const EncodeKey* key)
+{
+    BYTE* data = NULL;
+    size_t length = 0;
+    UINT64 convert_ns = 0;
+    UINT64 encode_start = metrics_now_ns();
+    BOOL encoded = encode_image_memory(image->format, image->quality, pixels, width, height, stride, &data, &length,
+                                       &convert_ns);
+    UINT64 encode_ns = metrics_now_ns() - encode_start;
+    request->stage_ns[HTTP_STAGE_CONVERT] = convert_ns;
+    request->stage_ns[HTTP_STAGE_ENCODE] = encode_ns > convert_ns ? encode_ns - convert_ns : 0;
+    if (!encoded)
+        return NULL;
+    
+    if (cache)
+        encode_cache_put(cache, key, data, length);
+    HttpResponse* response = create_image_response(image, data, length, FALSE);
+    free(data); // create_http_response makes its own copy
+    return response;
+}
+
+// /screen?ago=<ms> or ?generation=<n>: a past frame rebuilt from the history,
+// which never waits for or touches the live frame
+static HttpResponse* get_screen_from_history(RDPClient* client, HttpRequest* request, const FrameRect* region,
+                                             BOOL has_region, const ImageRequest* image)
 {
-    if (!client || !client->connected) {
-        return create_http_response(500, "text/plain", "RDP not connected", 17, 0);
+    if (!client->history) {
+        return create_http_response(404, "text/plain", "Frame history disabled", 22, 0);
     }
     
-    if (!request->body) {
-        return create_http_response(400, "text/plain", "Missing request body", 20, 0);
+    char value[32];
+    FrameHistoryLookup lookup;
+    UINT64 target;
+    if (http_query_get(request, "generation", value, sizeof(value))) {
+        char* end = NULL;
+        target = strtoull(value, &end, 10);
+        if (!value[0] || *end) {
+            return create_http_response(400, "text/plain", "Invalid generation", 18, 0);
+        }
+        lookup = HISTORY_BY_GENERATION;
+    } else {
+        int ago = -1;
+        UINT64 now = get_time_ms();
+        if (!http_query_int(request, "ago", 0, INT_MAX, &ago) || ago < 0) {
+            return create_http_response(400, "text/plain", "Invalid ago", 11, 0);
+        }
+        target = (UINT64)ago < now ? now - (UINT64)ago : 0;
+        lookup = HISTORY_BY_PAINT_TIME;
+    }
+    
+    BYTE* buffer = NULL;
+    UINT32 width, height, stride;
+    UINT64 generation = 0, paint_ms = 0;
+    const char* error = NULL;
+    UINT64 snapshot_start = metrics_now_ns();
+    if (!frame_history_get(client->history, lookup, target, &buffer, &width, &height, &stride, &generation,
+                           &paint_ms, &error)) {
+        return create_http_response(404, "text/plain", error, strlen(error), 0);
+    }
+    request->stage_ns[HTTP_STAGE_SNAPSHOT] = metrics_now_ns() - snapshot_start;
+    
+    // Regions are encoded in place from the rebuilt frame
+    BYTE* pixels = buffer;
+    if (has_region) {
+        if (region->x + region->width > width || region->y + region->height > height) {
+            free(buffer);
+            return create_http_response(400, "text/plain", "Region outside desktop", 22, 0);
+        }
+        pixels = buffer + (size_t)region->y * stride + (size_t)region->x * 4;
+        width = region->width;
+        height = region->height;
+    }
+    
+    // History frames share generations, and so cache entries, with live ones
+    EncodeKey key = { generation, image->format, image->quality, { 0, 0, 0, 0 }, 0 };
+    if (has_region)
+        key.rect = *region;
+    HttpResponse* response = get_cached_image(client->encode_cache, &key, image);
+    if (!response)
+        response = encode_image_response(request, image, pixels, width, height, stride, client->encode_cache, &key);
+    free(buffer);
+    
+    if (!response) {
+        return create_http_response(500, "text/plain", "Failed to encode image", 22, 0);
+    }
+    
+    snprintf(value, sizeof(value), "%llu", (unsigned long long)generation);
+    http_response_add_header(response, "X-Frame-Generation", value);
+    snprintf(value, sizeof(value), "%llu", (unsigned long long)(get_time_ms() - paint_ms));
+    http_response_add_header(response, "X-Frame-Age", value);
+    http_response_add_header(response, "X-Frame-History", "true");
+    
+    return response;
+}
+
+HttpResponse* handle_get_screen(RDPClient* client, HttpRequest* request)
+{
+    FrameRect region = { 0, 0, 0, 0 };
+    BOOL has_region = FALSE;
+    HttpResponse* invalid = parse_screen_region(request, &region, &has_region);
+    if (invalid) {
+        return invalid;
     }
     
-    // Parse JSON: {"flags": 1, "code": 65}
-    int flags = parse_json_int(request->body, "flags");
-    int code = parse_json_int(request->body, "code");
+    ImageRequest image;
+    invalid = parse_image_request(request, &image);
+    if (invalid) {
+        return invalid;
+    }
     
-    if (flags == 0 && code == 0) {
-        return create_http_response(400, "text/plain", "Invalid flags or code", 21, 0);
+    // The pointer is only known for the live screen
+    int with_cursor = 0;
+    if (!http_query_int(request, "cursor", 0, 1, &with_cursor)) {
+        return create_http_response(400, "text/plain", "Invalid cursor", 14, 0);
     }
     
-    if (!execute_sendkey(client, (DWORD)flags, (DWORD)code)) {
-        return create_http_response(500, "text/plain", "Failed to send key", 18, 0);
+    char unused[32];
+    if (http_query_get(request, "ago", unused, sizeof(unused)) ||
+        http_query_get(request, "generation", unused, sizeof(unused))) {
+        if (with_cursor) {
+            return create_http_response(400, "text/plain", "cursor is only supported for the live screen", 44, 0);
+        }
+        return get_screen_from_history(client, request, &region, has_region, &image);
+    }
+    
+    int fresh = 0;
+    if (!http_query_int(request, "fresh", 0, 1, &fresh)) {
+        return create_http_response(400, "text/plain", "Invalid fresh", 13, 0);
+    }
+    
+    // While reconnecting, the last good frame is served and flagged as stale;
+    // a forced refresh needs a live connection
+    UINT32 frame_width, frame_height;
+    RDPConnectPhase phase = rdp_client_get_phase(client);
+    BOOL stale = !fresh &&
+                 (phase == RDP_PHASE_RECONNECTING || (phase == RDP_PHASE_FIRST_FRAME && client->connected)) &&
+                 get_frame_size(client, &frame_width, &frame_height);
+    
+    if (!stale) {
+        HttpResponse* not_ready = check_client_ready(client);
+        if (not_ready) {
+            return not_ready;
+        }
+        
+        // Resumes display updates if the session went idle
+        rdp_client_note_consumer(client);
+    }
+    
+    if (has_region) {
+        UINT32 desktop_width, desktop_height;
+        get_desktop_size(client, &desktop_width, &desktop_height);
+        if (region.x + region.width > desktop_width || region.y + region.height > desktop_height) {
+            return create_http_response(400, "text/plain", "Region outside desktop", 22, 0);
+        }
+    }
+    
+    // Refresh Rect makes the server repaint the area; wait for the paint covering it
+    BOOL refreshed = FALSE;
+    if (fresh)
+        refreshed = rdp_client_refresh_frame(client, has_region ? &region : NULL, FRESH_FRAME_TIMEOUT_MS);
+    
+    // A poller asking again before the next paint gets the encoding made for
+    // the previous request without copying the frame
+    EncodeKey key = { get_frame_generation(client), image.format, image.quality, { 0, 0, 0, 0 }, 0 };
+    if (has_region)
+        key.rect = region;
+    CursorInfo cursor;
+    if (with_cursor && rdp_cursor_get_info(client->cursor, &cursor)) {
+        FrameRect area = region;
+        if (!has_region)
+            get_frame_size(client, &area.width, &area.height);
+        key.cursor = cursor_info_key(&cursor, &area);
+    }
+    UINT64 generation = key.generation;
+    HttpResponse* response = get_cached_image(client->encode_cache, &key, &image);
+    
+    // A hit before any non-blank frame can only be one served after the wait gave up
+    int retries = 0;
+    ScreenshotResult result = SCREENSHOT_SUCCESS;
+    if (response && !stale && !fresh && !client->nonblank_frame_seen)
+        result = SCREENSHOT_BLACK;
+    
+    if (!response) {
+        // Wait a bounded time for a non-blank frame
+        if (!stale && !fresh)
+            result = wait_for_nonblank_frame(client, client->blank_frame_timeout_ms, &retries);
+        if (result == SCREENSHOT_ERROR) {
+            return create_http_response(500, "text/plain", "Screenshot failed", 17, 0);
+        }
+        
+        BYTE* buffer = NULL;
+        UINT32 width, height, stride;
+        UINT64 snapshot_start = metrics_now_ns();
+        BOOL captured;
+        if (has_region) {
+            captured = get_frame_region(client, &region, &buffer, &stride, &generation);
+            width = region.width;
+            height = region.height;
+        } else {
+            captured = get_latest_frame(client, &buffer, &width, &height, &stride, &generation);
+        }
+        if (!captured) {
+            return create_http_response(500, "text/plain", "Screenshot failed", 17, 0);
+        }
+        request->stage_ns[HTTP_STAGE_SNAPSHOT] = metrics_now_ns() - snapshot_start;
+        
+        // Blended into the private copy, never the shared frame buffer
+        if (with_cursor) {
+            FrameRect area = { region.x, region.y, width, height };
+            key.cursor = rdp_cursor_draw(client->cursor, buffer, stride, &area);
+        }
+        
+        // The frame and the cursor may have moved on since the lookup; store what was copied
+        key.generation = generation;
+        response = encode_image_response(request, &image, buffer, width, height, stride, client->encode_cache, &key);
+        free(buffer);
+        
+        if (!response) {
+            return create_http_response(500, "text/plain", "Failed to encode image", 22, 0);
+        }
+    }
+    
+    // Report whether the frame was still blank when the wait bound expired
+    char retries_text[16];
+    snprintf(retries_text, sizeof(retries_text), "%d", retries);
+    http_response_add_header(response, "X-Screenshot-Result", result == SCREENSHOT_BLACK ? "black" : "ok");
+    http_response_add_header(response, "X-Screenshot-Retries", retries_text);
+    http_response_add_header(response, "X-Frame-Stale", stale ? "true" : "false");
+    if (fresh)
+        http_response_add_header(response, "X-Frame-Fresh", refreshed ? "true" : "false");
+    
+    // Milliseconds since the EndPaint that produced this frame
+    UINT64 paint_ms;
+    if (get_frame_paint_time(client, generation, &paint_ms)) {
+        char age_text[24];
+        snprintf(age_text, sizeof(age_text), "%llu", (unsigned long long)(get_time_ms() - paint_ms));
+        http_response_add_header(response, "X-Frame-Age", age_text);
+    }
+    
+    return response;
+}
+
+HttpResponse* handle_post_sendkey(RDPClient* client, HttpRequest* request)
+{
+    HttpResponse* not_ready = check_client_ready(client);
+    if (not_ready) {
+        return not_ready;
+    }
+    
+    // {"flags": 1, "code": 65} or an array of them; flags default to 0
+    static const JsonField fields[] = {
+        JSON_OPTIONAL(KeyEvent, flags, JSON_FIELD_INT, 0, 0xFFFF),
+        JSON_REQUIRED(KeyEvent, code, JSON_FIELD_INT, 0, 0xFFFF),
+    };
+    KeyEvent events[MAX_INPUT_BATCH] = { { 0 } };
+    UINT32 count;
+    JsonDocument doc;
+    HttpResponse* invalid = bind_input_events(request, &doc, fields, sizeof(fields) / sizeof(fields[0]), events, sizeof(KeyEvent),
+                                              &count);
+    if (invalid) {
+        return invalid;
+    }
+    
+    for (UINT32 i = 0; i < count; i++) {
+        if (!execute_sendkey(client, (DWORD)events[i].flags, (DWORD)events[i].code)) {
+            return create_http_response(500, "text/plain", "Failed to send key", 18, 0);
+        }
     }
     
     return create_http_response(200, "text/plain", "OK", 2, 0);
@@ -110,21 +617,30 @@ HttpResponse* handle_post_sendkey(RDPClient* client, HttpRequest* request)
 
 HttpResponse* handle_post_sendmouse(RDPClient* client, HttpRequest* request)
 {
-    if (!client || !client->connected) {
-        return create_http_response(500, "text/plain", "RDP not connected", 17, 0);
+    HttpResponse* not_ready = check_client_ready(client);
+    if (not_ready) {
+        return not_ready;
     }
     
-    if (!request->body) {
-        return create_http_response(400, "text/plain", "Missing request body", 20, 0);
+    // {"flags": 4096, "x": 100, "y": 200} or an array of them
+    static const JsonField fields[] = {
+        JSON_REQUIRED(MouseEvent, flags, JSON_FIELD_INT, 0, 0xFFFF),
+        JSON_REQUIRED(MouseEvent, x, JSON_FIELD_INT, 0, 0xFFFF),
+        JSON_REQUIRED(MouseEvent, y, JSON_FIELD_INT, 0, 0xFFFF),
+    };
+    MouseEvent events[MAX_INPUT_BATCH];
+    UINT32 count;
+    JsonDocument doc;
+    HttpResponse* invalid = bind_input_events(request, &doc, fields, sizeof(fields) / sizeof(fields[0]), events,
+                                              sizeof(MouseEvent), &count);
+    if (invalid) {
+        return invalid;
     }
     
-    // Parse JSON: {"flags": 4096, "x": 100, "y": 200}
-    int flags = parse_json_int(request->body, "flags");
-    int x = parse_json_int(request->body, "x");
-    int y = parse_json_int(request->body, "y");
-    
-    if (!execute_sendmouse(client, (DWORD)flags, (UINT16)x, (UINT16)y)) {
-        return create_http_response(500, "text/plain", "Failed to send mouse event", 27, 0);
+    for (UINT32 i = 0; i < count; i++) {
+        if (!execute_sendmouse(client, (DWORD)events[i].flags, (UINT16)events[i].x, (UINT16)events[i].y)) {
+            return create_http_response(500, "text/plain", "Failed to send mouse event", 27, 0);
+        }
     }
     
     return create_http_response(200, "text/plain", "OK", 2, 0);
@@ -132,20 +648,29 @@ HttpResponse* handle_post_sendmouse(RDPClient* client, HttpRequest* request)
 
 HttpResponse* handle_post_movemouse(RDPClient* client, HttpRequest* request)
 {
-    if (!client || !client->connected) {
-        return create_http_response(500, "text/plain", "RDP not connected", 17, 0);
+    HttpResponse* not_ready = check_client_ready(client);
+    if (not_ready) {
+        return not_ready;
     }
     
-    if (!request->body) {
-        return create_http_response(400, "text/plain", "Missing request body", 20, 0);
+    // {"x": 100, "y": 200} or an array of them
+    static const JsonField fields[] = {
+        JSON_REQUIRED(MouseEvent, x, JSON_FIELD_INT, 0, 0xFFFF),
+        JSON_REQUIRED(MouseEvent, y, JSON_FIELD_INT, 0, 0xFFFF),
+    };
+    MouseEvent events[MAX_INPUT_BATCH];
+    UINT32 count;
+    JsonDocument doc;
+    HttpResponse* invalid = bind_input_events(request, &doc, fields, sizeof(fields) / sizeof(fields[0]), events,
+                                              sizeof(MouseEvent), &count);
+    if (invalid) {
+        return invalid;
     }
     
-    // Parse JSON: {"x": 100, "y": 200}
-    int x = parse_json_int(request->body, "x");
-    int y = parse_json_int(request->body, "y");
-    
-    if (!execute_movemouse(client, (UINT16)x, (UINT16)y)) {
-        return create_http_response(500, "text/plain", "Failed to move mouse", 20, 0);
+    for (UINT32 i = 0; i < count; i++) {
+        if (!execute_movemouse(client, (UINT16)events[i].x, (UINT16)events[i].y)) {
+            return create_http_response(500, "text/plain", "Failed to move mouse", 20, 0);
+        }
     }
     
     return create_http_response(200, "text/plain", "OK", 2, 0);
@@ -157,18 +682,873 @@ HttpResponse* handle_get_status(RDPClient* client)
         return create_http_response(500, "text/plain", "No RDP client", 13, 0);
     }
     
-    char status_json[512];
+    RDPConnectProgress progress;
+    rdp_client_get_progress(client, &progress);
+    
+    // Per-phase timings; the current phase reports time spent so far
+    char timings[256];
+    size_t timings_length = 0;
+    for (int phase = RDP_PHASE_TCP; phase <= RDP_PHASE_FIRST_FRAME; phase++) {
+        timings_length += (size_t)snprintf(timings + timings_length, sizeof(timings) - timings_length,
+            "%s\"%s\": %llu",
+            phase > RDP_PHASE_TCP ? "," : "",
+            rdp_client_phase_name((RDPConnectPhase)phase),
+            (unsigned long long)progress.phase_ms[phase]);
+    }
+    
+    // Graphics pipeline: requested mode, negotiated version and codecs used so far
+    RDPGfxInfo gfx;
+    rdp_client_get_gfx_info(client, &gfx);
+    char codecs[256];
+    size_t codecs_length = 0;
+    codecs[0] = '\0';
+    for (UINT32 codec_id = 0; codec_id < 32; codec_id++) {
+        const char* name = rdp_gfx_codec_name(codec_id);
+        if (!(gfx.codecs_seen & (1u << codec_id)) || !name)
+            continue;
+        codecs_length += (size_t)snprintf(codecs + codecs_length, sizeof(codecs) - codecs_length,
+            "%s\"%s\"", codecs_length > 0 ? "," : "", name);
+    }
+    
+    // AVC is negotiated by version: 8.1 opts in with a flag, 10.x opts out
+    BOOL avc = FALSE;
+    if (gfx.caps_version == RDPGFX_CAPVERSION_81)
+        avc = (gfx.caps_flags & RDPGFX_CAPS_FLAG_AVC420_ENABLED) != 0;
+    else if (gfx.caps_version >= RDPGFX_CAPVERSION_10)
+        avc = (gfx.caps_flags & RDPGFX_CAPS_FLAG_AVC_DISABLED) == 0;
+    
+    RDPReconnectStats reconnect;
+    rdp_client_get_reconnect_stats(client, &reconnect);
+    
+    RDPIdleInfo idle;
+    rdp_client_get_idle_info(client, &idle);
+    
+    FrameHistoryStats history;
+    memset(&history, 0, sizeof(history));
+    if (client->history)
+        frame_history_get_stats(client->history, &history);
+    
+    // The error comes from FreeRDP and the names from the caller; either may hold quotes
+    char error[sizeof(progress.error) * 2];
+    char hostname[256];
+    char username[256];
+    
+    char status_json[4096];
     snprintf(status_json, sizeof(status_json),
         "{"
         "\"connected\": %s,"
+        "\"ready\": %s,"
+        "\"source\": \"%s\","
+        "\"phase\": \"%s\","
+        "\"state\": \"%s\","
+        "\"phase_ms\": {%s},"
+        "\"error\": \"%s\","
+        "\"gfx\": {\"mode\": \"%s\",\"active\": %s,\"version\": \"%s\",\"avc\": %s,"
+        "\"h264_decoder\": %s,\"codecs\": [%s]},"
+        "\"reconnect\": {\"disconnects\": %u,\"attempts\": %u,\"successes\": %u,\"cookie\": %s,"
+        "\"last_ms\": %llu,\"total_ms\": %llu},"
+        "\"idle\": {\"timeout_ms\": %u,\"idle_ms\": %llu,\"output_suppressed\": %s,\"suppressions\": %u},"
+        "\"history\": {\"budget_bytes\": %zu,\"bytes\": %zu,\"frames\": %u,\"oldest_generation\": %llu,"
+        "\"newest_generation\": %llu,\"span_ms\": %llu},"
         "\"hostname\": \"%s\","
         "\"port\": %d,"
         "\"username\": \"%s\""
         "}",
         client->connected ? "true" : "false",
-        client->hostname ? client->hostname : "",
+        progress.phase == RDP_PHASE_READY ? "true" : "false",
+        frame_source_name(client->source),
+        rdp_client_phase_name(progress.phase),
+        freerdp_state_string(freerdp_get_state(&client->context->context)),
+        timings,
+        json_escape(progress.error, error, sizeof(error)),
+        rdp_gfx_mode_name(gfx.mode),
+        gfx.active ? "true" : "false",
+        gfx.caps_version ? rdp_gfx_version_name(gfx.caps_version) : "",
+        avc ? "true" : "false",
+        rdp_h264_available() ? "true" : "false",
+        codecs,
+        reconnect.disconnects,
+        reconnect.attempts,
+        reconnect.successes,
+        reconnect.cookie ? "true" : "false",
+        (unsigned long long)reconnect.last_duration_ms,
+        (unsigned long long)reconnect.total_duration_ms,
+        idle.timeout_ms,
+        (unsigned long long)idle.idle_ms,
+        idle.suppressed ? "true" : "false",
+        idle.suppress_count,
+        history.budget_bytes,
+        history.bytes,
+        history.frames,
+        (unsigned long long)history.oldest_generation,
+        (unsigned long long)history.newest_generation,
+        (unsigned long long)history.span_ms,
+        json_escape(client->hostname, hostname, sizeof(hostname)),
         client->port,
-        client->username ? client->username : "");
+        json_escape(client->username, username, sizeof(username)));
     
     return create_http_response(200, "application/json", status_json, strlen(status_json), 0);
-}
\ No newline at end of file
+}
+
+HttpResponse* handle_post_wait_for(RDPClient* client, HttpRequest* request)
+{
+    HttpResponse* not_ready = check_client_ready(client);
+    if (not_ready) {
+        return not_ready;
+    }
+    rdp_client_note_consumer(client);
+    
+    // {"template": "<base64 PNG>", "x": 0, "y": 0, "width": 200, "height": 100,
+    //  "timeout_ms": 5000, "tolerance": 0}; width/height 0 mean to the desktop edge
+    static const JsonField fields[] = {
+        JSON_REQUIRED(WaitForRequest, template, JSON_FIELD_STRING, 0, 0),
+        JSON_OPTIONAL(WaitForRequest, x, JSON_FIELD_INT, 0, 0xFFFF),
+        JSON_OPTIONAL(WaitForRequest, y, JSON_FIELD_INT, 0, 0xFFFF),
+        JSON_OPTIONAL(WaitForRequest, width, JSON_FIELD_INT, 0, 0xFFFF),
+        JSON_OPTIONAL(WaitForRequest, height, JSON_FIELD_INT, 0, 0xFFFF),
+        JSON_OPTIONAL(WaitForRequest, timeout_ms, JSON_FIELD_INT, 0, INT32_MAX),
+        JSON_OPTIONAL(WaitForRequest, tolerance, JSON_FIELD_INT, 0, 255),
+    };
+    WaitForRequest wait = { 0 };
+    JsonDocument doc;
+    HttpResponse* invalid = parse_json_body(request, &doc);
+    if (invalid) {
+        return invalid;
+    }
+    if (!json_bind(&doc, 0, fields, sizeof(fields) / sizeof(fields[0]), &wait)) {
+        return create_http_response(400, "text/plain", doc.error, strlen(doc.error), 0);
+    }
+    
+    const char* encoded = wait.template;
+    size_t encoded_length = strlen(encoded);
+    if (encoded_length == 0) {
+        return create_http_response(400, "text/plain", "Missing template", 16, 0);
+    }
+    
+    size_t png_size = encoded_length / 4 * 3 + 3;
+    BYTE* png_data = malloc(png_size);
+    if (!png_data) {
+        return create_http_response(500, "text/plain", "Memory allocation failed", 24, 0);
+    }
+    
+    size_t png_length = base64_decode(encoded, encoded_length, png_data, png_size);
+    ImageTemplate image;
+    BOOL decoded = png_length > 0 && decode_png_memory(png_data, png_length, &image);
+    free(png_data);
+    
+    if (!decoded) {
+        return create_http_response(400, "text/plain", "Invalid template PNG", 20, 0);
+    }
+    
+    UINT32 frame_width, frame_height;
+    if (!get_frame_size(client, &frame_width, &frame_height)) {
+        free_image_template(&image);
+        return create_http_response(500, "text/plain", "No frame available", 18, 0);
+    }
+    
+    // Region defaults to the whole desktop and is clamped to it
+    int x = wait.x;
+    int y = wait.y;
+    int width = wait.width;
+    int height = wait.height;
+    if ((UINT32)x >= frame_width || (UINT32)y >= frame_height) {
+        free_image_template(&image);
+        return create_http_response(400, "text/plain", "Region outside desktop", 22, 0);
+    }
+    if (width <= 0 || (UINT32)(x + width) > frame_width)
+        width = (int)frame_width - x;
+    if (height <= 0 || (UINT32)(y + height) > frame_height)
+        height = (int)frame_height - y;
+    FrameRect region = { (UINT32)x, (UINT32)y, (UINT32)width, (UINT32)height };
+    
+    if (image.width > region.width || image.height > region.height) {
+        free_image_template(&image);
+        return create_http_response(400, "text/plain", "Template larger than region", 27, 0);
+    }
+    
+    int timeout_ms = wait.timeout_ms;
+    if (timeout_ms == 0)
+        timeout_ms = WAIT_FOR_DEFAULT_TIMEOUT_MS;
+    if (timeout_ms > WAIT_FOR_MAX_TIMEOUT_MS)
+        timeout_ms = WAIT_FOR_MAX_TIMEOUT_MS;
+    
+    UINT64 start_ms = get_time_ms();
+    UINT64 deadline_ms = start_ms + (UINT64)timeout_ms;
+    UINT64 generation = 0;
+    UINT32 searches = 0;
+    UINT32 match_x = 0, match_y = 0;
+    BOOL found = FALSE;
+    
+    for (;;) {
+        // Search the region as it looks right now
+        BYTE* pixels = NULL;
+        UINT32 stride = 0;
+        if (!get_frame_region(client, &region, &pixels, &stride, &generation))
+            break;
+        
+        found = find_template(pixels, region.width, region.height, stride, &image,
+                              (BYTE)wait.tolerance, &match_x, &match_y);
+        free(pixels);
+        searches++;
+        if (found)
+            break;
+        
+        // Sleep until a paint touches the region; paints elsewhere are skipped
+        BOOL region_changed = FALSE;
+        while (!region_changed) {
+            UINT64 now_ms = get_time_ms();
+            if (now_ms >= deadline_ms || !client->connected)
+                break;
+            
+            UINT64 latest;
+            if (!wait_for_frame_generation(client, generation, (UINT32)(deadline_ms - now_ms), &latest))
+                break;
+            
+            FrameRect damage;
+            if (get_frame_damage_since(client, generation, &damage))
+                region_changed = frame_rect_intersects(&damage, &region);
+            generation = latest;
+        }
+        
+        if (!region_changed)
+            break;
+    }
+    
+    free_image_template(&image);
+    
+    char result_json[256];
+    snprintf(result_json, sizeof(result_json),
+        "{"
+        "\"found\": %s,"
+        "\"x\": %u,"
+        "\"y\": %u,"
+        "\"generation\": %llu,"
+        "\"searches\": %u,"
+        "\"elapsed_ms\": %llu"
+        "}",
+        found ? "true" : "false",
+        found ? region.x + match_x : 0,
+        found ? region.y + match_y : 0,
+        (unsigned long long)generation,
+        searches,
+        (unsigned long long)(get_time_ms() - start_ms));
+    
+    return create_http_response(200, "application/json", result_json, strlen(result_json), 0);
+}
+
+// Parse "#rrggbb" / "rrggbb" into 0x00RRGGBB
+static BOOL parse_color(const char* value, size_t length, UINT32* color)
+{
+    if (length > 0 && value[0] == '#') {
+        value++;
+        length--;
+    }
+    if (length != 6)
+        return FALSE;
+    
+    char hex[7];
+    memcpy(hex, value, 6);
+    hex[6] = '\0';
+    
+    char* end = NULL;
+    unsigned long parsed = strtoul(hex, &end, 16);
+    if (*end != '\0')
+        return FALSE;
+    
+    *color = (UINT32)parsed;
+    return TRUE;
+}
+
+static const char* parse_probe(JsonDocument* doc, UINT32 object, UINT32 frame_width, UINT32 frame_height,
+                               Probe* probe)
+{
+    static const JsonField fields[] = {
+        JSON_REQUIRED(ProbeSpec, op, JSON_FIELD_STRING, 0, 0),
+        JSON_OPTIONAL(ProbeSpec, x, JSON_FIELD_INT, 0, 0xFFFF),
+        JSON_OPTIONAL(ProbeSpec, y, JSON_FIELD_INT, 0, 0xFFFF),
+        JSON_OPTIONAL(ProbeSpec, width, JSON_FIELD_INT, 0, 0xFFFF),
+        JSON_OPTIONAL(ProbeSpec, height, JSON_FIELD_INT, 0, 0xFFFF),
+        JSON_OPTIONAL(ProbeSpec, color, JSON_FIELD_STRING, 0, 0),
+        JSON_OPTIONAL(ProbeSpec, tolerance, JSON_FIELD_INT, 0, 255),
+        JSON_OPTIONAL(ProbeSpec, min, JSON_FIELD_DOUBLE, 0, 0),
+    };
+    ProbeSpec spec = { .min = 1.0 };
+    if (!json_bind(doc, object, fields, sizeof(fields) / sizeof(fields[0]), &spec))
+        return doc->error;
+    
+    memset(probe, 0, sizeof(Probe));
+    
+    if (strcmp(spec.op, "color") == 0)
+        probe->op = PROBE_COLOR;
+    else if (strcmp(spec.op, "mean") == 0)
+        probe->op = PROBE_MEAN;
+    else if (strcmp(spec.op, "fraction") == 0)
+        probe->op = PROBE_FRACTION;
+    else if (strcmp(spec.op, "black") == 0)
+        probe->op = PROBE_BLACK;
+    else
+        return "Unknown probe op";
+    
+    // A probe without width/height is a single pixel
+    UINT32 width = spec.width > 0 ? (UINT32)spec.width : 1;
+    UINT32 height = spec.height > 0 ? (UINT32)spec.height : 1;
+    if ((UINT32)spec.x + width > frame_width || (UINT32)spec.y + height > frame_height)
+        return "Probe outside desktop";
+    
+    probe->rect.x = (UINT32)spec.x;
+    probe->rect.y = (UINT32)spec.y;
+    probe->rect.width = width;
+    probe->rect.height = height;
+    
+    if (probe->op == PROBE_COLOR || probe->op == PROBE_FRACTION) {
+        if (!spec.color || !parse_color(spec.color, strlen(spec.color), &probe->color))
+            return "Probe color must be \"#rrggbb\"";
+    }
+    
+    probe->tolerance = (BYTE)spec.tolerance;
+    probe->min_fraction = spec.min;
+    
+    return NULL;
+}
+
+HttpResponse* handle_post_probe(RDPClient* client, HttpRequest* request)
+{
+    HttpResponse* not_ready = check_client_ready(client);
+    if (not_ready) {
+        return not_ready;
+    }
+    rdp_client_note_consumer(client);
+    
+    // {"probes": [{"op": "color", "x": 10, "y": 20, "color": "#00ff00", "tolerance": 8}, ...]}
+    static const JsonField fields[] = {
+        JSON_REQUIRED(ProbeRequest, probes, JSON_FIELD_ARRAY, 0, 0),
+    };
+    ProbeRequest probe_request = { 0 };
+    JsonDocument doc;
+    HttpResponse* invalid = parse_json_body(request, &doc);
+    if (invalid) {
+        return invalid;
+    }
+    if (!json_bind(&doc, 0, fields, sizeof(fields) / sizeof(fields[0]), &probe_request)) {
+        return create_http_response(400, "text/plain", doc.error, strlen(doc.error), 0);
+    }
+    
+    int probe_count = (int)doc.tokens[probe_request.probes].count;
+    if (probe_count == 0) {
+        return create_http_response(400, "text/plain", "Empty probes array", 18, 0);
+    }
+    if (probe_count > MAX_PROBES) {
+        return create_http_response(400, "text/plain", "Too many probes", 15, 0);
+    }
+    
+    UINT32 frame_width, frame_height;
+    if (!get_frame_size(client, &frame_width, &frame_height)) {
+        return create_http_response(500, "text/plain", "No frame available", 18, 0);
+    }
+    
+    Probe probes[MAX_PROBES];
+    UINT32 object = json_child(&doc, probe_request.probes);
+    for (int i = 0; i < probe_count; i++) {
+        const char* error = parse_probe(&doc, object, frame_width, frame_height, &probes[i]);
+        if (error) {
+            char message[192];
+            int length = snprintf(message, sizeof(message), "Probe %d: %s", i, error);
+            return create_http_response(400, "text/plain", message, (size_t)length, 0);
+        }
+        object = json_sibling(&doc, object);
+    }
+    
+    // Evaluate every probe against the same frame, without copying it
+    PixelStats stats[MAX_PROBES];
+    FrameView view;
+    if (!acquire_frame_view(client, &view)) {
+        return create_http_response(500, "text/plain", "No frame available", 18, 0);
+    }
+    
+    if (view.width != frame_width || view.height != frame_height) {
+        release_frame_view(client, &view);
+        return create_http_response(409, "text/plain", "Desktop size changed", 20, 0);
+    }
+    
+    BOOL black[MAX_PROBES];
+    for (int i = 0; i < probe_count; i++) {
+        if (probes[i].op == PROBE_BLACK) {
+            // Uniform check exits at the first differing block
+            UINT32 color = 0;
+            black[i] = pixel_rect_is_uniform(view.data, view.stride, &probes[i].rect, &color) && color == 0;
+        } else {
+            pixel_rect_stats(view.data, view.stride, &probes[i].rect, probes[i].color,
+                             probes[i].tolerance, &stats[i]);
+        }
+    }
+    
+    UINT64 generation = view.generation;
+    release_frame_view(client, &view);
+    
+    // Build JSON response
+    size_t capacity = 128 + (size_t)probe_count * 96;
+    char* result_json = malloc(capacity);
+    if (!result_json) {
+        return create_http_response(500, "text/plain", "Memory allocation failed", 24, 0);
+    }
+    
+    size_t length = (size_t)snprintf(result_json, capacity,
+        "{\"generation\": %llu,\"results\": [", (unsigned long long)generation);
+    
+    for (int i = 0; i < probe_count; i++) {
+        const PixelStats* st = &stats[i];
+        const char* separator = i > 0 ? "," : "";
+        
+        switch (probes[i].op) {
+            case PROBE_MEAN: {
+                UINT32 mean = (UINT32)((st->sum_r / st->count) << 16 | (st->sum_g / st->count) << 8 |
+                                       (st->sum_b / st->count));
+                length += (size_t)snprintf(result_json + length, capacity - length,
+                    "%s{\"pass\": true,\"mean\": \"#%06x\"}", separator, mean);
+                break;
+            }
+            case PROBE_BLACK:
+                length += (size_t)snprintf(result_json + length, capacity - length,
+                    "%s{\"pass\": %s}", separator, black[i] ? "true" : "false");
+                break;
+            default: {
+                double fraction = (double)st->matching / (double)st->count;
+                BOOL pass = probes[i].op == PROBE_FRACTION ? fraction >= probes[i].min_fraction
+                                                            : st->matching == st->count;
+                length += (size_t)snprintf(result_json + length, capacity - length,
+                    "%s{\"pass\": %s,\"fraction\": %.4f}", separator, pass ? "true" : "false", fraction);
+                break;
+            }
+        }
+    }
+    
+    length += (size_t)snprintf(result_json + length, capacity - length, "]}");
+    
+    HttpResponse* response = create_http_response(200, "application/json", result_json, length, 0);
+    free(result_json);
+    return response;
+}
+
+HttpResponse* handle_post_resize(RDPClient* client, HttpRequest* request)
+{
+    HttpResponse* not_ready = check_client_ready(client);
+    if (not_ready) {
+        return not_ready;
+    }
+    
+    // {"width": 1280, "height": 720, "timeout_ms": 5000}
+    static const JsonField fields[] = {
+        JSON_REQUIRED(ResizeRequest, width, JSON_FIELD_INT, 1, 0xFFFF),
+        JSON_REQUIRED(ResizeRequest, height, JSON_FIELD_INT, 1, 0xFFFF),
+        JSON_OPTIONAL(ResizeRequest, timeout_ms, JSON_FIELD_INT, 0, INT32_MAX),
+    };
+    ResizeRequest resize = { 0 };
+    JsonDocument doc;
+    HttpResponse* invalid = parse_json_body(request, &doc);
+    if (invalid) {
+        return invalid;
+    }
+    if (!json_bind(&doc, 0, fields, sizeof(fields) / sizeof(fields[0]), &resize)) {
+        return create_http_response(400, "text/plain", doc.error, strlen(doc.error), 0);
+    }
+    
+    int width = resize.width;
+    int height = resize.height;
+    int timeout_ms = resize.timeout_ms;
+    if (timeout_ms == 0)
+        timeout_ms = RESIZE_DEFAULT_TIMEOUT_MS;
+    if (timeout_ms > RESIZE_MAX_TIMEOUT_MS)
+        timeout_ms = RESIZE_MAX_TIMEOUT_MS;
+    
+    const char* error = NULL;
+    if (!rdp_client_resize(client, (UINT32)width, (UINT32)height, &error)) {
+        int status = strcmp(error, "Display control channel not available") == 0 ? 409 : 400;
+        return create_http_response(status, "text/plain", error, strlen(error), 0);
+    }
+    
+    // The server answers with a desktop resize and a repaint; wait until the
+    // frame pipeline has switched to the new size (width was rounded down to even)
+    UINT32 target_width = (UINT32)width & ~1u;
+    UINT32 frame_width = 0, frame_height = 0;
+    UINT64 generation = get_frame_generation(client);
+    UINT64 deadline_ms = get_time_ms() + (UINT64)timeout_ms;
+    BOOL resized = FALSE;
+    
+    for (;;) {
+        get_frame_size(client, &frame_width, &frame_height);
+        if (frame_width == target_width && frame_height == (UINT32)height) {
+            resized = TRUE;
+            break;
+        }
+        
+        UINT64 now_ms = get_time_ms();
+        if (now_ms >= deadline_ms || !client->connected)
+            break;
+        wait_for_frame_generation(client, generation, (UINT32)(deadline_ms - now_ms), &generation);
+    }
+    
+    char result_json[128];
+    snprintf(result_json, sizeof(result_json),
+        "{"
+        "\"resized\": %s,"
+        "\"width\": %u,"
+        "\"height\": %u"
+        "}",
+        resized ? "true" : "false",
+        frame_width,
+        frame_height);
+    
+    return create_http_response(200, "application/json", result_json, strlen(result_json), 0);
+}
+
+static HttpResponse* create_clipboard_error(ClipboardResult result)
+{
+    const char* error;
+    int status;
+    switch (result) {
+        case CLIPBOARD_UNAVAILABLE:
+            status = 409;
+            error = "Clipboard channel not available";
+            break;
+        case CLIPBOARD_EMPTY:
+            status = 404;
+            error = "Clipboard holds no text";
+            break;
+        case CLIPBOARD_INVALID:
+            status = 400;
+            error = "Text is not valid UTF-8";
+            break;
+        case CLIPBOARD_TIMEOUT:
+            status = 504;
+            error = "Server did not answer in time";
+            break;
+        default:
+            status = 502;
+            error = "Clipboard transfer failed";
+            break;
+    }
+    return create_http_response(status, "text/plain", error, strlen(error), 0);
+}
+
+static HttpResponse* parse_clipboard_timeout(HttpRequest* request, UINT32* timeout_ms)
+{
+    int timeout = CLIPBOARD_DEFAULT_TIMEOUT_MS;
+    if (!http_query_int(request, "timeout_ms", 0, INT_MAX, &timeout)) {
+        return create_http_response(400, "text/plain", "Invalid timeout_ms", 18, 0);
+    }
+    if (timeout > CLIPBOARD_MAX_TIMEOUT_MS)
+        timeout = CLIPBOARD_MAX_TIMEOUT_MS;
+    *timeout_ms = (UINT32)timeout;
+    return NULL;
+}
+
+HttpResponse* handle_get_clipboard(RDPClient* client, HttpRequest* request)
+{
+    HttpResponse* not_ready = check_client_ready(client);
+    if (not_ready) {
+        return not_ready;
+    }
+    
+    UINT32 timeout_ms;
+    HttpResponse* invalid = parse_clipboard_timeout(request, &timeout_ms);
+    if (invalid) {
+        return invalid;
+    }
+    
+    // Unless the text came from us, this waits for the server's format data response
+    char* text = NULL;
+    size_t length = 0;
+    ClipboardResult result = rdp_client_get_clipboard(client, timeout_ms, &text, &length);
+    if (result != CLIPBOARD_OK) {
+        return create_clipboard_error(result);
+    }
+    
+    HttpResponse* response = create_http_response(200, "text/plain; charset=utf-8", text, length, 0);
+    free(text);
+    return response;
+}
+
+HttpResponse* handle_put_clipboard(RDPClient* client, HttpRequest* request)
+{
+    HttpResponse* not_ready = check_client_ready(client);
+    if (not_ready) {
+        return not_ready;
+    }
+    
+    UINT32 timeout_ms;
+    HttpResponse* invalid = parse_clipboard_timeout(request, &timeout_ms);
+    if (invalid) {
+        return invalid;
+    }
+    int paste = 0;
+    if (!http_query_int(request, "paste", 0, 1, &paste)) {
+        return create_http_response(400, "text/plain", "Invalid paste", 13, 0);
+    }
+    
+    // The body is the UTF-8 text itself; the server fetches it when something pastes
+    const char* text = request->body ? request->body : "";
+    ClipboardResult result = rdp_client_set_clipboard(client, text, request->body_length, timeout_ms);
+    if (result != CLIPBOARD_OK) {
+        return create_clipboard_error(result);
+    }
+    
+    // Left Ctrl and V scancodes; the server has acknowledged the new format
+    // list, so the paste requests the text just set
+    if (paste) {
+        static const KeyEvent paste_keys[] = {
+            { KBD_FLAGS_DOWN, 0x1D },
+            { KBD_FLAGS_DOWN, 0x2F },
+            { KBD_FLAGS_RELEASE, 0x2F },
+            { KBD_FLAGS_RELEASE, 0x1D },
+        };
+        for (size_t i = 0; i < sizeof(paste_keys) / sizeof(paste_keys[0]); i++) {
+            if (!execute_sendkey(client, (DWORD)paste_keys[i].flags, (DWORD)paste_keys[i].code)) {
+                return create_http_response(500, "text/plain", "Failed to send key", 18, 0);
+            }
+        }
+    }
+    
+    return create_http_response(200, "text/plain", "OK", 2, 0);
+}
+
+HttpResponse* handle_get_cursor(RDPClient* client)
+{
+    HttpResponse* not_ready = check_client_ready(client);
+    if (not_ready) {
+        return not_ready;
+    }
+    
+    CursorInfo cursor;
+    if (!rdp_cursor_get_info(client->cursor, &cursor)) {
+        return create_http_response(500, "text/plain", "Cursor tracking unavailable", 27, 0);
+    }
+    
+    // The hash identifies a shape across cache slots and reconnects
+    char shape[24] = "null";
+    if (cursor.visible)
+        snprintf(shape, sizeof(shape), "\"%016llx\"", (unsigned long long)cursor.shape_hash);
+    
+    char result_json[320];
+    snprintf(result_json, sizeof(result_json),
+        "{"
+        "\"visible\": %s,"
+        "\"x\": %u,"
+        "\"y\": %u,"
+        "\"hotspot_x\": %u,"
+        "\"hotspot_y\": %u,"
+        "\"width\": %u,"
+        "\"height\": %u,"
+        "\"shape\": %s,"
+        "\"default_shape\": %s,"
+        "\"shape_changes\": %llu"
+        "}",
+        cursor.visible ? "true" : "false",
+        cursor.x,
+        cursor.y,
+        cursor.hotspot_x,
+        cursor.hotspot_y,
+        cursor.width,
+        cursor.height,
+        shape,
+        cursor.default_shape ? "true" : "false",
+        (unsigned long long)cursor.shape_changes);
+    
+    return create_http_response(200, "application/json", result_json, strlen(result_json), 0);
+}
+
+HttpResponse* handle_get_sessions(SessionPool* sessions)
+{
+    char* list_json = malloc(MAX_RESPONSE_SIZE);
+    if (!list_json) {
+        return create_http_response(500, "text/plain", "Memory allocation failed", 24, 0);
+    }
+    
+    size_t length = session_pool_list_json(sessions, list_json, MAX_RESPONSE_SIZE);
+    HttpResponse* response = create_http_response(200, "application/json", list_json, length, 0);
+    free(list_json);
+    return response;
+}
+
+HttpResponse* handle_post_sessions(SessionPool* sessions, HttpRequest* request)
+{
+    // {"id": "lab1", "host": "10.0.0.5", "port": 3389, "username": "...", "password": "...", "domain": "...",
+    //  "width": 1280, "height": 720, "bpp": 16}
+    static const JsonField fields[] = {
+        JSON_OPTIONAL(SessionRequest, id, JSON_FIELD_STRING, 0, SESSION_ID_SIZE - 1),
+        JSON_REQUIRED(SessionRequest, host, JSON_FIELD_STRING, 0, 255),
+        JSON_OPTIONAL(SessionRequest, port, JSON_FIELD_INT, 1, 65535),
+        JSON_OPTIONAL(SessionRequest, username, JSON_FIELD_STRING, 0, 255),
+        JSON_OPTIONAL(SessionRequest, password, JSON_FIELD_STRING, 0, 255),
+        JSON_OPTIONAL(SessionRequest, domain, JSON_FIELD_STRING, 0, 255),
+        JSON_OPTIONAL(SessionRequest, width, JSON_FIELD_UINT, 0, 0xFFFF),
+        JSON_OPTIONAL(SessionRequest, height, JSON_FIELD_UINT, 0, 0xFFFF),
+        JSON_OPTIONAL(SessionRequest, bpp, JSON_FIELD_UINT, 0, 32),
+    };
+    SessionRequest session_request = { .port = 3389 };
+    JsonDocument doc;
+    HttpResponse* invalid = parse_json_body(request, &doc);
+    if (invalid) {
+        return invalid;
+    }
+    if (!json_bind(&doc, 0, fields, sizeof(fields) / sizeof(fields[0]), &session_request)) {
+        return create_http_response(400, "text/plain", doc.error, strlen(doc.error), 0);
+    }
+    
+    // Zero (absent) keeps the server-wide default for that field
+    RDPGeometry geometry = { session_request.width, session_request.height, session_request.bpp };
+    
+    const char* error = NULL;
+    RDPSession* session = NULL;
+    SessionCreateResult result = session_pool_create(sessions, session_request.id, session_request.host,
+                                                     session_request.port, session_request.username,
+                                                     session_request.password, session_request.domain,
+                                                     &geometry, &session, &error);
+    if (result != SESSION_CREATE_OK) {
+        int status;
+        switch (result) {
+            case SESSION_CREATE_EXISTS:
+                status = 409;
+                break;
+            case SESSION_CREATE_FULL:
+                status = 503;
+                break;
+            case SESSION_CREATE_FAILED:
+                status = 500;
+                break;
+            case SESSION_CREATE_UNREACHABLE:
+                status = 502;
+                break;
+            default:
+                status = 400;
+                break;
+        }
+        return create_http_response(status, "text/plain", error, strlen(error), 0);
+    }
+    
+    // The session is pinned, so a DELETE racing this response cannot free it
+    char result_json[256];
+    snprintf(result_json, sizeof(result_json),
+        "{"
+        "\"id\": \"%s\","
+        "\"connected\": %s,"
+        "\"phase\": \"%s\""
+        "}",
+        session->id,
+        session->client->connected ? "true" : "false",
+        rdp_client_phase_name(rdp_client_get_phase(session->client)));
+    session_pool_release(sessions, session);
+    
+    return create_http_response(201, "application/json", result_json, strlen(result_json), 0);
+}
+
+HttpResponse* handle_delete_session(SessionPool* sessions, const char* id)
+{
+    if (!session_pool_remove(sessions, id)) {
+        return create_http_response(404, "text/plain", "Unknown session", 15, 0);
+    }
+    
+    return create_http_response(200, "text/plain", "OK", 2, 0);
+}
+
+HttpResponse* handle_get_recording(RDPClient* client)
+{
+    if (!client->recorder) {
+        return create_http_response(404, "text/plain", "Not recording", 13, 0);
+    }
+    
+    RecorderStats stats;
+    recorder_get_stats(client->recorder, &stats);
+    
+    char path[1024];
+    char json[2048];
+    snprintf(json, sizeof(json),
+        "{"
+        "\"path\": \"%s\","
+        "\"start_unix_ms\": %llu,"
+        "\"duration_ms\": %llu,"
+        "\"keyframes\": %u,"
+        "\"deltas\": %u,"
+        "\"tiles\": %llu,"
+        "\"inputs\": %llu,"
+        "\"raw_bytes\": %llu,"
+        "\"file_bytes\": %llu,"
+        "\"pending_bytes\": %llu,"
+        "\"dropped\": %u"
+        "}",
+        json_escape(recorder_path(client->recorder), path, sizeof(path)),
+        (unsigned long long)stats.start_unix_ms,
+        (unsigned long long)stats.duration_ms,
+        stats.keyframes,
+        stats.deltas,
+        (unsigned long long)stats.tiles,
+        (unsigned long long)stats.inputs,
+        (unsigned long long)stats.raw_bytes,
+        (unsigned long long)stats.file_bytes,
+        (unsigned long long)stats.pending_bytes,
+        stats.dropped);
+    
+    return create_http_response(200, "application/json", json, strlen(json), 0);
+}
+
+HttpResponse* handle_get_recording_frame(RDPClient* client, HttpRequest* request)
+{
+    if (!client->recorder) {
+        return create_http_response(404, "text/plain", "Not recording", 13, 0);
+    }
+    
+    // t is milliseconds since the recording started; start_unix_ms on /recording converts
+    int t = -1;
+    if (!http_query_int(request, "t", 0, INT_MAX, &t) || t < 0) {
+        return create_http_response(400, "text/plain", "Missing or invalid t", 20, 0);
+    }
+    
+    ImageRequest image;
+    HttpResponse* invalid = parse_image_request(request, &image);
+    if (invalid) {
+        return invalid;
+    }
+    
+    BYTE* buffer = NULL;
+    UINT32 width, height, stride;
+    UINT64 frame_t_ms = 0, generation = 0;
+    const char* error = NULL;
+    UINT64 snapshot_start = metrics_now_ns();
+    if (!recorder_frame_at(client->recorder, (UINT64)t, &buffer, &width, &height, &stride, &frame_t_ms,
+                           &generation, &error)) {
+        return create_http_response(404, "text/plain", error, strlen(error), 0);
+    }
+    request->stage_ns[HTTP_STAGE_SNAPSHOT] = metrics_now_ns() - snapshot_start;
+    
+    // Recorded frames are lossless copies of the live ones, so they share cache entries
+    EncodeKey key = { generation, image.format, image.quality, { 0, 0, 0, 0 }, 0 };
+    HttpResponse* response = get_cached_image(client->encode_cache, &key, &image);
+    if (!response)
+        response = encode_image_response(request, &image, buffer, width, height, stride, client->encode_cache, &key);
+    free(buffer);
+    
+    if (!response) {
+        return create_http_response(500, "text/plain", "Failed to encode image", 22, 0);
+    }
+    
+    // The recorded time of the frame returned, at or before t
+    char value[24];
+    snprintf(value, sizeof(value), "%llu", (unsigned long long)frame_t_ms);
+    http_response_add_header(response, "X-Recording-Time", value);
+    snprintf(value, sizeof(value), "%llu", (unsigned long long)generation);
+    http_response_add_header(response, "X-Frame-Generation", value);
+    
+    return response;
+}
+
+HttpResponse* handle_get_metrics(void)
+{
+    char* text = NULL;
+    size_t length = 0;
+    if (!metrics_render(&text, &length)) {
+        return create_http_response(500, "text/plain", "Failed to render metrics", 24, 0);
+    }
+    
+    HttpResponse* response = create_http_response(200, "text/plain; version=0.0.4", text, length, 0);
+    free(text);
+    return response;
+}
@@ -1,12 +1,24 @@
 #include "http_server.h"
+#include "http_router.h"
+#include "metrics.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 #include <signal.h>
+#include <poll.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+
+// Compiled from the route table on first use; the table is fixed, so one
+// router serves every server in the process
+static HttpRouter* router = NULL;
+static pthread_once_t router_once = PTHREAD_ONCE_INIT;
+static void router_compile(void);
 
 HttpServer* http_server_new(int port)
 {
@@ -16,7 +28,9 @@ HttpServer* http_server_new(int port)
     
     server->port = port > 0 ? port : DEFAULT_PORT;
     server->server_fd = -1;
-    server->rdp_client = NULL;
+    server->sessions = NULL;
+    server->workers = NULL;
+    server->worker_count = 0;
     server->running = 0;
     
     return server;
@@ -29,16 +43,19 @@ void http_server_free(HttpServer* server)
         
     if (server->server_fd >= 0)
         close(server->server_fd);
+    
+    // Let in-flight requests finish before the sessions they use go away
+    worker_pool_free(server->workers);
         
     free(server);
 }
 
-int http_server_start(HttpServer* server, RDPClient* rdp_client)
+int http_server_start(HttpServer* server, SessionPool* sessions)
 {
-    if (!server || !rdp_client)
+    if (!server || !sessions)
         return -1;
         
-    server->rdp_client = rdp_client;
+    server->sessions = sessions;
     
     // Create socket
     server->server_fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -74,6 +91,23 @@ int http_server_start(HttpServer* server, RDPClient* rdp_client)
         return -1;
     }
     
+    // The route table is compiled once, before the first request
+    pthread_once(&router_once, router_compile);
+    if (!router) {
+        close(server->server_fd);
+        server->server_fd = -1;
+        return -1;
+    }
+    
+    // Connections are handled on a shared worker pool
+    server->workers = worker_pool_new(server->worker_count);
+    if (!server->workers) {
+        fprintf(stderr, "Failed to create worker pool\n");
+        close(server->server_fd);
+        server->server_fd = -1;
+        return -1;
+    }
+    
     server->running = 1;
     printf("HTTP server listening on port %d\n", server->port);
     return 0;
@@ -86,99 +120,40 @@ void http_server_stop(HttpServer* server)
         
     server->running = 0;
     if (server->server_fd >= 0) {
+        // shutdown() wakes a thread blocked in accept()
+        shutdown(server->server_fd, SHUT_RDWR);
         close(server->server_fd);
         server->server_fd = -1;
     }
 }
 
-HttpRequest* parse_http_request(const char* request_data)
-{
-    if (!request_data)
-        return NULL;
-        
-    HttpRequest* request = (HttpRequest*)calloc(1, sizeof(HttpRequest));
-    if (!request)
-        return NULL;
-    
-    // Parse first line: METHOD PATH HTTP/1.1
-    const char* line_end = strstr(request_data, "\r\n");
-    if (!line_end) {
-        free(request);
-        return NULL;
-    }
-    
-    char first_line[512];
-    size_t line_len = (size_t)(line_end - request_data);
-    if (line_len >= sizeof(first_line)) {
-        free(request);
-        return NULL;
-    }
-    
-    strncpy(first_line, request_data, line_len);
-    first_line[line_len] = '\0';
-    
-    // Parse method
-    if (strncmp(first_line, "GET ", 4) == 0) {
-        request->method = HTTP_GET;
-        sscanf(first_line + 4, "%255s", request->path);
-    } else if (strncmp(first_line, "POST ", 5) == 0) {
-        request->method = HTTP_POST;
-        sscanf(first_line + 5, "%255s", request->path);
-    } else {
-        request->method = HTTP_INVALID;
-        free(request);
-        return NULL;
-    }
-    
-    // Find headers end and body start
-    const char* headers_end = strstr(request_data, "\r\n\r\n");
-    if (headers_end) {
-        // Copy headers
-        size_t headers_len = (size_t)(headers_end - request_data);
-        if (headers_len < sizeof(request->headers)) {
-            strncpy(request->headers, request_data, headers_len);
-            request->headers[headers_len] = '\0';
-        }
-        
-        // Parse body for POST requests
-        if (request->method == HTTP_POST) {
-            const char* body_start = headers_end + 4;
-            request->body_length = strlen(body_start);
-            if (request->body_length > 0) {
-                request->body = malloc(request->body_length + 1);
-                if (request->body) {
-                    strcpy(request->body, body_start);
-                }
-            }
-        }
-    }
-    
-    return request;
-}
+// Arena that create_http_response allocates from on this thread
+static _Thread_local Arena* response_arena = NULL;
 
-void free_http_request(HttpRequest* request)
+void http_response_bind_arena(Arena* arena)
 {
-    if (!request)
-        return;
-        
-    if (request->body)
-        free(request->body);
-    free(request);
+    response_arena = arena;
 }
 
 HttpResponse* create_http_response(int status_code, const char* content_type, 
                                  const char* body, size_t body_length, int is_binary)
 {
-    HttpResponse* response = (HttpResponse*)calloc(1, sizeof(HttpResponse));
+    Arena* arena = response_arena;
+    HttpResponse* response = arena ? (HttpResponse*)arena_alloc(arena, sizeof(HttpResponse))
+                                   : (HttpResponse*)malloc(sizeof(HttpResponse));
     if (!response)
         return NULL;
+    memset(response, 0, sizeof(HttpResponse));
     
+    response->arena = arena;
     response->status_code = status_code;
-    response->content_type = content_type ? strdup(content_type) : strdup("text/plain");
+    if (!content_type)
+        content_type = "text/plain";
+    response->content_type = arena ? arena_strdup(arena, content_type) : strdup(content_type);
     response->is_binary = is_binary;
     
     if (body && body_length > 0) {
-        response->body = malloc(body_length);
+        response->body = arena ? (char*)arena_alloc(arena, body_length) : malloc(body_length);
         if (response->body) {
             memcpy(response->body, body, body_length);
             response->body_length = body_length;
@@ -190,7 +165,8 @@ HttpResponse* create_http_response(int status_code, const char* content_type,
 
 void free_http_response(HttpResponse* response)
 {
-    if (!response)
+    // Arena responses go when their arena is reset
+    if (!response || response->arena)
         return;
         
     if (response->content_type)
@@ -200,7 +176,32 @@ void free_http_response(HttpResponse* response)
     free(response);
 }
 
-int send_http_response(int client_fd, HttpResponse* response)
+void http_response_add_header(HttpResponse* response, const char* name, const char* value)
+{
+    if (!response || !name || !value)
+        return;
+    
+    size_t used = strlen(response->extra_headers);
+    snprintf(response->extra_headers + used, sizeof(response->extra_headers) - used,
+             "%s: %s\r\n", name, value);
+}
+
+// send() may return early; a short write would desynchronize a persistent connection
+static int send_all(int client_fd, const char* data, size_t length, int flags)
+{
+    while (length > 0) {
+        ssize_t sent = send(client_fd, data, length, MSG_NOSIGNAL | flags);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return -1;
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return 0;
+}
+
+int send_http_response(int client_fd, HttpResponse* response, BOOL keep_alive)
 {
     if (!response)
         return -1;
@@ -209,9 +210,20 @@ int send_http_response(int client_fd, HttpResponse* response)
     const char* status_text;
     switch (response->status_code) {
         case 200: status_text = "OK"; break;
+        case 201: status_text = "Created"; break;
         case 400: status_text = "Bad Request"; break;
         case 404: status_text = "Not Found"; break;
+        case 405: status_text = "Method Not Allowed"; break;
+        case 406: status_text = "Not Acceptable"; break;
+        case 409: status_text = "Conflict"; break;
+        case 413: status_text = "Payload Too Large"; break;
+        case 417: status_text = "Expectation Failed"; break;
+        case 431: status_text = "Request Header Fields Too Large"; break;
         case 500: status_text = "Internal Server Error"; break;
+        case 501: status_text = "Not Implemented"; break;
+        case 502: status_text = "Bad Gateway"; break;
+        case 503: status_text = "Service Unavailable"; break;
+        case 504: status_text = "Gateway Timeout"; break;
         default: status_text = "Unknown"; break;
     }
     
@@ -221,50 +233,465 @@ int send_http_response(int client_fd, HttpResponse* response)
         "HTTP/1.1 %d %s\r\n"
         "Content-Type: %s\r\n"
         "Content-Length: %zu\r\n"
-        "Connection: close\r\n"
+        "%s"
+        "Connection: %s\r\n"
         "\r\n",
         response->status_code, status_text,
         response->content_type,
-        response->body_length);
+        response->body_length,
+        response->extra_headers,
+        keep_alive ? "keep-alive" : "close");
     
-    if (send(client_fd, headers, strlen(headers), 0) < 0)
+    // MSG_MORE joins the headers to the body's first segment
+    BOOL has_body = response->body && response->body_length > 0;
+    if (send_all(client_fd, headers, strlen(headers), has_body ? MSG_MORE : 0) < 0)
         return -1;
     
     // Send body if present
-    if (response->body && response->body_length > 0) {
-        if (send(client_fd, response->body, response->body_length, 0) < 0)
+    if (has_body) {
+        if (send_all(client_fd, response->body, response->body_length, 0) < 0)
             return -1;
     }
     
     return 0;
 }
 
-static HttpResponse* route_request(HttpServer* server, HttpRequest* request)
+// Adapters from the route handler signature to the handlers in http_routes.c
+static HttpResponse* route_get_screen(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)server;
+    return handle_get_screen(client, request);
+}
+
+static HttpResponse* route_get_status(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)server;
+    (void)request;
+    return handle_get_status(client);
+}
+
+static HttpResponse* route_get_recording(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)server;
+    (void)request;
+    return handle_get_recording(client);
+}
+
+static HttpResponse* route_get_recording_frame(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)server;
+    return handle_get_recording_frame(client, request);
+}
+
+static HttpResponse* route_post_sendkey(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)server;
+    return handle_post_sendkey(client, request);
+}
+
+static HttpResponse* route_post_sendmouse(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)server;
+    return handle_post_sendmouse(client, request);
+}
+
+static HttpResponse* route_post_movemouse(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)server;
+    return handle_post_movemouse(client, request);
+}
+
+static HttpResponse* route_post_wait_for(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)server;
+    return handle_post_wait_for(client, request);
+}
+
+static HttpResponse* route_post_probe(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)server;
+    return handle_post_probe(client, request);
+}
+
+static HttpResponse* route_post_resize(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)server;
+    return handle_post_resize(client, request);
+}
+
+static HttpResponse* route_get_clipboard(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)server;
+    return handle_get_clipboard(client, request);
+}
+
+static HttpResponse* route_put_clipboard(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)server;
+    return handle_put_clipboard(client, request);
+}
+
+static HttpResponse* route_get_cursor(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)server;
+    (void)request;
+    return handle_get_cursor(client);
+}
+
+static HttpResponse* route_get_sessions(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)client;
+    (void)request;
+    if (!server->sessions)
+        return create_http_response(404, "text/plain", "Not Found", 9, 0);
+    return handle_get_sessions(server->sessions);
+}
+
+static HttpResponse* route_post_sessions(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)client;
+    if (!server->sessions)
+        return create_http_response(404, "text/plain", "Not Found", 9, 0);
+    return handle_post_sessions(server->sessions, request);
+}
+
+static HttpResponse* route_delete_session(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)client;
+    if (!server->sessions)
+        return create_http_response(404, "text/plain", "Not Found", 9, 0);
+    return handle_delete_session(server->sessions, http_path_param(request, "id"));
+}
+
+static HttpResponse* route_get_metrics(HttpServer* server, RDPClient* client, HttpRequest* request)
+{
+    (void)server;
+    (void)client;
+    (void)request;
+    return handle_get_metrics();
+}
+
+static const HttpRoute routes[] = {
+    { HTTP_GET, "/screen", route_get_screen, TRUE, METRIC_ROUTE_SCREEN, HTTP_COST_FRAME, 0,
+      "Get current screenshot (PNG)" },
+    { HTTP_GET, "/status", route_get_status, TRUE, METRIC_ROUTE_STATUS, HTTP_COST_CHEAP, 0,
+      "Get connection status" },
+    { HTTP_POST, "/sendkey", route_post_sendkey, TRUE, METRIC_ROUTE_SENDKEY, HTTP_COST_CHEAP, 0,
+      "Send keyboard event" },
+    { HTTP_POST, "/sendmouse", route_post_sendmouse, TRUE, METRIC_ROUTE_SENDMOUSE, HTTP_COST_CHEAP, 0,
+      "Send mouse button event" },
+    { HTTP_POST, "/movemouse", route_post_movemouse, TRUE, METRIC_ROUTE_MOVEMOUSE, HTTP_COST_CHEAP, 0,
+      "Move mouse cursor" },
+    { HTTP_POST, "/wait_for", route_post_wait_for, TRUE, METRIC_ROUTE_WAIT_FOR, HTTP_COST_BLOCKING, 0,
+      "Wait until a template image appears" },
+    { HTTP_POST, "/probe", route_post_probe, TRUE, METRIC_ROUTE_PROBE, HTTP_COST_FRAME, 0,
+      "Evaluate pixel/region color predicates" },
+    { HTTP_POST, "/resize", route_post_resize, TRUE, METRIC_ROUTE_RESIZE, HTTP_COST_BLOCKING, 0,
+      "Resize the remote desktop" },
+    { HTTP_GET, "/clipboard", route_get_clipboard, TRUE, METRIC_ROUTE_CLIPBOARD, HTTP_COST_BLOCKING, 0,
+      "Get remote clipboard text" },
+    { HTTP_PUT, "/clipboard", route_put_clipboard, TRUE, METRIC_ROUTE_CLIPBOARD, HTTP_COST_BLOCKING, 0,
+      "Set remote clipboard text (?paste=1 sends Ctrl+V)" },
+    { HTTP_GET, "/cursor", route_get_cursor, TRUE, METRIC_ROUTE_CURSOR, HTTP_COST_CHEAP, 0,
+      "Pointer position, hotspot and shape" },
+    { HTTP_GET, "/recording", route_get_recording, TRUE, METRIC_ROUTE_RECORDING, HTTP_COST_CHEAP, 0,
+      "Recording status" },
+    { HTTP_GET, "/recording/frame", route_get_recording_frame, TRUE, METRIC_ROUTE_RECORDING, HTTP_COST_FRAME, 0,
+      "Replay a recorded frame (?t=)" },
+    { HTTP_GET, "/sessions", route_get_sessions, FALSE, METRIC_ROUTE_SESSIONS, HTTP_COST_CHEAP, 0,
+      "List sessions" },
+    { HTTP_POST, "/sessions", route_post_sessions, FALSE, METRIC_ROUTE_SESSIONS, HTTP_COST_CHEAP, 0,
+      "Create a session" },
+    { HTTP_DELETE, "/sessions/{id}", route_delete_session, FALSE, METRIC_ROUTE_SESSIONS, HTTP_COST_CHEAP, 0,
+      "Disconnect and remove a session" },
+    { HTTP_GET, "/metrics", route_get_metrics, FALSE, METRIC_ROUTE_METRICS, HTTP_COST_CHEAP, 0,
+      "Prometheus metrics" },
+};
+
+#define ROUTE_COUNT (sizeof(routes) / sizeof(routes[0]))
+
+static int route_in_flight[ROUTE_COUNT];
+
+static void router_compile(void)
+{
+    router = http_router_new(routes, ROUTE_COUNT);
+    if (!router)
+        fprintf(stderr, "Failed to compile route table\n");
+}
+
+static int route_in_flight_limit(HttpServer* server, const HttpRoute* route)
+{
+    if (route->max_in_flight > 0)
+        return route->max_in_flight;
+    
+    // A blocking route may hold its worker for up to a minute; keep half
+    // the workers free for everything else
+    if (route->cost == HTTP_COST_BLOCKING && server->workers) {
+        int limit = server->workers->thread_count / 2;
+        return limit > 0 ? limit : 1;
+    }
+    return 0;
+}
+
+HttpResponse* route_request(HttpServer* server, HttpRequest* request)
 {
-    if (!server || !request || !server->rdp_client)
+    if (!server || !request)
         return create_http_response(500, "text/plain", "Server error", 12, 0);
     
-    if (request->method == HTTP_GET) {
-        if (strncmp(request->path, "/screen", 7) == 0) {
-            return handle_get_screen(server->rdp_client);
-        } else if (strcmp(request->path, "/status") == 0) {
-            return handle_get_status(server->rdp_client);
-        } else {
-            return create_http_response(404, "text/plain", "Not Found", 9, 0);
+    pthread_once(&router_once, router_compile);
+    if (!router)
+        return create_http_response(500, "text/plain", "Server error", 12, 0);
+    
+    char allow[32];
+    switch (http_router_match(router, request, allow, sizeof(allow))) {
+        case HTTP_ROUTE_FOUND:
+            break;
+        case HTTP_ROUTE_METHOD_NOT_ALLOWED: {
+            HttpResponse* response = create_http_response(405, "text/plain", "Method Not Allowed", 18, 0);
+            http_response_add_header(response, "Allow", allow);
+            return response;
         }
-    } else if (request->method == HTTP_POST) {
-        if (strcmp(request->path, "/sendkey") == 0) {
-            return handle_post_sendkey(server->rdp_client, request);
-        } else if (strcmp(request->path, "/sendmouse") == 0) {
-            return handle_post_sendmouse(server->rdp_client, request);
-        } else if (strcmp(request->path, "/movemouse") == 0) {
-            return handle_post_movemouse(server->rdp_client, request);
-        } else {
+        default:
             return create_http_response(404, "text/plain", "Not Found", 9, 0);
+    }
+    
+    const HttpRoute* route = request->route;
+    
+    // Per-session routes run against the named session, or the default one.
+    // Both are pinned, since DELETE /sessions/default may run concurrently.
+    RDPSession* session = NULL;
+    RDPClient* client = NULL;
+    if (route->per_session) {
+        if (request->session_scoped) {
+            const char* id = http_path_param(request, "id");
+            session = session_pool_acquire(server->sessions, id, strlen(id));
+            if (!session)
+                return create_http_response(404, "text/plain", "Unknown session", 15, 0);
+        } else {
+            session = session_pool_acquire(server->sessions, "default", 7);
+            if (!session)
+                return create_http_response(404, "text/plain", "No default session", 18, 0);
+        }
+        client = session->client;
+    }
+    
+    int* in_flight = &route_in_flight[route - routes];
+    int limit = route_in_flight_limit(server, route);
+    HttpResponse* response;
+    if (limit > 0 && __atomic_add_fetch(in_flight, 1, __ATOMIC_RELAXED) > limit) {
+        response = create_http_response(503, "text/plain", "Too many concurrent requests for this route", 43, 0);
+        http_response_add_header(response, "Retry-After", "1");
+    } else {
+        response = route->handler(server, client, request);
+    }
+    if (limit > 0)
+        __atomic_sub_fetch(in_flight, 1, __ATOMIC_RELAXED);
+    
+    if (session)
+        session_pool_release(server->sessions, session);
+    return response;
+}
+
+typedef struct {
+    HttpServer* server;
+    int client_fd;
+} ConnectionTask;
+
+// Server-Timing: route is the whole handler, and snapshot, convert and encode
+// are parts of it. The response is built before it is sent, so send time only
+// reaches the metrics.
+static void add_server_timing(HttpResponse* response, const HttpRequest* request)
+{
+    static const char* names[HTTP_STAGE_COUNT] = { "parse", "route", "snapshot", "convert", "encode" };
+    
+    if (!response)
+        return;
+    
+    char value[256];
+    size_t length = 0;
+    value[0] = '\0';
+    for (int stage = 0; stage < HTTP_STAGE_COUNT && length < sizeof(value); stage++) {
+        if (stage > HTTP_STAGE_ROUTE && request->stage_ns[stage] == 0)
+            continue;
+        length += (size_t)snprintf(value + length, sizeof(value) - length, "%s%s;dur=%.3f",
+                                   length > 0 ? ", " : "", names[stage], (double)request->stage_ns[stage] / 1e6);
+    }
+    
+    http_response_add_header(response, "Server-Timing", value);
+}
+
+// Answers a request the parser refused; the connection is closed after it
+static void send_parse_error(int client_fd, const HttpParser* parser)
+{
+    HttpResponse* response = create_http_response(parser->error_status, "text/plain", parser->error,
+                                                  strlen(parser->error), 0);
+    send_http_response(client_fd, response, FALSE);
+    free_http_response(response);
+}
+
+// A worker serves one connection at a time, so the read buffer and the
+// response arena belong to the worker thread and outlive its connections
+typedef struct {
+    char* buffer;
+    Arena* arena;
+} ConnectionMemory;
+
+static pthread_key_t connection_memory_key;
+static pthread_once_t connection_memory_once = PTHREAD_ONCE_INIT;
+static _Thread_local ConnectionMemory* connection_memory = NULL;
+
+static void connection_memory_release(void* arg)
+{
+    ConnectionMemory* memory = (ConnectionMemory*)arg;
+    arena_free(memory->arena);
+    free(memory->buffer);
+    free(memory);
+}
+
+static void connection_memory_key_create(void)
+{
+    pthread_key_create(&connection_memory_key, connection_memory_release);
+}
+
+static ConnectionMemory* get_connection_memory(void)
+{
+    if (connection_memory)
+        return connection_memory;
+    
+    pthread_once(&connection_memory_once, connection_memory_key_create);
+    
+    ConnectionMemory* memory = (ConnectionMemory*)calloc(1, sizeof(ConnectionMemory));
+    if (!memory)
+        return NULL;
+    memory->buffer = malloc(MAX_REQUEST_SIZE);
+    memory->arena = arena_new(ARENA_DEFAULT_CAPACITY);
+    if (!memory->buffer || !memory->arena) {
+        connection_memory_release(memory);
+        return NULL;
+    }
+    
+    pthread_setspecific(connection_memory_key, memory);
+    connection_memory = memory;
+    return memory;
+}
+
+// Waits for the next request on a persistent connection in short slices, so
+// an idle connection holds its worker only while no other connection waits
+// for one. Returns FALSE when the connection should be closed.
+static BOOL wait_for_next_request(HttpServer* server, int fd)
+{
+    for (int waited = 0; waited < HTTP_KEEPALIVE_TIMEOUT_MS; waited += HTTP_IDLE_POLL_MS) {
+        if (!server->running || worker_pool_pending(server->workers) > 0)
+            return FALSE;
+        
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, HTTP_IDLE_POLL_MS);
+        if (ready > 0)
+            return TRUE;
+        if (ready < 0 && errno != EINTR)
+            return FALSE;
+    }
+    
+    return FALSE;
+}
+
+// Serves requests on one connection until the client closes it, asks to, or
+// goes idle. Requests are parsed in place in the worker's read buffer,
+// pipelined requests are answered in order, and everything a response
+// allocates is dropped at once after it is sent.
+static void handle_connection(void* arg)
+{
+    ConnectionTask* task = (ConnectionTask*)arg;
+    
+    ConnectionMemory* memory = get_connection_memory();
+    if (!memory) {
+        close(task->client_fd);
+        free(task);
+        return;
+    }
+    char* buffer = memory->buffer;
+    Arena* arena = memory->arena;
+    http_response_bind_arena(arena);
+    
+    // Idle persistent connections and stalled uploads give their worker back
+    struct timeval timeout = { HTTP_KEEPALIVE_TIMEOUT_MS / 1000, (HTTP_KEEPALIVE_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(task->client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    
+    // Without close() to flush it, a response's last partial segment would
+    // wait on the client's delayed ACK
+    int one = 1;
+    setsockopt(task->client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    HttpParser parser;
+    http_parser_init(&parser, buffer, MAX_REQUEST_SIZE);
+    size_t length = 0;
+    int served = 0;
+    BOOL keep_alive = TRUE;
+    
+    // Parse covers reading the request off the socket as well
+    UINT64 start = metrics_now_ns();
+    while (keep_alive) {
+        HttpParseResult result = http_parser_execute(&parser, length);
+        if (result == HTTP_PARSE_ERROR) {
+            send_parse_error(task->client_fd, &parser);
+            break;
+        }
+        
+        if (result == HTTP_PARSE_INCOMPLETE) {
+            if (parser.continue_pending) {
+                parser.continue_pending = FALSE;
+                static const char continue_line[] = "HTTP/1.1 100 Continue\r\n\r\n";
+                if (send_all(task->client_fd, continue_line, sizeof(continue_line) - 1, 0) < 0)
+                    break;
+            }
+            
+            // Between requests nothing is buffered; a partial request keeps
+            // the worker until it completes or SO_RCVTIMEO expires
+            if (length == 0 && served > 0 && !wait_for_next_request(task->server, task->client_fd))
+                break;
+            
+            ssize_t received = recv(task->client_fd, buffer + length, MAX_REQUEST_SIZE - 1 - length, 0);
+            if (received <= 0)
+                break;
+            if (length == 0)
+                start = metrics_now_ns();
+            length += (size_t)received;
+            continue;
         }
+        
+        HttpRequest* request = &parser.request;
+        served++;
+        keep_alive = request->keep_alive && served < HTTP_MAX_KEEPALIVE_REQUESTS && task->server->running;
+        
+        UINT64 parsed = metrics_now_ns();
+        request->stage_ns[HTTP_STAGE_PARSE] = parsed - start;
+        
+        HttpResponse* response = route_request(task->server, request);
+        UINT64 routed = metrics_now_ns();
+        request->stage_ns[HTTP_STAGE_ROUTE] = routed - parsed;
+        add_server_timing(response, request);
+        
+        // A kept connection holds its worker, so it is given up while
+        // other connections wait for one
+        if (keep_alive && worker_pool_pending(task->server->workers) > 0)
+            keep_alive = FALSE;
+        if (send_http_response(task->client_fd, response, keep_alive) < 0)
+            keep_alive = FALSE;
+        UINT64 sent = metrics_now_ns();
+        metrics_observe(METRIC_HIST_SEND, sent - routed);
+        metrics_observe_request(request->route ? request->route->metric : METRIC_ROUTE_OTHER, sent - start);
+        free_http_response(response);
+        arena_reset(arena);
+        
+        // A pipelined request already in the buffer starts now
+        http_parser_next(&parser, &length);
+        start = metrics_now_ns();
     }
     
-    return create_http_response(400, "text/plain", "Bad Request", 11, 0);
+    http_response_bind_arena(NULL);
+    arena_reset(arena);
+    close(task->client_fd);
+    free(task);
 }
 
 int http_server_run(HttpServer* server)
@@ -272,12 +699,12 @@ int http_server_run(HttpServer* server)
     if (!server || !server->running)
         return -1;
     
+    static const char* method_names[] = { "GET", "POST", "DELETE", "PUT" };
     printf("Server ready. Available endpoints:\n");
-    printf("  GET  /screen     - Get current screenshot (PNG)\n");
-    printf("  GET  /status     - Get connection status\n");
-    printf("  POST /sendkey    - Send keyboard event\n");
-    printf("  POST /sendmouse  - Send mouse button event\n");
-    printf("  POST /movemouse  - Move mouse cursor\n");
+    for (size_t i = 0; i < ROUTE_COUNT; i++) {
+        printf("  %-6s %-16s - %s\n", method_names[routes[i].method], routes[i].pattern, routes[i].summary);
+    }
+    printf("  Per-session routes are also served under /sessions/{id}/\n");
     
     while (server->running) {
         struct sockaddr_in client_addr;
@@ -291,23 +718,18 @@ int http_server_run(HttpServer* server)
             continue;
         }
         
-        // Read request
-        char buffer[MAX_REQUEST_SIZE];
-        ssize_t bytes_received = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-        if (bytes_received > 0) {
-            buffer[bytes_received] = '\0';
-            
-            // Parse and route request
-            HttpRequest* request = parse_http_request(buffer);
-            if (request) {
-                HttpResponse* response = route_request(server, request);
-                send_http_response(client_fd, response);
-                free_http_response(response);
-                free_http_request(request);
-            }
+        ConnectionTask* task = (ConnectionTask*)malloc(sizeof(ConnectionTask));
+        if (!task) {
+            close(client_fd);
+            continue;
         }
+        task->server = server;
+        task->client_fd = client_fd;
         
-        close(client_fd);
+        if (!worker_pool_submit(server->workers, handle_connection, task)) {
+            close(client_fd);
+            free(task);
+        }
     }
     
     return 0;
@@ -0,0 +1,189 @@
+#include "image_encode.h"
+#include "metrics.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+typedef struct {
+    const char* name;
+    const char* mime;
+} ImageFormatInfo;
+
+static const ImageFormatInfo formats[IMAGE_FORMAT_COUNT] = {
+    [IMAGE_FORMAT_PNG] = { "png", "image/png" },
+    [IMAGE_FORMAT_QOI] = { "qoi", "image/qoi" },
+    [IMAGE_FORMAT_JPEG] = { "jpeg", "image/jpeg" },
+};
+
+const char* image_format_mime(ImageFormat format)
+{
+    return format < IMAGE_FORMAT_COUNT ? formats[format].mime : "application/octet-stream";
+}
+
+BOOL image_format_parse(const char* name, ImageFormat* format)
+{
+    if (!name || !format)
+        return FALSE;
+    
+    if (strcasecmp(name, "jpg") == 0) {
+        *format = IMAGE_FORMAT_JPEG;
+        return TRUE;
+    }
+    for (int i = 0; i < IMAGE_FORMAT_COUNT; i++) {
+        if (strcasecmp(name, formats[i].name) == 0 || strcasecmp(name, formats[i].mime) == 0) {
+            *format = (ImageFormat)i;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+BOOL encode_image_memory(ImageFormat format, int quality, BYTE* buffer, UINT32 width, UINT32 height, UINT32 stride,
+                         BYTE** data, size_t* length, UINT64* convert_ns)
+{
+    // QOI and JPEG read the pixels as they are, with no separate conversion pass
+    if (convert_ns)
+        *convert_ns = 0;
+    
+    switch (format) {
+        case IMAGE_FORMAT_PNG:
+            return encode_png_memory(buffer, width, height, stride, data, length, convert_ns);
+        case IMAGE_FORMAT_QOI:
+            return encode_qoi_memory(buffer, width, height, stride, data, length);
+        case IMAGE_FORMAT_JPEG:
+            return encode_jpeg_memory(buffer, width, height, stride, quality, data, length);
+        default:
+            return FALSE;
+    }
+}
+
+typedef struct {
+    EncodeKey key;
+    BYTE* data;
+    size_t length;
+    UINT64 last_used;       // cache clock at the last hit or store
+} EncodeCacheEntry;
+
+struct _EncodeCache {
+    pthread_mutex_t mutex;
+    EncodeCacheEntry entries[ENCODE_CACHE_ENTRIES];
+    size_t bytes;           // total length of the cached encodings
+    UINT64 clock;
+};
+
+EncodeCache* encode_cache_new(void)
+{
+    EncodeCache* cache = (EncodeCache*)calloc(1, sizeof(EncodeCache));
+    if (!cache)
+        return NULL;
+    
+    if (pthread_mutex_init(&cache->mutex, NULL) != 0) {
+        free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void encode_cache_free(EncodeCache* cache)
+{
+    if (!cache)
+        return;
+    
+    for (int i = 0; i < ENCODE_CACHE_ENTRIES; i++)
+        free(cache->entries[i].data);
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache);
+}
+
+static BOOL encode_key_equal(const EncodeKey* a, const EncodeKey* b)
+{
+    return a->generation == b->generation && a->format == b->format && a->quality == b->quality &&
+           a->rect.x == b->rect.x && a->rect.y == b->rect.y && a->rect.width == b->rect.width &&
+           a->rect.height == b->rect.height && a->cursor == b->cursor;
+}
+
+BOOL encode_cache_acquire(EncodeCache* cache, const EncodeKey* key, const BYTE** data, size_t* length)
+{
+    if (!cache || !key || !data || !length)
+        return FALSE;
+    
+    pthread_mutex_lock(&cache->mutex);
+    for (int i = 0; i < ENCODE_CACHE_ENTRIES; i++) {
+        EncodeCacheEntry* entry = &cache->entries[i];
+        if (entry->data && encode_key_equal(&entry->key, key)) {
+            entry->last_used = ++cache->clock;
+            *data = entry->data;
+            *length = entry->length;
+            metrics_count(METRIC_ENCODE_CACHE_HIT, 1);
+            return TRUE;
+        }
+    }
+    pthread_mutex_unlock(&cache->mutex);
+    
+    metrics_count(METRIC_ENCODE_CACHE_MISS, 1);
+    return FALSE;
+}
+
+void encode_cache_release(EncodeCache* cache)
+{
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void encode_cache_put(EncodeCache* cache, const EncodeKey* key, const BYTE* data, size_t length)
+{
+    if (!cache || !key || !data || length > ENCODE_CACHE_BUDGET)
+        return;
+    
+    BYTE* copy = (BYTE*)malloc(length);
+    if (!copy)
+        return;
+    memcpy(copy, data, length);
+    
+    // A concurrent miss on the same key replaces the entry stored first
+    pthread_mutex_lock(&cache->mutex);
+    EncodeCacheEntry* slot = NULL;
+    for (int i = 0; i < ENCODE_CACHE_ENTRIES && !slot; i++) {
+        if (cache->entries[i].data && encode_key_equal(&cache->entries[i].key, key))
+            slot = &cache->entries[i];
+    }
+    
+    // Evict least recently used entries until there is a free slot and room in the budget
+    BYTE* evicted[ENCODE_CACHE_ENTRIES];
+    int evicted_count = 0;
+    if (slot) {
+        evicted[evicted_count++] = slot->data;
+        cache->bytes -= slot->length;
+        slot->data = NULL;
+    }
+    for (;;) {
+        EncodeCacheEntry* oldest = NULL;
+        EncodeCacheEntry* empty = slot;
+        for (int i = 0; i < ENCODE_CACHE_ENTRIES; i++) {
+            EncodeCacheEntry* entry = &cache->entries[i];
+            if (!entry->data) {
+                if (!empty)
+                    empty = entry;
+            } else if (!oldest || entry->last_used < oldest->last_used) {
+                oldest = entry;
+            }
+        }
+        if (empty && cache->bytes + length <= ENCODE_CACHE_BUDGET) {
+            slot = empty;
+            break;
+        }
+        evicted[evicted_count++] = oldest->data;
+        cache->bytes -= oldest->length;
+        oldest->data = NULL;
+    }
+    
+    slot->key = *key;
+    slot->data = copy;
+    slot->length = length;
+    slot->last_used = ++cache->clock;
+    cache->bytes += length;
+    pthread_mutex_unlock(&cache->mutex);
+    
+    for (int i = 0; i < evicted_count; i++)
+        free(evicted[i]);
+}
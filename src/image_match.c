@@ -0,0 +1,212 @@
+#include "image_match.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <png.h>
+
+#define PIXEL_RGB_MASK 0x00FFFFFF
+
+static int base64_value(char c)
+{
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+' || c == '-') return 62;
+    if (c == '/' || c == '_') return 63;
+    return -1;
+}
+
+size_t base64_decode(const char* input, size_t input_length, BYTE* output, size_t output_size)
+{
+    if (!input || !output)
+        return 0;
+    
+    UINT32 accumulator = 0;
+    int bits = 0;
+    size_t written = 0;
+    
+    for (size_t i = 0; i < input_length; i++) {
+        char c = input[i];
+        if (c == '=')
+            break;
+        
+        // Tolerate whitespace and JSON-escaped slashes
+        if (c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\\')
+            continue;
+        
+        int value = base64_value(c);
+        if (value < 0)
+            return 0;
+        
+        accumulator = (accumulator << 6) | (UINT32)value;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (written >= output_size)
+                return 0;
+            output[written++] = (BYTE)((accumulator >> bits) & 0xFF);
+        }
+    }
+    
+    return written;
+}
+
+typedef struct {
+    const BYTE* data;
+    size_t length;
+    size_t offset;
+} PngMemoryReader;
+
+static void png_memory_read(png_structp png_ptr, png_bytep out, png_size_t count)
+{
+    PngMemoryReader* reader = (PngMemoryReader*)png_get_io_ptr(png_ptr);
+    if (reader->offset + count > reader->length)
+        png_error(png_ptr, "Read past end of PNG data");
+    
+    memcpy(out, reader->data + reader->offset, count);
+    reader->offset += count;
+}
+
+BOOL decode_png_memory(const BYTE* data, size_t length, ImageTemplate* image)
+{
+    if (!data || !image || length < 8 || png_sig_cmp(data, 0, 8) != 0)
+        return FALSE;
+    
+    memset(image, 0, sizeof(ImageTemplate));
+    
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png_ptr)
+        return FALSE;
+    
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr) {
+        png_destroy_read_struct(&png_ptr, NULL, NULL);
+        return FALSE;
+    }
+    
+    BYTE* volatile row = NULL;
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        free(row);
+        free_image_template(image);
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return FALSE;
+    }
+    
+    PngMemoryReader reader = { data, length, 0 };
+    png_set_read_fn(png_ptr, &reader, png_memory_read);
+    png_read_info(png_ptr, info_ptr);
+    
+    // Normalize everything to 8-bit RGB
+    png_byte color_type = png_get_color_type(png_ptr, info_ptr);
+    if (color_type == PNG_COLOR_TYPE_PALETTE)
+        png_set_palette_to_rgb(png_ptr);
+    if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+        png_set_gray_to_rgb(png_ptr);
+    if (png_get_bit_depth(png_ptr, info_ptr) == 16)
+        png_set_strip_16(png_ptr);
+    if (png_get_bit_depth(png_ptr, info_ptr) < 8)
+        png_set_packing(png_ptr);
+    png_set_strip_alpha(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
+    
+    UINT32 width = png_get_image_width(png_ptr, info_ptr);
+    UINT32 height = png_get_image_height(png_ptr, info_ptr);
+    if (width == 0 || height == 0 || width > 4096 || height > 4096)
+        png_error(png_ptr, "Unsupported template size");
+    
+    row = malloc(png_get_rowbytes(png_ptr, info_ptr));
+    image->pixels = malloc((size_t)width * height * sizeof(UINT32));
+    if (!row || !image->pixels)
+        png_error(png_ptr, "Out of memory");
+    
+    for (UINT32 y = 0; y < height; y++) {
+        png_read_row(png_ptr, row, NULL);
+        UINT32* dst = image->pixels + (size_t)y * width;
+        for (UINT32 x = 0; x < width; x++) {
+            const BYTE* rgb = row + x * 3;
+            dst[x] = ((UINT32)rgb[0] << 16) | ((UINT32)rgb[1] << 8) | rgb[2];
+        }
+    }
+    
+    image->width = width;
+    image->height = height;
+    
+    free(row);
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    return TRUE;
+}
+
+void free_image_template(ImageTemplate* image)
+{
+    if (!image)
+        return;
+    
+    free(image->pixels);
+    image->pixels = NULL;
+    image->width = 0;
+    image->height = 0;
+}
+
+static inline BOOL pixel_within(UINT32 a, UINT32 b, BYTE tolerance)
+{
+    int dr = (int)((a >> 16) & 0xFF) - (int)((b >> 16) & 0xFF);
+    int dg = (int)((a >> 8) & 0xFF) - (int)((b >> 8) & 0xFF);
+    int db = (int)(a & 0xFF) - (int)(b & 0xFF);
+    
+    return abs(dr) <= tolerance && abs(dg) <= tolerance && abs(db) <= tolerance;
+}
+
+static BOOL template_matches_at(const BYTE* haystack, UINT32 stride, const ImageTemplate* image,
+                                UINT32 x, UINT32 y, BYTE tolerance)
+{
+    for (UINT32 ty = 0; ty < image->height; ty++) {
+        const UINT32* src = (const UINT32*)(haystack + (size_t)(y + ty) * stride) + x;
+        const UINT32* tpl = image->pixels + (size_t)ty * image->width;
+        
+        if (tolerance == 0) {
+            // Exact match: accumulate differences so the row loop stays branch-free
+            UINT32 diff = 0;
+            for (UINT32 tx = 0; tx < image->width; tx++)
+                diff |= (src[tx] ^ tpl[tx]) & PIXEL_RGB_MASK;
+            if (diff)
+                return FALSE;
+        } else {
+            for (UINT32 tx = 0; tx < image->width; tx++) {
+                if (!pixel_within(src[tx], tpl[tx], tolerance))
+                    return FALSE;
+            }
+        }
+    }
+    
+    return TRUE;
+}
+
+BOOL find_template(const BYTE* haystack, UINT32 width, UINT32 height, UINT32 stride,
+                   const ImageTemplate* image, BYTE tolerance, UINT32* match_x, UINT32* match_y)
+{
+    if (!haystack || !image || !image->pixels || image->width > width || image->height > height)
+        return FALSE;
+    
+    // Anchor on the template's first pixel to reject most positions cheaply
+    UINT32 anchor = image->pixels[0];
+    
+    for (UINT32 y = 0; y + image->height <= height; y++) {
+        const UINT32* line = (const UINT32*)(haystack + (size_t)y * stride);
+        for (UINT32 x = 0; x + image->width <= width; x++) {
+            if (tolerance == 0) {
+                if ((line[x] ^ anchor) & PIXEL_RGB_MASK)
+                    continue;
+            } else if (!pixel_within(line[x], anchor, tolerance)) {
+                continue;
+            }
+            
+            if (template_matches_at(haystack, stride, image, x, y, tolerance)) {
+                if (match_x) *match_x = x;
+                if (match_y) *match_y = y;
+                return TRUE;
+            }
+        }
+    }
+    
+    return FALSE;
+}
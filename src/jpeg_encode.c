@@ -0,0 +1,86 @@
+#include "image_encode.h"
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// winpr already defines INT32; XMD_H stops jmorecfg.h from redefining it
+#define XMD_H
+#include <jpeglib.h>
+
+#ifndef JCS_EXTENSIONS
+#error "libjpeg-turbo is required for JCS_EXT_BGRX input"
+#endif
+
+// libjpeg reports errors by calling error_exit, which must not return. The
+// output written by the destination manager lives here as well, so it is
+// read back from memory after the longjmp.
+typedef struct {
+    struct jpeg_error_mgr base;
+    jmp_buf jump;
+    unsigned char* data;
+    unsigned long length;
+} JpegState;
+
+static void jpeg_error_exit(j_common_ptr cinfo)
+{
+    JpegState* state = (JpegState*)cinfo->err;
+    longjmp(state->jump, 1);
+}
+
+static void jpeg_output_message(j_common_ptr cinfo)
+{
+    char message[JMSG_LENGTH_MAX];
+    cinfo->err->format_message(cinfo, message);
+    fprintf(stderr, "JPEG encode: %s\n", message);
+}
+
+BOOL encode_jpeg_memory(BYTE* buffer, UINT32 width, UINT32 height, UINT32 stride, int quality, BYTE** jpeg_data,
+                        size_t* jpeg_length)
+{
+    if (!buffer || !jpeg_data || !jpeg_length || width == 0 || height == 0 || width > JPEG_MAX_DIMENSION ||
+        height > JPEG_MAX_DIMENSION)
+        return FALSE;
+    
+    JSAMPROW* rows = (JSAMPROW*)malloc((size_t)height * sizeof(JSAMPROW));
+    if (!rows)
+        return FALSE;
+    for (UINT32 y = 0; y < height; y++)
+        rows[y] = buffer + (size_t)y * stride;
+    
+    struct jpeg_compress_struct cinfo;
+    JpegState state;
+    state.data = NULL;
+    state.length = 0;
+    cinfo.err = jpeg_std_error(&state.base);
+    state.base.error_exit = jpeg_error_exit;
+    state.base.output_message = jpeg_output_message;
+    if (setjmp(state.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        free(state.data);
+        free(rows);
+        return FALSE;
+    }
+    
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &state.data, &state.length);
+    
+    // 0x00RRGGBB is B, G, R, X in memory, which libjpeg-turbo reads directly
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 4;
+    cinfo.in_color_space = JCS_EXT_BGRX;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.dct_method = JDCT_ISLOW;
+    
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height)
+        jpeg_write_scanlines(&cinfo, rows + cinfo.next_scanline, cinfo.image_height - cinfo.next_scanline);
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(rows);
+    
+    *jpeg_data = state.data;
+    *jpeg_length = state.length;
+    return TRUE;
+}
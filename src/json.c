@@ -0,0 +1,477 @@
+#include "json.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static BOOL json_fail(JsonDocument* doc, size_t offset, const char* reason)
+{
+    snprintf(doc->error, sizeof(doc->error), "Invalid JSON at offset %zu: %s", offset, reason);
+    return FALSE;
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static BOOL read_hex4(const char* text, size_t remaining, UINT32* value)
+{
+    if (remaining < 4)
+        return FALSE;
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hex_digit(text[i]);
+        if (digit < 0)
+            return FALSE;
+        *value = *value << 4 | (UINT32)digit;
+    }
+    return TRUE;
+}
+
+// Unescapes the string starting after the opening quote at *pos in place and
+// NUL-terminates it; *pos ends after the closing quote
+static BOOL parse_string(JsonDocument* doc, size_t length, size_t* pos, JsonToken* token)
+{
+    char* text = doc->text;
+    size_t in = *pos;
+    size_t out = in;
+    token->start = (UINT32)in;
+    
+    for (;;) {
+        if (in >= length)
+            return json_fail(doc, in, "unterminated string");
+        
+        char c = text[in++];
+        if (c == '"')
+            break;
+        if ((unsigned char)c < 0x20)
+            return json_fail(doc, in - 1, "control character in string");
+        if (c != '\\') {
+            text[out++] = c;
+            continue;
+        }
+        
+        if (in >= length)
+            return json_fail(doc, in, "unterminated string");
+        c = text[in++];
+        switch (c) {
+            case '"': case '\\': case '/': text[out++] = c; break;
+            case 'b': text[out++] = '\b'; break;
+            case 'f': text[out++] = '\f'; break;
+            case 'n': text[out++] = '\n'; break;
+            case 'r': text[out++] = '\r'; break;
+            case 't': text[out++] = '\t'; break;
+            case 'u': {
+                UINT32 code;
+                if (!read_hex4(text + in, length - in, &code))
+                    return json_fail(doc, in, "bad \\u escape");
+                in += 4;
+                
+                // A high surrogate must pair with a low one
+                if (code >= 0xD800 && code <= 0xDBFF) {
+                    UINT32 low;
+                    if (in + 2 > length || text[in] != '\\' || text[in + 1] != 'u' ||
+                        !read_hex4(text + in + 2, length - in - 2, &low) || low < 0xDC00 || low > 0xDFFF)
+                        return json_fail(doc, in, "unpaired surrogate");
+                    in += 6;
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                } else if (code >= 0xDC00 && code <= 0xDFFF) {
+                    return json_fail(doc, in, "unpaired surrogate");
+                }
+                if (code == 0)
+                    return json_fail(doc, in, "\\u0000 in string");
+                
+                // UTF-8 is never longer than the escape it replaces
+                if (code < 0x80) {
+                    text[out++] = (char)code;
+                } else if (code < 0x800) {
+                    text[out++] = (char)(0xC0 | code >> 6);
+                    text[out++] = (char)(0x80 | (code & 0x3F));
+                } else if (code < 0x10000) {
+                    text[out++] = (char)(0xE0 | code >> 12);
+                    text[out++] = (char)(0x80 | (code >> 6 & 0x3F));
+                    text[out++] = (char)(0x80 | (code & 0x3F));
+                } else {
+                    text[out++] = (char)(0xF0 | code >> 18);
+                    text[out++] = (char)(0x80 | (code >> 12 & 0x3F));
+                    text[out++] = (char)(0x80 | (code >> 6 & 0x3F));
+                    text[out++] = (char)(0x80 | (code & 0x3F));
+                }
+                break;
+            }
+            default:
+                return json_fail(doc, in - 1, "bad escape");
+        }
+    }
+    
+    // The closing quote, at the latest, takes the terminator
+    text[out] = '\0';
+    token->type = JSON_STRING;
+    token->length = (UINT32)(out - token->start);
+    *pos = in;
+    return TRUE;
+}
+
+// Numbers are validated here and converted when bound; 0x... is accepted
+// for integer fields
+static BOOL parse_number(JsonDocument* doc, size_t length, size_t* pos, JsonToken* token)
+{
+    const char* text = doc->text;
+    size_t p = *pos;
+    token->start = (UINT32)p;
+    
+    if (text[p] == '-')
+        p++;
+    if (p + 1 < length && text[p] == '0' && (text[p + 1] == 'x' || text[p + 1] == 'X')) {
+        p += 2;
+        size_t digits = p;
+        while (p < length && hex_digit(text[p]) >= 0)
+            p++;
+        if (p == digits)
+            return json_fail(doc, p, "bad hex number");
+    } else {
+        size_t digits = p;
+        while (p < length && text[p] >= '0' && text[p] <= '9')
+            p++;
+        if (p == digits)
+            return json_fail(doc, p, "bad number");
+        if (p < length && text[p] == '.') {
+            p++;
+            digits = p;
+            while (p < length && text[p] >= '0' && text[p] <= '9')
+                p++;
+            if (p == digits)
+                return json_fail(doc, p, "bad number");
+        }
+        if (p < length && (text[p] == 'e' || text[p] == 'E')) {
+            p++;
+            if (p < length && (text[p] == '+' || text[p] == '-'))
+                p++;
+            digits = p;
+            while (p < length && text[p] >= '0' && text[p] <= '9')
+                p++;
+            if (p == digits)
+                return json_fail(doc, p, "bad number");
+        }
+    }
+    
+    token->type = JSON_NUMBER;
+    token->length = (UINT32)(p - token->start);
+    *pos = p;
+    return TRUE;
+}
+
+static BOOL parse_literal(JsonDocument* doc, size_t length, size_t* pos, JsonToken* token)
+{
+    static const struct {
+        const char* word;
+        JsonType type;
+    } literals[] = { { "true", JSON_TRUE }, { "false", JSON_FALSE }, { "null", JSON_NULL } };
+    
+    for (size_t i = 0; i < sizeof(literals) / sizeof(literals[0]); i++) {
+        size_t word_length = strlen(literals[i].word);
+        if (length - *pos >= word_length && memcmp(doc->text + *pos, literals[i].word, word_length) == 0) {
+            token->type = literals[i].type;
+            token->start = (UINT32)*pos;
+            token->length = (UINT32)word_length;
+            *pos += word_length;
+            return TRUE;
+        }
+    }
+    return json_fail(doc, *pos, "unexpected character");
+}
+
+static size_t skip_space(const char* text, size_t length, size_t pos)
+{
+    while (pos < length && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+        pos++;
+    return pos;
+}
+
+BOOL json_parse(JsonDocument* doc, char* text, size_t length)
+{
+    doc->text = text;
+    doc->count = 0;
+    doc->error[0] = '\0';
+    
+    // Open containers, innermost last
+    UINT32 stack[JSON_MAX_DEPTH];
+    int depth = 0;
+    size_t pos = 0;
+    
+    // Each pass reads one value, with the key before it inside objects
+    for (;;) {
+        pos = skip_space(text, length, pos);
+        JsonToken* parent = depth > 0 ? &doc->tokens[stack[depth - 1]] : NULL;
+        
+        // Close containers
+        if (parent && pos < length && text[pos] == (parent->type == JSON_OBJECT ? '}' : ']')) {
+            parent->next = doc->count;
+            depth--;
+            pos++;
+        } else {
+            if (parent && parent->count > 0) {
+                if (pos >= length || text[pos] != ',')
+                    return json_fail(doc, pos, parent->type == JSON_OBJECT ? "expected ',' or '}'"
+                                                                           : "expected ',' or ']'");
+                pos = skip_space(text, length, pos + 1);
+                if (pos < length && (text[pos] == '}' || text[pos] == ']'))
+                    return json_fail(doc, pos, "trailing comma");
+            }
+            
+            if (parent && parent->type == JSON_OBJECT) {
+                if (pos >= length || text[pos] != '"')
+                    return json_fail(doc, pos, "expected key");
+                if (doc->count == JSON_MAX_TOKENS)
+                    return json_fail(doc, pos, "too many values");
+                JsonToken* key = &doc->tokens[doc->count++];
+                memset(key, 0, sizeof(JsonToken));
+                pos++;
+                if (!parse_string(doc, length, &pos, key))
+                    return FALSE;
+                key->next = doc->count;
+                pos = skip_space(text, length, pos);
+                if (pos >= length || text[pos] != ':')
+                    return json_fail(doc, pos, "expected ':'");
+                pos = skip_space(text, length, pos + 1);
+            }
+            
+            if (pos >= length)
+                return json_fail(doc, pos, "unexpected end");
+            if (doc->count == JSON_MAX_TOKENS)
+                return json_fail(doc, pos, "too many values");
+            UINT32 index = doc->count++;
+            JsonToken* token = &doc->tokens[index];
+            memset(token, 0, sizeof(JsonToken));
+            if (parent)
+                parent->count++;
+            
+            char c = text[pos];
+            if (c == '{' || c == '[') {
+                if (depth == JSON_MAX_DEPTH)
+                    return json_fail(doc, pos, "nested too deeply");
+                token->type = c == '{' ? JSON_OBJECT : JSON_ARRAY;
+                token->start = (UINT32)pos;
+                stack[depth++] = index;
+                pos++;
+                continue;
+            }
+            
+            BOOL parsed;
+            if (c == '"') {
+                pos++;
+                parsed = parse_string(doc, length, &pos, token);
+            } else if (c == '-' || (c >= '0' && c <= '9')) {
+                parsed = parse_number(doc, length, &pos, token);
+            } else {
+                parsed = parse_literal(doc, length, &pos, token);
+            }
+            if (!parsed)
+                return FALSE;
+            token->next = doc->count;
+        }
+        
+        if (depth == 0)
+            break;
+    }
+    
+    if (skip_space(text, length, pos) != length)
+        return json_fail(doc, pos, "data after the value");
+    return TRUE;
+}
+
+UINT32 json_child(const JsonDocument* doc, UINT32 container)
+{
+    (void)doc;
+    return container + 1;
+}
+
+UINT32 json_sibling(const JsonDocument* doc, UINT32 token)
+{
+    return doc->tokens[token].next;
+}
+
+// Integers come as JSON numbers or, for hex, quoted strings like "0x1000"
+static BOOL token_integer(const JsonDocument* doc, const JsonToken* token, INT64* value)
+{
+    if (token->type != JSON_NUMBER && token->type != JSON_STRING)
+        return FALSE;
+    if (token->length == 0 || token->length > 24)
+        return FALSE;
+    
+    char digits[32];
+    memcpy(digits, doc->text + token->start, token->length);
+    digits[token->length] = '\0';
+    
+    BOOL negative = digits[0] == '-';
+    const char* start = digits + (negative ? 1 : 0);
+    BOOL hex = start[0] == '0' && (start[1] == 'x' || start[1] == 'X');
+    if (token->type == JSON_STRING && !hex)
+        return FALSE;
+    
+    char* end = NULL;
+    errno = 0;
+    unsigned long long magnitude = strtoull(hex ? start + 2 : start, &end, hex ? 16 : 10);
+    if (*end || errno == ERANGE || end == start || magnitude > (unsigned long long)INT64_MAX)
+        return FALSE;
+    *value = negative ? -(INT64)magnitude : (INT64)magnitude;
+    return TRUE;
+}
+
+static BOOL bind_field(JsonDocument* doc, const JsonField* field, const JsonToken* token, void* target)
+{
+    char* member = (char*)target + field->offset;
+    
+    switch (field->type) {
+        case JSON_FIELD_INT:
+        case JSON_FIELD_UINT: {
+            INT64 value;
+            if (!token_integer(doc, token, &value)) {
+                snprintf(doc->error, sizeof(doc->error), "Field \"%s\" must be an integer", field->name);
+                return FALSE;
+            }
+            if (value < field->min || value > field->max) {
+                snprintf(doc->error, sizeof(doc->error), "Field \"%s\" must be between %lld and %lld",
+                         field->name, (long long)field->min, (long long)field->max);
+                return FALSE;
+            }
+            if (field->type == JSON_FIELD_INT)
+                *(int*)member = (int)value;
+            else
+                *(UINT32*)member = (UINT32)value;
+            return TRUE;
+        }
+        case JSON_FIELD_DOUBLE: {
+            if (token->type != JSON_NUMBER) {
+                snprintf(doc->error, sizeof(doc->error), "Field \"%s\" must be a number", field->name);
+                return FALSE;
+            }
+            char digits[64];
+            size_t length = token->length < sizeof(digits) - 1 ? token->length : sizeof(digits) - 1;
+            memcpy(digits, doc->text + token->start, length);
+            digits[length] = '\0';
+            *(double*)member = strtod(digits, NULL);
+            return TRUE;
+        }
+        case JSON_FIELD_BOOL:
+            if (token->type != JSON_TRUE && token->type != JSON_FALSE) {
+                snprintf(doc->error, sizeof(doc->error), "Field \"%s\" must be true or false", field->name);
+                return FALSE;
+            }
+            *(BOOL*)member = token->type == JSON_TRUE;
+            return TRUE;
+        case JSON_FIELD_STRING:
+            if (token->type != JSON_STRING) {
+                snprintf(doc->error, sizeof(doc->error), "Field \"%s\" must be a string", field->name);
+                return FALSE;
+            }
+            if (field->max > 0 && token->length > (UINT64)field->max) {
+                snprintf(doc->error, sizeof(doc->error), "Field \"%s\" is longer than %lld bytes", field->name,
+                         (long long)field->max);
+                return FALSE;
+            }
+            *(const char**)member = doc->text + token->start;
+            return TRUE;
+        case JSON_FIELD_ARRAY:
+            if (token->type != JSON_ARRAY) {
+                snprintf(doc->error, sizeof(doc->error), "Field \"%s\" must be an array", field->name);
+                return FALSE;
+            }
+            *(UINT32*)member = (UINT32)(token - doc->tokens);
+            return TRUE;
+    }
+    return FALSE;
+}
+
+BOOL json_bind(JsonDocument* doc, UINT32 object, const JsonField* fields, size_t field_count, void* target)
+{
+    if (object >= doc->count || doc->tokens[object].type != JSON_OBJECT) {
+        snprintf(doc->error, sizeof(doc->error), "Expected a JSON object");
+        return FALSE;
+    }
+    
+    UINT64 seen = 0;
+    UINT32 key = json_child(doc, object);
+    for (UINT32 i = 0; i < doc->tokens[object].count; i++) {
+        UINT32 value = key + 1;
+        const char* name = doc->text + doc->tokens[key].start;
+        
+        for (size_t f = 0; f < field_count && f < 64; f++) {
+            if (strcmp(fields[f].name, name) != 0)
+                continue;
+            if (seen & (1ULL << f)) {
+                snprintf(doc->error, sizeof(doc->error), "Duplicate field \"%s\"", name);
+                return FALSE;
+            }
+            seen |= 1ULL << f;
+            if (!bind_field(doc, &fields[f], &doc->tokens[value], target))
+                return FALSE;
+            break;
+        }
+        key = json_sibling(doc, value);
+    }
+    
+    for (size_t f = 0; f < field_count && f < 64; f++) {
+        if (fields[f].required && !(seen & (1ULL << f))) {
+            snprintf(doc->error, sizeof(doc->error), "Missing field \"%s\"", fields[f].name);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+const char* json_escape(const char* text, char* out, size_t size)
+{
+    static const char hex[] = "0123456789abcdef";
+    
+    if (!out || size == 0)
+        return "";
+    
+    size_t length = 0;
+    for (const unsigned char* in = (const unsigned char*)(text ? text : ""); *in; in++) {
+        char escape[7];
+        size_t escape_length = 2;
+        escape[0] = '\\';
+        switch (*in) {
+            case '"': escape[1] = '"'; break;
+            case '\\': escape[1] = '\\'; break;
+            case '\n': escape[1] = 'n'; break;
+            case '\r': escape[1] = 'r'; break;
+            case '\t': escape[1] = 't'; break;
+            default:
+                if (*in >= 0x20) {
+                    escape[0] = (char)*in;
+                    escape_length = 1;
+                } else {
+                    memcpy(escape + 1, "u00", 3);
+                    escape[4] = hex[*in >> 4];
+                    escape[5] = hex[*in & 0xF];
+                    escape_length = 6;
+                }
+                break;
+        }
+        
+        // An escape is never split, and a UTF-8 sequence cut short is dropped whole
+        if (length + escape_length >= size) {
+            if ((*in & 0xC0) == 0x80) {
+                while (length > 0 && ((unsigned char)out[length - 1] & 0xC0) == 0x80)
+                    length--;
+                if (length > 0)
+                    length--;
+            }
+            break;
+        }
+        memcpy(out + length, escape, escape_length);
+        length += escape_length;
+    }
+    
+    out[length] = '\0';
+    return out;
+}
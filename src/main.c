@@ -1,5 +1,6 @@
 #include "rcrdp.h"
 #include "http_server.h"
+#include "bitmap_decode.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,7 +13,8 @@
 #endif
 
 static HttpServer* g_server = NULL;
-static RDPClient* g_client = NULL;
+static SessionPool* g_sessions = NULL;
+static BitmapDecoder* g_decoder = NULL;
 
 typedef struct {
     char* hostname;
@@ -21,6 +23,17 @@ typedef struct {
     char* password;
     char* domain;
     int http_port;
+    int blank_timeout_ms;
+    RDPGeometry geometry;
+    RDPGfxMode gfx_mode;
+    char* sessions_file;
+    int workers;
+    int decode_threads;
+    int reconnect_attempts;
+    int idle_timeout_s;
+    char* source;
+    char* record_dir;
+    int history_mb;
 } ServerConfig;
 
 static void config_init(ServerConfig* config)
@@ -28,6 +41,12 @@ static void config_init(ServerConfig* config)
     memset(config, 0, sizeof(ServerConfig));
     config->rdp_port = 3389;
     config->http_port = DEFAULT_PORT;
+    config->blank_timeout_ms = DEFAULT_BLANK_FRAME_TIMEOUT_MS;
+    config->geometry.width = DEFAULT_DESKTOP_WIDTH;
+    config->geometry.height = DEFAULT_DESKTOP_HEIGHT;
+    config->geometry.color_depth = DEFAULT_COLOR_DEPTH;
+    config->gfx_mode = RDP_GFX_AUTO;
+    config->reconnect_attempts = DEFAULT_RECONNECT_ATTEMPTS;
 }
 
 static void config_free(ServerConfig* config)
@@ -36,41 +55,75 @@ static void config_free(ServerConfig* config)
     if (config->username) free(config->username);
     if (config->password) free(config->password);
     if (config->domain) free(config->domain);
+    if (config->sessions_file) free(config->sessions_file);
+    if (config->source) free(config->source);
+    if (config->record_dir) free(config->record_dir);
 }
 
 static void signal_handler(int signum)
 {
     printf("\nReceived signal %d, shutting down...\n", signum);
     
+    // Sessions are disconnected during cleanup, once the workers have drained
     if (g_server) {
         http_server_stop(g_server);
     }
-    
-    if (g_client) {
-        rdp_client_disconnect(g_client);
-    }
 }
 
 static void print_server_usage(void)
 {
     printf("Usage: rcrdp [options]\n\n");
     printf("Connection options:\n");
-    printf("  -h, --host <hostname>     RDP server hostname (required)\n");
+    printf("  -h, --host <hostname>     RDP server hostname for the default session\n");
     printf("  -r, --rdp-port <port>     RDP server port (default: 3389)\n");
     printf("  -u, --username <user>     Username for authentication\n");
     printf("  -P, --password <pass>     Password for authentication\n");
-    printf("  -d, --domain <domain>     Domain for authentication\n\n");
+    printf("  -d, --domain <domain>     Domain for authentication\n");
+    printf("  -W, --width <pixels>      Desktop width (default: %d)\n", DEFAULT_DESKTOP_WIDTH);
+    printf("  -H, --height <pixels>     Desktop height (default: %d)\n", DEFAULT_DESKTOP_HEIGHT);
+    printf("  -b, --bpp <depth>         Color depth: 8, 15, 16, 24 or 32 (default: %d)\n", DEFAULT_COLOR_DEPTH);
+    printf("  -g, --gfx <mode>          Graphics pipeline: auto, avc444, avc420, progressive or off\n");
+    printf("                            (default: auto, AVC444 when FreeRDP has an H.264 decoder)\n");
+    printf("  -R, --reconnect <n>       Reconnect attempts after a dropped connection, 0 disables (default: %d)\n",
+           DEFAULT_RECONNECT_ATTEMPTS);
+    printf("  -I, --idle-timeout <s>    Pause display updates after <s> seconds without screen\n");
+    printf("                            requests, 0 disables (default: 0)\n");
+    printf("  -F, --source <spec>       Frame source for every session (default: freerdp):\n");
+    printf("                            synthetic[:fps=<n>,damage=full|tile|none,log=<file>]\n");
+    printf("                            replay:<dir of PNGs>[,fps=<n>,log=<file>]\n");
+    printf("  -o, --record <dir>        Record every session to <dir>/<id>-<time>.rcrec\n");
+    printf("  -M, --history <MiB>       Keep up to <MiB> of recent frames per session for\n");
+    printf("                            /screen?ago= and ?generation=, 0 disables (default: 0)\n");
+    printf("  -S, --sessions <file>     Create additional sessions from a file, one per line:\n");
+    printf("                            <id> <host> [port] [username] [password] [domain]\n");
+    printf("                            [width=<w>] [height=<h>] [bpp=<depth>]\n\n");
     printf("Server options:\n");
     printf("  -p, --port <port>         HTTP server port (default: 8080)\n");
+    printf("  -w, --workers <n>         HTTP worker threads (default: 2 per CPU, at least 4)\n");
+    printf("  -D, --decode-threads <n>  Bitmap/tile decode threads, 1 decodes inline (default: 1 per CPU)\n");
+    printf("  -B, --blank-timeout <ms>  Max wait for a non-blank frame on /screen (default: %d)\n",
+           DEFAULT_BLANK_FRAME_TIMEOUT_MS);
     printf("  --help                    Show this help message\n\n");
     printf("HTTP API Endpoints:\n");
-    printf("  GET  /screen              Get current screenshot (PNG)\n");
+    printf("  GET  /screen              Get current screenshot (PNG); ?fresh=1 forces a repaint,\n");
+    printf("                            ?x=&y=&width=&height= crops to a region,\n");
+    printf("                            ?ago=<ms> or ?generation=<n> reads the frame history\n");
     printf("  GET  /status              Get connection status (JSON)\n");
     printf("  POST /sendkey             Send keyboard event (JSON: {\"flags\": 1, \"code\": 65})\n");
     printf("  POST /sendmouse           Send mouse event (JSON: {\"flags\": 4096, \"x\": 100, \"y\": 200})\n");
-    printf("  POST /movemouse           Move mouse (JSON: {\"x\": 100, \"y\": 200})\n\n");
+    printf("  POST /movemouse           Move mouse (JSON: {\"x\": 100, \"y\": 200})\n");
+    printf("  POST /wait_for            Wait for template image (JSON: {\"template\": \"<base64 PNG>\", \"timeout_ms\": 5000})\n");
+    printf("  POST /probe               Check pixel/region colors (JSON: {\"probes\": [{\"op\": \"color\", \"x\": 10, \"y\": 20, \"color\": \"#00ff00\"}]})\n");
+    printf("  POST /resize              Resize the desktop (JSON: {\"width\": 1280, \"height\": 720})\n");
+    printf("  GET  /recording           Recording status (JSON)\n");
+    printf("  GET  /recording/frame     Recorded screen at ?t=<ms since the recording started> (PNG)\n");
+    printf("  GET  /sessions            List sessions (JSON)\n");
+    printf("  POST /sessions            Create session (JSON: {\"id\": \"lab1\", \"host\": \"10.0.0.5\", \"username\": \"admin\", \"password\": \"...\"})\n");
+    printf("  DELETE /sessions/{id}     Disconnect and remove session\n");
+    printf("  /sessions/{id}/<route>    Any route above, for a specific session\n\n");
     printf("Examples:\n");
     printf("  rcrdp -h 192.168.1.100 -u admin -P password\n");
+    printf("  rcrdp -F synthetic:fps=60,damage=tile\n");
     printf("  curl http://localhost:8080/screen > screenshot.png\n");
     printf("  curl -X POST -d '{\"flags\":1,\"code\":65}' http://localhost:8080/sendkey\n");
     printf("  curl -X POST -d '{\"x\":100,\"y\":200}' http://localhost:8080/movemouse\n");
@@ -88,11 +141,24 @@ static int parse_arguments(int argc, char** argv, ServerConfig* config)
         {"username", required_argument, 0, 'u'},
         {"password", required_argument, 0, 'P'},
         {"domain", required_argument, 0, 'd'},
+        {"blank-timeout", required_argument, 0, 'B'},
+        {"sessions", required_argument, 0, 'S'},
+        {"workers", required_argument, 0, 'w'},
+        {"width", required_argument, 0, 'W'},
+        {"height", required_argument, 0, 'H'},
+        {"bpp", required_argument, 0, 'b'},
+        {"gfx", required_argument, 0, 'g'},
+        {"decode-threads", required_argument, 0, 'D'},
+        {"reconnect", required_argument, 0, 'R'},
+        {"idle-timeout", required_argument, 0, 'I'},
+        {"source", required_argument, 0, 'F'},
+        {"record", required_argument, 0, 'o'},
+        {"history", required_argument, 0, 'M'},
         {"help", no_argument, 0, '?'},
         {0, 0, 0, 0}
     };
     
-    while ((opt = getopt_long(argc, argv, "h:r:p:u:P:d:?", long_options, &option_index)) != -1)
+    while ((opt = getopt_long(argc, argv, "h:r:p:u:P:d:B:S:w:W:H:b:g:D:R:I:F:o:M:?", long_options, &option_index)) != -1)
     {
         switch (opt)
         {
@@ -114,6 +180,58 @@ static int parse_arguments(int argc, char** argv, ServerConfig* config)
             case 'd':
                 config->domain = strdup(optarg);
                 break;
+            case 'B':
+                config->blank_timeout_ms = atoi(optarg);
+                if (config->blank_timeout_ms < 0)
+                    config->blank_timeout_ms = 0;
+                break;
+            case 'S':
+                config->sessions_file = strdup(optarg);
+                break;
+            case 'w':
+                config->workers = atoi(optarg);
+                break;
+            case 'W':
+                config->geometry.width = (UINT32)atoi(optarg);
+                break;
+            case 'H':
+                config->geometry.height = (UINT32)atoi(optarg);
+                break;
+            case 'b':
+                config->geometry.color_depth = (UINT32)atoi(optarg);
+                break;
+            case 'D':
+                config->decode_threads = atoi(optarg);
+                if (config->decode_threads < 0)
+                    config->decode_threads = 0;
+                break;
+            case 'R':
+                config->reconnect_attempts = atoi(optarg);
+                if (config->reconnect_attempts < 0)
+                    config->reconnect_attempts = 0;
+                break;
+            case 'I':
+                config->idle_timeout_s = atoi(optarg);
+                if (config->idle_timeout_s < 0)
+                    config->idle_timeout_s = 0;
+                break;
+            case 'F':
+                config->source = strdup(optarg);
+                break;
+            case 'o':
+                config->record_dir = strdup(optarg);
+                break;
+            case 'M':
+                config->history_mb = atoi(optarg);
+                if (config->history_mb < 0)
+                    config->history_mb = 0;
+                break;
+            case 'g':
+                if (!rdp_gfx_mode_parse(optarg, &config->gfx_mode)) {
+                    fprintf(stderr, "Error: Unknown graphics mode %s\n", optarg);
+                    return -1;
+                }
+                break;
             case '?':
             default:
                 print_server_usage();
@@ -121,12 +239,20 @@ static int parse_arguments(int argc, char** argv, ServerConfig* config)
         }
     }
     
-    if (!config->hostname) {
-        fprintf(stderr, "Error: hostname is required\n");
-        print_server_usage();
+    const char* error = NULL;
+    if (!rdp_geometry_valid(&config->geometry, &error)) {
+        fprintf(stderr, "Error: %s\n", error);
         return -1;
     }
     
+    // A local source needs no server, so it always gets a default session
+    if (config->source && !config->hostname && strcmp(config->source, "freerdp") != 0)
+        config->hostname = strdup("local");
+    
+    if (!config->hostname && !config->sessions_file) {
+        printf("No default session; create sessions with POST /sessions\n");
+    }
+    
     return 0;
 }
 
@@ -146,55 +272,85 @@ int main(int argc, char** argv)
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     
-    // Create RDP client
-    g_client = rdp_client_new();
-    if (!g_client) {
-        fprintf(stderr, "Error: Failed to create RDP client\n");
+    g_sessions = session_pool_new();
+    if (!g_sessions) {
+        fprintf(stderr, "Error: Failed to create session pool\n");
         ret = 1;
         goto cleanup;
     }
+    g_sessions->blank_frame_timeout_ms = (UINT32)config.blank_timeout_ms;
+    g_sessions->geometry = config.geometry;
+    g_sessions->gfx_mode = config.gfx_mode;
+    g_sessions->reconnect_attempts = config.reconnect_attempts;
+    g_sessions->idle_timeout_ms = (UINT32)config.idle_timeout_s * 1000;
+    g_sessions->source = config.source;
+    g_sessions->record_dir = config.record_dir;
+    g_sessions->history_budget = (size_t)config.history_mb * 1024 * 1024;
     
-    // Connect to RDP server
-    printf("Connecting to RDP server %s:%d...\n", config.hostname, config.rdp_port);
-    if (!rdp_client_connect(g_client, config.hostname, config.rdp_port,
-                           config.username, config.password, config.domain)) {
-        fprintf(stderr, "Error: Failed to connect to RDP server\n");
-        ret = 1;
-        goto cleanup;
+    // One decode pool for all sessions; a single thread keeps decode on the event threads
+    if (config.decode_threads != 1) {
+        g_decoder = bitmap_decoder_new(config.decode_threads);
+        if (!g_decoder) {
+            fprintf(stderr, "Error: Failed to create bitmap decoder\n");
+            ret = 1;
+            goto cleanup;
+        }
+        config.decode_threads = g_decoder->thread_count;
     }
+    g_sessions->decoder = g_decoder;
+    g_sessions->decode_threads = config.decode_threads;
     
-    // Create HTTP server
+    // Bind the listener before any session exists, so health checks see the
+    // port at once; sessions connect in the background and /status reports
+    // their handshake progress
     g_server = http_server_new(config.http_port);
     if (!g_server) {
         fprintf(stderr, "Error: Failed to create HTTP server\n");
         ret = 1;
         goto cleanup;
     }
+    g_server->worker_count = config.workers;
     
-    // Start HTTP server
-    if (http_server_start(g_server, g_client) != 0) {
+    if (http_server_start(g_server, g_sessions) != 0) {
         fprintf(stderr, "Error: Failed to start HTTP server\n");
         ret = 1;
         goto cleanup;
     }
     
+    // A session that cannot be set up is reported and left out; the rest are
+    // still served, and POST /sessions can add it later
+    if (config.hostname) {
+        const char* error = NULL;
+        printf("Connecting to RDP server %s:%d...\n", config.hostname, config.rdp_port);
+        if (session_pool_create(g_sessions, "default", config.hostname, config.rdp_port, config.username,
+                                config.password, config.domain, NULL, NULL, &error) != SESSION_CREATE_OK)
+            fprintf(stderr, "Error: default session: %s\n", error);
+    }
+    
+    if (config.sessions_file && session_pool_load_file(g_sessions, config.sessions_file) < 0)
+        fprintf(stderr, "Error: sessions from %s not loaded\n", config.sessions_file);
+    
     // Run server loop
     printf("RDP-HTTP bridge running. Press Ctrl+C to stop.\n");
     http_server_run(g_server);
     
 cleanup:
-    if (g_client) {
-        rdp_client_disconnect(g_client);
-        rdp_client_free(g_client);
-        g_client = NULL;
-    }
-    
     if (g_server) {
         http_server_stop(g_server);
         http_server_free(g_server);
         g_server = NULL;
     }
     
+    if (g_sessions) {
+        session_pool_free(g_sessions);
+        g_sessions = NULL;
+    }
+    
+    if (g_decoder) {
+        bitmap_decoder_free(g_decoder);
+        g_decoder = NULL;
+    }
+    
     config_free(&config);
     printf("Server shutdown complete.\n");
     return ret;
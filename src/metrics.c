@@ -0,0 +1,341 @@
+#include "metrics.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    UINT64 buckets[METRIC_BUCKETS];   // the last one counts values above every bound
+    UINT64 sum;
+} HistogramData;
+
+// One shard per live thread. Only the owning thread writes, using relaxed
+// stores; the scraper reads with relaxed loads and sums across shards.
+// Shards of exited threads keep their totals and are handed to new threads.
+typedef struct _MetricsShard {
+    UINT64 counters[METRIC_COUNTER_COUNT];
+    HistogramData histograms[METRIC_HIST_COUNT];
+    BOOL in_use;
+    struct _MetricsShard* next;
+} MetricsShard;
+
+typedef struct {
+    const char* name;
+    const char* label;      // "key=\"value\"" or NULL
+    const char* help;
+} MetricDescriptor;
+
+typedef enum {
+    METRIC_UNIT_SECONDS,    // recorded in nanoseconds, bucketed in microseconds
+    METRIC_UNIT_BYTES
+} MetricUnit;
+
+typedef struct {
+    MetricDescriptor descriptor;
+    MetricUnit unit;
+} HistogramDescriptor;
+
+// Entries sharing a name must be adjacent so HELP/TYPE is written once
+static const MetricDescriptor counter_descriptors[METRIC_COUNTER_COUNT] = {
+    [METRIC_PAINTS] = { "rcrdp_paints_total", NULL, "Frames copied out of the GDI surface" },
+    [METRIC_EVENT_LOOP_WAKEUPS] = { "rcrdp_event_loop_wakeups_total", NULL,
+                                    "Event loop wakeups with a signalled handle" },
+    [METRIC_INPUT_KEY] = { "rcrdp_input_events_total", "type=\"key\"", "Input events sent to the server" },
+    [METRIC_INPUT_MOUSE] = { "rcrdp_input_events_total", "type=\"mouse\"", "Input events sent to the server" },
+    [METRIC_INPUT_MOVE] = { "rcrdp_input_events_total", "type=\"move\"", "Input events sent to the server" },
+    [METRIC_ENCODE_CACHE_HIT] = { "rcrdp_encode_cache_lookups_total", "result=\"hit\"",
+                                  "Encode cache lookups by screenshot requests" },
+    [METRIC_ENCODE_CACHE_MISS] = { "rcrdp_encode_cache_lookups_total", "result=\"miss\"",
+                                   "Encode cache lookups by screenshot requests" },
+};
+
+#define REQUEST_HISTOGRAM(route) \
+    { { "rcrdp_http_request_duration_seconds", "route=\"" route "\"", \
+        "HTTP request latency from read to send" }, METRIC_UNIT_SECONDS }
+
+static const HistogramDescriptor histogram_descriptors[METRIC_HIST_COUNT] = {
+    [METRIC_HIST_COPY_FRAME] = { { "rcrdp_copy_frame_buffer_seconds", NULL,
+                                   "Time to copy a paint into the frame buffer" }, METRIC_UNIT_SECONDS },
+    [METRIC_HIST_FRAME_LOCK_WAIT] = { { "rcrdp_frame_lock_wait_seconds", NULL,
+                                        "Wait for frame_mutex when taking a snapshot" }, METRIC_UNIT_SECONDS },
+    [METRIC_HIST_PNG_ENCODE] = { { "rcrdp_png_encode_seconds", NULL, "PNG encode time" }, METRIC_UNIT_SECONDS },
+    [METRIC_HIST_PNG_BYTES] = { { "rcrdp_png_bytes", NULL, "Encoded PNG size" }, METRIC_UNIT_BYTES },
+    [METRIC_HIST_CHECK_EVENTS] = { { "rcrdp_check_event_handles_seconds", NULL,
+                                     "Time spent in freerdp_check_event_handles" }, METRIC_UNIT_SECONDS },
+    [METRIC_HIST_SEND] = { { "rcrdp_http_send_seconds", NULL, "Time to write a response to the socket" },
+                           METRIC_UNIT_SECONDS },
+    [METRIC_HIST_REQUEST + METRIC_ROUTE_SCREEN] = REQUEST_HISTOGRAM("screen"),
+    [METRIC_HIST_REQUEST + METRIC_ROUTE_STATUS] = REQUEST_HISTOGRAM("status"),
+    [METRIC_HIST_REQUEST + METRIC_ROUTE_SENDKEY] = REQUEST_HISTOGRAM("sendkey"),
+    [METRIC_HIST_REQUEST + METRIC_ROUTE_SENDMOUSE] = REQUEST_HISTOGRAM("sendmouse"),
+    [METRIC_HIST_REQUEST + METRIC_ROUTE_MOVEMOUSE] = REQUEST_HISTOGRAM("movemouse"),
+    [METRIC_HIST_REQUEST + METRIC_ROUTE_WAIT_FOR] = REQUEST_HISTOGRAM("wait_for"),
+    [METRIC_HIST_REQUEST + METRIC_ROUTE_PROBE] = REQUEST_HISTOGRAM("probe"),
+    [METRIC_HIST_REQUEST + METRIC_ROUTE_RESIZE] = REQUEST_HISTOGRAM("resize"),
+    [METRIC_HIST_REQUEST + METRIC_ROUTE_CLIPBOARD] = REQUEST_HISTOGRAM("clipboard"),
+    [METRIC_HIST_REQUEST + METRIC_ROUTE_CURSOR] = REQUEST_HISTOGRAM("cursor"),
+    [METRIC_HIST_REQUEST + METRIC_ROUTE_RECORDING] = REQUEST_HISTOGRAM("recording"),
+    [METRIC_HIST_REQUEST + METRIC_ROUTE_SESSIONS] = REQUEST_HISTOGRAM("sessions"),
+    [METRIC_HIST_REQUEST + METRIC_ROUTE_METRICS] = REQUEST_HISTOGRAM("metrics"),
+    [METRIC_HIST_REQUEST + METRIC_ROUTE_OTHER] = REQUEST_HISTOGRAM("other"),
+};
+
+static pthread_mutex_t shards_mutex = PTHREAD_MUTEX_INITIALIZER;
+static MetricsShard* shards = NULL;
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local MetricsShard* thread_shard = NULL;
+
+static void shard_release(void* arg)
+{
+    MetricsShard* shard = (MetricsShard*)arg;
+    pthread_mutex_lock(&shards_mutex);
+    shard->in_use = FALSE;
+    pthread_mutex_unlock(&shards_mutex);
+}
+
+static void shard_key_create(void)
+{
+    pthread_key_create(&shard_key, shard_release);
+}
+
+static MetricsShard* get_thread_shard(void)
+{
+    if (thread_shard)
+        return thread_shard;
+    
+    pthread_once(&shard_key_once, shard_key_create);
+    
+    pthread_mutex_lock(&shards_mutex);
+    MetricsShard* shard = shards;
+    while (shard && shard->in_use)
+        shard = shard->next;
+    if (!shard) {
+        shard = (MetricsShard*)calloc(1, sizeof(MetricsShard));
+        if (!shard) {
+            pthread_mutex_unlock(&shards_mutex);
+            return NULL;
+        }
+        shard->next = shards;
+        shards = shard;
+    }
+    shard->in_use = TRUE;
+    pthread_mutex_unlock(&shards_mutex);
+    
+    pthread_setspecific(shard_key, shard);
+    thread_shard = shard;
+    return shard;
+}
+
+// Single-writer increment: a relaxed load/store pair, no locked instruction
+static inline void shard_add(UINT64* value, UINT64 amount)
+{
+    __atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+// Values up to 4 get their own bucket; above that each power of two is split
+// into four, so bucket bounds are 1, 2, 3, 4, 5, 6, 7, 8, 10, 12, 14, 16, 20, ...
+static UINT32 bucket_index(UINT64 value)
+{
+    if (value <= 4)
+        return value == 0 ? 0 : (UINT32)(value - 1);
+    
+    UINT64 below = value - 1;
+    UINT32 exponent = 63 - (UINT32)__builtin_clzll(below);
+    UINT32 sub = (UINT32)(below >> (exponent - 2)) & 3;
+    UINT32 index = 4 + (exponent - 2) * 4 + sub;
+    return index < METRIC_BUCKETS ? index : METRIC_BUCKETS - 1;
+}
+
+static UINT64 bucket_bound(UINT32 index)
+{
+    if (index < 4)
+        return index + 1;
+    
+    UINT32 exponent = (index - 4) / 4 + 2;
+    UINT32 sub = (index - 4) % 4;
+    return (1ULL << exponent) + (UINT64)(sub + 1) * (1ULL << (exponent - 2));
+}
+
+UINT64 metrics_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000000000ULL + (UINT64)ts.tv_nsec;
+}
+
+void metrics_count(MetricCounter counter, UINT64 value)
+{
+    MetricsShard* shard = get_thread_shard();
+    if (!shard || counter >= METRIC_COUNTER_COUNT)
+        return;
+    
+    shard_add(&shard->counters[counter], value);
+}
+
+void metrics_observe(MetricHistogram histogram, UINT64 value)
+{
+    MetricsShard* shard = get_thread_shard();
+    if (!shard || histogram >= METRIC_HIST_COUNT)
+        return;
+    
+    // Round up so a bucket bound is never below the value it counts
+    UINT64 bucketed = histogram_descriptors[histogram].unit == METRIC_UNIT_SECONDS ? (value + 999) / 1000 : value;
+    HistogramData* data = &shard->histograms[histogram];
+    shard_add(&data->buckets[bucket_index(bucketed)], 1);
+    shard_add(&data->sum, value);
+}
+
+void metrics_observe_request(MetricRoute route, UINT64 duration_ns)
+{
+    if (route >= METRIC_ROUTE_COUNT)
+        route = METRIC_ROUTE_OTHER;
+    metrics_observe((MetricHistogram)(METRIC_HIST_REQUEST + route), duration_ns);
+}
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+    BOOL failed;
+} TextBuffer;
+
+static void text_append(TextBuffer* text, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void text_append(TextBuffer* text, const char* format, ...)
+{
+    if (text->failed)
+        return;
+    
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(text->data + text->length, text->capacity - text->length, format, args);
+        va_end(args);
+        
+        if (written < 0) {
+            text->failed = TRUE;
+            return;
+        }
+        if ((size_t)written < text->capacity - text->length) {
+            text->length += (size_t)written;
+            return;
+        }
+        
+        size_t capacity = text->capacity * 2 + (size_t)written;
+        char* data = (char*)realloc(text->data, capacity);
+        if (!data) {
+            text->failed = TRUE;
+            return;
+        }
+        text->data = data;
+        text->capacity = capacity;
+    }
+}
+
+static void text_append_header(TextBuffer* text, const MetricDescriptor* descriptor,
+                               const MetricDescriptor* previous, const char* type)
+{
+    if (previous && strcmp(previous->name, descriptor->name) == 0)
+        return;
+    text_append(text, "# HELP %s %s\n# TYPE %s %s\n", descriptor->name, descriptor->help,
+                descriptor->name, type);
+}
+
+BOOL metrics_render(char** text_out, size_t* length)
+{
+    if (!text_out || !length)
+        return FALSE;
+    
+    UINT64* counters = (UINT64*)calloc(METRIC_COUNTER_COUNT, sizeof(UINT64));
+    HistogramData* histograms = (HistogramData*)calloc(METRIC_HIST_COUNT, sizeof(HistogramData));
+    if (!counters || !histograms) {
+        free(counters);
+        free(histograms);
+        return FALSE;
+    }
+    
+    // Sum every shard; values may be a few increments apart but never torn
+    pthread_mutex_lock(&shards_mutex);
+    for (MetricsShard* shard = shards; shard; shard = shard->next) {
+        for (int i = 0; i < METRIC_COUNTER_COUNT; i++)
+            counters[i] += __atomic_load_n(&shard->counters[i], __ATOMIC_RELAXED);
+        for (int i = 0; i < METRIC_HIST_COUNT; i++) {
+            HistogramData* data = &shard->histograms[i];
+            for (int b = 0; b < METRIC_BUCKETS; b++)
+                histograms[i].buckets[b] += __atomic_load_n(&data->buckets[b], __ATOMIC_RELAXED);
+            histograms[i].sum += __atomic_load_n(&data->sum, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&shards_mutex);
+    
+    TextBuffer text = { NULL, 0, 0, FALSE };
+    text.capacity = 16384;
+    text.data = (char*)malloc(text.capacity);
+    if (!text.data)
+        text.failed = TRUE;
+    
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        const MetricDescriptor* descriptor = &counter_descriptors[i];
+        text_append_header(&text, descriptor, i > 0 ? &counter_descriptors[i - 1] : NULL, "counter");
+        text_append(&text, "%s%s%s%s %llu\n", descriptor->name,
+                    descriptor->label ? "{" : "", descriptor->label ? descriptor->label : "",
+                    descriptor->label ? "}" : "", (unsigned long long)counters[i]);
+    }
+    
+    // Only buckets that have seen a value are written; once present they stay,
+    // so the series set only grows between scrapes
+    for (int i = 0; i < METRIC_HIST_COUNT; i++) {
+        const HistogramDescriptor* histogram = &histogram_descriptors[i];
+        const MetricDescriptor* descriptor = &histogram->descriptor;
+        text_append_header(&text, descriptor, i > 0 ? &histogram_descriptors[i - 1].descriptor : NULL,
+                           "histogram");
+        
+        const char* label = descriptor->label ? descriptor->label : "";
+        const char* separator = descriptor->label ? "," : "";
+        BOOL seconds = histogram->unit == METRIC_UNIT_SECONDS;
+        UINT64 cumulative = 0;
+        for (int b = 0; b < METRIC_BUCKETS - 1; b++) {
+            if (histograms[i].buckets[b] == 0)
+                continue;
+            cumulative += histograms[i].buckets[b];
+            if (seconds)
+                text_append(&text, "%s_bucket{%s%sle=\"%g\"} %llu\n", descriptor->name, label, separator,
+                            (double)bucket_bound((UINT32)b) / 1e6, (unsigned long long)cumulative);
+            else
+                text_append(&text, "%s_bucket{%s%sle=\"%llu\"} %llu\n", descriptor->name, label, separator,
+                            (unsigned long long)bucket_bound((UINT32)b), (unsigned long long)cumulative);
+        }
+        
+        // Summed from the same bucket reads, so +Inf and _count never fall
+        // below a finite bucket while observations race the scrape
+        UINT64 total = cumulative + histograms[i].buckets[METRIC_BUCKETS - 1];
+        text_append(&text, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", descriptor->name, label, separator,
+                    (unsigned long long)total);
+        
+        const char* braces_open = descriptor->label ? "{" : "";
+        const char* braces_close = descriptor->label ? "}" : "";
+        if (seconds)
+            text_append(&text, "%s_sum%s%s%s %.9f\n", descriptor->name, braces_open, label, braces_close,
+                        (double)histograms[i].sum / 1e9);
+        else
+            text_append(&text, "%s_sum%s%s%s %llu\n", descriptor->name, braces_open, label, braces_close,
+                        (unsigned long long)histograms[i].sum);
+        text_append(&text, "%s_count%s%s%s %llu\n", descriptor->name, braces_open, label, braces_close,
+                    (unsigned long long)total);
+    }
+    
+    free(counters);
+    free(histograms);
+    
+    if (text.failed) {
+        free(text.data);
+        return FALSE;
+    }
+    
+    *text_out = text.data;
+    *length = text.length;
+    return TRUE;
+}
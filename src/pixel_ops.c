@@ -0,0 +1,148 @@
+#include "pixel_ops.h"
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static inline BYTE channel_diff(UINT32 a, UINT32 b, int shift)
+{
+    int d = (int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF);
+    return (BYTE)(d < 0 ? -d : d);
+}
+
+static void stats_row_scalar(const UINT32* row, UINT32 count, UINT32 color, BYTE tolerance,
+                             PixelStats* stats)
+{
+    for (UINT32 i = 0; i < count; i++) {
+        UINT32 p = row[i];
+        stats->sum_r += (p >> 16) & 0xFF;
+        stats->sum_g += (p >> 8) & 0xFF;
+        stats->sum_b += p & 0xFF;
+        stats->matching += channel_diff(p, color, 16) <= tolerance &&
+                           channel_diff(p, color, 8) <= tolerance &&
+                           channel_diff(p, color, 0) <= tolerance;
+    }
+}
+
+#if defined(__SSE2__)
+static void stats_row_sse2(const UINT32* row, UINT32 count, UINT32 color, BYTE tolerance,
+                           PixelStats* stats)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i target = _mm_set1_epi32((int)color);
+    const __m128i tol = _mm_set1_epi8((char)tolerance);
+    const __m128i rgb_mask = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i mask_r = _mm_set1_epi32(0x00FF0000);
+    const __m128i mask_g = _mm_set1_epi32(0x0000FF00);
+    const __m128i mask_b = _mm_set1_epi32(0x000000FF);
+    
+    __m128i acc_r = zero, acc_g = zero, acc_b = zero;
+    UINT64 matching = 0;
+    UINT32 i = 0;
+    
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+        
+        // |v - target| per byte, X byte masked out, then compare against tolerance
+        __m128i diff = _mm_or_si128(_mm_subs_epu8(v, target), _mm_subs_epu8(target, v));
+        __m128i over = _mm_subs_epu8(_mm_and_si128(diff, rgb_mask), tol);
+        __m128i hit = _mm_cmpeq_epi32(over, zero);
+        matching += (UINT64)__builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(hit)));
+        
+        // Sum each channel with SAD against zero (one byte per lane survives the mask)
+        acc_r = _mm_add_epi64(acc_r, _mm_sad_epu8(_mm_and_si128(v, mask_r), zero));
+        acc_g = _mm_add_epi64(acc_g, _mm_sad_epu8(_mm_and_si128(v, mask_g), zero));
+        acc_b = _mm_add_epi64(acc_b, _mm_sad_epu8(_mm_and_si128(v, mask_b), zero));
+    }
+    
+    UINT64 lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc_r);
+    stats->sum_r += lanes[0] + lanes[1];
+    _mm_storeu_si128((__m128i*)lanes, acc_g);
+    stats->sum_g += lanes[0] + lanes[1];
+    _mm_storeu_si128((__m128i*)lanes, acc_b);
+    stats->sum_b += lanes[0] + lanes[1];
+    stats->matching += matching;
+    
+    stats_row_scalar(row + i, count - i, color, tolerance, stats);
+}
+#endif
+
+void pixel_rect_stats(const BYTE* data, UINT32 stride, const FrameRect* rect,
+                      UINT32 color, BYTE tolerance, PixelStats* stats)
+{
+    if (!stats)
+        return;
+    
+    memset(stats, 0, sizeof(PixelStats));
+    if (!data || !rect)
+        return;
+    
+    for (UINT32 y = 0; y < rect->height; y++) {
+        const UINT32* row = (const UINT32*)(data + (size_t)(rect->y + y) * stride) + rect->x;
+#if defined(__SSE2__)
+        stats_row_sse2(row, rect->width, color, tolerance, stats);
+#else
+        stats_row_scalar(row, rect->width, color, tolerance, stats);
+#endif
+    }
+    
+    stats->count = (UINT64)rect->width * rect->height;
+}
+
+
+// Compare one row against the reference pixel; returns FALSE on the first difference
+static BOOL row_is_uniform(const UINT32* row, UINT32 count, UINT32 reference)
+{
+    UINT32 i = 0;
+    
+#if defined(__SSE2__)
+    const __m128i ref = _mm_set1_epi32((int)(reference & 0x00FFFFFF));
+    const __m128i rgb_mask = _mm_set1_epi32(0x00FFFFFF);
+    
+    // 16 pixels per block: OR the XORs together and test the block once
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_xor_si128(_mm_and_si128(_mm_loadu_si128((const __m128i*)(row + i)), rgb_mask), ref);
+        __m128i b = _mm_xor_si128(_mm_and_si128(_mm_loadu_si128((const __m128i*)(row + i + 4)), rgb_mask), ref);
+        __m128i c = _mm_xor_si128(_mm_and_si128(_mm_loadu_si128((const __m128i*)(row + i + 8)), rgb_mask), ref);
+        __m128i d = _mm_xor_si128(_mm_and_si128(_mm_loadu_si128((const __m128i*)(row + i + 12)), rgb_mask), ref);
+        __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xFFFF)
+            return FALSE;
+    }
+#endif
+    
+    for (; i < count; i++) {
+        if ((row[i] ^ reference) & 0x00FFFFFF)
+            return FALSE;
+    }
+    
+    return TRUE;
+}
+
+BOOL pixel_rect_is_uniform(const BYTE* data, UINT32 stride, const FrameRect* rect, UINT32* color)
+{
+    if (!data || !rect || rect->width == 0 || rect->height == 0)
+        return FALSE;
+    
+    const BYTE* origin = data + (size_t)rect->y * stride + (size_t)rect->x * 4;
+    UINT32 reference = *(const UINT32*)origin & 0x00FFFFFF;
+    
+    // Coarse pass over every 16th row first: real content almost always fails here
+    for (UINT32 y = 0; y < rect->height; y += 16) {
+        if (!row_is_uniform((const UINT32*)(origin + (size_t)y * stride), rect->width, reference))
+            return FALSE;
+    }
+    
+    for (UINT32 y = 0; y < rect->height; y++) {
+        if (y % 16 == 0)
+            continue;
+        if (!row_is_uniform((const UINT32*)(origin + (size_t)y * stride), rect->width, reference))
+            return FALSE;
+    }
+    
+    if (color)
+        *color = reference;
+    return TRUE;
+}
\ No newline at end of file
@@ -0,0 +1,389 @@
+#include "rcrdp.h"
+#include "metrics.h"
+#include "worker_pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Frames are cut into horizontal strips that are filtered and deflated
+// concurrently, pigz-style: every strip but the last ends in a sync flush so
+// the raw deflate streams concatenate into one, each strip is primed with
+// the 32 KiB of filtered rows before it so matches still reach back across
+// the cut, and the strips' Adler-32s are combined for the zlib trailer.
+
+#define PNG_STRIP_MIN_ROWS 64
+#define PNG_PARALLEL_MIN_PIXELS (512 * 512)     // smaller images are encoded on the calling thread
+#define PNG_ZLIB_LEVEL 6                        // libpng's default
+#define PNG_WINDOW_SIZE 32768
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+    int pending;
+} PngBatch;
+
+typedef struct {
+    const BYTE* frame;
+    UINT32 width;
+    UINT32 stride;
+    UINT32 first_row;
+    UINT32 last_row;            // exclusive
+    BOOL final;                 // the image's last strip ends the deflate stream
+    BYTE* out;
+    size_t out_length;
+    size_t out_capacity;
+    uLong adler;
+    size_t raw_length;
+    UINT64 convert_ns;
+    BOOL failed;
+    PngBatch* batch;
+} PngStrip;
+
+static WorkerPool* encode_pool = NULL;
+static int encode_threads = 1;
+static pthread_once_t encode_pool_once = PTHREAD_ONCE_INIT;
+
+static void encode_pool_create(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    encode_threads = cpus < 1 ? 1 : (int)cpus;
+    
+    // The calling thread encodes a strip too
+    if (encode_threads > 1)
+        encode_pool = worker_pool_new(encode_threads - 1);
+    if (!encode_pool)
+        encode_threads = 1;
+}
+
+// 0x00RRGGBB pixels (B, G, R, X in memory) to packed RGB
+static void convert_row(const BYTE* src, BYTE* rgb, UINT32 width)
+{
+    const UINT32* pixels = (const UINT32*)src;
+    for (UINT32 x = 0; x < width; x++) {
+        UINT32 pixel = pixels[x];
+        rgb[x * 3 + 0] = (BYTE)(pixel >> 16);
+        rgb[x * 3 + 1] = (BYTE)(pixel >> 8);
+        rgb[x * 3 + 2] = (BYTE)pixel;
+    }
+}
+
+static inline BYTE paeth(BYTE a, BYTE b, BYTE c)
+{
+    int p = (int)a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return pb <= pc ? b : c;
+}
+
+static inline UINT32 filter_cost(BYTE value)
+{
+    return value < 128 ? value : 256u - value;
+}
+
+// Writes the filter byte and filtered row to out, choosing the filter with
+// the smallest sum of absolute differences as libpng's default heuristic does
+static void filter_row(const BYTE* row, const BYTE* prev, size_t row_bytes, BYTE* out)
+{
+    UINT32 cost[5] = { 0, 0, 0, 0, 0 };
+    for (size_t i = 0; i < row_bytes; i++) {
+        BYTE a = i >= 3 ? row[i - 3] : 0;
+        BYTE b = prev[i];
+        BYTE c = i >= 3 ? prev[i - 3] : 0;
+        cost[0] += filter_cost(row[i]);
+        cost[1] += filter_cost((BYTE)(row[i] - a));
+        cost[2] += filter_cost((BYTE)(row[i] - b));
+        cost[3] += filter_cost((BYTE)(row[i] - ((a + b) >> 1)));
+        cost[4] += filter_cost((BYTE)(row[i] - paeth(a, b, c)));
+    }
+    
+    int best = 0;
+    for (int filter = 1; filter < 5; filter++) {
+        if (cost[filter] < cost[best])
+            best = filter;
+    }
+    
+    out[0] = (BYTE)best;
+    BYTE* filtered = out + 1;
+    for (size_t i = 0; i < row_bytes; i++) {
+        BYTE a = i >= 3 ? row[i - 3] : 0;
+        BYTE b = prev[i];
+        BYTE c = i >= 3 ? prev[i - 3] : 0;
+        switch (best) {
+            case 0: filtered[i] = row[i]; break;
+            case 1: filtered[i] = (BYTE)(row[i] - a); break;
+            case 2: filtered[i] = (BYTE)(row[i] - b); break;
+            case 3: filtered[i] = (BYTE)(row[i] - ((a + b) >> 1)); break;
+            default: filtered[i] = (BYTE)(row[i] - paeth(a, b, c)); break;
+        }
+    }
+}
+
+// Runs deflate over the pending input, growing the strip's output as needed
+static BOOL strip_deflate(PngStrip* strip, z_stream* stream, int flush)
+{
+    for (;;) {
+        if (strip->out_length == strip->out_capacity) {
+            size_t capacity = strip->out_capacity * 2;
+            BYTE* out = (BYTE*)realloc(strip->out, capacity);
+            if (!out)
+                return FALSE;
+            strip->out = out;
+            strip->out_capacity = capacity;
+        }
+        
+        stream->next_out = strip->out + strip->out_length;
+        stream->avail_out = (uInt)(strip->out_capacity - strip->out_length);
+        int result = deflate(stream, flush);
+        strip->out_length = strip->out_capacity - stream->avail_out;
+        if (result == Z_STREAM_ERROR)
+            return FALSE;
+        
+        // Done when deflate stopped short of the end of the output
+        if (flush == Z_FINISH ? result == Z_STREAM_END : (stream->avail_in == 0 && stream->avail_out > 0))
+            return TRUE;
+    }
+}
+
+static BOOL encode_strip(PngStrip* strip)
+{
+    size_t row_bytes = (size_t)strip->width * 3;
+    size_t filtered_bytes = row_bytes + 1;
+    UINT32 window_rows = (UINT32)((PNG_WINDOW_SIZE + filtered_bytes - 1) / filtered_bytes);
+    UINT32 dictionary_rows = strip->first_row < window_rows ? strip->first_row : window_rows;
+    
+    BYTE* rows = (BYTE*)calloc(2, row_bytes);
+    BYTE* filtered = (BYTE*)malloc(filtered_bytes * (dictionary_rows > 0 ? dictionary_rows : 1));
+    strip->out_capacity = 65536;
+    strip->out = (BYTE*)malloc(strip->out_capacity);
+    if (!rows || !filtered || !strip->out) {
+        free(rows);
+        free(filtered);
+        return FALSE;
+    }
+    
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, PNG_ZLIB_LEVEL, Z_DEFLATED, -15, 8, Z_FILTERED) != Z_OK) {
+        free(rows);
+        free(filtered);
+        return FALSE;
+    }
+    
+    // prev starts as the row above the first one filtered, zero above the image
+    BYTE* prev = rows;
+    BYTE* cur = rows + row_bytes;
+    UINT32 y = strip->first_row - dictionary_rows;
+    if (y > 0)
+        convert_row(strip->frame + (size_t)(y - 1) * strip->stride, prev, strip->width);
+    
+    // The rows before the strip are filtered again only to prime the window
+    if (dictionary_rows > 0) {
+        for (UINT32 i = 0; i < dictionary_rows; i++, y++) {
+            convert_row(strip->frame + (size_t)y * strip->stride, cur, strip->width);
+            filter_row(cur, prev, row_bytes, filtered + (size_t)i * filtered_bytes);
+            BYTE* swap = prev;
+            prev = cur;
+            cur = swap;
+        }
+        size_t length = (size_t)dictionary_rows * filtered_bytes;
+        size_t window = length < PNG_WINDOW_SIZE ? length : PNG_WINDOW_SIZE;
+        deflateSetDictionary(&stream, filtered + length - window, (uInt)window);
+    }
+    
+    BOOL ok = TRUE;
+    strip->adler = adler32(0L, Z_NULL, 0);
+    for (; y < strip->last_row && ok; y++) {
+        UINT64 start = metrics_now_ns();
+        convert_row(strip->frame + (size_t)y * strip->stride, cur, strip->width);
+        strip->convert_ns += metrics_now_ns() - start;
+        
+        filter_row(cur, prev, row_bytes, filtered);
+        strip->adler = adler32(strip->adler, filtered, (uInt)filtered_bytes);
+        strip->raw_length += filtered_bytes;
+        
+        stream.next_in = filtered;
+        stream.avail_in = (uInt)filtered_bytes;
+        ok = strip_deflate(strip, &stream, Z_NO_FLUSH);
+        
+        BYTE* swap = prev;
+        prev = cur;
+        cur = swap;
+    }
+    
+    // A sync flush ends on a byte boundary without marking the last block
+    if (ok)
+        ok = strip_deflate(strip, &stream, strip->final ? Z_FINISH : Z_SYNC_FLUSH);
+    
+    deflateEnd(&stream);
+    free(rows);
+    free(filtered);
+    return ok;
+}
+
+static void encode_strip_task(void* arg)
+{
+    PngStrip* strip = (PngStrip*)arg;
+    strip->failed = !encode_strip(strip);
+    
+    PngBatch* batch = strip->batch;
+    pthread_mutex_lock(&batch->mutex);
+    if (--batch->pending == 0)
+        pthread_cond_broadcast(&batch->done);
+    pthread_mutex_unlock(&batch->mutex);
+}
+
+static void put_u32(BYTE* out, UINT32 value)
+{
+    out[0] = (BYTE)(value >> 24);
+    out[1] = (BYTE)(value >> 16);
+    out[2] = (BYTE)(value >> 8);
+    out[3] = (BYTE)value;
+}
+
+// Appends a chunk whose data is the concatenation of up to three parts
+static BYTE* put_chunk(BYTE* out, const char* type, const BYTE* a, size_t a_length, const BYTE* b,
+                       size_t b_length, const BYTE* c, size_t c_length)
+{
+    put_u32(out, (UINT32)(a_length + b_length + c_length));
+    memcpy(out + 4, type, 4);
+    BYTE* data = out + 8;
+    if (a_length)
+        memcpy(data, a, a_length);
+    if (b_length)
+        memcpy(data + a_length, b, b_length);
+    if (c_length)
+        memcpy(data + a_length + b_length, c, c_length);
+    
+    uLong crc = crc32(0L, out + 4, (uInt)(4 + a_length + b_length + c_length));
+    BYTE* end = data + a_length + b_length + c_length;
+    put_u32(end, (UINT32)crc);
+    return end + 4;
+}
+
+BOOL encode_png_memory(BYTE* buffer, UINT32 width, UINT32 height, UINT32 stride,
+                       BYTE** png_data, size_t* png_length, UINT64* convert_ns)
+{
+    int strip_count = 1;
+    if ((UINT64)width * height >= PNG_PARALLEL_MIN_PIXELS) {
+        pthread_once(&encode_pool_once, encode_pool_create);
+        strip_count = encode_threads;
+        if ((UINT32)strip_count > height / PNG_STRIP_MIN_ROWS)
+            strip_count = (int)(height / PNG_STRIP_MIN_ROWS);
+    }
+    
+    return encode_png_strips(buffer, width, height, stride, strip_count, png_data, png_length, convert_ns);
+}
+
+BOOL encode_png_strips(BYTE* buffer, UINT32 width, UINT32 height, UINT32 stride, int strip_count,
+                       BYTE** png_data, size_t* png_length, UINT64* convert_ns)
+{
+    if (!buffer || !png_data || !png_length || width == 0 || height == 0)
+        return FALSE;
+    
+    UINT64 start = metrics_now_ns();
+    
+    // Every strip needs a row
+    if (strip_count < 1)
+        strip_count = 1;
+    if ((UINT32)strip_count > height)
+        strip_count = (int)height;
+    if (strip_count > 1)
+        pthread_once(&encode_pool_once, encode_pool_create);
+    
+    PngStrip* strips = (PngStrip*)calloc((size_t)strip_count, sizeof(PngStrip));
+    if (!strips)
+        return FALSE;
+    
+    PngBatch batch;
+    pthread_mutex_init(&batch.mutex, NULL);
+    pthread_cond_init(&batch.done, NULL);
+    batch.pending = strip_count - 1;
+    
+    for (int i = 0; i < strip_count; i++) {
+        PngStrip* strip = &strips[i];
+        strip->frame = buffer;
+        strip->width = width;
+        strip->stride = stride;
+        strip->first_row = (UINT32)((UINT64)height * (UINT64)i / (UINT64)strip_count);
+        strip->last_row = (UINT32)((UINT64)height * (UINT64)(i + 1) / (UINT64)strip_count);
+        strip->final = i == strip_count - 1;
+        strip->batch = &batch;
+    }
+    
+    // Strip 0 runs here while the pool takes the rest; if the pool is
+    // shutting down they run here as well
+    for (int i = 1; i < strip_count; i++) {
+        if (!worker_pool_submit(encode_pool, encode_strip_task, &strips[i]))
+            encode_strip_task(&strips[i]);
+    }
+    strips[0].failed = !encode_strip(&strips[0]);
+    
+    pthread_mutex_lock(&batch.mutex);
+    while (batch.pending > 0)
+        pthread_cond_wait(&batch.done, &batch.mutex);
+    pthread_mutex_unlock(&batch.mutex);
+    pthread_cond_destroy(&batch.done);
+    pthread_mutex_destroy(&batch.mutex);
+    
+    // One IDAT per strip: the zlib header leads the first, the combined
+    // Adler-32 trails the last
+    BOOL ok = TRUE;
+    size_t total = 8 + 25 + 12;
+    uLong adler = 0;
+    UINT64 slowest_convert = 0;
+    for (int i = 0; i < strip_count; i++) {
+        ok = ok && !strips[i].failed;
+        total += 12 + strips[i].out_length;
+        adler = i == 0 ? strips[i].adler : adler32_combine(adler, strips[i].adler, (z_off_t)strips[i].raw_length);
+        if (strips[i].convert_ns > slowest_convert)
+            slowest_convert = strips[i].convert_ns;
+    }
+    total += 2 + 4;
+    
+    BYTE* png = ok ? (BYTE*)malloc(total) : NULL;
+    if (png) {
+        static const BYTE signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+        static const BYTE zlib_header[2] = { 0x78, 0x9c };
+        BYTE header[13];
+        put_u32(header, width);
+        put_u32(header + 4, height);
+        header[8] = 8;          // bits per channel
+        header[9] = 2;          // RGB
+        header[10] = 0;         // deflate
+        header[11] = 0;         // adaptive filtering
+        header[12] = 0;         // no interlace
+        BYTE trailer[4];
+        put_u32(trailer, (UINT32)adler);
+        
+        BYTE* out = png;
+        memcpy(out, signature, sizeof(signature));
+        out = put_chunk(out + sizeof(signature), "IHDR", header, sizeof(header), NULL, 0, NULL, 0);
+        for (int i = 0; i < strip_count; i++) {
+            out = put_chunk(out, "IDAT", zlib_header, i == 0 ? sizeof(zlib_header) : 0, strips[i].out,
+                            strips[i].out_length, trailer, strips[i].final ? sizeof(trailer) : 0);
+        }
+        out = put_chunk(out, "IEND", NULL, 0, NULL, 0, NULL, 0);
+        total = (size_t)(out - png);
+    }
+    
+    for (int i = 0; i < strip_count; i++)
+        free(strips[i].out);
+    free(strips);
+    if (!png)
+        return FALSE;
+    
+    // Strips convert concurrently, so the slowest one is what conversion added
+    if (convert_ns)
+        *convert_ns = slowest_convert;
+    metrics_observe(METRIC_HIST_PNG_ENCODE, metrics_now_ns() - start);
+    metrics_observe(METRIC_HIST_PNG_BYTES, total);
+    
+    *png_data = png;
+    *png_length = total;
+    return TRUE;
+}
@@ -0,0 +1,114 @@
+#include "image_encode.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The Quite OK Image format (qoiformat.org): each pixel becomes a run of the
+// previous pixel, a reference into a 64-entry table of recently seen colors,
+// a small difference from the previous pixel, or the pixel itself. There is
+// no entropy coding, so it encodes an order of magnitude faster than deflate.
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_HEADER_SIZE 14
+#define QOI_MAX_RUN 62
+
+static const BYTE qoi_end_marker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+static BYTE* put_u32(BYTE* out, UINT32 value)
+{
+    out[0] = (BYTE)(value >> 24);
+    out[1] = (BYTE)(value >> 16);
+    out[2] = (BYTE)(value >> 8);
+    out[3] = (BYTE)value;
+    return out + 4;
+}
+
+BOOL encode_qoi_memory(BYTE* buffer, UINT32 width, UINT32 height, UINT32 stride, BYTE** qoi_data,
+                       size_t* qoi_length)
+{
+    if (!buffer || !qoi_data || !qoi_length || width == 0 || height == 0)
+        return FALSE;
+    
+    // Worst case is a full QOI_OP_RGB per pixel
+    size_t capacity = QOI_HEADER_SIZE + (size_t)width * height * 4 + sizeof(qoi_end_marker);
+    BYTE* qoi = (BYTE*)malloc(capacity);
+    if (!qoi)
+        return FALSE;
+    
+    BYTE* out = qoi;
+    memcpy(out, "qoif", 4);
+    out = put_u32(out + 4, width);
+    out = put_u32(out, height);
+    *out++ = 3;             // RGB
+    *out++ = 0;             // sRGB with linear alpha
+    
+    // Colors are kept as 0x00RRGGBB; every pixel is opaque, which the hash
+    // below assumes when it adds alpha's 255 * 11
+    UINT32 index[64];
+    memset(index, 0xff, sizeof(index));
+    UINT32 previous = 0;
+    int run = 0;
+    
+    for (UINT32 y = 0; y < height; y++) {
+        const UINT32* row = (const UINT32*)(buffer + (size_t)y * stride);
+        for (UINT32 x = 0; x < width; x++) {
+            UINT32 pixel = row[x] & 0x00ffffff;
+            if (pixel == previous) {
+                if (++run == QOI_MAX_RUN) {
+                    *out++ = (BYTE)(QOI_OP_RUN | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            
+            if (run > 0) {
+                *out++ = (BYTE)(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+            
+            BYTE r = (BYTE)(pixel >> 16);
+            BYTE g = (BYTE)(pixel >> 8);
+            BYTE b = (BYTE)pixel;
+            int slot = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+            if (index[slot] == pixel) {
+                *out++ = (BYTE)(QOI_OP_INDEX | slot);
+            } else {
+                index[slot] = pixel;
+                
+                signed char dr = (signed char)(r - (BYTE)(previous >> 16));
+                signed char dg = (signed char)(g - (BYTE)(previous >> 8));
+                signed char db = (signed char)(b - (BYTE)previous);
+                signed char dr_dg = (signed char)(dr - dg);
+                signed char db_dg = (signed char)(db - dg);
+                
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    *out++ = (BYTE)(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                    *out++ = (BYTE)(QOI_OP_LUMA | (dg + 32));
+                    *out++ = (BYTE)((dr_dg + 8) << 4 | (db_dg + 8));
+                } else {
+                    *out++ = QOI_OP_RGB;
+                    *out++ = r;
+                    *out++ = g;
+                    *out++ = b;
+                }
+            }
+            previous = pixel;
+        }
+    }
+    
+    if (run > 0)
+        *out++ = (BYTE)(QOI_OP_RUN | (run - 1));
+    memcpy(out, qoi_end_marker, sizeof(qoi_end_marker));
+    out += sizeof(qoi_end_marker);
+    
+    // Give back the worst-case headroom
+    size_t length = (size_t)(out - qoi);
+    BYTE* shrunk = (BYTE*)realloc(qoi, length);
+    *qoi_data = shrunk ? shrunk : qoi;
+    *qoi_length = length;
+    return TRUE;
+}
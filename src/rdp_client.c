@@ -1,23 +1,256 @@
 #include "rcrdp.h"
+#include "bitmap_decode.h"
+#include "metrics.h"
+#include "frame_source.h"
+#include "recorder.h"
+#include "frame_history.h"
+#include "image_encode.h"
+#include "clipboard.h"
+#include "cursor.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <freerdp3/freerdp/client.h>
 #include <freerdp3/freerdp/client/cmdline.h>
+#include <freerdp3/freerdp/codec/h264.h>
+#include <freerdp3/freerdp/gdi/gfx.h>
 #include <freerdp3/freerdp/channels/channels.h>
+#include <freerdp3/freerdp/event.h>
 #include <freerdp3/freerdp/gdi/gdi.h>
 #include <freerdp3/freerdp/settings.h>
 #include <freerdp3/freerdp/settings_types.h>
+#include <freerdp3/freerdp/transport_io.h>
 #include <winpr3/winpr/wlog.h>
 
+static const char* const phase_names[RDP_PHASE_COUNT] = {
+    "idle", "tcp", "tls_nla", "licensing", "first_frame", "ready", "reconnecting", "failed"
+};
+
+// Default transport callbacks, identical for every context; the hooks below
+// forward to them while timing the handshake
+static rdpTransportIo default_io;
+static BOOL default_io_saved = FALSE;
+static pthread_mutex_t default_io_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Client whose handshake runs on this thread; ReadPdu only sees the transport
+static _Thread_local RDPClient* connecting_client = NULL;
+
+static int rdp_client_tcp_connect(rdpContext* context, rdpSettings* settings, const char* hostname,
+                                  int port, DWORD timeout)
+{
+    int sockfd = default_io.TCPConnect(context, settings, hostname, port, timeout);
+    
+    RDPClient* client = ((RDPContext*)context)->client;
+    if (sockfd >= 0 && client)
+        rdp_client_set_phase(client, RDP_PHASE_TLS_NLA);
+    
+    return sockfd;
+}
+
+static int rdp_client_read_pdu(rdpTransport* transport, wStream* s)
+{
+    // Licensing has no client callback, so watch the state machine between reads
+    RDPClient* client = connecting_client;
+    if (client && rdp_client_get_phase(client) == RDP_PHASE_TLS_NLA &&
+        freerdp_get_state(&client->context->context) >= CONNECTION_STATE_LICENSING)
+        rdp_client_set_phase(client, RDP_PHASE_LICENSING);
+    
+    return default_io.ReadPdu(transport, s);
+}
+
 static BOOL rdp_client_pre_connect(freerdp* instance)
 {
-    WINPR_UNUSED(instance);
+    const rdpTransportIo* io = freerdp_get_io_callbacks(instance->context);
+    if (!io)
+        return TRUE;
+    
+    pthread_mutex_lock(&default_io_mutex);
+    if (!default_io_saved && io->TCPConnect != rdp_client_tcp_connect) {
+        default_io = *io;
+        default_io_saved = TRUE;
+    }
+    pthread_mutex_unlock(&default_io_mutex);
+    
+    if (!default_io_saved)
+        return TRUE;
+    
+    rdpTransportIo hooked = default_io;
+    hooked.TCPConnect = rdp_client_tcp_connect;
+    hooked.ReadPdu = rdp_client_read_pdu;
+    return freerdp_set_io_callbacks(instance->context, &hooked);
+}
+
+static UINT rdp_client_disp_caps(DispClientContext* disp, UINT32 max_monitors,
+                                 UINT32 max_area_factor_a, UINT32 max_area_factor_b)
+{
+    WINPR_UNUSED(max_monitors);
+    RDPClient* client = (RDPClient*)disp->custom;
+    
+    pthread_mutex_lock(&client->state_mutex);
+    client->disp_max_area = max_area_factor_a * max_area_factor_b;
+    pthread_mutex_unlock(&client->state_mutex);
+    
+    printf("DEBUG: Display control ready, max area %ux%u\n", max_area_factor_a, max_area_factor_b);
+    return CHANNEL_RC_OK;
+}
+
+static RDPClient* rdp_client_from_gfx(RdpgfxClientContext* gfx)
+{
+    // GDI owns gfx->custom once the pipeline is initialized
+    rdpGdi* gdi = (rdpGdi*)gfx->custom;
+    return gdi && gdi->context ? ((RDPContext*)gdi->context)->client : NULL;
+}
+
+static UINT rdp_client_gfx_caps_confirm(RdpgfxClientContext* gfx, const RDPGFX_CAPS_CONFIRM_PDU* confirm)
+{
+    RDPClient* client = rdp_client_from_gfx(gfx);
+    if (client && confirm && confirm->capsSet) {
+        pthread_mutex_lock(&client->state_mutex);
+        client->gfx_caps_version = confirm->capsSet->version;
+        client->gfx_caps_flags = confirm->capsSet->flags;
+        pthread_mutex_unlock(&client->state_mutex);
+        printf("DEBUG: Graphics pipeline confirmed version %s, flags 0x%08X\n",
+               rdp_gfx_version_name(confirm->capsSet->version), confirm->capsSet->flags);
+    }
+    
+    return CHANNEL_RC_OK;
+}
+
+static UINT rdp_client_gfx_surface_command(RdpgfxClientContext* gfx, const RDPGFX_SURFACE_COMMAND* cmd)
+{
+    RDPClient* client = rdp_client_from_gfx(gfx);
+    if (!client || !client->gfx_surface_command)
+        return CHANNEL_RC_OK;
+    
+    // Record codecs as they are first used; decode stays in GDI
+    if (cmd->codecId < 32 && !(client->gfx_codecs_seen & (1u << cmd->codecId))) {
+        pthread_mutex_lock(&client->state_mutex);
+        client->gfx_codecs_seen |= 1u << cmd->codecId;
+        pthread_mutex_unlock(&client->state_mutex);
+    }
+    
+    return client->gfx_surface_command(gfx, cmd);
+}
+
+static void rdp_client_gfx_connected(RDPClient* client, RdpgfxClientContext* gfx)
+{
+    rdpGdi* gdi = client->context->context.gdi;
+    if (!gdi || !gdi_graphics_pipeline_init(gdi, gfx)) {
+        fprintf(stderr, "Failed to initialize graphics pipeline\n");
+        return;
+    }
+    
+    // Surface output goes through BeginPaint/EndPaint like legacy updates
+    client->gfx_surface_command = gfx->SurfaceCommand;
+    gfx->SurfaceCommand = rdp_client_gfx_surface_command;
+    gfx->CapsConfirm = rdp_client_gfx_caps_confirm;
+    
+    pthread_mutex_lock(&client->state_mutex);
+    client->gfx = gfx;
+    client->gfx_caps_version = 0;
+    client->gfx_caps_flags = 0;
+    client->gfx_codecs_seen = 0;
+    pthread_mutex_unlock(&client->state_mutex);
+}
+
+static void rdp_client_gfx_disconnected(RDPClient* client, RdpgfxClientContext* gfx)
+{
+    pthread_mutex_lock(&client->state_mutex);
+    client->gfx = NULL;
+    pthread_mutex_unlock(&client->state_mutex);
+    
+    rdpGdi* gdi = client->context->context.gdi;
+    if (gdi)
+        gdi_graphics_pipeline_uninit(gdi, gfx);
+    client->gfx_surface_command = NULL;
+}
+
+static void rdp_client_channel_connected(void* context, const ChannelConnectedEventArgs* e)
+{
+    RDPClient* client = ((RDPContext*)context)->client;
+    if (!client)
+        return;
+    
+    if (strcmp(e->name, RDPGFX_DVC_CHANNEL_NAME) == 0) {
+        rdp_client_gfx_connected(client, (RdpgfxClientContext*)e->pInterface);
+        return;
+    }
+    if (strcmp(e->name, CLIPRDR_SVC_CHANNEL_NAME) == 0) {
+        rdp_clipboard_connected(client, (CliprdrClientContext*)e->pInterface);
+        return;
+    }
+    if (strcmp(e->name, DISP_DVC_CHANNEL_NAME) != 0)
+        return;
+    
+    DispClientContext* disp = (DispClientContext*)e->pInterface;
+    disp->custom = client;
+    disp->DisplayControlCaps = rdp_client_disp_caps;
+    
+    pthread_mutex_lock(&client->state_mutex);
+    client->disp = disp;
+    pthread_mutex_unlock(&client->state_mutex);
+}
+
+static void rdp_client_channel_disconnected(void* context, const ChannelDisconnectedEventArgs* e)
+{
+    RDPClient* client = ((RDPContext*)context)->client;
+    if (!client)
+        return;
+    
+    if (strcmp(e->name, RDPGFX_DVC_CHANNEL_NAME) == 0) {
+        rdp_client_gfx_disconnected(client, (RdpgfxClientContext*)e->pInterface);
+        return;
+    }
+    if (strcmp(e->name, CLIPRDR_SVC_CHANNEL_NAME) == 0) {
+        rdp_clipboard_disconnected(client);
+        return;
+    }
+    if (strcmp(e->name, DISP_DVC_CHANNEL_NAME) != 0)
+        return;
+    
+    pthread_mutex_lock(&client->state_mutex);
+    client->disp = NULL;
+    client->disp_max_area = 0;
+    pthread_mutex_unlock(&client->state_mutex);
+}
+
+static BOOL rdp_client_desktop_resize(rdpContext* context)
+{
+    RDPClient* client = ((RDPContext*)context)->client;
+    rdpGdi* gdi = context->gdi;
+    UINT32 width = freerdp_settings_get_uint32(context->settings, FreeRDP_DesktopWidth);
+    UINT32 height = freerdp_settings_get_uint32(context->settings, FreeRDP_DesktopHeight);
+    
+    if (!gdi || !gdi_resize(gdi, width, height))
+        return FALSE;
+    
+    printf("DEBUG: Desktop resized to %ux%u\n", width, height);
+    if (!client)
+        return TRUE;
+    
+    pthread_mutex_lock(&client->state_mutex);
+    client->geometry.width = width;
+    client->geometry.height = height;
+    pthread_mutex_unlock(&client->state_mutex);
+    
+    // Publish the reallocated surface now so /screen never mixes old and new sizes
+    copy_frame_buffer(client, gdi->primary_buffer, gdi->width, gdi->height, gdi->stride, NULL);
     return TRUE;
 }
 
 static BOOL rdp_client_begin_paint(rdpContext* context)
 {
-    WINPR_UNUSED(context);
+    rdpGdi* gdi = context->gdi;
+    
+    // Reset the invalid region so EndPaint only sees this paint's damage
+    if (gdi && gdi->primary && gdi->primary->hdc && gdi->primary->hdc->hwnd) {
+        gdi->primary->hdc->hwnd->invalid->null = TRUE;
+        gdi->primary->hdc->hwnd->ninvalid = 0;
+    }
+    
     return TRUE;
 }
 
@@ -30,27 +263,81 @@ static BOOL rdp_client_end_paint(rdpContext* context)
         return TRUE;
     
     // Mark that we've received at least one frame
-    client->first_frame_received = TRUE;
+    if (!client->first_frame_received) {
+        client->first_frame_received = TRUE;
+        rdp_client_set_phase(client, RDP_PHASE_READY);
+    }
     
-    // Copy current frame to latest frame buffer for non-blocking screenshots
+    // Copy damaged area to latest frame buffer for non-blocking screenshots
     rdpGdi* gdi = context->gdi;
-    if (gdi && gdi->primary_buffer) {
-        copy_frame_buffer(client, gdi->primary_buffer, gdi->width, gdi->height, gdi->stride);
+    if (!gdi || !gdi->primary_buffer)
+        return TRUE;
+    
+    // RDPGFX ResetGraphics resizes the surface without a DesktopResize callback
+    if (gdi->width != client->geometry.width || gdi->height != client->geometry.height) {
+        pthread_mutex_lock(&client->state_mutex);
+        client->geometry.width = gdi->width;
+        client->geometry.height = gdi->height;
+        pthread_mutex_unlock(&client->state_mutex);
     }
     
+    HGDI_RGN invalid = gdi->primary->hdc->hwnd->invalid;
+    if (invalid->null) {
+        // Nothing was drawn; only capture if we have no frame at all yet
+        if (!client->latest_frame_buffer)
+            copy_frame_buffer(client, gdi->primary_buffer, gdi->width, gdi->height, gdi->stride, NULL);
+        return TRUE;
+    }
+    
+    // Clip the invalid region to the desktop
+    INT32 x1 = invalid->x < 0 ? 0 : invalid->x;
+    INT32 y1 = invalid->y < 0 ? 0 : invalid->y;
+    INT32 x2 = invalid->x + invalid->w;
+    INT32 y2 = invalid->y + invalid->h;
+    if (x2 > (INT32)gdi->width) x2 = (INT32)gdi->width;
+    if (y2 > (INT32)gdi->height) y2 = (INT32)gdi->height;
+    if (x2 <= x1 || y2 <= y1)
+        return TRUE;
+    
+    FrameRect damage = { (UINT32)x1, (UINT32)y1, (UINT32)(x2 - x1), (UINT32)(y2 - y1) };
+    copy_frame_buffer(client, gdi->primary_buffer, gdi->width, gdi->height, gdi->stride, &damage);
+    
     return TRUE;
 }
 
+static BOOL rdp_client_bitmap_update(rdpContext* context, const BITMAP_UPDATE* bitmap)
+{
+    RDPClient* client = ((RDPContext*)context)->client;
+    return bitmap_decoder_update(client->decoder, context->gdi, bitmap);
+}
+
 static BOOL rdp_client_post_connect(freerdp* instance)
 {
     if (!gdi_init(instance, PIXEL_FORMAT_RGBX32))
         return FALSE;
     
+    RDPClient* client = ((RDPContext*)instance->context)->client;
     rdpUpdate* update = instance->context->update;
     if (update) {
         update->BeginPaint = rdp_client_begin_paint;
         update->EndPaint = rdp_client_end_paint;
+        update->DesktopResize = rdp_client_desktop_resize;
+        
+        // Spread legacy bitmap decode across the shared decoder threads
+        if (client && client->decoder)
+            update->BitmapUpdate = rdp_client_bitmap_update;
+        
+        // Pointer shapes and positions, which never reach the primary buffer
+        if (client)
+            rdp_cursor_register(client, update);
     }
+    
+    // Handshake is over; drop the timing hooks from the steady-state read path
+    if (default_io_saved)
+        freerdp_set_io_callbacks(instance->context, &default_io);
+    
+    if (client)
+        rdp_client_set_phase(client, RDP_PHASE_FIRST_FRAME);
         
     return TRUE;
 }
@@ -134,21 +421,30 @@ RDPClient* rdp_client_new(void)
         return NULL;
     }
     client->context->client = client;
+    client->source = rdp_freerdp_source();
     
     // Set up callback functions
     client->instance->PreConnect = rdp_client_pre_connect;
     client->instance->PostConnect = rdp_client_post_connect;
     client->instance->PostDisconnect = rdp_client_post_disconnect;
+    client->instance->LoadChannels = freerdp_client_load_channels;
     client->instance->Authenticate = rdp_client_authenticate;
     client->instance->VerifyCertificateEx = rdp_client_verify_certificate;
     
     // Initialize client state
     client->connected = FALSE;
     client->first_frame_received = FALSE;
+    client->nonblank_frame_seen = FALSE;
     client->screenshot_requested = FALSE;
     client->screenshot_filename = NULL;
-    client->screenshot_retry_count = 0;
+    client->blank_frame_timeout_ms = DEFAULT_BLANK_FRAME_TIMEOUT_MS;
     client->port = 3389;
+    client->geometry.width = DEFAULT_DESKTOP_WIDTH;
+    client->geometry.height = DEFAULT_DESKTOP_HEIGHT;
+    client->geometry.color_depth = DEFAULT_COLOR_DEPTH;
+    client->gfx_mode = RDP_GFX_AUTO;
+    client->reconnect_attempts = DEFAULT_RECONNECT_ATTEMPTS;
+    client->reconnect_seed = (unsigned int)time(NULL) ^ (unsigned int)(uintptr_t)client;
     
     // Initialize threading components
     client->thread_running = FALSE;
@@ -158,6 +454,9 @@ RDPClient* rdp_client_new(void)
     client->latest_frame_height = 0;
     client->latest_frame_stride = 0;
     client->frame_updated = FALSE;
+    client->frame_generation = 0;
+    client->phase = RDP_PHASE_IDLE;
+    client->connect_thread_running = FALSE;
     
     if (pthread_mutex_init(&client->frame_mutex, NULL) != 0) {
         fprintf(stderr, "Failed to initialize frame mutex\n");
@@ -167,6 +466,52 @@ RDPClient* rdp_client_new(void)
         return NULL;
     }
     
+    if (pthread_mutex_init(&client->input_mutex, NULL) != 0) {
+        fprintf(stderr, "Failed to initialize input mutex\n");
+        pthread_mutex_destroy(&client->frame_mutex);
+        freerdp_context_free(client->instance);
+        freerdp_free(client->instance);
+        free(client);
+        return NULL;
+    }
+    
+    // Frame waiters use absolute monotonic deadlines
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    if (pthread_cond_init(&client->frame_cond, &cond_attr) != 0) {
+        fprintf(stderr, "Failed to initialize frame condition\n");
+        pthread_condattr_destroy(&cond_attr);
+        pthread_mutex_destroy(&client->input_mutex);
+        pthread_mutex_destroy(&client->frame_mutex);
+        freerdp_context_free(client->instance);
+        freerdp_free(client->instance);
+        free(client);
+        return NULL;
+    }
+    pthread_condattr_destroy(&cond_attr);
+    
+    if (pthread_mutex_init(&client->state_mutex, NULL) != 0) {
+        fprintf(stderr, "Failed to initialize state mutex\n");
+        pthread_cond_destroy(&client->frame_cond);
+        pthread_mutex_destroy(&client->input_mutex);
+        pthread_mutex_destroy(&client->frame_mutex);
+        freerdp_context_free(client->instance);
+        freerdp_free(client->instance);
+        free(client);
+        return NULL;
+    }
+    
+    // Screenshots are still served without the cache or the cursor, and the
+    // clipboard reports itself unavailable, if they can't be allocated
+    client->encode_cache = encode_cache_new();
+    client->clipboard = rdp_clipboard_new();
+    client->cursor = rdp_cursor_new();
+    
+    // Dynamic channels announce themselves through the context's PubSub
+    PubSub_SubscribeChannelConnected(client->context->context.pubSub, rdp_client_channel_connected);
+    PubSub_SubscribeChannelDisconnected(client->context->context.pubSub, rdp_client_channel_disconnected);
+    
     printf("DEBUG: RDP client initialized successfully\n");
     return client;
 }
@@ -176,11 +521,16 @@ void rdp_client_free(RDPClient* client)
     if (!client)
         return;
     
-    // Stop event processing thread first
+    // The history and the recorder read frames until they are stopped
+    frame_history_stop(client->history);
+    client->history = NULL;
+    recorder_stop(client->recorder);
+    client->recorder = NULL;
+    
+    // Abort any handshake in progress and stop the event thread
+    rdp_client_disconnect(client);
     rdp_client_stop_event_thread(client);
-        
-    if (client->connected)
-        rdp_client_disconnect(client);
+    frame_source_free(client->source);
     
     // Clean up frame buffer
     pthread_mutex_lock(&client->frame_mutex);
@@ -189,7 +539,16 @@ void rdp_client_free(RDPClient* client)
         client->latest_frame_buffer = NULL;
     }
     pthread_mutex_unlock(&client->frame_mutex);
+    encode_cache_free(client->encode_cache);
+    client->encode_cache = NULL;
+    rdp_clipboard_free(client->clipboard);
+    client->clipboard = NULL;
+    rdp_cursor_free(client->cursor);
+    client->cursor = NULL;
+    pthread_cond_destroy(&client->frame_cond);
     pthread_mutex_destroy(&client->frame_mutex);
+    pthread_mutex_destroy(&client->input_mutex);
+    pthread_mutex_destroy(&client->state_mutex);
         
     if (client->hostname)
         free(client->hostname);
@@ -204,6 +563,8 @@ void rdp_client_free(RDPClient* client)
         
     if (client->instance)
     {
+        PubSub_UnsubscribeChannelConnected(client->context->context.pubSub, rdp_client_channel_connected);
+        PubSub_UnsubscribeChannelDisconnected(client->context->context.pubSub, rdp_client_channel_disconnected);
         freerdp_context_free(client->instance);
         freerdp_free(client->instance);
     }
@@ -211,22 +572,51 @@ void rdp_client_free(RDPClient* client)
     free(client);
 }
 
-BOOL rdp_client_connect(RDPClient* client, const char* hostname, int port,
-                       const char* username, const char* password, const char* domain)
+static void rdp_client_configure_gfx(RDPClient* client, rdpSettings* settings)
+{
+    RDPGfxMode mode = client->gfx_mode;
+    
+    // RDPGFX surfaces are always 32 bpp
+    if (mode != RDP_GFX_OFF && client->geometry.color_depth != 32) {
+        printf("DEBUG: Graphics pipeline needs 32 bpp; using bitmap updates\n");
+        mode = RDP_GFX_OFF;
+    }
+    
+    BOOL h264 = rdp_h264_available();
+    if (mode == RDP_GFX_AUTO)
+        mode = h264 ? RDP_GFX_AVC444 : RDP_GFX_PROGRESSIVE;
+    if ((mode == RDP_GFX_AVC444 || mode == RDP_GFX_AVC420) && !h264) {
+        fprintf(stderr, "WARNING: FreeRDP was built without an H.264 decoder; using progressive\n");
+        mode = RDP_GFX_PROGRESSIVE;
+    }
+    
+    BOOL enabled = mode != RDP_GFX_OFF;
+    freerdp_settings_set_bool(settings, FreeRDP_SupportGraphicsPipeline, enabled);
+    freerdp_settings_set_bool(settings, FreeRDP_GfxThinClient, FALSE);
+    freerdp_settings_set_bool(settings, FreeRDP_GfxProgressive, enabled);
+    freerdp_settings_set_bool(settings, FreeRDP_GfxProgressiveV2, enabled);
+    freerdp_settings_set_bool(settings, FreeRDP_GfxPlanar, enabled);
+    freerdp_settings_set_bool(settings, FreeRDP_GfxH264, mode == RDP_GFX_AVC420 || mode == RDP_GFX_AVC444);
+    freerdp_settings_set_bool(settings, FreeRDP_GfxAVC444, mode == RDP_GFX_AVC444);
+    freerdp_settings_set_bool(settings, FreeRDP_GfxAVC444v2, mode == RDP_GFX_AVC444);
+    
+    printf("DEBUG: Graphics pipeline %s\n", rdp_gfx_mode_name(mode));
+}
+
+static void rdp_client_configure(RDPClient* client, const char* hostname, int port,
+                                 const char* username, const char* password, const char* domain)
 {
-    if (!client || !hostname)
-        return FALSE;
-        
     rdpSettings* settings = client->context->context.settings;
     
+    free(client->hostname);
+    free(client->username);
+    free(client->password);
+    free(client->domain);
     client->hostname = _strdup(hostname);
     client->port = port;
-    if (username)
-        client->username = _strdup(username);
-    if (password)
-        client->password = _strdup(password);
-    if (domain)
-        client->domain = _strdup(domain);
+    client->username = username ? _strdup(username) : NULL;
+    client->password = password ? _strdup(password) : NULL;
+    client->domain = domain ? _strdup(domain) : NULL;
     
     freerdp_settings_set_string(settings, FreeRDP_ServerHostname, hostname);
     freerdp_settings_set_uint32(settings, FreeRDP_ServerPort, port);
@@ -237,9 +627,9 @@ BOOL rdp_client_connect(RDPClient* client, const char* hostname, int port,
     if (domain)
         freerdp_settings_set_string(settings, FreeRDP_Domain, domain);
     
-    freerdp_settings_set_uint32(settings, FreeRDP_DesktopWidth, 1024);
-    freerdp_settings_set_uint32(settings, FreeRDP_DesktopHeight, 768);
-    freerdp_settings_set_uint32(settings, FreeRDP_ColorDepth, 32);
+    freerdp_settings_set_uint32(settings, FreeRDP_DesktopWidth, client->geometry.width);
+    freerdp_settings_set_uint32(settings, FreeRDP_DesktopHeight, client->geometry.height);
+    freerdp_settings_set_uint32(settings, FreeRDP_ColorDepth, client->geometry.color_depth);
     freerdp_settings_set_bool(settings, FreeRDP_SoftwareGdi, TRUE);
     freerdp_settings_set_bool(settings, FreeRDP_IgnoreCertificate, TRUE);
     
@@ -261,29 +651,149 @@ BOOL rdp_client_connect(RDPClient* client, const char* hostname, int port,
     freerdp_settings_set_bool(settings, FreeRDP_DisableCursorShadow, TRUE);
     freerdp_settings_set_bool(settings, FreeRDP_DisableCursorBlinking, TRUE);
     
-    if (!freerdp_connect(client->instance))
+    // Pointer shapes are cached by index in the client's own cursor cache
+    freerdp_settings_set_uint32(settings, FreeRDP_PointerCacheSize, CURSOR_CACHE_SIZE);
+    freerdp_settings_set_uint32(settings, FreeRDP_ColorPointerCacheSize, CURSOR_CACHE_SIZE);
+    
+    // Suppress Output is only sent if advertised; the server must also support it
+    freerdp_settings_set_bool(settings, FreeRDP_SuppressOutput, TRUE);
+    
+    // Ask the server for an auto-reconnect cookie so a dropped session can resume
+    freerdp_settings_set_bool(settings, FreeRDP_AutoReconnectionEnabled, client->reconnect_attempts > 0);
+    
+    // Display Control channel for resizing without reconnecting
+    freerdp_settings_set_bool(settings, FreeRDP_SupportDisplayControl, TRUE);
+    freerdp_settings_set_bool(settings, FreeRDP_DynamicResolutionUpdate, TRUE);
+    
+    // Clipboard channel for text transfer in both directions
+    freerdp_settings_set_bool(settings, FreeRDP_RedirectClipboard, TRUE);
+    
+    rdp_client_configure_gfx(client, settings);
+    
+    // RemoteFX and progressive tiles are decoded on FreeRDP's own thread pool
+    if (client->decode_threads == 1)
+        freerdp_settings_set_uint32(settings, FreeRDP_ThreadingFlags, THREADING_FLAGS_DISABLE_THREADS);
+}
+
+static void rdp_client_fail(RDPClient* client, const char* error)
+{
+    pthread_mutex_lock(&client->state_mutex);
+    snprintf(client->last_error, sizeof(client->last_error), "%s", error ? error : "Unknown error");
+    pthread_mutex_unlock(&client->state_mutex);
+    rdp_client_set_phase(client, RDP_PHASE_FAILED);
+}
+
+static void rdp_client_reset_progress(RDPClient* client)
+{
+    pthread_mutex_lock(&client->state_mutex);
+    client->phase = RDP_PHASE_IDLE;
+    memset(client->phase_duration_ms, 0, sizeof(client->phase_duration_ms));
+    client->last_error[0] = '\0';
+    pthread_mutex_unlock(&client->state_mutex);
+    
+    client->first_frame_received = FALSE;
+    client->nonblank_frame_seen = FALSE;
+    client->output_suppressed = FALSE;
+    client->last_consumer_ms = get_time_ms();
+    rdp_client_set_phase(client, RDP_PHASE_TCP);
+}
+
+// Runs the handshake on the calling thread; phases advance from the IO hooks
+// and callbacks above
+static BOOL rdp_client_establish(RDPClient* client)
+{
+    connecting_client = client;
+    BOOL connected = freerdp_connect(client->instance);
+    connecting_client = NULL;
+    
+    if (!connected)
     {
-        fprintf(stderr, "Failed to connect to %s:%d\n", hostname, port);
+        fprintf(stderr, "Failed to connect to %s:%d\n", client->hostname, client->port);
+        rdp_client_fail(client, freerdp_get_last_error_string(freerdp_get_last_error(&client->context->context)));
         return FALSE;
     }
     
     client->connected = TRUE;
-    printf("Connected to %s:%d\n", hostname, port);
+    printf("Connected to %s:%d\n", client->hostname, client->port);
     
     // Start the event processing thread
     if (!rdp_client_start_event_thread(client)) {
         fprintf(stderr, "Failed to start event processing thread\n");
         freerdp_disconnect(client->instance);
         client->connected = FALSE;
+        rdp_client_fail(client, "Failed to start event processing thread");
         return FALSE;
     }
     
     return TRUE;
 }
 
+BOOL rdp_client_connect(RDPClient* client, const char* hostname, int port,
+                       const char* username, const char* password, const char* domain)
+{
+    if (!client || !hostname)
+        return FALSE;
+    
+    rdp_client_configure(client, hostname, port, username, password, domain);
+    rdp_client_reset_progress(client);
+    if (client->source != rdp_freerdp_source())
+        return client->source->ops->start(client->source, client);
+    return rdp_client_establish(client);
+}
+
+static void* rdp_connect_thread_proc(void* arg)
+{
+    rdp_client_establish((RDPClient*)arg);
+    return NULL;
+}
+
+BOOL rdp_client_connect_async(RDPClient* client, const char* hostname, int port,
+                              const char* username, const char* password, const char* domain)
+{
+    if (!client || !hostname || client->connect_thread_running || client->connected)
+        return FALSE;
+    
+    rdp_client_configure(client, hostname, port, username, password, domain);
+    rdp_client_reset_progress(client);
+    return client->source->ops->start(client->source, client);
+}
+
 void rdp_client_disconnect(RDPClient* client)
 {
-    if (!client || !client->connected)
+    if (!client || !client->source)
+        return;
+    
+    client->source->ops->stop(client->source, client);
+}
+
+// FreeRDP frame source: the handshake runs on connect_thread, then paints
+// arrive through the update callbacks on the event thread
+static BOOL freerdp_source_start(FrameSource* source, RDPClient* client)
+{
+    WINPR_UNUSED(source);
+    
+    if (pthread_create(&client->connect_thread, NULL, rdp_connect_thread_proc, client) != 0) {
+        fprintf(stderr, "Failed to create connection thread\n");
+        rdp_client_fail(client, "Failed to create connection thread");
+        return FALSE;
+    }
+    
+    client->connect_thread_running = TRUE;
+    return TRUE;
+}
+
+static void freerdp_source_stop(FrameSource* source, RDPClient* client)
+{
+    WINPR_UNUSED(source);
+    
+    // Cancel a background handshake; freerdp_connect returns once it sees the abort
+    if (client->connect_thread_running) {
+        freerdp_abort_connect_context(&client->context->context);
+        pthread_join(client->connect_thread, NULL);
+        client->connect_thread_running = FALSE;
+    }
+    
+    if (!client->connected)
         return;
     
     // Stop event processing thread first
@@ -291,6 +801,7 @@ void rdp_client_disconnect(RDPClient* client)
         
     freerdp_disconnect(client->instance);
     client->connected = FALSE;
+    rdp_client_set_phase(client, RDP_PHASE_IDLE);
     printf("Disconnected from %s:%d\n", client->hostname, client->port);
 }
 
@@ -320,67 +831,710 @@ void rdp_client_stop_event_thread(RDPClient* client)
     printf("DEBUG: Stopping event processing thread...\n");
     client->stop_requested = TRUE;
     
+    // Cut short a reconnect attempt in progress
+    if (rdp_client_get_phase(client) == RDP_PHASE_RECONNECTING)
+        freerdp_abort_connect_context(&client->context->context);
+    
     // Wait for thread to finish
     pthread_join(client->event_thread, NULL);
     client->thread_running = FALSE;
     printf("DEBUG: Event processing thread stopped\n");
 }
 
-void* rdp_event_thread_proc(void* arg)
+static BOOL freerdp_source_send_keyboard(FrameSource* source, RDPClient* client, DWORD flags, DWORD code)
 {
-    RDPClient* client = (RDPClient*)arg;
-    
-    if (!client || !client->instance) {
-        fprintf(stderr, "Invalid client in event thread\n");
-        return NULL;
-    }
-    
-    printf("DEBUG: Event processing thread running\n");
+    WINPR_UNUSED(source);
+    return freerdp_input_send_keyboard_event(client->context->context.input, (UINT16)flags, (UINT8)code);
+}
+
+static BOOL freerdp_source_send_mouse(FrameSource* source, RDPClient* client, DWORD flags, UINT16 x, UINT16 y)
+{
+    WINPR_UNUSED(source);
+    return freerdp_input_send_mouse_event(client->context->context.input, (UINT16)flags, x, y);
+}
+
+static BOOL freerdp_source_refresh_rect(FrameSource* source, RDPClient* client, const FrameRect* rect)
+{
+    WINPR_UNUSED(source);
     
-    while (!client->stop_requested && client->connected) {
-        // Get event handles for the RDP connection
-        HANDLE handles[32];
-        DWORD count = freerdp_get_event_handles(&client->context->context, handles, 32);
-        
-        if (count == 0) {
-            fprintf(stderr, "No event handles available\n");
-            break;
-        }
-        
-        // Wait for events with a short timeout to allow checking stop_requested
-        DWORD status = WaitForMultipleObjects(count, handles, FALSE, 100); // 100ms timeout
-        
-        if (status == WAIT_FAILED) {
-            fprintf(stderr, "WaitForMultipleObjects failed\n");
-            break;
-        }
-        
-        if (status != WAIT_TIMEOUT) {
-            // Process the event
-            if (!freerdp_check_event_handles(&client->context->context)) {
-                fprintf(stderr, "freerdp_check_event_handles failed\n");
-                break;
-            }
-        }
-    }
+    rdpContext* context = &client->context->context;
+    rdpUpdate* update = context->update;
+    if (!update || !update->RefreshRect)
+        return FALSE;
     
-    printf("DEBUG: Event processing thread exiting\n");
-    return NULL;
+    // TS_RECTANGLE16 is inclusive
+    RECTANGLE_16 area = { (UINT16)rect->x, (UINT16)rect->y, (UINT16)(rect->x + rect->width - 1),
+                          (UINT16)(rect->y + rect->height - 1) };
+    return update->RefreshRect(context, 1, &area);
 }
 
-// Frame buffer management functions
-BOOL copy_frame_buffer(RDPClient* client, BYTE* src_buffer, UINT32 width, UINT32 height, UINT32 stride)
+static BOOL freerdp_source_suppress_output(FrameSource* source, RDPClient* client, BOOL allow)
 {
-    if (!client || !src_buffer)
+    WINPR_UNUSED(source);
+    
+    rdpContext* context = &client->context->context;
+    rdpUpdate* update = context->update;
+    if (!update || !update->SuppressOutput)
         return FALSE;
     
-    pthread_mutex_lock(&client->frame_mutex);
+    UINT32 width, height;
+    get_desktop_size(client, &width, &height);
+    RECTANGLE_16 area = { 0, 0, (UINT16)(width - 1), (UINT16)(height - 1) };
+    return update->SuppressOutput(context, allow ? 1 : 0, allow ? &area : NULL);
+}
+
+// Sends Suppress Output (allow = FALSE) or resumes display updates for the whole desktop.
+// Callers hold input_mutex, which orders these PDUs against each other.
+static BOOL rdp_client_send_suppress_output(RDPClient* client, BOOL allow)
+{
+    return client->source->ops->suppress_output(client->source, client, allow);
+}
+
+// Called from the event loop; pauses display updates once nobody has looked
+// at the screen for idle_timeout_ms
+void rdp_client_check_idle(RDPClient* client)
+{
+    if (client->idle_timeout_ms == 0 || rdp_client_get_phase(client) != RDP_PHASE_READY)
+        return;
     
-    // Calculate required buffer size
-    size_t buffer_size = (size_t)height * stride;
+    pthread_mutex_lock(&client->input_mutex);
+    pthread_mutex_lock(&client->state_mutex);
+    BOOL suppress = !client->output_suppressed &&
+                    get_time_ms() - client->last_consumer_ms >= client->idle_timeout_ms;
+    if (suppress) {
+        client->output_suppressed = TRUE;
+        client->suppress_count++;
+    }
+    pthread_mutex_unlock(&client->state_mutex);
     
-    // Reallocate buffer if size changed
-    if (client->latest_frame_width != width || 
+    if (suppress) {
+        printf("DEBUG: %s:%d idle for %u ms, suppressing output\n", client->hostname, client->port,
+               client->idle_timeout_ms);
+        rdp_client_send_suppress_output(client, FALSE);
+    }
+    pthread_mutex_unlock(&client->input_mutex);
+}
+
+void rdp_client_get_idle_info(RDPClient* client, RDPIdleInfo* info)
+{
+    if (!info)
+        return;
+    
+    memset(info, 0, sizeof(*info));
+    if (!client)
+        return;
+    
+    pthread_mutex_lock(&client->state_mutex);
+    info->timeout_ms = client->idle_timeout_ms;
+    info->idle_ms = get_time_ms() - client->last_consumer_ms;
+    info->suppressed = client->output_suppressed;
+    info->suppress_count = client->suppress_count;
+    pthread_mutex_unlock(&client->state_mutex);
+}
+
+BOOL rdp_client_note_consumer(RDPClient* client)
+{
+    if (!client)
+        return FALSE;
+    
+    pthread_mutex_lock(&client->input_mutex);
+    pthread_mutex_lock(&client->state_mutex);
+    client->last_consumer_ms = get_time_ms();
+    BOOL resume = client->output_suppressed;
+    client->output_suppressed = FALSE;
+    pthread_mutex_unlock(&client->state_mutex);
+    
+    if (!resume) {
+        pthread_mutex_unlock(&client->input_mutex);
+        return FALSE;
+    }
+    
+    // Resume updates and ask for the whole desktop, then wait for it to arrive
+    UINT64 generation = get_frame_generation(client);
+    rdp_client_send_suppress_output(client, TRUE);
+    pthread_mutex_unlock(&client->input_mutex);
+    
+    rdp_client_refresh_rect(client, NULL);
+    wait_for_frame_generation(client, generation, IDLE_RESUME_TIMEOUT_MS, NULL);
+    printf("DEBUG: %s:%d output resumed\n", client->hostname, client->port);
+    return TRUE;
+}
+
+BOOL rdp_client_refresh_rect(RDPClient* client, const FrameRect* rect)
+{
+    if (!client || !client->connected)
+        return FALSE;
+    
+    // NULL means the whole desktop
+    FrameRect area = { 0, 0, 0, 0 };
+    if (rect)
+        area = *rect;
+    else
+        get_desktop_size(client, &area.width, &area.height);
+    if (area.width == 0 || area.height == 0)
+        return FALSE;
+    
+    pthread_mutex_lock(&client->input_mutex);
+    BOOL sent = client->source->ops->refresh_rect(client->source, client, &area);
+    pthread_mutex_unlock(&client->input_mutex);
+    return sent;
+}
+
+// Asks the server to repaint rect (NULL for the whole desktop) and waits until
+// the damage painted since covers it. Damage is tracked as a bounding box, so
+// coverage is judged by the union of the paints that followed the request.
+BOOL rdp_client_refresh_frame(RDPClient* client, const FrameRect* rect, UINT32 timeout_ms)
+{
+    if (!client)
+        return FALSE;
+    
+    FrameRect area = { 0, 0, 0, 0 };
+    if (rect)
+        area = *rect;
+    else
+        get_desktop_size(client, &area.width, &area.height);
+    
+    UINT64 requested = get_frame_generation(client);
+    if (!rdp_client_refresh_rect(client, rect))
+        return FALSE;
+    
+    UINT64 deadline = get_time_ms() + timeout_ms;
+    UINT64 seen = requested;
+    for (;;) {
+        UINT64 now = get_time_ms();
+        if (now >= deadline)
+            return FALSE;
+        if (!wait_for_frame_generation(client, seen, (UINT32)(deadline - now), &seen))
+            return FALSE;
+        
+        FrameRect damage;
+        if (get_frame_damage_since(client, requested, &damage) &&
+            damage.x <= area.x && damage.y <= area.y &&
+            damage.x + damage.width >= area.x + area.width &&
+            damage.y + damage.height >= area.y + area.height)
+            return TRUE;
+    }
+}
+
+// Pumps FreeRDP events until stopped (NULL) or the connection fails (reason)
+static const char* rdp_client_process_events(RDPClient* client)
+{
+    const char* error = NULL;
+    
+    while (!client->stop_requested && client->connected) {
+        // Get event handles for the RDP connection
+        HANDLE handles[32];
+        DWORD count = freerdp_get_event_handles(&client->context->context, handles, 32);
+        
+        if (count == 0) {
+            fprintf(stderr, "No event handles available\n");
+            error = "No event handles available";
+            break;
+        }
+        
+        // Wait for events with a short timeout to allow checking stop_requested
+        DWORD status = WaitForMultipleObjects(count, handles, FALSE, 100); // 100ms timeout
+        
+        if (status == WAIT_FAILED) {
+            fprintf(stderr, "WaitForMultipleObjects failed\n");
+            error = "WaitForMultipleObjects failed";
+            break;
+        }
+        
+        if (status != WAIT_TIMEOUT) {
+            // Process the event
+            metrics_count(METRIC_EVENT_LOOP_WAKEUPS, 1);
+            UINT64 start = metrics_now_ns();
+            BOOL handled = freerdp_check_event_handles(&client->context->context);
+            metrics_observe(METRIC_HIST_CHECK_EVENTS, metrics_now_ns() - start);
+            if (!handled) {
+                fprintf(stderr, "freerdp_check_event_handles failed\n");
+                error = "Connection lost";
+                break;
+            }
+        }
+        
+        rdp_client_check_idle(client);
+    }
+    
+    return error;
+}
+
+// Sleeps up to delay_ms, waking early when the client is being stopped
+static void rdp_client_backoff_sleep(RDPClient* client, UINT32 delay_ms)
+{
+    UINT64 deadline_ms = get_time_ms() + delay_ms;
+    while (!client->stop_requested) {
+        UINT64 now_ms = get_time_ms();
+        if (now_ms >= deadline_ms)
+            break;
+        UINT64 remaining_ms = deadline_ms - now_ms;
+        usleep((useconds_t)(remaining_ms < 100 ? remaining_ms : 100) * 1000);
+    }
+}
+
+// Reconnect supervisor: exponential backoff with equal jitter, resuming the
+// session through the server's auto-reconnect cookie when it issued one
+static BOOL rdp_client_reconnect(RDPClient* client)
+{
+    if (client->reconnect_attempts <= 0)
+        return FALSE;
+    
+    rdpSettings* settings = client->context->context.settings;
+    const ARC_SC_PRIVATE_PACKET* cookie =
+        (const ARC_SC_PRIVATE_PACKET*)freerdp_settings_get_pointer(settings, FreeRDP_ServerAutoReconnectCookie);
+    UINT64 outage_start_ms = get_time_ms();
+    
+    pthread_mutex_lock(&client->state_mutex);
+    client->reconnect.disconnects++;
+    client->reconnect.cookie = cookie && cookie->cbLen > 0;
+    pthread_mutex_unlock(&client->state_mutex);
+    rdp_client_set_phase(client, RDP_PHASE_RECONNECTING);
+    
+    UINT32 delay_ms = RECONNECT_BASE_DELAY_MS;
+    for (int attempt = 1; attempt <= client->reconnect_attempts && !client->stop_requested; attempt++) {
+        UINT32 jittered_ms = delay_ms / 2 + (UINT32)(rand_r(&client->reconnect_seed) % (delay_ms / 2 + 1));
+        printf("Reconnecting to %s:%d in %u ms (attempt %d/%d)\n", client->hostname, client->port,
+               jittered_ms, attempt, client->reconnect_attempts);
+        rdp_client_backoff_sleep(client, jittered_ms);
+        if (client->stop_requested)
+            break;
+        
+        pthread_mutex_lock(&client->state_mutex);
+        client->reconnect.attempts++;
+        pthread_mutex_unlock(&client->state_mutex);
+        
+        if (freerdp_reconnect(client->instance)) {
+            UINT64 outage_ms = get_time_ms() - outage_start_ms;
+            pthread_mutex_lock(&client->state_mutex);
+            client->reconnect.successes++;
+            client->reconnect.last_duration_ms = outage_ms;
+            client->reconnect.total_duration_ms += outage_ms;
+            client->last_error[0] = '\0';
+            
+            // A new connection starts with output enabled
+            client->output_suppressed = FALSE;
+            client->last_consumer_ms = get_time_ms();
+            pthread_mutex_unlock(&client->state_mutex);
+            
+            // Routes stay on the stale frame until the server repaints
+            client->first_frame_received = FALSE;
+    client->nonblank_frame_seen = FALSE;
+            rdp_client_set_phase(client, RDP_PHASE_FIRST_FRAME);
+            printf("Reconnected to %s:%d after %llu ms\n", client->hostname, client->port,
+                   (unsigned long long)outage_ms);
+            return TRUE;
+        }
+        
+        delay_ms = delay_ms * 2 > RECONNECT_MAX_DELAY_MS ? RECONNECT_MAX_DELAY_MS : delay_ms * 2;
+    }
+    
+    fprintf(stderr, "Giving up reconnecting to %s:%d\n", client->hostname, client->port);
+    return FALSE;
+}
+
+void* rdp_event_thread_proc(void* arg)
+{
+    RDPClient* client = (RDPClient*)arg;
+    
+    if (!client || !client->instance) {
+        fprintf(stderr, "Invalid client in event thread\n");
+        return NULL;
+    }
+    
+    printf("DEBUG: Event processing thread running\n");
+    
+    for (;;) {
+        const char* error = rdp_client_process_events(client);
+        if (!error)
+            break;
+        
+        // Keep serving the last frame while the supervisor tries to get back
+        if (client->stop_requested || !rdp_client_reconnect(client)) {
+            if (!client->stop_requested)
+                rdp_client_fail(client, error);
+            break;
+        }
+    }
+    
+    printf("DEBUG: Event processing thread exiting\n");
+    return NULL;
+}
+
+// Desktop geometry
+BOOL rdp_geometry_valid(const RDPGeometry* geometry, const char** error)
+{
+    const char* ignored;
+    if (!error)
+        error = &ignored;
+    
+    if (!geometry) {
+        *error = "Missing geometry";
+        return FALSE;
+    }
+    if (geometry->width < MIN_DESKTOP_SIZE || geometry->width > MAX_DESKTOP_SIZE ||
+        geometry->height < MIN_DESKTOP_SIZE || geometry->height > MAX_DESKTOP_SIZE) {
+        *error = "Width and height must be between 200 and 8192";
+        return FALSE;
+    }
+    
+    switch (geometry->color_depth) {
+        case 8:
+        case 15:
+        case 16:
+        case 24:
+        case 32:
+            return TRUE;
+        default:
+            *error = "Color depth must be 8, 15, 16, 24 or 32";
+            return FALSE;
+    }
+}
+
+BOOL get_desktop_size(RDPClient* client, UINT32* width, UINT32* height)
+{
+    if (!client || !width || !height)
+        return FALSE;
+    
+    pthread_mutex_lock(&client->state_mutex);
+    *width = client->geometry.width;
+    *height = client->geometry.height;
+    pthread_mutex_unlock(&client->state_mutex);
+    return TRUE;
+}
+
+BOOL rdp_client_resize(RDPClient* client, UINT32 width, UINT32 height, const char** error)
+{
+    const char* ignored;
+    if (!error)
+        error = &ignored;
+    
+    // MS-RDPEDISP requires an even width
+    width &= ~1u;
+    RDPGeometry geometry = { width, height, DEFAULT_COLOR_DEPTH };
+    if (!rdp_geometry_valid(&geometry, error))
+        return FALSE;
+    
+    return client->source->ops->resize(client->source, client, width, height, error);
+}
+
+static BOOL freerdp_source_resize(FrameSource* source, RDPClient* client, UINT32 width, UINT32 height,
+                                  const char** error)
+{
+    WINPR_UNUSED(source);
+    
+    pthread_mutex_lock(&client->state_mutex);
+    DispClientContext* disp = client->disp;
+    UINT32 max_area = client->disp_max_area;
+    pthread_mutex_unlock(&client->state_mutex);
+    
+    if (!disp || max_area == 0) {
+        *error = "Display control channel not available";
+        return FALSE;
+    }
+    if ((UINT64)width * height > max_area) {
+        *error = "Requested size exceeds the server's maximum monitor area";
+        return FALSE;
+    }
+    
+    DISPLAY_CONTROL_MONITOR_LAYOUT layout;
+    memset(&layout, 0, sizeof(layout));
+    layout.Flags = DISPLAY_CONTROL_MONITOR_PRIMARY;
+    layout.Width = width;
+    layout.Height = height;
+    layout.Orientation = ORIENTATION_LANDSCAPE;
+    layout.DesktopScaleFactor = 100;
+    layout.DeviceScaleFactor = 100;
+    
+    // Channel writes share the input lock with other HTTP-side senders
+    pthread_mutex_lock(&client->input_mutex);
+    UINT status = disp->SendMonitorLayout(disp, 1, &layout);
+    pthread_mutex_unlock(&client->input_mutex);
+    
+    if (status != CHANNEL_RC_OK) {
+        *error = "Failed to send monitor layout";
+        return FALSE;
+    }
+    
+    printf("DEBUG: Requested desktop resize to %ux%u\n", width, height);
+    return TRUE;
+}
+
+ClipboardResult rdp_client_set_clipboard(RDPClient* client, const char* text, size_t length, UINT32 timeout_ms)
+{
+    if (!client || !text)
+        return CLIPBOARD_FAILED;
+    return client->source->ops->set_clipboard(client->source, client, text, length, timeout_ms);
+}
+
+ClipboardResult rdp_client_get_clipboard(RDPClient* client, UINT32 timeout_ms, char** text, size_t* length)
+{
+    if (!client || !text || !length)
+        return CLIPBOARD_FAILED;
+    return client->source->ops->get_clipboard(client->source, client, timeout_ms, text, length);
+}
+
+static ClipboardResult freerdp_source_set_clipboard(FrameSource* source, RDPClient* client, const char* text,
+                                                    size_t length, UINT32 timeout_ms)
+{
+    WINPR_UNUSED(source);
+    return rdp_clipboard_set_text(client, text, length, timeout_ms);
+}
+
+static ClipboardResult freerdp_source_get_clipboard(FrameSource* source, RDPClient* client, UINT32 timeout_ms,
+                                                    char** text, size_t* length)
+{
+    WINPR_UNUSED(source);
+    return rdp_clipboard_get_text(client, timeout_ms, text, length);
+}
+
+static const FrameSourceOps freerdp_source_ops = {
+    "freerdp",
+    freerdp_source_start,
+    freerdp_source_stop,
+    freerdp_source_send_keyboard,
+    freerdp_source_send_mouse,
+    freerdp_source_refresh_rect,
+    freerdp_source_suppress_output,
+    freerdp_source_resize,
+    freerdp_source_set_clipboard,
+    freerdp_source_get_clipboard,
+    NULL,
+};
+
+static FrameSource freerdp_source = { &freerdp_source_ops };
+
+FrameSource* rdp_freerdp_source(void)
+{
+    return &freerdp_source;
+}
+
+// Graphics pipeline
+static const char* const gfx_mode_names[] = { "off", "auto", "avc444", "avc420", "progressive" };
+
+BOOL rdp_gfx_mode_parse(const char* name, RDPGfxMode* mode)
+{
+    if (!name || !mode)
+        return FALSE;
+    
+    for (size_t i = 0; i < sizeof(gfx_mode_names) / sizeof(gfx_mode_names[0]); i++) {
+        if (strcmp(name, gfx_mode_names[i]) == 0) {
+            *mode = (RDPGfxMode)i;
+            return TRUE;
+        }
+    }
+    
+    return FALSE;
+}
+
+const char* rdp_gfx_mode_name(RDPGfxMode mode)
+{
+    if ((size_t)mode >= sizeof(gfx_mode_names) / sizeof(gfx_mode_names[0]))
+        return "unknown";
+    return gfx_mode_names[mode];
+}
+
+const char* rdp_gfx_version_name(UINT32 caps_version)
+{
+    switch (caps_version) {
+        case RDPGFX_CAPVERSION_8: return "8.0";
+        case RDPGFX_CAPVERSION_81: return "8.1";
+        case RDPGFX_CAPVERSION_10: return "10.0";
+        case RDPGFX_CAPVERSION_101: return "10.1";
+        case RDPGFX_CAPVERSION_102: return "10.2";
+        case RDPGFX_CAPVERSION_103: return "10.3";
+        case RDPGFX_CAPVERSION_104: return "10.4";
+        case RDPGFX_CAPVERSION_105: return "10.5";
+        case RDPGFX_CAPVERSION_106: return "10.6";
+        case RDPGFX_CAPVERSION_107: return "10.7";
+        default: return "unknown";
+    }
+}
+
+const char* rdp_gfx_codec_name(UINT32 codec_id)
+{
+    switch (codec_id) {
+        case RDPGFX_CODECID_UNCOMPRESSED: return "uncompressed";
+        case RDPGFX_CODECID_CAVIDEO: return "remotefx";
+        case RDPGFX_CODECID_CLEARCODEC: return "clearcodec";
+        case RDPGFX_CODECID_CAPROGRESSIVE: return "progressive";
+        case RDPGFX_CODECID_CAPROGRESSIVE_V2: return "progressive_v2";
+        case RDPGFX_CODECID_PLANAR: return "planar";
+        case RDPGFX_CODECID_AVC420: return "avc420";
+        case RDPGFX_CODECID_AVC444: return "avc444";
+        case RDPGFX_CODECID_AVC444v2: return "avc444v2";
+        case RDPGFX_CODECID_ALPHA: return "alpha";
+        default: return NULL;
+    }
+}
+
+static pthread_once_t h264_probe_once = PTHREAD_ONCE_INIT;
+static BOOL h264_decoder_available = FALSE;
+
+static void probe_h264_decoder(void)
+{
+    // Fails when FreeRDP was built without any H.264 backend
+    H264_CONTEXT* h264 = h264_context_new(FALSE);
+    h264_decoder_available = h264 != NULL;
+    h264_context_free(h264);
+}
+
+BOOL rdp_h264_available(void)
+{
+    pthread_once(&h264_probe_once, probe_h264_decoder);
+    return h264_decoder_available;
+}
+
+void rdp_client_get_gfx_info(RDPClient* client, RDPGfxInfo* info)
+{
+    if (!info)
+        return;
+    
+    memset(info, 0, sizeof(*info));
+    if (!client)
+        return;
+    
+    pthread_mutex_lock(&client->state_mutex);
+    info->mode = client->gfx_mode;
+    info->active = client->gfx != NULL;
+    info->caps_version = client->gfx_caps_version;
+    info->caps_flags = client->gfx_caps_flags;
+    info->codecs_seen = client->gfx_codecs_seen;
+    pthread_mutex_unlock(&client->state_mutex);
+}
+
+// Connection phase tracking
+const char* rdp_client_phase_name(RDPConnectPhase phase)
+{
+    if (phase < 0 || phase >= RDP_PHASE_COUNT)
+        return "unknown";
+    return phase_names[phase];
+}
+
+void rdp_client_set_phase(RDPClient* client, RDPConnectPhase phase)
+{
+    if (!client)
+        return;
+    
+    pthread_mutex_lock(&client->state_mutex);
+    if (client->phase == phase) {
+        pthread_mutex_unlock(&client->state_mutex);
+        return;
+    }
+    
+    UINT64 now_ms = get_time_ms();
+    if (client->phase != RDP_PHASE_IDLE)
+        client->phase_duration_ms[client->phase] += now_ms - client->phase_started_ms;
+    RDPConnectPhase previous = client->phase;
+    client->phase = phase;
+    client->phase_started_ms = now_ms;
+    pthread_mutex_unlock(&client->state_mutex);
+    
+    printf("DEBUG: %s:%d connection phase %s -> %s\n", client->hostname ? client->hostname : "",
+           client->port, phase_names[previous], phase_names[phase]);
+}
+
+RDPConnectPhase rdp_client_get_phase(RDPClient* client)
+{
+    if (!client)
+        return RDP_PHASE_IDLE;
+    
+    pthread_mutex_lock(&client->state_mutex);
+    RDPConnectPhase phase = client->phase;
+    pthread_mutex_unlock(&client->state_mutex);
+    return phase;
+}
+
+void rdp_client_get_reconnect_stats(RDPClient* client, RDPReconnectStats* stats)
+{
+    if (!stats)
+        return;
+    
+    memset(stats, 0, sizeof(*stats));
+    if (!client)
+        return;
+    
+    pthread_mutex_lock(&client->state_mutex);
+    *stats = client->reconnect;
+    pthread_mutex_unlock(&client->state_mutex);
+}
+
+void rdp_client_get_progress(RDPClient* client, RDPConnectProgress* progress)
+{
+    if (!progress)
+        return;
+    
+    memset(progress, 0, sizeof(*progress));
+    if (!client)
+        return;
+    
+    pthread_mutex_lock(&client->state_mutex);
+    progress->phase = client->phase;
+    memcpy(progress->phase_ms, client->phase_duration_ms, sizeof(progress->phase_ms));
+    if (client->phase != RDP_PHASE_IDLE)
+        progress->phase_ms[client->phase] += get_time_ms() - client->phase_started_ms;
+    snprintf(progress->error, sizeof(progress->error), "%s", client->last_error);
+    pthread_mutex_unlock(&client->state_mutex);
+}
+
+// Frame buffer management functions
+UINT64 get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000 + (UINT64)ts.tv_nsec / 1000000;
+}
+
+BOOL frame_rect_intersects(const FrameRect* a, const FrameRect* b)
+{
+    if (!a || !b || a->width == 0 || a->height == 0 || b->width == 0 || b->height == 0)
+        return FALSE;
+    
+    return a->x < b->x + b->width && b->x < a->x + a->width &&
+           a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+static void frame_rect_union(FrameRect* acc, const FrameRect* rect)
+{
+    if (acc->width == 0 || acc->height == 0) {
+        *acc = *rect;
+        return;
+    }
+    
+    UINT32 x2 = acc->x + acc->width;
+    UINT32 y2 = acc->y + acc->height;
+    if (rect->x + rect->width > x2) x2 = rect->x + rect->width;
+    if (rect->y + rect->height > y2) y2 = rect->y + rect->height;
+    if (rect->x < acc->x) acc->x = rect->x;
+    if (rect->y < acc->y) acc->y = rect->y;
+    acc->width = x2 - acc->x;
+    acc->height = y2 - acc->y;
+}
+
+// Snapshot readers record how long they waited behind paints and other readers
+static void lock_frame_for_snapshot(RDPClient* client)
+{
+    UINT64 start = metrics_now_ns();
+    pthread_mutex_lock(&client->frame_mutex);
+    metrics_observe(METRIC_HIST_FRAME_LOCK_WAIT, metrics_now_ns() - start);
+}
+
+BOOL copy_frame_buffer(RDPClient* client, BYTE* src_buffer, UINT32 width, UINT32 height, UINT32 stride,
+                       const FrameRect* damage)
+{
+    if (!client || !src_buffer)
+        return FALSE;
+    
+    UINT64 start = metrics_now_ns();
+    pthread_mutex_lock(&client->frame_mutex);
+    
+    // Calculate required buffer size
+    size_t buffer_size = (size_t)height * stride;
+    BOOL full_copy = (damage == NULL);
+    
+    // Reallocate buffer if size changed
+    if (!client->latest_frame_buffer ||
+        client->latest_frame_width != width || 
         client->latest_frame_height != height || 
         client->latest_frame_stride != stride) {
         
@@ -397,22 +1551,212 @@ BOOL copy_frame_buffer(RDPClient* client, BYTE* src_buffer, UINT32 width, UINT32
         client->latest_frame_width = width;
         client->latest_frame_height = height;
         client->latest_frame_stride = stride;
+        full_copy = TRUE;
     }
     
-    // Copy the frame data
-    memcpy(client->latest_frame_buffer, src_buffer, buffer_size);
+    FrameRect rect = { 0, 0, width, height };
+    if (full_copy) {
+        memcpy(client->latest_frame_buffer, src_buffer, buffer_size);
+    } else {
+        // Only the damaged rows/columns changed since the previous paint
+        rect = *damage;
+        size_t offset = (size_t)rect.y * stride + (size_t)rect.x * 4;
+        size_t row_bytes = (size_t)rect.width * 4;
+        for (UINT32 y = 0; y < rect.height; y++) {
+            memcpy(client->latest_frame_buffer + offset, src_buffer + offset, row_bytes);
+            offset += stride;
+        }
+    }
     client->frame_updated = TRUE;
     
+    // Publish the new generation and wake anyone waiting for a frame change
+    client->frame_generation++;
+    FrameDamage* entry = &client->damage_history[client->frame_generation % FRAME_DAMAGE_HISTORY];
+    entry->generation = client->frame_generation;
+    entry->rect = rect;
+    entry->paint_ms = get_time_ms();
+    pthread_cond_broadcast(&client->frame_cond);
+    
     pthread_mutex_unlock(&client->frame_mutex);
+    
+    metrics_count(METRIC_PAINTS, 1);
+    metrics_observe(METRIC_HIST_COPY_FRAME, metrics_now_ns() - start);
     return TRUE;
 }
 
-BOOL get_latest_frame(RDPClient* client, BYTE** buffer, UINT32* width, UINT32* height, UINT32* stride)
+UINT64 get_frame_generation(RDPClient* client)
 {
-    if (!client || !buffer || !width || !height || !stride)
+    if (!client)
+        return 0;
+    
+    pthread_mutex_lock(&client->frame_mutex);
+    UINT64 generation = client->frame_generation;
+    pthread_mutex_unlock(&client->frame_mutex);
+    return generation;
+}
+
+BOOL get_frame_size(RDPClient* client, UINT32* width, UINT32* height)
+{
+    if (!client || !width || !height)
+        return FALSE;
+    
+    pthread_mutex_lock(&client->frame_mutex);
+    BOOL available = client->latest_frame_buffer != NULL && client->frame_updated;
+    *width = client->latest_frame_width;
+    *height = client->latest_frame_height;
+    pthread_mutex_unlock(&client->frame_mutex);
+    return available;
+}
+
+BOOL wait_for_frame_generation(RDPClient* client, UINT64 after, UINT32 timeout_ms, UINT64* generation)
+{
+    if (!client)
+        return FALSE;
+    
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    
+    pthread_mutex_lock(&client->frame_mutex);
+    
+    int rc = 0;
+    while (client->frame_generation <= after && rc == 0)
+        rc = pthread_cond_timedwait(&client->frame_cond, &client->frame_mutex, &deadline);
+    
+    BOOL advanced = client->frame_generation > after;
+    if (generation)
+        *generation = client->frame_generation;
+    
+    pthread_mutex_unlock(&client->frame_mutex);
+    return advanced;
+}
+
+// Union of the damage of generations (since, current]; frame_mutex held
+static BOOL frame_damage_since_locked(RDPClient* client, UINT64 since, UINT64 current, FrameRect* damage)
+{
+    memset(damage, 0, sizeof(FrameRect));
+    if (current <= since)
+        return FALSE;
+    
+    if (current - since > FRAME_DAMAGE_HISTORY) {
+        // History no longer covers the range; assume everything changed
+        damage->width = client->latest_frame_width;
+        damage->height = client->latest_frame_height;
+    } else {
+        for (UINT64 gen = since + 1; gen <= current; gen++) {
+            const FrameDamage* entry = &client->damage_history[gen % FRAME_DAMAGE_HISTORY];
+            if (entry->generation == gen)
+                frame_rect_union(damage, &entry->rect);
+        }
+    }
+    return TRUE;
+}
+
+BOOL get_frame_damage_since(RDPClient* client, UINT64 since, FrameRect* damage)
+{
+    if (!client || !damage)
         return FALSE;
     
     pthread_mutex_lock(&client->frame_mutex);
+    BOOL damaged = frame_damage_since_locked(client, since, client->frame_generation, damage);
+    pthread_mutex_unlock(&client->frame_mutex);
+    return damaged;
+}
+
+BOOL get_frame_view_damage(RDPClient* client, const FrameView* view, UINT64 since, FrameRect* damage,
+                           UINT64* paint_ms)
+{
+    if (!client || !view || !view->data || !damage)
+        return FALSE;
+    
+    if (paint_ms) {
+        const FrameDamage* entry = &client->damage_history[view->generation % FRAME_DAMAGE_HISTORY];
+        *paint_ms = entry->generation == view->generation ? entry->paint_ms : get_time_ms();
+    }
+    return frame_damage_since_locked(client, since, view->generation, damage);
+}
+
+BOOL get_frame_region(RDPClient* client, const FrameRect* region, BYTE** buffer, UINT32* stride,
+                      UINT64* generation)
+{
+    if (!client || !region || !buffer || !stride)
+        return FALSE;
+    
+    lock_frame_for_snapshot(client);
+    
+    if (!client->latest_frame_buffer || !client->frame_updated ||
+        region->width == 0 || region->height == 0 ||
+        region->x + region->width > client->latest_frame_width ||
+        region->y + region->height > client->latest_frame_height) {
+        pthread_mutex_unlock(&client->frame_mutex);
+        return FALSE;
+    }
+    
+    // Copy only the requested rectangle so the lock is held briefly
+    size_t row_bytes = (size_t)region->width * 4;
+    *buffer = malloc(row_bytes * region->height);
+    if (!*buffer) {
+        pthread_mutex_unlock(&client->frame_mutex);
+        return FALSE;
+    }
+    
+    const BYTE* src = client->latest_frame_buffer +
+                      (size_t)region->y * client->latest_frame_stride + (size_t)region->x * 4;
+    for (UINT32 y = 0; y < region->height; y++) {
+        memcpy(*buffer + y * row_bytes, src, row_bytes);
+        src += client->latest_frame_stride;
+    }
+    
+    *stride = (UINT32)row_bytes;
+    if (generation)
+        *generation = client->frame_generation;
+    
+    pthread_mutex_unlock(&client->frame_mutex);
+    return TRUE;
+}
+
+BOOL acquire_frame_view(RDPClient* client, FrameView* view)
+{
+    if (!client || !view)
+        return FALSE;
+    
+    lock_frame_for_snapshot(client);
+    
+    if (!client->latest_frame_buffer || !client->frame_updated) {
+        pthread_mutex_unlock(&client->frame_mutex);
+        return FALSE;
+    }
+    
+    // The lock stays held until release_frame_view so the view is a consistent snapshot
+    view->data = client->latest_frame_buffer;
+    view->width = client->latest_frame_width;
+    view->height = client->latest_frame_height;
+    view->stride = client->latest_frame_stride;
+    view->generation = client->frame_generation;
+    return TRUE;
+}
+
+void release_frame_view(RDPClient* client, FrameView* view)
+{
+    if (!client || !view || !view->data)
+        return;
+    
+    view->data = NULL;
+    pthread_mutex_unlock(&client->frame_mutex);
+}
+
+BOOL get_latest_frame(RDPClient* client, BYTE** buffer, UINT32* width, UINT32* height, UINT32* stride,
+                      UINT64* generation)
+{
+    if (!client || !buffer || !width || !height || !stride)
+        return FALSE;
+    
+    lock_frame_for_snapshot(client);
     
     if (!client->latest_frame_buffer || !client->frame_updated) {
         pthread_mutex_unlock(&client->frame_mutex);
@@ -431,7 +1775,23 @@ BOOL get_latest_frame(RDPClient* client, BYTE** buffer, UINT32* width, UINT32* h
     *width = client->latest_frame_width;
     *height = client->latest_frame_height;
     *stride = client->latest_frame_stride;
+    if (generation)
+        *generation = client->frame_generation;
     
     pthread_mutex_unlock(&client->frame_mutex);
     return TRUE;
+}
+
+BOOL get_frame_paint_time(RDPClient* client, UINT64 generation, UINT64* paint_ms)
+{
+    if (!client || !paint_ms)
+        return FALSE;
+    
+    pthread_mutex_lock(&client->frame_mutex);
+    const FrameDamage* entry = &client->damage_history[generation % FRAME_DAMAGE_HISTORY];
+    BOOL found = generation > 0 && entry->generation == generation;
+    if (found)
+        *paint_ms = entry->paint_ms;
+    pthread_mutex_unlock(&client->frame_mutex);
+    return found;
 }
\ No newline at end of file
@@ -0,0 +1,782 @@
+#include "recorder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+typedef struct {
+    UINT64 t_ms;
+    UINT64 offset;
+} RecordIndexEntry;
+
+struct _Recorder {
+    RDPClient* client;
+    char* path;
+    FILE* file;
+    UINT64 start_ms;            // get_time_ms() at start; record times are relative to it
+    UINT64 start_unix_ms;
+    
+    // Capture state, owned by the capture thread
+    BYTE* shadow;               // frame as recorded so far
+    UINT32 width;
+    UINT32 height;
+    UINT32 stride;
+    BYTE* staging;              // damaged rows copied out under frame_mutex
+    BYTE* tiles;                // changed tile pixels of one delta
+    BYTE* tile_headers;
+    BYTE* compressed;
+    size_t compressed_capacity;
+    UINT64 last_generation;
+    UINT64 last_keyframe_ms;
+    BOOL need_keyframe;
+    
+    // Records appended but not yet written; guarded by mutex. The writer
+    // swaps pending with writing so appends never wait for the disk.
+    BYTE* pending;
+    size_t pending_length;
+    size_t pending_capacity;
+    BYTE* writing;
+    size_t writing_capacity;
+    UINT64 appended;            // bytes appended after the file header
+    RecordIndexEntry* index;
+    size_t index_count;
+    size_t index_capacity;
+    RecorderStats stats;
+    BOOL stopping;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    
+    // Orders file writes, and keeps reconstruction reads consistent with them
+    pthread_mutex_t file_mutex;
+    
+    pthread_t capture_thread;
+    pthread_t writer_thread;
+    BOOL capture_running;
+    BOOL writer_running;
+};
+
+static void put_u16(BYTE* p, UINT16 v)
+{
+    p[0] = (BYTE)v;
+    p[1] = (BYTE)(v >> 8);
+}
+
+static void put_u32(BYTE* p, UINT32 v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (BYTE)(v >> (8 * i));
+}
+
+static void put_u64(BYTE* p, UINT64 v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (BYTE)(v >> (8 * i));
+}
+
+static UINT16 get_u16(const BYTE* p)
+{
+    return (UINT16)(p[0] | (p[1] << 8));
+}
+
+static UINT32 get_u32(const BYTE* p)
+{
+    return (UINT32)p[0] | ((UINT32)p[1] << 8) | ((UINT32)p[2] << 16) | ((UINT32)p[3] << 24);
+}
+
+static UINT64 get_u64(const BYTE* p)
+{
+    return (UINT64)get_u32(p) | ((UINT64)get_u32(p + 4) << 32);
+}
+
+static void deadline_after(struct timespec* deadline, UINT32 ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+// Appends one record built from a fixed part and an optional second part.
+// Returns FALSE and counts a drop when the writer is too far behind.
+static BOOL recorder_append(Recorder* recorder, RecordType type, UINT64 t_ms, const BYTE* part1, size_t length1,
+                            const BYTE* part2, size_t length2)
+{
+    size_t record_length = RECORDER_RECORD_HEADER_SIZE + length1 + length2;
+    
+    pthread_mutex_lock(&recorder->mutex);
+    if (recorder->pending_length + record_length > RECORDER_MAX_PENDING_BYTES) {
+        recorder->stats.dropped++;
+        pthread_mutex_unlock(&recorder->mutex);
+        return FALSE;
+    }
+    
+    if (recorder->pending_length + record_length > recorder->pending_capacity) {
+        size_t capacity = recorder->pending_capacity ? recorder->pending_capacity : RECORDER_BATCH_BYTES;
+        while (capacity < recorder->pending_length + record_length)
+            capacity *= 2;
+        BYTE* grown = (BYTE*)realloc(recorder->pending, capacity);
+        if (!grown) {
+            recorder->stats.dropped++;
+            pthread_mutex_unlock(&recorder->mutex);
+            return FALSE;
+        }
+        recorder->pending = grown;
+        recorder->pending_capacity = capacity;
+    }
+    
+    // Keyframes are indexed by where they will land in the file
+    if (type == RECORD_KEYFRAME) {
+        if (recorder->index_count == recorder->index_capacity) {
+            size_t capacity = recorder->index_capacity ? recorder->index_capacity * 2 : 64;
+            RecordIndexEntry* grown =
+                (RecordIndexEntry*)realloc(recorder->index, capacity * sizeof(RecordIndexEntry));
+            if (!grown) {
+                recorder->stats.dropped++;
+                pthread_mutex_unlock(&recorder->mutex);
+                return FALSE;
+            }
+            recorder->index = grown;
+            recorder->index_capacity = capacity;
+        }
+        recorder->index[recorder->index_count].t_ms = t_ms;
+        recorder->index[recorder->index_count].offset = RECORDER_HEADER_SIZE + recorder->appended;
+        recorder->index_count++;
+    }
+    
+    BYTE* p = recorder->pending + recorder->pending_length;
+    memset(p, 0, RECORDER_RECORD_HEADER_SIZE);
+    p[0] = (BYTE)type;
+    put_u32(p + 4, (UINT32)(length1 + length2));
+    put_u64(p + 8, t_ms);
+    if (length1)
+        memcpy(p + RECORDER_RECORD_HEADER_SIZE, part1, length1);
+    if (length2)
+        memcpy(p + RECORDER_RECORD_HEADER_SIZE + length1, part2, length2);
+    recorder->pending_length += record_length;
+    recorder->appended += record_length;
+    
+    if (recorder->pending_length >= RECORDER_BATCH_BYTES)
+        pthread_cond_broadcast(&recorder->wake);
+    pthread_mutex_unlock(&recorder->mutex);
+    return TRUE;
+}
+
+// Compresses length bytes of src into recorder->compressed
+static BOOL recorder_compress(Recorder* recorder, const BYTE* src, size_t length, uLongf* compressed_length)
+{
+    uLong bound = compressBound((uLong)length);
+    if (bound > recorder->compressed_capacity) {
+        BYTE* grown = (BYTE*)realloc(recorder->compressed, bound);
+        if (!grown)
+            return FALSE;
+        recorder->compressed = grown;
+        recorder->compressed_capacity = bound;
+    }
+    
+    *compressed_length = bound;
+    return compress2(recorder->compressed, compressed_length, src, (uLong)length, Z_BEST_SPEED) == Z_OK;
+}
+
+static BOOL recorder_alloc_frame(Recorder* recorder, UINT32 width, UINT32 height)
+{
+    UINT32 columns = (width + RECORDER_TILE_SIZE - 1) / RECORDER_TILE_SIZE;
+    UINT32 rows = (height + RECORDER_TILE_SIZE - 1) / RECORDER_TILE_SIZE;
+    size_t frame_bytes = (size_t)width * height * 4;
+    
+    free(recorder->shadow);
+    free(recorder->staging);
+    free(recorder->tiles);
+    free(recorder->tile_headers);
+    recorder->shadow = (BYTE*)malloc(frame_bytes);
+    recorder->staging = (BYTE*)malloc(frame_bytes);
+    recorder->tiles = (BYTE*)malloc(frame_bytes);
+    recorder->tile_headers = (BYTE*)malloc((size_t)columns * rows * 8);
+    if (!recorder->shadow || !recorder->staging || !recorder->tiles || !recorder->tile_headers) {
+        recorder->width = 0;
+        recorder->height = 0;
+        return FALSE;
+    }
+    
+    recorder->width = width;
+    recorder->height = height;
+    recorder->stride = width * 4;
+    return TRUE;
+}
+
+static void recorder_write_keyframe(Recorder* recorder, UINT64 now_ms)
+{
+    UINT32 width, height;
+    if (!get_frame_size(recorder->client, &width, &height))
+        return;
+    
+    if ((width != recorder->width || height != recorder->height || !recorder->shadow) &&
+        !recorder_alloc_frame(recorder, width, height))
+        return;
+    
+    FrameView view;
+    if (!acquire_frame_view(recorder->client, &view))
+        return;
+    if (view.width != recorder->width || view.height != recorder->height) {
+        release_frame_view(recorder->client, &view);
+        return;
+    }
+    for (UINT32 y = 0; y < view.height; y++)
+        memcpy(recorder->shadow + (size_t)y * recorder->stride, view.data + (size_t)y * view.stride,
+               recorder->stride);
+    UINT64 generation = view.generation;
+    release_frame_view(recorder->client, &view);
+    
+    size_t frame_bytes = (size_t)recorder->stride * recorder->height;
+    uLongf compressed_length;
+    if (!recorder_compress(recorder, recorder->shadow, frame_bytes, &compressed_length))
+        return;
+    
+    BYTE fixed[16];
+    put_u32(fixed, recorder->width);
+    put_u32(fixed + 4, recorder->height);
+    put_u64(fixed + 8, generation);
+    if (!recorder_append(recorder, RECORD_KEYFRAME, now_ms - recorder->start_ms, fixed, sizeof(fixed),
+                         recorder->compressed, compressed_length))
+        return;
+    
+    pthread_mutex_lock(&recorder->mutex);
+    recorder->stats.keyframes++;
+    recorder->stats.raw_bytes += frame_bytes;
+    pthread_mutex_unlock(&recorder->mutex);
+    
+    recorder->last_generation = generation;
+    recorder->last_keyframe_ms = now_ms;
+    recorder->need_keyframe = FALSE;
+}
+
+// Records the tiles that changed since the last recorded generation: the
+// damage history narrows the area, and tiles are compared against the shadow
+// frame so repaints of identical pixels cost nothing in the file
+static void recorder_write_delta(Recorder* recorder, UINT64 now_ms)
+{
+    // Damage and pixels come from the same locked view, so the delta is
+    // exactly the frame at its generation
+    FrameView view;
+    if (!acquire_frame_view(recorder->client, &view))
+        return;
+    if (view.width != recorder->width || view.height != recorder->height) {
+        release_frame_view(recorder->client, &view);
+        recorder->need_keyframe = TRUE;
+        return;
+    }
+    
+    FrameRect damage;
+    UINT64 generation = view.generation;
+    BOOL damaged = get_frame_view_damage(recorder->client, &view, recorder->last_generation, &damage, NULL);
+    recorder->last_generation = generation;
+    
+    // Widen the damage to whole tiles
+    UINT32 x0 = damage.x / RECORDER_TILE_SIZE * RECORDER_TILE_SIZE;
+    UINT32 y0 = damage.y / RECORDER_TILE_SIZE * RECORDER_TILE_SIZE;
+    UINT32 x1 = damage.x + damage.width;
+    UINT32 y1 = damage.y + damage.height;
+    x1 = (x1 + RECORDER_TILE_SIZE - 1) / RECORDER_TILE_SIZE * RECORDER_TILE_SIZE;
+    y1 = (y1 + RECORDER_TILE_SIZE - 1) / RECORDER_TILE_SIZE * RECORDER_TILE_SIZE;
+    if (x1 > recorder->width)
+        x1 = recorder->width;
+    if (y1 > recorder->height)
+        y1 = recorder->height;
+    if (!damaged || x0 >= x1 || y0 >= y1) {
+        release_frame_view(recorder->client, &view);
+        return;
+    }
+    
+    // Copy the damaged rows out so frame_mutex is held only for the copy
+    size_t row_bytes = (size_t)(x1 - x0) * 4;
+    for (UINT32 y = y0; y < y1; y++)
+        memcpy(recorder->staging + (size_t)y * recorder->stride + (size_t)x0 * 4,
+               view.data + (size_t)y * view.stride + (size_t)x0 * 4, row_bytes);
+    release_frame_view(recorder->client, &view);
+    
+    UINT32 tile_count = 0;
+    size_t tile_bytes = 0;
+    for (UINT32 ty = y0; ty < y1; ty += RECORDER_TILE_SIZE) {
+        UINT32 th = ty + RECORDER_TILE_SIZE > y1 ? y1 - ty : RECORDER_TILE_SIZE;
+        for (UINT32 tx = x0; tx < x1; tx += RECORDER_TILE_SIZE) {
+            UINT32 tw = tx + RECORDER_TILE_SIZE > x1 ? x1 - tx : RECORDER_TILE_SIZE;
+            size_t tile_row = (size_t)tw * 4;
+            
+            BOOL changed = FALSE;
+            for (UINT32 y = ty; y < ty + th && !changed; y++) {
+                size_t offset = (size_t)y * recorder->stride + (size_t)tx * 4;
+                changed = memcmp(recorder->staging + offset, recorder->shadow + offset, tile_row) != 0;
+            }
+            if (!changed)
+                continue;
+            
+            for (UINT32 y = ty; y < ty + th; y++) {
+                size_t offset = (size_t)y * recorder->stride + (size_t)tx * 4;
+                memcpy(recorder->shadow + offset, recorder->staging + offset, tile_row);
+                memcpy(recorder->tiles + tile_bytes, recorder->staging + offset, tile_row);
+                tile_bytes += tile_row;
+            }
+            
+            BYTE* header = recorder->tile_headers + (size_t)tile_count * 8;
+            put_u16(header, (UINT16)tx);
+            put_u16(header + 2, (UINT16)ty);
+            put_u16(header + 4, (UINT16)tw);
+            put_u16(header + 6, (UINT16)th);
+            tile_count++;
+        }
+    }
+    if (tile_count == 0)
+        return;
+    
+    uLongf compressed_length;
+    if (!recorder_compress(recorder, recorder->tiles, tile_bytes, &compressed_length))
+        return;
+    
+    // Fixed part: generation, tile count and the tile headers; then the pixels
+    size_t fixed_length = 12 + (size_t)tile_count * 8;
+    BYTE* fixed = (BYTE*)malloc(fixed_length);
+    if (!fixed)
+        return;
+    put_u64(fixed, generation);
+    put_u32(fixed + 8, tile_count);
+    memcpy(fixed + 12, recorder->tile_headers, (size_t)tile_count * 8);
+    BOOL appended = recorder_append(recorder, RECORD_DELTA, now_ms - recorder->start_ms, fixed, fixed_length,
+                                    recorder->compressed, compressed_length);
+    free(fixed);
+    
+    if (appended) {
+        pthread_mutex_lock(&recorder->mutex);
+        recorder->stats.deltas++;
+        recorder->stats.tiles += tile_count;
+        recorder->stats.raw_bytes += tile_bytes;
+        pthread_mutex_unlock(&recorder->mutex);
+    } else {
+        // The shadow is ahead of the file; start over from a keyframe
+        recorder->need_keyframe = TRUE;
+    }
+}
+
+static void* recorder_capture_proc(void* arg)
+{
+    Recorder* recorder = (Recorder*)arg;
+    
+    for (;;) {
+        pthread_mutex_lock(&recorder->mutex);
+        BOOL stopping = recorder->stopping;
+        pthread_mutex_unlock(&recorder->mutex);
+        if (stopping)
+            break;
+        
+        // Short waits keep stop responsive while the session is idle
+        if (!wait_for_frame_generation(recorder->client, recorder->last_generation, 250, NULL) &&
+            !recorder->need_keyframe)
+            continue;
+        
+        UINT64 now_ms = get_time_ms();
+        if (recorder->need_keyframe || !recorder->shadow ||
+            now_ms - recorder->last_keyframe_ms >= RECORDER_KEYFRAME_INTERVAL_MS) {
+            recorder_write_keyframe(recorder, now_ms);
+        } else {
+            UINT32 width, height;
+            if (get_frame_size(recorder->client, &width, &height) &&
+                (width != recorder->width || height != recorder->height))
+                recorder_write_keyframe(recorder, now_ms);
+            else
+                recorder_write_delta(recorder, now_ms);
+        }
+        
+        // Bursts of paints are coalesced into one record per interval
+        struct timespec deadline;
+        deadline_after(&deadline, RECORDER_CAPTURE_INTERVAL_MS);
+        pthread_mutex_lock(&recorder->mutex);
+        while (!recorder->stopping &&
+               pthread_cond_timedwait(&recorder->wake, &recorder->mutex, &deadline) == 0)
+            ;
+        pthread_mutex_unlock(&recorder->mutex);
+    }
+    
+    return NULL;
+}
+
+// Writes whatever is pending. Called with file_mutex held and mutex not held.
+static void recorder_write_pending(Recorder* recorder)
+{
+    pthread_mutex_lock(&recorder->mutex);
+    BYTE* batch = recorder->pending;
+    size_t length = recorder->pending_length;
+    recorder->pending = recorder->writing;
+    recorder->writing = batch;
+    size_t capacity = recorder->pending_capacity;
+    recorder->pending_capacity = recorder->writing_capacity;
+    recorder->writing_capacity = capacity;
+    recorder->pending_length = 0;
+    pthread_mutex_unlock(&recorder->mutex);
+    
+    if (length > 0 && (fwrite(batch, 1, length, recorder->file) != length || fflush(recorder->file) != 0))
+        fprintf(stderr, "Recorder: write to %s failed\n", recorder->path);
+}
+
+static void* recorder_writer_proc(void* arg)
+{
+    Recorder* recorder = (Recorder*)arg;
+    
+    pthread_mutex_lock(&recorder->mutex);
+    while (!recorder->stopping) {
+        struct timespec deadline;
+        deadline_after(&deadline, RECORDER_FLUSH_INTERVAL_MS);
+        while (!recorder->stopping && recorder->pending_length < RECORDER_BATCH_BYTES &&
+               pthread_cond_timedwait(&recorder->wake, &recorder->mutex, &deadline) == 0)
+            ;
+        pthread_mutex_unlock(&recorder->mutex);
+        
+        pthread_mutex_lock(&recorder->file_mutex);
+        recorder_write_pending(recorder);
+        pthread_mutex_unlock(&recorder->file_mutex);
+        
+        pthread_mutex_lock(&recorder->mutex);
+    }
+    pthread_mutex_unlock(&recorder->mutex);
+    
+    return NULL;
+}
+
+Recorder* recorder_start(RDPClient* client, const char* path, const char** error)
+{
+    const char* ignored;
+    if (!error)
+        error = &ignored;
+    
+    Recorder* recorder = (Recorder*)calloc(1, sizeof(Recorder));
+    if (!recorder) {
+        *error = "Memory allocation failed";
+        return NULL;
+    }
+    
+    recorder->client = client;
+    recorder->path = strdup(path);
+    recorder->file = fopen(path, "w+b");
+    if (!recorder->path || !recorder->file) {
+        *error = "Cannot create recording file";
+        if (recorder->file)
+            fclose(recorder->file);
+        free(recorder->path);
+        free(recorder);
+        return NULL;
+    }
+    
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    recorder->start_unix_ms = (UINT64)now.tv_sec * 1000 + (UINT64)now.tv_nsec / 1000000;
+    recorder->start_ms = get_time_ms();
+    recorder->stats.start_unix_ms = recorder->start_unix_ms;
+    recorder->need_keyframe = TRUE;
+    
+    BYTE header[RECORDER_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, RECORDER_MAGIC, 8);
+    put_u32(header + 8, RECORDER_VERSION);
+    put_u32(header + 12, RECORDER_TILE_SIZE);
+    put_u64(header + 16, recorder->start_unix_ms);
+    fwrite(header, 1, sizeof(header), recorder->file);
+    fflush(recorder->file);
+    
+    pthread_mutex_init(&recorder->mutex, NULL);
+    pthread_mutex_init(&recorder->file_mutex, NULL);
+    
+    // Both threads wait on absolute monotonic deadlines
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&recorder->wake, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    
+    if (pthread_create(&recorder->writer_thread, NULL, recorder_writer_proc, recorder) != 0) {
+        *error = "Failed to create recorder thread";
+        recorder_stop(recorder);
+        return NULL;
+    }
+    recorder->writer_running = TRUE;
+    
+    if (pthread_create(&recorder->capture_thread, NULL, recorder_capture_proc, recorder) != 0) {
+        *error = "Failed to create recorder thread";
+        recorder_stop(recorder);
+        return NULL;
+    }
+    recorder->capture_running = TRUE;
+    
+    printf("DEBUG: Recording to %s\n", path);
+    return recorder;
+}
+
+void recorder_stop(Recorder* recorder)
+{
+    if (!recorder)
+        return;
+    
+    pthread_mutex_lock(&recorder->mutex);
+    recorder->stopping = TRUE;
+    pthread_cond_broadcast(&recorder->wake);
+    pthread_mutex_unlock(&recorder->mutex);
+    if (recorder->capture_running)
+        pthread_join(recorder->capture_thread, NULL);
+    if (recorder->writer_running)
+        pthread_join(recorder->writer_thread, NULL);
+    
+    // Trailing index and footer so readers can seek without a scan
+    size_t index_length = 4 + recorder->index_count * 16;
+    BYTE* index = (BYTE*)malloc(index_length);
+    if (index) {
+        put_u32(index, (UINT32)recorder->index_count);
+        for (size_t i = 0; i < recorder->index_count; i++) {
+            put_u64(index + 4 + i * 16, recorder->index[i].t_ms);
+            put_u64(index + 12 + i * 16, recorder->index[i].offset);
+        }
+        UINT64 index_offset = RECORDER_HEADER_SIZE + recorder->appended;
+        if (recorder_append(recorder, RECORD_INDEX, get_time_ms() - recorder->start_ms, index, index_length,
+                            NULL, 0)) {
+            BYTE footer[16];
+            memcpy(footer, RECORDER_FOOTER_MAGIC, 8);
+            put_u64(footer + 8, index_offset);
+            recorder_write_pending(recorder);
+            fwrite(footer, 1, sizeof(footer), recorder->file);
+        }
+        free(index);
+    }
+    recorder_write_pending(recorder);
+    
+    printf("DEBUG: Recording %s closed: %u keyframes, %u deltas, %llu bytes\n", recorder->path,
+           recorder->stats.keyframes, recorder->stats.deltas,
+           (unsigned long long)(RECORDER_HEADER_SIZE + recorder->appended));
+    
+    fclose(recorder->file);
+    pthread_cond_destroy(&recorder->wake);
+    pthread_mutex_destroy(&recorder->file_mutex);
+    pthread_mutex_destroy(&recorder->mutex);
+    free(recorder->shadow);
+    free(recorder->staging);
+    free(recorder->tiles);
+    free(recorder->tile_headers);
+    free(recorder->compressed);
+    free(recorder->pending);
+    free(recorder->writing);
+    free(recorder->index);
+    free(recorder->path);
+    free(recorder);
+}
+
+void recorder_note_input(Recorder* recorder, RecordInputKind kind, DWORD flags, UINT32 a, UINT32 b)
+{
+    if (!recorder)
+        return;
+    
+    BYTE payload[16];
+    put_u32(payload, (UINT32)kind);
+    put_u32(payload + 4, (UINT32)flags);
+    put_u32(payload + 8, a);
+    put_u32(payload + 12, b);
+    if (recorder_append(recorder, RECORD_INPUT, get_time_ms() - recorder->start_ms, payload, sizeof(payload),
+                        NULL, 0)) {
+        pthread_mutex_lock(&recorder->mutex);
+        recorder->stats.inputs++;
+        pthread_mutex_unlock(&recorder->mutex);
+    }
+}
+
+void recorder_get_stats(Recorder* recorder, RecorderStats* stats)
+{
+    pthread_mutex_lock(&recorder->mutex);
+    *stats = recorder->stats;
+    stats->duration_ms = get_time_ms() - recorder->start_ms;
+    stats->file_bytes = RECORDER_HEADER_SIZE + recorder->appended;
+    stats->pending_bytes = recorder->pending_length;
+    pthread_mutex_unlock(&recorder->mutex);
+}
+
+const char* recorder_path(Recorder* recorder)
+{
+    return recorder->path;
+}
+
+static BOOL read_at(int fd, UINT64 offset, BYTE* buffer, size_t length)
+{
+    while (length > 0) {
+        ssize_t n = pread(fd, buffer, length, (off_t)offset);
+        if (n <= 0)
+            return FALSE;
+        buffer += n;
+        offset += (UINT64)n;
+        length -= (size_t)n;
+    }
+    return TRUE;
+}
+
+// Applies a DELTA payload to frame
+static BOOL apply_delta(const BYTE* payload, size_t length, BYTE* frame, UINT32 width, UINT32 height,
+                        UINT64* generation)
+{
+    if (length < 12)
+        return FALSE;
+    *generation = get_u64(payload);
+    UINT32 tile_count = get_u32(payload + 8);
+    if ((UINT64)tile_count * 8 > length - 12)
+        return FALSE;
+    
+    const BYTE* headers = payload + 12;
+    size_t raw_length = 0;
+    for (UINT32 i = 0; i < tile_count; i++) {
+        const BYTE* header = headers + (size_t)i * 8;
+        UINT32 x = get_u16(header), y = get_u16(header + 2), w = get_u16(header + 4), h = get_u16(header + 6);
+        if (x + w > width || y + h > height)
+            return FALSE;
+        raw_length += (size_t)w * h * 4;
+    }
+    
+    BYTE* raw = (BYTE*)malloc(raw_length ? raw_length : 1);
+    if (!raw)
+        return FALSE;
+    uLongf decoded = (uLongf)raw_length;
+    size_t data_offset = 12 + (size_t)tile_count * 8;
+    if (uncompress(raw, &decoded, payload + data_offset, (uLong)(length - data_offset)) != Z_OK ||
+        decoded != raw_length) {
+        free(raw);
+        return FALSE;
+    }
+    
+    const BYTE* src = raw;
+    size_t stride = (size_t)width * 4;
+    for (UINT32 i = 0; i < tile_count; i++) {
+        const BYTE* header = headers + (size_t)i * 8;
+        UINT32 x = get_u16(header), y = get_u16(header + 2), w = get_u16(header + 4), h = get_u16(header + 6);
+        for (UINT32 row = 0; row < h; row++) {
+            memcpy(frame + (size_t)(y + row) * stride + (size_t)x * 4, src, (size_t)w * 4);
+            src += (size_t)w * 4;
+        }
+    }
+    
+    free(raw);
+    return TRUE;
+}
+
+BOOL recorder_frame_at(Recorder* recorder, UINT64 t_ms, BYTE** buffer, UINT32* width, UINT32* height,
+                       UINT32* stride, UINT64* frame_t_ms, UINT64* generation, const char** error)
+{
+    const char* ignored;
+    if (!error)
+        error = &ignored;
+    *buffer = NULL;
+    
+    // Flush first so every record up to now is on disk, and hold file_mutex
+    // while reading so the writer cannot interleave
+    pthread_mutex_lock(&recorder->file_mutex);
+    recorder_write_pending(recorder);
+    
+    // Everything appended before the records still pending is on disk
+    pthread_mutex_lock(&recorder->mutex);
+    UINT64 end = RECORDER_HEADER_SIZE + recorder->appended - recorder->pending_length;
+    size_t low = 0, high = recorder->index_count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (recorder->index[mid].t_ms <= t_ms)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    while (low > 0 && recorder->index[low - 1].offset >= end)
+        low--;
+    BOOL found = low > 0;
+    UINT64 offset = found ? recorder->index[low - 1].offset : 0;
+    pthread_mutex_unlock(&recorder->mutex);
+    
+    if (!found) {
+        pthread_mutex_unlock(&recorder->file_mutex);
+        *error = "No frame recorded at that time";
+        return FALSE;
+    }
+    
+    int fd = fileno(recorder->file);
+    BYTE* frame = NULL;
+    BYTE* payload = NULL;
+    size_t payload_capacity = 0;
+    UINT32 frame_width = 0, frame_height = 0;
+    BOOL ok = TRUE;
+    
+    while (ok && offset + RECORDER_RECORD_HEADER_SIZE <= end) {
+        BYTE header[RECORDER_RECORD_HEADER_SIZE];
+        if (!read_at(fd, offset, header, sizeof(header))) {
+            ok = FALSE;
+            break;
+        }
+        RecordType type = (RecordType)header[0];
+        UINT32 length = get_u32(header + 4);
+        UINT64 record_t_ms = get_u64(header + 8);
+        if (frame && record_t_ms > t_ms)
+            break;
+        
+        UINT64 payload_offset = offset + RECORDER_RECORD_HEADER_SIZE;
+        offset = payload_offset + length;
+        if (offset > end) {
+            ok = FALSE;
+            break;
+        }
+        if (type != RECORD_KEYFRAME && type != RECORD_DELTA)
+            continue;
+        
+        if (length > payload_capacity) {
+            BYTE* grown = (BYTE*)realloc(payload, length);
+            if (!grown) {
+                ok = FALSE;
+                break;
+            }
+            payload = grown;
+            payload_capacity = length;
+        }
+        if (!read_at(fd, payload_offset, payload, length)) {
+            ok = FALSE;
+            break;
+        }
+        
+        if (type == RECORD_KEYFRAME) {
+            if (length < 16) {
+                ok = FALSE;
+                break;
+            }
+            UINT32 w = get_u32(payload), h = get_u32(payload + 4);
+            size_t frame_bytes = (size_t)w * h * 4;
+            BYTE* replaced = (BYTE*)realloc(frame, frame_bytes ? frame_bytes : 1);
+            if (!replaced) {
+                ok = FALSE;
+                break;
+            }
+            frame = replaced;
+            uLongf decoded = (uLongf)frame_bytes;
+            if (uncompress(frame, &decoded, payload + 16, length - 16) != Z_OK || decoded != frame_bytes) {
+                ok = FALSE;
+                break;
+            }
+            frame_width = w;
+            frame_height = h;
+            *generation = get_u64(payload + 8);
+        } else if (frame) {
+            ok = apply_delta(payload, length, frame, frame_width, frame_height, generation);
+        }
+        *frame_t_ms = record_t_ms;
+    }
+    pthread_mutex_unlock(&recorder->file_mutex);
+    free(payload);
+    
+    if (!ok || !frame) {
+        free(frame);
+        *error = "Recording is corrupt";
+        return FALSE;
+    }
+    
+    *buffer = frame;
+    *width = frame_width;
+    *height = frame_height;
+    *stride = frame_width * 4;
+    return TRUE;
+}
@@ -0,0 +1,400 @@
+#include "session_pool.h"
+#include "frame_source.h"
+#include "recorder.h"
+#include "frame_history.h"
+#include "json.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+SessionPool* session_pool_new(void)
+{
+    SessionPool* pool = (SessionPool*)calloc(1, sizeof(SessionPool));
+    if (!pool)
+        return NULL;
+    
+    if (pthread_mutex_init(&pool->mutex, NULL) != 0) {
+        free(pool);
+        return NULL;
+    }
+    
+    pool->next_auto_id = 1;
+    pool->blank_frame_timeout_ms = DEFAULT_BLANK_FRAME_TIMEOUT_MS;
+    pool->geometry.width = DEFAULT_DESKTOP_WIDTH;
+    pool->geometry.height = DEFAULT_DESKTOP_HEIGHT;
+    pool->geometry.color_depth = DEFAULT_COLOR_DEPTH;
+    pool->gfx_mode = RDP_GFX_AUTO;
+    pool->reconnect_attempts = DEFAULT_RECONNECT_ATTEMPTS;
+    return pool;
+}
+
+static void session_destroy(RDPSession* session)
+{
+    printf("Closing session %s\n", session->id);
+    rdp_client_disconnect(session->client);
+    rdp_client_free(session->client);
+    free(session);
+}
+
+void session_pool_free(SessionPool* pool)
+{
+    if (!pool)
+        return;
+    
+    // Called after the HTTP workers have drained, so nothing holds a reference
+    for (int i = 0; i < pool->count; i++)
+        session_destroy(pool->sessions[i]);
+    
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+static BOOL session_id_valid(const char* id)
+{
+    size_t length = strlen(id);
+    if (length == 0 || length >= SESSION_ID_SIZE)
+        return FALSE;
+    
+    // IDs appear in URL paths, so keep them to unreserved characters
+    for (size_t i = 0; i < length; i++) {
+        char c = id[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+              c == '-' || c == '_' || c == '.'))
+            return FALSE;
+    }
+    
+    return TRUE;
+}
+
+static int session_find_locked(SessionPool* pool, const char* id, size_t id_length)
+{
+    for (int i = 0; i < pool->count; i++) {
+        const char* existing = pool->sessions[i]->id;
+        if (strlen(existing) == id_length && strncmp(existing, id, id_length) == 0)
+            return i;
+    }
+    
+    return -1;
+}
+
+SessionCreateResult session_pool_create(SessionPool* pool, const char* id, const char* hostname, int port,
+                                        const char* username, const char* password, const char* domain,
+                                        const RDPGeometry* geometry, RDPSession** created, const char** error)
+{
+    const char* ignored;
+    if (!error)
+        error = &ignored;
+    if (created)
+        *created = NULL;
+    
+    if (!pool || !hostname) {
+        *error = "Missing hostname";
+        return SESSION_CREATE_INVALID;
+    }
+    
+    // Unset fields fall back to the pool default
+    RDPGeometry requested = pool->geometry;
+    if (geometry) {
+        if (geometry->width)
+            requested.width = geometry->width;
+        if (geometry->height)
+            requested.height = geometry->height;
+        if (geometry->color_depth)
+            requested.color_depth = geometry->color_depth;
+    }
+    if (!rdp_geometry_valid(&requested, error))
+        return SESSION_CREATE_INVALID;
+    
+    RDPSession* session = (RDPSession*)calloc(1, sizeof(RDPSession));
+    if (!session) {
+        *error = "Memory allocation failed";
+        return SESSION_CREATE_FAILED;
+    }
+    
+    pthread_mutex_lock(&pool->mutex);
+    if (id && *id) {
+        snprintf(session->id, sizeof(session->id), "%s", id);
+    } else {
+        snprintf(session->id, sizeof(session->id), "s%d", pool->next_auto_id++);
+    }
+    BOOL duplicate = session_find_locked(pool, session->id, strlen(session->id)) >= 0;
+    BOOL full = pool->count >= MAX_SESSIONS;
+    pthread_mutex_unlock(&pool->mutex);
+    
+    if (!session_id_valid(session->id) || (id && strlen(id) >= SESSION_ID_SIZE)) {
+        *error = "Invalid session id";
+        free(session);
+        return SESSION_CREATE_INVALID;
+    }
+    if (duplicate) {
+        *error = "Session already exists";
+        free(session);
+        return SESSION_CREATE_EXISTS;
+    }
+    if (full) {
+        *error = "Too many sessions";
+        free(session);
+        return SESSION_CREATE_FULL;
+    }
+    
+    session->client = rdp_client_new();
+    if (!session->client) {
+        *error = "Failed to create RDP client";
+        free(session);
+        return SESSION_CREATE_FAILED;
+    }
+    session->client->blank_frame_timeout_ms = pool->blank_frame_timeout_ms;
+    session->client->geometry = requested;
+    session->client->gfx_mode = pool->gfx_mode;
+    session->client->decoder = pool->decoder;
+    session->client->decode_threads = pool->decode_threads;
+    session->client->reconnect_attempts = pool->reconnect_attempts;
+    session->client->idle_timeout_ms = pool->idle_timeout_ms;
+    
+    if (pool->source) {
+        FrameSource* source = frame_source_new(pool->source, error);
+        if (!source) {
+            rdp_client_free(session->client);
+            free(session);
+            return SESSION_CREATE_FAILED;
+        }
+        session->client->source = source;
+    }
+    
+    // The handshake runs in the background; routes answer 503 until the first frame
+    printf("Connecting session %s to %s:%d...\n", session->id, hostname, port);
+    if (!rdp_client_connect_async(session->client, hostname, port, username, password, domain)) {
+        *error = "Failed to start RDP connection";
+        rdp_client_free(session->client);
+        free(session);
+        return SESSION_CREATE_UNREACHABLE;
+    }
+    
+    // One file per session and start, so restarts never overwrite a recording
+    if (pool->record_dir) {
+        char path[1024];
+        char started[32];
+        time_t now = time(NULL);
+        struct tm local;
+        localtime_r(&now, &local);
+        strftime(started, sizeof(started), "%Y%m%d-%H%M%S", &local);
+        snprintf(path, sizeof(path), "%s/%s-%s.rcrec", pool->record_dir, session->id, started);
+        session->client->recorder = recorder_start(session->client, path, error);
+        if (!session->client->recorder) {
+            rdp_client_free(session->client);
+            free(session);
+            return SESSION_CREATE_FAILED;
+        }
+    }
+    
+    if (pool->history_budget > 0) {
+        session->client->history = frame_history_start(session->client, pool->history_budget, error);
+        if (!session->client->history) {
+            rdp_client_free(session->client);
+            free(session);
+            return SESSION_CREATE_FAILED;
+        }
+    }
+    
+    // Another request may have taken the id or the last slot meanwhile
+    pthread_mutex_lock(&pool->mutex);
+    duplicate = session_find_locked(pool, session->id, strlen(session->id)) >= 0;
+    full = pool->count >= MAX_SESSIONS;
+    if (duplicate || full) {
+        pthread_mutex_unlock(&pool->mutex);
+        *error = duplicate ? "Session already exists" : "Too many sessions";
+        session_destroy(session);
+        return duplicate ? SESSION_CREATE_EXISTS : SESSION_CREATE_FULL;
+    }
+    pool->sessions[pool->count++] = session;
+    
+    // Pinned before the lock drops, so a concurrent DELETE cannot free it under the caller
+    if (created) {
+        session->refcount++;
+        *created = session;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    
+    return SESSION_CREATE_OK;
+}
+
+BOOL session_pool_remove(SessionPool* pool, const char* id)
+{
+    if (!pool || !id)
+        return FALSE;
+    
+    pthread_mutex_lock(&pool->mutex);
+    int index = session_find_locked(pool, id, strlen(id));
+    if (index < 0) {
+        pthread_mutex_unlock(&pool->mutex);
+        return FALSE;
+    }
+    
+    RDPSession* session = pool->sessions[index];
+    pool->sessions[index] = pool->sessions[--pool->count];
+    pool->sessions[pool->count] = NULL;
+    
+    // Requests still using the session free it on release
+    session->removed = TRUE;
+    BOOL destroy = session->refcount == 0;
+    pthread_mutex_unlock(&pool->mutex);
+    
+    if (destroy)
+        session_destroy(session);
+    return TRUE;
+}
+
+RDPSession* session_pool_acquire(SessionPool* pool, const char* id, size_t id_length)
+{
+    if (!pool || !id)
+        return NULL;
+    
+    pthread_mutex_lock(&pool->mutex);
+    int index = session_find_locked(pool, id, id_length);
+    RDPSession* session = index >= 0 ? pool->sessions[index] : NULL;
+    if (session)
+        session->refcount++;
+    pthread_mutex_unlock(&pool->mutex);
+    
+    return session;
+}
+
+void session_pool_release(SessionPool* pool, RDPSession* session)
+{
+    if (!pool || !session)
+        return;
+    
+    pthread_mutex_lock(&pool->mutex);
+    BOOL destroy = --session->refcount == 0 && session->removed;
+    pthread_mutex_unlock(&pool->mutex);
+    
+    if (destroy)
+        session_destroy(session);
+}
+
+// Parses "width=1280", "height=720" or "bpp=16" into geometry
+static BOOL parse_geometry_option(const char* option, RDPGeometry* geometry)
+{
+    const char* value = strchr(option, '=');
+    if (!value)
+        return FALSE;
+    
+    size_t key_length = (size_t)(value - option);
+    int number = atoi(value + 1);
+    if (number <= 0)
+        return FALSE;
+    
+    if (key_length == 5 && strncmp(option, "width", 5) == 0)
+        geometry->width = (UINT32)number;
+    else if (key_length == 6 && strncmp(option, "height", 6) == 0)
+        geometry->height = (UINT32)number;
+    else if (key_length == 3 && strncmp(option, "bpp", 3) == 0)
+        geometry->color_depth = (UINT32)number;
+    else
+        return FALSE;
+    
+    return TRUE;
+}
+
+// Config file: one session per line, "<id> <host> [port] [username] [password] [domain]",
+// optionally followed by width=, height= and bpp= options
+int session_pool_load_file(SessionPool* pool, const char* path)
+{
+    if (!pool || !path)
+        return -1;
+    
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Failed to open session file %s\n", path);
+        return -1;
+    }
+    
+    char line[1024];
+    int line_number = 0;
+    int created = 0;
+    
+    while (fgets(line, sizeof(line), fp)) {
+        line_number++;
+        
+        char* comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+        
+        char* fields[6] = { NULL };
+        int field_count = 0;
+        RDPGeometry geometry = { 0, 0, 0 };
+        BOOL valid = TRUE;
+        char* save = NULL;
+        for (char* token = strtok_r(line, " \t\r\n", &save); token;
+             token = strtok_r(NULL, " \t\r\n", &save)) {
+            if (strchr(token, '=')) {
+                if (!parse_geometry_option(token, &geometry)) {
+                    fprintf(stderr, "%s:%d: unknown option \"%s\"\n", path, line_number, token);
+                    valid = FALSE;
+                }
+            } else if (field_count < 6) {
+                fields[field_count++] = token;
+            }
+        }
+        
+        if (!valid)
+            continue;
+        if (field_count == 0)
+            continue;
+        if (field_count < 2) {
+            fprintf(stderr, "%s:%d: expected \"<id> <host> [port] [user] [pass] [domain]\"\n",
+                    path, line_number);
+            continue;
+        }
+        
+        int port = field_count > 2 ? atoi(fields[2]) : 3389;
+        if (port <= 0 || port > 65535)
+            port = 3389;
+        
+        const char* error = NULL;
+        if (session_pool_create(pool, fields[0], fields[1], port, fields[3], fields[4], fields[5],
+                                &geometry, NULL, &error) == SESSION_CREATE_OK)
+            created++;
+        else
+            fprintf(stderr, "%s:%d: session %s: %s\n", path, line_number, fields[0], error);
+    }
+    
+    fclose(fp);
+    return created;
+}
+
+size_t session_pool_list_json(SessionPool* pool, char* buffer, size_t buffer_size)
+{
+    if (!pool || !buffer || buffer_size < 3)
+        return 0;
+    
+    size_t length = (size_t)snprintf(buffer, buffer_size, "[");
+    
+    char id[SESSION_ID_SIZE];
+    char hostname[256];
+    pthread_mutex_lock(&pool->mutex);
+    for (int i = 0; i < pool->count && length < buffer_size; i++) {
+        RDPClient* client = pool->sessions[i]->client;
+        length += (size_t)snprintf(buffer + length, buffer_size - length,
+            "%s{\"id\": \"%s\",\"hostname\": \"%s\",\"port\": %d,\"width\": %u,\"height\": %u,"
+            "\"bpp\": %u,\"connected\": %s,\"phase\": \"%s\"}",
+            i > 0 ? "," : "",
+            json_escape(pool->sessions[i]->id, id, sizeof(id)),
+            json_escape(client->hostname, hostname, sizeof(hostname)),
+            client->port,
+            client->geometry.width,
+            client->geometry.height,
+            client->geometry.color_depth,
+            client->connected ? "true" : "false",
+            rdp_client_phase_name(rdp_client_get_phase(client)));
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    
+    if (length < buffer_size)
+        length += (size_t)snprintf(buffer + length, buffer_size - length, "]");
+    if (length >= buffer_size)
+        length = buffer_size - 1;
+    
+    return length;
+}
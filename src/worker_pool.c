@@ -0,0 +1,141 @@
+#include "worker_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void* worker_thread_proc(void* arg)
+{
+    WorkerPool* pool = (WorkerPool*)arg;
+    
+    for (;;) {
+        pthread_mutex_lock(&pool->mutex);
+        while (!pool->head && !pool->stopping)
+            pthread_cond_wait(&pool->task_available, &pool->mutex);
+        
+        // Drain remaining tasks before honouring stop
+        WorkerTask* task = pool->head;
+        if (!task) {
+            pthread_mutex_unlock(&pool->mutex);
+            break;
+        }
+        
+        pool->head = task->next;
+        if (!pool->head)
+            pool->tail = NULL;
+        pool->pending--;
+        pthread_mutex_unlock(&pool->mutex);
+        
+        task->fn(task->arg);
+        free(task);
+    }
+    
+    return NULL;
+}
+
+int worker_pool_default_size(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        cpus = 1;
+    
+    // Handlers may block waiting for frames, so keep more threads than cores
+    int size = (int)cpus * 2;
+    return size < 4 ? 4 : size;
+}
+
+WorkerPool* worker_pool_new(int thread_count)
+{
+    if (thread_count <= 0)
+        thread_count = worker_pool_default_size();
+    
+    WorkerPool* pool = (WorkerPool*)calloc(1, sizeof(WorkerPool));
+    if (!pool)
+        return NULL;
+    
+    pool->threads = (pthread_t*)calloc((size_t)thread_count, sizeof(pthread_t));
+    if (!pool->threads) {
+        free(pool);
+        return NULL;
+    }
+    
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->task_available, NULL);
+    
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_thread_proc, pool) != 0) {
+            fprintf(stderr, "Failed to create worker thread %d\n", i);
+            break;
+        }
+        pool->thread_count++;
+    }
+    
+    if (pool->thread_count == 0) {
+        worker_pool_free(pool);
+        return NULL;
+    }
+    
+    printf("DEBUG: Worker pool started with %d threads\n", pool->thread_count);
+    return pool;
+}
+
+void worker_pool_free(WorkerPool* pool)
+{
+    if (!pool)
+        return;
+    
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = TRUE;
+    pthread_cond_broadcast(&pool->task_available);
+    pthread_mutex_unlock(&pool->mutex);
+    
+    for (int i = 0; i < pool->thread_count; i++)
+        pthread_join(pool->threads[i], NULL);
+    
+    pthread_cond_destroy(&pool->task_available);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool);
+}
+
+BOOL worker_pool_submit(WorkerPool* pool, WorkerTaskFn fn, void* arg)
+{
+    if (!pool || !fn)
+        return FALSE;
+    
+    WorkerTask* task = (WorkerTask*)malloc(sizeof(WorkerTask));
+    if (!task)
+        return FALSE;
+    
+    task->fn = fn;
+    task->arg = arg;
+    task->next = NULL;
+    
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->stopping) {
+        pthread_mutex_unlock(&pool->mutex);
+        free(task);
+        return FALSE;
+    }
+    
+    if (pool->tail)
+        pool->tail->next = task;
+    else
+        pool->head = task;
+    pool->tail = task;
+    pool->pending++;
+    
+    pthread_cond_signal(&pool->task_available);
+    pthread_mutex_unlock(&pool->mutex);
+    return TRUE;
+}
+
+int worker_pool_pending(WorkerPool* pool)
+{
+    if (!pool)
+        return 0;
+    
+    pthread_mutex_lock(&pool->mutex);
+    int pending = pool->pending;
+    pthread_mutex_unlock(&pool->mutex);
+    return pending;
+}
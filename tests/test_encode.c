@@ -0,0 +1,340 @@
+#include "../include/rcrdp.h"
+#include "../include/image_encode.h"
+#include <png.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 0x00RRGGBB test frame: runs and gradients that deflate finds matches in,
+// with noise between them so every filter type gets picked. stride leaves
+// padding after each row, which the encoders must skip.
+static BYTE* make_frame(UINT32 width, UINT32 height, UINT32 stride)
+{
+    BYTE* frame = (BYTE*)malloc((size_t)stride * height);
+    if (!frame)
+        return NULL;
+    memset(frame, 0xA5, (size_t)stride * height);
+    
+    UINT32 seed = 2463534242u ^ (width * 31 + height);
+    for (UINT32 y = 0; y < height; y++) {
+        UINT32* row = (UINT32*)(frame + (size_t)y * stride);
+        for (UINT32 x = 0; x < width; x++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            if ((x / 16 + y / 16) % 3 == 0)
+                row[x] = seed & 0x00FFFFFF;
+            else if ((x / 16 + y / 16) % 3 == 1)
+                row[x] = ((x & 0xFF) << 16) | ((y & 0xFF) << 8) | ((x + y) & 0xFF);
+            else
+                row[x] = 0x00336699;
+        }
+    }
+    
+    return frame;
+}
+
+static BOOL rgb_matches_frame(const BYTE* rgb, const BYTE* frame, UINT32 width, UINT32 height, UINT32 stride,
+                              char* detail, size_t detail_size)
+{
+    for (UINT32 y = 0; y < height; y++) {
+        const UINT32* row = (const UINT32*)(frame + (size_t)y * stride);
+        for (UINT32 x = 0; x < width; x++) {
+            const BYTE* decoded = rgb + ((size_t)y * width + x) * 3;
+            UINT32 pixel = ((UINT32)decoded[0] << 16) | ((UINT32)decoded[1] << 8) | decoded[2];
+            if (pixel != (row[x] & 0x00FFFFFF)) {
+                snprintf(detail, detail_size, "pixel %u,%u is %06x, expected %06x", x, y, pixel,
+                         row[x] & 0x00FFFFFF);
+                return FALSE;
+            }
+        }
+    }
+    
+    return TRUE;
+}
+
+// Decodes with libpng and compares every pixel with the source frame
+static BOOL png_matches_frame(const BYTE* png_data, size_t png_length, const BYTE* frame, UINT32 width,
+                              UINT32 height, UINT32 stride, char* detail, size_t detail_size)
+{
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_memory(&image, png_data, png_length)) {
+        snprintf(detail, detail_size, "libpng: %s", image.message);
+        return FALSE;
+    }
+    if (image.width != width || image.height != height) {
+        snprintf(detail, detail_size, "decoded as %ux%u", image.width, image.height);
+        png_image_free(&image);
+        return FALSE;
+    }
+    
+    image.format = PNG_FORMAT_RGB;
+    BYTE* rgb = (BYTE*)malloc(PNG_IMAGE_SIZE(image));
+    if (!rgb || !png_image_finish_read(&image, NULL, rgb, 0, NULL)) {
+        snprintf(detail, detail_size, "libpng: %s", rgb ? image.message : "out of memory");
+        png_image_free(&image);
+        free(rgb);
+        return FALSE;
+    }
+    
+    BOOL matches = rgb_matches_frame(rgb, frame, width, height, stride, detail, detail_size);
+    free(rgb);
+    return matches;
+}
+
+// QOI decoder after the specification at qoiformat.org, to packed RGB
+static BYTE* decode_qoi(const BYTE* data, size_t length, UINT32* width, UINT32* height)
+{
+    static const BYTE end_marker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    if (length < 14 + sizeof(end_marker) || memcmp(data, "qoif", 4) != 0)
+        return NULL;
+    *width = ((UINT32)data[4] << 24) | ((UINT32)data[5] << 16) | ((UINT32)data[6] << 8) | data[7];
+    *height = ((UINT32)data[8] << 24) | ((UINT32)data[9] << 16) | ((UINT32)data[10] << 8) | data[11];
+    if (*width == 0 || *height == 0 || data[12] != 3)
+        return NULL;
+    
+    size_t pixel_count = (size_t)*width * *height;
+    BYTE* rgb = (BYTE*)malloc(pixel_count * 3);
+    if (!rgb)
+        return NULL;
+    
+    BYTE index[64][4];
+    memset(index, 0, sizeof(index));
+    BYTE px[4] = { 0, 0, 0, 255 };
+    size_t pos = 14;
+    size_t end = length - sizeof(end_marker);
+    int run = 0;
+    for (size_t i = 0; i < pixel_count; i++) {
+        if (run > 0) {
+            run--;
+        } else {
+            if (pos >= end) {
+                free(rgb);
+                return NULL;
+            }
+            BYTE b = data[pos++];
+            if (b == 0xFE && pos + 3 <= end) {
+                memcpy(px, data + pos, 3);
+                pos += 3;
+            } else if (b == 0xFF && pos + 4 <= end) {
+                memcpy(px, data + pos, 4);
+                pos += 4;
+            } else if ((b >> 6) == 0) {
+                memcpy(px, index[b], 4);
+            } else if ((b >> 6) == 1) {
+                px[0] += ((b >> 4) & 3) - 2;
+                px[1] += ((b >> 2) & 3) - 2;
+                px[2] += (b & 3) - 2;
+            } else if ((b >> 6) == 2 && pos < end) {
+                int dg = (b & 0x3F) - 32;
+                BYTE b2 = data[pos++];
+                px[0] += dg - 8 + (b2 >> 4);
+                px[1] += dg;
+                px[2] += dg - 8 + (b2 & 0x0F);
+            } else if ((b >> 6) == 3 && b < 0xFE) {
+                run = b & 0x3F;
+            } else {
+                free(rgb);
+                return NULL;
+            }
+            memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64], px, 4);
+        }
+        memcpy(rgb + i * 3, px, 3);
+    }
+    
+    if (pos != end || memcmp(data + end, end_marker, sizeof(end_marker)) != 0) {
+        free(rgb);
+        return NULL;
+    }
+    return rgb;
+}
+
+static int test_png_round_trip(void)
+{
+    // strips 0 means encode_png_memory's own choice
+    static const struct {
+        UINT32 width;
+        UINT32 height;
+        int strips;
+    } cases[] = {
+        { 1, 1, 1 },
+        { 1, 1, 8 },            // more strips than rows
+        { 3, 2, 5 },
+        { 333, 7, 3 },          // rows not divisible by the strip count
+        { 7, 333, 5 },
+        { 1001, 601, 7 },       // each strip primed with a full window
+        { 1024, 768, 0 },
+        { 1920, 1080, 0 },
+    };
+    
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        UINT32 width = cases[i].width;
+        UINT32 height = cases[i].height;
+        UINT32 stride = width * 4 + 12;
+        BYTE* frame = make_frame(width, height, stride);
+        BYTE* png_data = NULL;
+        size_t png_length = 0;
+        char detail[128] = "encode failed";
+        char strips[16] = "default";
+        if (cases[i].strips > 0)
+            snprintf(strips, sizeof(strips), "%d", cases[i].strips);
+        
+        BOOL encoded = frame && (cases[i].strips > 0
+                                     ? encode_png_strips(frame, width, height, stride, cases[i].strips, &png_data,
+                                                         &png_length, NULL)
+                                     : encode_png_memory(frame, width, height, stride, &png_data, &png_length, NULL));
+        if (encoded && png_matches_frame(png_data, png_length, frame, width, height, stride, detail, sizeof(detail))) {
+            printf("PASS: PNG %ux%u in %s strips decodes to the source pixels\n", width, height, strips);
+        } else {
+            printf("FAIL: PNG %ux%u in %s strips: %s\n", width, height, strips, detail);
+            failures++;
+        }
+        
+        free(png_data);
+        free(frame);
+    }
+    
+    return failures;
+}
+
+static int test_qoi_round_trip(void)
+{
+    static const struct {
+        UINT32 width;
+        UINT32 height;
+    } cases[] = {
+        { 1, 1 },
+        { 333, 7 },
+        { 1024, 768 },
+    };
+    
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        UINT32 width = cases[i].width;
+        UINT32 height = cases[i].height;
+        UINT32 stride = width * 4 + 12;
+        BYTE* frame = make_frame(width, height, stride);
+        BYTE* qoi_data = NULL;
+        size_t qoi_length = 0;
+        char detail[128] = "encode failed";
+        
+        BYTE* rgb = NULL;
+        UINT32 decoded_width = 0;
+        UINT32 decoded_height = 0;
+        if (frame && encode_qoi_memory(frame, width, height, stride, &qoi_data, &qoi_length)) {
+            rgb = decode_qoi(qoi_data, qoi_length, &decoded_width, &decoded_height);
+            snprintf(detail, sizeof(detail), rgb ? "decoded as %ux%u" : "not a valid QOI stream", decoded_width,
+                     decoded_height);
+        }
+        if (rgb && decoded_width == width && decoded_height == height &&
+            rgb_matches_frame(rgb, frame, width, height, stride, detail, sizeof(detail))) {
+            printf("PASS: QOI %ux%u decodes to the source pixels\n", width, height);
+        } else {
+            printf("FAIL: QOI %ux%u: %s\n", width, height, detail);
+            failures++;
+        }
+        
+        free(rgb);
+        free(qoi_data);
+        free(frame);
+    }
+    
+    return failures;
+}
+
+static int check_cache(EncodeCache* cache, const char* what, const EncodeKey* key, const BYTE* expected,
+                       size_t expected_length)
+{
+    const BYTE* data = NULL;
+    size_t length = 0;
+    BOOL hit = encode_cache_acquire(cache, key, &data, &length);
+    BOOL same = hit && expected && length == expected_length && memcmp(data, expected, length) == 0;
+    if (hit)
+        encode_cache_release(cache);
+    
+    if (expected ? same : !hit) {
+        printf("PASS: %s %s\n", what, expected ? "is served from the cache" : "misses the cache");
+        return 0;
+    }
+    printf("FAIL: %s %s\n", what, hit ? (expected ? "returned other bytes" : "hit the cache") : "missed the cache");
+    return 1;
+}
+
+static int test_encode_cache(void)
+{
+    EncodeCache* cache = encode_cache_new();
+    if (!cache) {
+        printf("FAIL: Failed to create encode cache\n");
+        return 1;
+    }
+    
+    static const BYTE jpeg[] = "encoded at quality 80";
+    static const BYTE region[] = "encoded region";
+    EncodeKey key = { 7, IMAGE_FORMAT_JPEG, 80, { 0, 0, 0, 0 }, 0 };
+    EncodeKey region_key = { 7, IMAGE_FORMAT_JPEG, 80, { 10, 20, 100, 50 }, 0 };
+    encode_cache_put(cache, &key, jpeg, sizeof(jpeg));
+    encode_cache_put(cache, &region_key, region, sizeof(region));
+    
+    int failures = 0;
+    failures += check_cache(cache, "The same key", &key, jpeg, sizeof(jpeg));
+    failures += check_cache(cache, "The same region", &region_key, region, sizeof(region));
+    
+    EncodeKey other = key;
+    other.quality = 60;
+    failures += check_cache(cache, "Another quality", &other, NULL, 0);
+    other = region_key;
+    other.rect.width = 101;
+    failures += check_cache(cache, "Another region", &other, NULL, 0);
+    other = key;
+    other.format = IMAGE_FORMAT_QOI;
+    failures += check_cache(cache, "Another format", &other, NULL, 0);
+    other = key;
+    other.generation = 8;
+    failures += check_cache(cache, "The next generation", &other, NULL, 0);
+    other = key;
+    other.cursor = 1;
+    failures += check_cache(cache, "A composited cursor", &other, NULL, 0);
+    
+    // The least recently used entry goes first: region_key, since key was just read
+    failures += check_cache(cache, "The same key", &key, jpeg, sizeof(jpeg));
+    for (UINT64 generation = 100; generation < 100 + ENCODE_CACHE_ENTRIES - 1; generation++) {
+        other = key;
+        other.generation = generation;
+        encode_cache_put(cache, &other, jpeg, sizeof(jpeg));
+    }
+    failures += check_cache(cache, "A recently used key", &key, jpeg, sizeof(jpeg));
+    failures += check_cache(cache, "An evicted key", &region_key, NULL, 0);
+    
+    encode_cache_free(cache);
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+    
+    printf("=== Image Encode Tests ===\n\n");
+    
+    printf("Test 1: PNG Round Trip\n");
+    failures += test_png_round_trip();
+    printf("\n");
+    
+    printf("Test 2: QOI Round Trip\n");
+    failures += test_qoi_round_trip();
+    printf("\n");
+    
+    printf("Test 3: Encode Cache\n");
+    failures += test_encode_cache();
+    printf("\n");
+    
+    if (failures == 0) {
+        printf("=== ALL TESTS PASSED ===\n");
+        return 0;
+    } else {
+        printf("=== %d TEST(S) FAILED ===\n", failures);
+        return 1;
+    }
+}
@@ -0,0 +1,575 @@
+#include "../include/http_server.h"
+#include "../include/http_router.h"
+#include "../include/arena.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Feeds text to a fresh parser step bytes at a time, as separate reads
+// would; bytes past the current length are not yet in the buffer
+static HttpParseResult parse_in_steps(HttpParser* parser, char* buffer, size_t capacity, const char* text,
+                                      size_t step)
+{
+    size_t total = strlen(text);
+    http_parser_init(parser, buffer, capacity);
+    
+    HttpParseResult result = HTTP_PARSE_INCOMPLETE;
+    size_t length = 0;
+    while (result == HTTP_PARSE_INCOMPLETE && length < total && length < capacity) {
+        size_t count = total - length < step ? total - length : step;
+        if (count > capacity - length)
+            count = capacity - length;
+        memcpy(buffer + length, text + length, count);
+        length += count;
+        result = http_parser_execute(parser, length);
+    }
+    return result;
+}
+
+static int check_request(const HttpParser* parser, HttpParseResult result, const char* label, const char* path,
+                         const char* body)
+{
+    const HttpRequest* request = &parser->request;
+    size_t body_length = body ? strlen(body) : 0;
+    BOOL matches = result == HTTP_PARSE_DONE && strcmp(request->path, path) == 0 &&
+                   request->body_length == body_length &&
+                   (body ? request->body && memcmp(request->body, body, body_length) == 0 : !request->body);
+    if (matches) {
+        printf("PASS: %s\n", label);
+    } else {
+        printf("FAIL: %s: result %d, path \"%s\", %zu body bytes\n", label, result,
+               result == HTTP_PARSE_DONE ? request->path : "", result == HTTP_PARSE_DONE ? request->body_length : 0);
+    }
+    return matches ? 0 : 1;
+}
+
+static int check_error(const HttpParser* parser, HttpParseResult result, const char* label, int status)
+{
+    if (result == HTTP_PARSE_ERROR && parser->error_status == status) {
+        printf("PASS: %s answers %d (%s)\n", label, status, parser->error);
+        return 0;
+    }
+    
+    printf("FAIL: %s: result %d, status %d, expected %d\n", label, result, parser->error_status, status);
+    return 1;
+}
+
+static int test_split_reads(void)
+{
+    static const char text[] = "POST /sendkey?x=1&name=a%20b HTTP/1.1\r\n"
+                               "Host: localhost\r\n"
+                               "Content-Type: application/json\r\n"
+                               "Content-Length: 13\r\n"
+                               "\r\n"
+                               "{\"code\": 30}\n";
+    static const size_t steps[] = { 1, 2, 7, 64, sizeof(text) };
+    char buffer[1024];
+    int failures = 0;
+    
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        HttpParser parser;
+        HttpParseResult result = parse_in_steps(&parser, buffer, sizeof(buffer), text, steps[i]);
+        
+        char label[64];
+        snprintf(label, sizeof(label), "request read %zu bytes at a time", steps[i]);
+        if (check_request(&parser, result, label, "/sendkey", "{\"code\": 30}\n") != 0) {
+            failures++;
+            continue;
+        }
+        
+        const HttpRequest* request = &parser.request;
+        const char* type = http_header_get(request, "content-type");
+        const char* name = http_query_value(request, "name");
+        if (request->method != HTTP_POST || !request->keep_alive || !type ||
+            strcmp(type, "application/json") != 0 || !name || strcmp(name, "a b") != 0) {
+            printf("FAIL: %s: headers or query not parsed\n", label);
+            failures++;
+        }
+    }
+    
+    return failures;
+}
+
+static int test_chunked_body(void)
+{
+    static const char text[] = "POST /clipboard HTTP/1.1\r\n"
+                               "Transfer-Encoding: chunked\r\n"
+                               "\r\n"
+                               "5\r\nhello\r\n"
+                               "7;ext=1\r\n, world\r\n"
+                               "0\r\n"
+                               "Trailer: ignored\r\n"
+                               "\r\n";
+    char buffer[1024];
+    HttpParser parser;
+    int failures = 0;
+    
+    failures += check_request(&parser, parse_in_steps(&parser, buffer, sizeof(buffer), text, sizeof(text)),
+                              "chunked body in one read", "/clipboard", "hello, world");
+    failures += check_request(&parser, parse_in_steps(&parser, buffer, sizeof(buffer), text, 3),
+                              "chunked body read 3 bytes at a time", "/clipboard", "hello, world");
+    
+    failures += check_error(&parser, parse_in_steps(&parser, buffer, sizeof(buffer),
+                                                    "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                                    "zz\r\nhello\r\n0\r\n\r\n", 1),
+                            "non-hex chunk size", 400);
+    failures += check_error(&parser, parse_in_steps(&parser, buffer, sizeof(buffer),
+                                                    "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                                    "5 x\r\nhello\r\n0\r\n\r\n", 1),
+                            "chunk size with trailing garbage", 400);
+    failures += check_error(&parser, parse_in_steps(&parser, buffer, sizeof(buffer),
+                                                    "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                                    "3\r\nhello\r\n0\r\n\r\n", 1),
+                            "chunk longer than its size", 400);
+    failures += check_error(&parser, parse_in_steps(&parser, buffer, sizeof(buffer),
+                                                    "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                                    "ffffffffffffffffff\r\n", 1),
+                            "chunk size past the buffer", 413);
+    failures += check_error(&parser, parse_in_steps(&parser, buffer, sizeof(buffer),
+                                                    "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+                                                    "Content-Length: 5\r\n\r\nhello", 1),
+                            "chunked body with Content-Length", 400);
+    
+    return failures;
+}
+
+static int test_pipelined(void)
+{
+    static const char text[] = "POST /sendkey HTTP/1.1\r\nContent-Length: 2\r\n\r\n[]"
+                               "GET /screen?format=qoi HTTP/1.1\r\n\r\n"
+                               "\r\n"
+                               "DELETE /sessions/lab1 HTTP/1.1\r\nConnection: close\r\n\r\n";
+    char buffer[1024];
+    size_t length = strlen(text);
+    memcpy(buffer, text, length);
+    
+    HttpParser parser;
+    http_parser_init(&parser, buffer, sizeof(buffer));
+    int failures = 0;
+    
+    // The body's terminator overwrites the next request's first byte until
+    // http_parser_next puts it back
+    failures += check_request(&parser, http_parser_execute(&parser, length), "first pipelined request", "/sendkey",
+                              "[]");
+    
+    http_parser_next(&parser, &length);
+    HttpParseResult result = http_parser_execute(&parser, length);
+    failures += check_request(&parser, result, "second pipelined request", "/screen", NULL);
+    const char* format = http_query_value(&parser.request, "format");
+    if (result == HTTP_PARSE_DONE && (!format || strcmp(format, "qoi") != 0)) {
+        printf("FAIL: second pipelined request lost its query\n");
+        failures++;
+    }
+    
+    // A stray blank line between requests is skipped
+    http_parser_next(&parser, &length);
+    result = http_parser_execute(&parser, length);
+    failures += check_request(&parser, result, "third pipelined request", "/sessions/lab1", NULL);
+    if (result == HTTP_PARSE_DONE && (parser.request.method != HTTP_DELETE || parser.request.keep_alive)) {
+        printf("FAIL: third pipelined request has the wrong method or keep-alive\n");
+        failures++;
+    }
+    
+    http_parser_next(&parser, &length);
+    if (length == 0 && http_parser_execute(&parser, length) == HTTP_PARSE_INCOMPLETE) {
+        printf("PASS: nothing left after the last request\n");
+    } else {
+        printf("FAIL: %zu bytes left after the last request\n", length);
+        failures++;
+    }
+    
+    return failures;
+}
+
+static int test_size_limits(void)
+{
+    char buffer[256];
+    HttpParser parser;
+    int failures = 0;
+    
+    // The declared length is refused before the body arrives
+    failures += check_error(&parser, parse_in_steps(&parser, buffer, sizeof(buffer),
+                                                    "POST / HTTP/1.1\r\nContent-Length: 4096\r\n\r\n", 1),
+                            "Content-Length past the buffer", 413);
+    
+    // One byte stays free for the body's terminator
+    char text[512];
+    const char* head = "POST / HTTP/1.1\r\nContent-Length: ";
+    size_t body_length = sizeof(buffer) - strlen(head) - strlen("000\r\n\r\n");
+    int length = snprintf(text, sizeof(text), "%s%03zu\r\n\r\n", head, body_length);
+    memset(text + length, 'x', body_length);
+    text[length + body_length] = '\0';
+    failures += check_error(&parser, parse_in_steps(&parser, buffer, sizeof(buffer), text, 1),
+                            "body filling the whole buffer", 413);
+    
+    memset(text, 0, sizeof(text));
+    length = snprintf(text, sizeof(text), "%s%03zu\r\n\r\n", head, body_length - 1);
+    memset(text + length, 'x', body_length - 1);
+    HttpParseResult result = parse_in_steps(&parser, buffer, sizeof(buffer), text, 1);
+    if (result == HTTP_PARSE_DONE && parser.request.body_length == body_length - 1) {
+        printf("PASS: body one byte short of the buffer is accepted\n");
+    } else {
+        printf("FAIL: body one byte short of the buffer: result %d\n", result);
+        failures++;
+    }
+    
+    // Headers that never end within the buffer
+    length = snprintf(text, sizeof(text), "GET / HTTP/1.1\r\nX-Padding: ");
+    memset(text + length, 'a', sizeof(text) - (size_t)length - 1);
+    text[sizeof(text) - 1] = '\0';
+    failures += check_error(&parser, parse_in_steps(&parser, buffer, sizeof(buffer), text, 16),
+                            "header larger than the buffer", 431);
+    
+    char large[MAX_REQUEST_SIZE];
+    size_t used = (size_t)snprintf(large, sizeof(large), "GET / HTTP/1.1\r\n");
+    for (int i = 0; i <= HTTP_MAX_HEADERS; i++)
+        used += (size_t)snprintf(large + used, sizeof(large) - used, "X-Header-%d: %d\r\n", i, i);
+    snprintf(large + used, sizeof(large) - used, "\r\n");
+    char* request_buffer = (char*)malloc(MAX_REQUEST_SIZE);
+    if (!request_buffer)
+        return failures + 1;
+    failures += check_error(&parser, parse_in_steps(&parser, request_buffer, MAX_REQUEST_SIZE, large, 4096),
+                            "too many headers", 431);
+    free(request_buffer);
+    
+    return failures;
+}
+
+static int test_malformed(void)
+{
+    static const struct {
+        const char* text;
+        const char* label;
+        int status;
+    } cases[] = {
+        { "GET /screen%00.png HTTP/1.1\r\n\r\n", "%00 in the path", 400 },
+        { "GET /screen?format=png%00 HTTP/1.1\r\n\r\n", "%00 in a query value", 400 },
+        { "GET /screen%4 HTTP/1.1\r\n\r\n", "truncated escape in the path", 400 },
+        { "GET /screen%zz HTTP/1.1\r\n\r\n", "non-hex escape in the path", 400 },
+        { "GET screen HTTP/1.1\r\n\r\n", "relative target", 400 },
+        { "GET / HTTP/2.0\r\n\r\n", "HTTP/2.0", 400 },
+        { "PATCH / HTTP/1.1\r\n\r\n", "unknown method", 501 },
+        { "GET / HTTP/1.1\r\nHost: a\r\n folded\r\n\r\n", "folded header", 400 },
+        { "GET / HTTP/1.1\r\nHost : a\r\n\r\n", "space before the colon", 400 },
+        { "POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n", "non-numeric Content-Length", 400 },
+        { "POST / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n", "conflicting Content-Length",
+          400 },
+    };
+    char buffer[512];
+    int failures = 0;
+    
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        HttpParser parser;
+        failures += check_error(&parser, parse_in_steps(&parser, buffer, sizeof(buffer), cases[i].text, 1),
+                                cases[i].label, cases[i].status);
+    }
+    
+    // Escapes other than %00 decode
+    HttpParser parser;
+    failures += check_request(&parser, parse_in_steps(&parser, buffer, sizeof(buffer),
+                                                      "GET /sessions/lab%2D1/screen HTTP/1.1\r\n\r\n", 1),
+                              "escaped path is decoded", "/sessions/lab-1/screen", NULL);
+    
+    return failures;
+}
+
+static int test_query_int(void)
+{
+    static const struct {
+        const char* query;
+        BOOL valid;
+        int value;
+    } cases[] = {
+        { "", TRUE, 7 },
+        { "n=", TRUE, 7 },
+        { "n=42", TRUE, 42 },
+        { "n=-5", TRUE, -5 },
+        { "n=100", TRUE, 100 },
+        { "n=101", FALSE, 7 },
+        { "n=-6", FALSE, 7 },
+        { "n=12abc", FALSE, 7 },
+        { "n=abc", FALSE, 7 },
+        { "n=%2012", FALSE, 7 },
+        { "n=%2B12", FALSE, 7 },
+        { "n=1.5", FALSE, 7 },
+        { "n=99999999999999999999", FALSE, 7 },
+    };
+    int failures = 0;
+    
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        char buffer[256];
+        int length = snprintf(buffer, sizeof(buffer), "GET /screen?%s HTTP/1.1\r\n\r\n", cases[i].query);
+        HttpParser parser;
+        http_parser_init(&parser, buffer, sizeof(buffer));
+        if (http_parser_execute(&parser, (size_t)length) != HTTP_PARSE_DONE) {
+            printf("FAIL: \"%s\" did not parse\n", cases[i].query);
+            failures++;
+            continue;
+        }
+        
+        int value = 7;
+        BOOL valid = http_query_int(&parser.request, "n", -5, 100, &value);
+        if (valid == cases[i].valid && value == cases[i].value) {
+            printf("PASS: \"%s\" is %s\n", cases[i].query, valid ? "accepted" : "rejected");
+        } else {
+            printf("FAIL: \"%s\": %s with %d\n", cases[i].query, valid ? "accepted" : "rejected", value);
+            failures++;
+        }
+    }
+    
+    return failures;
+}
+
+// Handlers are never called; routes are told apart by pattern. The
+// parameter route comes first so literal precedence cannot depend on order.
+static const HttpRoute test_routes[] = {
+    { HTTP_GET, "/items/{name}", NULL, FALSE, METRIC_ROUTE_OTHER, HTTP_COST_CHEAP, 0, "Item" },
+    { HTTP_GET, "/items/latest", NULL, FALSE, METRIC_ROUTE_OTHER, HTTP_COST_CHEAP, 0, "Latest item" },
+    { HTTP_GET, "/screen", NULL, TRUE, METRIC_ROUTE_SCREEN, HTTP_COST_FRAME, 0, "Screen" },
+    { HTTP_GET, "/recording/frame", NULL, TRUE, METRIC_ROUTE_RECORDING, HTTP_COST_FRAME, 0, "Recorded frame" },
+    { HTTP_GET, "/sessions", NULL, FALSE, METRIC_ROUTE_SESSIONS, HTTP_COST_CHEAP, 0, "List sessions" },
+    { HTTP_POST, "/sessions", NULL, FALSE, METRIC_ROUTE_SESSIONS, HTTP_COST_CHEAP, 0, "Create a session" },
+    { HTTP_DELETE, "/sessions/{id}", NULL, FALSE, METRIC_ROUTE_SESSIONS, HTTP_COST_CHEAP, 0, "Remove a session" },
+    { HTTP_PUT, "/sessions/{id}", NULL, FALSE, METRIC_ROUTE_SESSIONS, HTTP_COST_CHEAP, 0, "Replace a session" },
+};
+
+// Matches "METHOD path"; pattern, param and allow are what to expect, with
+// pattern NULL for a 404 and allow set for a 405
+static int check_route(const HttpRouter* router, const char* method, const char* path, const char* pattern,
+                       BOOL scoped, const char* param, const char* allow)
+{
+    char buffer[512];
+    int length = snprintf(buffer, sizeof(buffer), "%s %s HTTP/1.1\r\n\r\n", method, path);
+    HttpParser parser;
+    http_parser_init(&parser, buffer, sizeof(buffer));
+    if (http_parser_execute(&parser, (size_t)length) != HTTP_PARSE_DONE) {
+        printf("FAIL: %s %s did not parse\n", method, path);
+        return 1;
+    }
+    
+    char allowed[64] = "unset";
+    HttpRequest* request = &parser.request;
+    HttpRouteResult result = http_router_match(router, request, allowed, sizeof(allowed));
+    
+    BOOL matches;
+    if (allow) {
+        matches = result == HTTP_ROUTE_METHOD_NOT_ALLOWED && strcmp(allowed, allow) == 0;
+    } else if (!pattern) {
+        matches = result == HTTP_ROUTE_NOT_FOUND;
+    } else {
+        const char* value = request->param_count > 0 ? request->params[0].value : NULL;
+        matches = result == HTTP_ROUTE_FOUND && strcmp(request->route->pattern, pattern) == 0 &&
+                  request->session_scoped == scoped &&
+                  (param ? value && strcmp(value, param) == 0 : request->param_count == 0);
+    }
+    
+    if (matches) {
+        printf("PASS: %s %s -> %s%s%s\n", method, path, allow ? "405, Allow: " : pattern ? pattern : "404",
+               allow ? allow : "", scoped ? " (session)" : "");
+    } else {
+        printf("FAIL: %s %s: result %d, route %s, %d params, Allow \"%s\"\n", method, path, result,
+               request->route ? request->route->pattern : "none", request->param_count, allowed);
+    }
+    return matches ? 0 : 1;
+}
+
+static int test_router(void)
+{
+    HttpRouter* router = http_router_new(test_routes, sizeof(test_routes) / sizeof(test_routes[0]));
+    if (!router) {
+        printf("FAIL: route table did not compile\n");
+        return 1;
+    }
+    
+    int failures = 0;
+    failures += check_route(router, "GET", "/screen", "/screen", FALSE, NULL, NULL);
+    failures += check_route(router, "GET", "/recording/frame", "/recording/frame", FALSE, NULL, NULL);
+    
+    // Per-session routes are served again under /sessions/{id}
+    failures += check_route(router, "GET", "/sessions/lab1/screen", "/screen", TRUE, "lab1", NULL);
+    failures += check_route(router, "GET", "/sessions/lab-2/recording/frame", "/recording/frame", TRUE, "lab-2",
+                            NULL);
+    failures += check_route(router, "DELETE", "/sessions/lab1", "/sessions/{id}", FALSE, "lab1", NULL);
+    failures += check_route(router, "GET", "/sessions/lab1/sessions", NULL, FALSE, NULL, NULL);
+    
+    // Literal segments win over parameters, whatever the table order
+    failures += check_route(router, "GET", "/items/latest", "/items/latest", FALSE, NULL, NULL);
+    failures += check_route(router, "GET", "/items/oldest", "/items/{name}", FALSE, "oldest", NULL);
+    failures += check_route(router, "GET", "/items/latest2", "/items/{name}", FALSE, "latest2", NULL);
+    
+    // Whole segments only: no prefix matches, no trailing slash, no empty parameter
+    failures += check_route(router, "GET", "/screenshots", NULL, FALSE, NULL, NULL);
+    failures += check_route(router, "GET", "/scree", NULL, FALSE, NULL, NULL);
+    failures += check_route(router, "GET", "/screen/", NULL, FALSE, NULL, NULL);
+    failures += check_route(router, "GET", "/screen/extra", NULL, FALSE, NULL, NULL);
+    failures += check_route(router, "GET", "/recording", NULL, FALSE, NULL, NULL);
+    failures += check_route(router, "GET", "/items/", NULL, FALSE, NULL, NULL);
+    failures += check_route(router, "GET", "/sessions//screen", NULL, FALSE, NULL, NULL);
+    failures += check_route(router, "GET", "/", NULL, FALSE, NULL, NULL);
+    
+    // Allow lists every method of the path, in table method order
+    failures += check_route(router, "POST", "/screen", NULL, FALSE, NULL, "GET");
+    failures += check_route(router, "PUT", "/sessions", NULL, FALSE, NULL, "GET, POST");
+    failures += check_route(router, "GET", "/sessions/lab1", NULL, FALSE, NULL, "DELETE, PUT");
+    failures += check_route(router, "POST", "/sessions/lab1/screen", NULL, FALSE, NULL, "GET");
+    
+    // A parameter too long for the request's storage is not found rather than truncated
+    char path[256];
+    snprintf(path, sizeof(path), "/items/%0200d", 0);
+    failures += check_route(router, "GET", path, NULL, FALSE, NULL, NULL);
+    
+    http_router_free(router);
+    
+    // Two parameter names at one position would make lookups ambiguous
+    static const HttpRoute conflicting[] = {
+        { HTTP_GET, "/items/{name}", NULL, FALSE, METRIC_ROUTE_OTHER, HTTP_COST_CHEAP, 0, "Item" },
+        { HTTP_PUT, "/items/{id}", NULL, FALSE, METRIC_ROUTE_OTHER, HTTP_COST_CHEAP, 0, "Item" },
+    };
+    router = http_router_new(conflicting, sizeof(conflicting) / sizeof(conflicting[0]));
+    if (!router) {
+        printf("PASS: conflicting parameter names are refused\n");
+    } else {
+        printf("FAIL: conflicting parameter names compiled\n");
+        http_router_free(router);
+        failures++;
+    }
+    
+    return failures;
+}
+
+// Fills each allocation with its own byte so overlaps show up as mismatches
+static BOOL fill_and_check(BYTE** blocks, const size_t* sizes, int count)
+{
+    for (int i = 0; i < count; i++)
+        memset(blocks[i], i + 1, sizes[i]);
+    for (int i = 0; i < count; i++) {
+        for (size_t j = 0; j < sizes[i]; j++) {
+            if (blocks[i][j] != (BYTE)(i + 1))
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static int test_arena(void)
+{
+    Arena* arena = arena_new(256);
+    if (!arena) {
+        printf("FAIL: arena_new failed\n");
+        return 1;
+    }
+    
+    int failures = 0;
+    
+    // Odd sizes still leave every allocation 16-byte aligned
+    static const size_t odd_sizes[] = { 1, 3, 17, 0, 33, 15 };
+    BYTE* blocks[32];
+    size_t sizes[32];
+    BOOL aligned = TRUE;
+    int count = 0;
+    for (size_t i = 0; i < sizeof(odd_sizes) / sizeof(odd_sizes[0]); i++) {
+        blocks[count] = (BYTE*)arena_alloc(arena, odd_sizes[i]);
+        sizes[count] = odd_sizes[i];
+        if (!blocks[count] || (uintptr_t)blocks[count] % 16 != 0)
+            aligned = FALSE;
+        count++;
+    }
+    if (aligned && fill_and_check(blocks, sizes, count) && !arena->overflow) {
+        printf("PASS: small allocations are aligned, disjoint and in the first block\n");
+    } else {
+        printf("FAIL: small allocations: aligned %d, overflow %p\n", aligned, (void*)arena->overflow);
+        failures++;
+    }
+    
+    // Past the first block, and one allocation larger than a whole block
+    BOOL grown = TRUE;
+    for (int i = 0; i < 12; i++) {
+        sizes[count] = i == 6 ? 4096 : 40;
+        blocks[count] = (BYTE*)arena_alloc(arena, sizes[count]);
+        if (!blocks[count] || (uintptr_t)blocks[count] % 16 != 0)
+            grown = FALSE;
+        count++;
+    }
+    if (grown && fill_and_check(blocks, sizes, count) && arena->overflow) {
+        printf("PASS: allocations grow past the first block and keep their contents\n");
+    } else {
+        printf("FAIL: allocations past the first block\n");
+        failures++;
+    }
+    
+    // A reset frees overflow blocks and hands out the first block again
+    BYTE* base = arena->base;
+    arena_reset(arena);
+    char* text = arena_strdup(arena, "reused");
+    if (!arena->overflow && (BYTE*)text == base && strcmp(text, "reused") == 0) {
+        printf("PASS: reset reuses the first block\n");
+    } else {
+        printf("FAIL: after reset: overflow %p, first allocation at offset %td\n", (void*)arena->overflow,
+               (BYTE*)text - base);
+        failures++;
+    }
+    
+    // Sizes that cannot be met fail cleanly and leave the arena usable
+    void* huge = arena_alloc(arena, SIZE_MAX);
+    void* wrapping = arena_alloc(arena, SIZE_MAX - 8);
+    void* unavailable = arena_alloc(arena, SIZE_MAX / 2);
+    char* after = arena_strdup(arena, "still usable");
+    if (!huge && !wrapping && !unavailable && after && strcmp(text, "reused") == 0 &&
+        strcmp(after, "still usable") == 0) {
+        printf("PASS: impossible sizes return NULL\n");
+    } else {
+        printf("FAIL: impossible sizes: %p, %p, %p\n", huge, wrapping, unavailable);
+        failures++;
+    }
+    
+    arena_free(arena);
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+    
+    printf("=== HTTP Tests ===\n\n");
+    
+    printf("Test 1: Requests Split Across Reads\n");
+    failures += test_split_reads();
+    printf("\n");
+    
+    printf("Test 2: Chunked Bodies\n");
+    failures += test_chunked_body();
+    printf("\n");
+    
+    printf("Test 3: Pipelined Requests\n");
+    failures += test_pipelined();
+    printf("\n");
+    
+    printf("Test 4: Size Limits\n");
+    failures += test_size_limits();
+    printf("\n");
+    
+    printf("Test 5: Malformed Requests\n");
+    failures += test_malformed();
+    printf("\n");
+    
+    printf("Test 6: Integer Query Parameters\n");
+    failures += test_query_int();
+    printf("\n");
+    
+    printf("Test 7: Routing\n");
+    failures += test_router();
+    printf("\n");
+    
+    printf("Test 8: Response Arena\n");
+    failures += test_arena();
+    printf("\n");
+    
+    if (failures == 0) {
+        printf("=== ALL TESTS PASSED ===\n");
+        return 0;
+    } else {
+        printf("=== %d TEST(S) FAILED ===\n", failures);
+        return 1;
+    }
+}
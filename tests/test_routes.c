@@ -0,0 +1,227 @@
+#include "../include/rcrdp.h"
+#include "../include/frame_source.h"
+#include "../include/http_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define READY_TIMEOUT_MS 5000
+#define BATCH_SIZE 256      // MAX_INPUT_BATCH in http_routes.c
+
+// A synthetic session needs no RDP server; options are the source's, e.g.
+// an input log that shows what the routes sent
+static RDPClient* start_synthetic_client(const char* options)
+{
+    char spec[256];
+    snprintf(spec, sizeof(spec), "synthetic:%s", options);
+    
+    const char* error = NULL;
+    FrameSource* source = frame_source_new(spec, &error);
+    if (!source) {
+        fprintf(stderr, "FAIL: Failed to create synthetic source: %s\n", error);
+        return NULL;
+    }
+    
+    RDPClient* client = rdp_client_new();
+    if (!client) {
+        frame_source_free(source);
+        return NULL;
+    }
+    client->source = source;
+    
+    if (!rdp_client_connect(client, "synthetic", 0, NULL, NULL, NULL)) {
+        fprintf(stderr, "FAIL: Synthetic source did not start\n");
+        rdp_client_free(client);
+        return NULL;
+    }
+    
+    for (int waited = 0; waited < READY_TIMEOUT_MS; waited += 10) {
+        if (client->connected && rdp_client_get_phase(client) == RDP_PHASE_READY)
+            return client;
+        usleep(10000);
+    }
+    
+    fprintf(stderr, "FAIL: Synthetic session not ready after %d ms\n", READY_TIMEOUT_MS);
+    rdp_client_disconnect(client);
+    rdp_client_free(client);
+    return NULL;
+}
+
+static int count_log_lines(const char* log_path, const char* kind)
+{
+    FILE* log = fopen(log_path, "r");
+    if (!log)
+        return -1;
+    
+    char line[256];
+    int count = 0;
+    while (fgets(line, sizeof(line), log)) {
+        const char* space = strchr(line, ' ');
+        if (space && strncmp(space + 1, kind, strlen(kind)) == 0)
+            count++;
+    }
+    
+    fclose(log);
+    return count;
+}
+
+typedef HttpResponse* (*InputHandler)(RDPClient* client, HttpRequest* request);
+
+// Posts a batch of count copies of event and returns the status code
+static int post_batch(RDPClient* client, InputHandler handler, const char* path, const char* event, int count,
+                      char* message, size_t message_size)
+{
+    size_t event_length = strlen(event);
+    size_t body_length = 1 + (size_t)count * (event_length + 1);
+    size_t capacity = body_length + 256;
+    char* buffer = (char*)malloc(capacity);
+    if (!buffer)
+        return -1;
+    
+    size_t length = (size_t)snprintf(buffer, capacity, "POST %s HTTP/1.1\r\nContent-Type: application/json\r\n"
+                                     "Content-Length: %zu\r\n\r\n[", path, body_length);
+    for (int i = 0; i < count; i++) {
+        memcpy(buffer + length, event, event_length);
+        length += event_length;
+        buffer[length++] = i + 1 < count ? ',' : ']';
+    }
+    
+    HttpParser parser;
+    http_parser_init(&parser, buffer, capacity);
+    if (http_parser_execute(&parser, length) != HTTP_PARSE_DONE) {
+        free(buffer);
+        return -1;
+    }
+    
+    HttpResponse* response = handler(client, &parser.request);
+    int status = response ? response->status_code : -1;
+    if (response)
+        snprintf(message, message_size, "%.*s", (int)response->body_length, response->body);
+    free_http_response(response);
+    free(buffer);
+    return status;
+}
+
+static int test_full_batch(InputHandler handler, const char* path, const char* event, const char* kind)
+{
+    char log_path[] = "/tmp/rcrdp_test_routes_XXXXXX";
+    int fd = mkstemp(log_path);
+    if (fd < 0) {
+        fprintf(stderr, "FAIL: Cannot create input log\n");
+        return 1;
+    }
+    close(fd);
+    
+    char options[64];
+    snprintf(options, sizeof(options), "log=%s", log_path);
+    RDPClient* client = start_synthetic_client(options);
+    if (!client) {
+        unlink(log_path);
+        return 1;
+    }
+    
+    int failures = 0;
+    char message[192] = "";
+    int status = post_batch(client, handler, path, event, BATCH_SIZE, message, sizeof(message));
+    int sent = count_log_lines(log_path, kind);
+    if (status == 200 && sent == BATCH_SIZE) {
+        printf("PASS: %s accepted a batch of %d events\n", path, BATCH_SIZE);
+    } else {
+        printf("FAIL: %s batch of %d: status %d (%s), %d events sent\n", path, BATCH_SIZE, status, message, sent);
+        failures++;
+    }
+    
+    // One more than the limit is refused by the batch check, with nothing sent
+    status = post_batch(client, handler, path, event, BATCH_SIZE + 1, message, sizeof(message));
+    sent = count_log_lines(log_path, kind);
+    if (status == 400 && strstr(message, "events per batch") && sent == BATCH_SIZE) {
+        printf("PASS: %s refused a batch of %d events\n", path, BATCH_SIZE + 1);
+    } else {
+        printf("FAIL: %s batch of %d: status %d (%s), %d events sent\n", path, BATCH_SIZE + 1, status, message,
+               sent);
+        failures++;
+    }
+    
+    rdp_client_disconnect(client);
+    rdp_client_free(client);
+    unlink(log_path);
+    return failures;
+}
+
+static int check_screen_cache(RDPClient* client, const char* target, const char* expected)
+{
+    char text[256];
+    int length = snprintf(text, sizeof(text), "GET %s HTTP/1.1\r\n\r\n", target);
+    
+    HttpParser parser;
+    http_parser_init(&parser, text, sizeof(text));
+    if (http_parser_execute(&parser, (size_t)length) != HTTP_PARSE_DONE) {
+        printf("FAIL: %s did not parse\n", target);
+        return 1;
+    }
+    
+    HttpResponse* response = handle_get_screen(client, &parser.request);
+    const char* cache = response ? strstr(response->extra_headers, "X-Encode-Cache: ") : NULL;
+    BOOL matches = response && response->status_code == 200 && cache &&
+                   strncmp(cache + 16, expected, strlen(expected)) == 0;
+    if (matches) {
+        printf("PASS: %s is a cache %s\n", target, expected);
+    } else {
+        printf("FAIL: %s: status %d, expected a cache %s\n", target, response ? response->status_code : -1,
+               expected);
+    }
+    
+    free_http_response(response);
+    return matches ? 0 : 1;
+}
+
+static int test_screen_cache(void)
+{
+    // Without damage the source paints once, so every request sees one generation
+    RDPClient* client = start_synthetic_client("damage=none");
+    if (!client)
+        return 1;
+    
+    int failures = 0;
+    failures += check_screen_cache(client, "/screen?format=qoi", "miss");
+    failures += check_screen_cache(client, "/screen?format=qoi", "hit");
+    failures += check_screen_cache(client, "/screen?format=jpeg&quality=60", "miss");
+    failures += check_screen_cache(client, "/screen?format=jpeg&quality=60", "hit");
+    failures += check_screen_cache(client, "/screen?format=jpeg&quality=61", "miss");
+    failures += check_screen_cache(client, "/screen?format=qoi&x=0&y=0&width=64&height=64", "miss");
+    failures += check_screen_cache(client, "/screen?format=qoi&x=0&y=0&width=64&height=64", "hit");
+    failures += check_screen_cache(client, "/screen?format=qoi&x=0&y=0&width=64&height=32", "miss");
+    
+    rdp_client_disconnect(client);
+    rdp_client_free(client);
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+    
+    printf("=== HTTP Route Tests ===\n\n");
+    
+    printf("Test 1: Key Event Batch\n");
+    failures += test_full_batch(handle_post_sendkey, "/sendkey", "{\"flags\": 16384, \"code\": 30}", "key");
+    printf("\n");
+    
+    printf("Test 2: Mouse Event Batch\n");
+    failures += test_full_batch(handle_post_sendmouse, "/sendmouse", "{\"flags\": 2048, \"x\": 1023, \"y\": 767}",
+                                "mouse");
+    printf("\n");
+    
+    printf("Test 3: Screenshot Encode Cache\n");
+    failures += test_screen_cache();
+    printf("\n");
+    
+    if (failures == 0) {
+        printf("=== ALL TESTS PASSED ===\n");
+        return 0;
+    } else {
+        printf("=== %d TEST(S) FAILED ===\n", failures);
+        return 1;
+    }
+}